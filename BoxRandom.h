@@ -7,6 +7,9 @@
 
 #include <gmpxx.h>
 
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
 #include <iostream>
 
 struct GmpRandom {
@@ -52,41 +55,123 @@ class Outcomes {
 };
 
 template
-<class I, class O, class N = mpq_class>
-class NondeterministicTransform {
+<class O, class N = mpq_class, class H = boost::hash<O> >
+class HashedOutcomes {
+    // same interface and same (first-seen) ordering as Outcomes, but
+    // duplicates are found through a hash index instead of a scan.
+    // the outcome type needs a hash_value consistent with its ==
+    private:
+        N sum;
+        std::vector<N> weights;
+        std::vector<O> outcomes;
+        boost::unordered_map<O,int,H> index;
+
     public:
-        virtual Outcomes<O,N> transform(I) = 0;
+        HashedOutcomes(void) : sum(0), weights(), outcomes(), index() {
+        }
 
-        Outcomes<O,N> operator()(const Outcomes<I,N>& orig) {
-            const int sz = orig.getNumberOfOutcomes();
+        explicit HashedOutcomes(const Outcomes<O,N>& that) : sum(0), weights(), outcomes(), index() {
+            const int sz = that.getNumberOfOutcomes();
+            for(int i=0;i<sz;i++) {
+                add( that.getWeight(i), that.getOutcome(i) );
+            }
+        }
+
+        void add(const N& w, const O& o) {
+            sum += w;
+            typename boost::unordered_map<O,int,H>::iterator i = index.find( o );
+            if( i != index.end() ) {
+                weights[i->second] += w;
+                return;
+            }
+            index[o] = outcomes.size();
+            weights.push_back( w );
+            outcomes.push_back( o );
+        }
+
+        Outcomes<O,N> toOutcomes(void) const {
             Outcomes<O,N> rv;
+            const int sz = outcomes.size();
+            for(int i=0;i<sz;i++) {
+                rv.add( weights[i], outcomes[i] );
+            }
+            return rv;
+        }
+
+        int getNumberOfOutcomes(void) const { return outcomes.size(); }
+        const N& getTotalWeight(void) const { return sum; }
+        const N& getWeight(int j) const { return weights[j]; }
+        O getOutcome(int j) const { return outcomes[j]; }
+};
+
+template
+<class I, class O, class N = mpq_class>
+class NondeterministicTransform {
+    private:
+        template<class RC, class C>
+        RC apply(const C& orig) {
+            const int sz = orig.getNumberOfOutcomes();
+            RC rv;
             for(int i=0;i<sz;i++) {
-                const N& mwt = orig.getWeight(i);
                 const Outcomes<O,N> mrv = transform( orig.getOutcome(i) );
                 const int msz = mrv.getNumberOfOutcomes();
                 const N& totw = mrv.getTotalWeight();
-                for(int j=0;j<msz;j++) {
-                    rv.add( mwt * mrv.getWeight(j) / totw, mrv.getOutcome(j) );
+                if( totw == 1 ) {
+                    // already normalized, as most dice are
+                    const N& mwt = orig.getWeight(i);
+                    for(int j=0;j<msz;j++) {
+                        rv.add( mwt * mrv.getWeight(j), mrv.getOutcome(j) );
+                    }
+                } else {
+                    const N mwt = orig.getWeight(i) / totw;
+                    for(int j=0;j<msz;j++) {
+                        rv.add( mwt * mrv.getWeight(j), mrv.getOutcome(j) );
+                    }
                 }
             }
             return rv;
         }
+
+    public:
+        virtual ~NondeterministicTransform(void) {}
+
+        virtual Outcomes<O,N> transform(I) = 0;
+
+        Outcomes<O,N> operator()(const Outcomes<I,N>& orig) {
+            return apply< Outcomes<O,N> >( orig );
+        }
+
+        HashedOutcomes<O,N> operator()(const HashedOutcomes<I,N>& orig) {
+            return apply< HashedOutcomes<O,N> >( orig );
+        }
 };
 
 template
 <class I, class O, class N = mpq_class>
 class DeterministicTransform {
-    public:
-        virtual O transform(I) = 0;
-
-        Outcomes<O,N> operator()(const Outcomes<I,N>& orig) {
+    private:
+        template<class RC, class C>
+        RC apply(const C& orig) {
             const int sz = orig.getNumberOfOutcomes();
-            Outcomes<O,N> rv;
+            RC rv;
             for(int i=0;i<sz;i++) {
                 rv.add( orig.getWeight(i), transform(orig.getOutcome(i)) );
             }
             return rv;
         }
+
+    public:
+        virtual ~DeterministicTransform(void) {}
+
+        virtual O transform(I) = 0;
+
+        Outcomes<O,N> operator()(const Outcomes<I,N>& orig) {
+            return apply< Outcomes<O,N> >( orig );
+        }
+
+        HashedOutcomes<O,N> operator()(const HashedOutcomes<I,N>& orig) {
+            return apply< HashedOutcomes<O,N> >( orig );
+        }
 };
 
 template
@@ -100,7 +185,7 @@ O chooseRandomOutcome(const Outcomes<O,mpq_class>& outcomes, gmp_randclass& prng
         hugeval *= outcomes.getWeight(i).get_den();
     }
     using namespace std;
-    mpq_class r ( prng.get_z_range( hugeval * outcomes.getTotalWeight() ), hugeval );
+    mpq_class r ( prng.get_z_range( mpz_class( hugeval * outcomes.getTotalWeight() ) ), hugeval );
     for(int i=0;i<sz;i++) {
         r -= outcomes.getWeight(i);
         if( r < 0 ) {
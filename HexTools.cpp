@@ -100,6 +100,15 @@ void polariseHexCoordinate(int x, int y, int& i, int& j, int& r) {
     }
 }
 
+int hexDistance(int x0, int y0, int x1, int y1) {
+    // every step moves three columns and one row, or two rows in
+    // the same column; diagonal steps take care of the column
+    // difference and whatever rows remain are walked straight
+    const int cols = abs(x1 - x0) / 3, rows = abs(y1 - y0);
+    if( rows <= cols ) return cols;
+    return cols + (rows - cols) / 2;
+}
+
 void HexRegion::add(int x, int y) {
     coords.insert( HexCoordinate(x,y) );
 }
@@ -117,6 +126,75 @@ bool HexRegion::contains(int x, int y) const {
     return i != coords.end();
 }
 
+static void reduceToRhombus(int radius, int& x, int& y) {
+    // x+y and y-x each change along only one of the periods, so each is
+    // brought into [-3r,3r) on its own
+    const int period = 6 * radius, half = 3 * radius;
+    int p = y + x, q = y - x;
+    p = ((p + half) % period + period) % period - half;
+    q = ((q + half) % period + period) % period - half;
+    x = (p - q) / 2;
+    y = (p + q) / 2;
+}
+
+static bool isTorusCoreCell(int radius, int x, int y) {
+    // the inside of the core and half of its rim
+    int i, j, r;
+    polariseHexCoordinate( x, y, i, j, r );
+    if( r < radius ) return true;
+    return r == radius && ( (i == 0 && j != 0) || i == 1 || i == 2 );
+}
+
+int HexTorusWrapping::canonicalIndex(int radius, int x, int y) {
+    if( isInvalidHexCoordinate( x, y ) ) return -1;
+    reduceToRhombus( radius, x, y );
+    // from the rhombus, the core is at most one period away
+    const int p = 3 * radius;
+    const int tx[] = { 0, p, -p, -p, p, 2*p, -2*p, 0, 0 },
+              ty[] = { 0, p, -p, p, -p, 0, 0, 2*p, -2*p };
+    for(int k=0;k<9;k++) {
+        if( isTorusCoreCell( radius, x + tx[k], y + ty[k] ) ) {
+            return flattenHexCoordinate( x + tx[k], y + ty[k] );
+        }
+    }
+    throw std::logic_error( "no cell in the core of the torus" );
+}
+
+HexTorusWrapping::HexTorusWrapping(int radius) :
+    radius ( radius ),
+    columns ( radius + 1 ),
+    rows ( 3 * radius + 2 )
+{
+    // the window holds both the rhombus that far cells are brought
+    // into and every neighbour of the core
+    if( radius < 1 ) {
+        throw std::logic_error( "hex torus of radius less than one" );
+    }
+    window.resize( (2 * columns + 1) * (2 * rows + 1) );
+    for(int i=-columns;i<=columns;i++) for(int y=-rows;y<=rows;y++) {
+        window[ (i + columns) * (2 * rows + 1) + y + rows ] = canonicalIndex( radius, 3 * i, y );
+    }
+    const static int dx[] = { 3, 0, -3, -3, 0, 3 },
+                     dy[] = { 1, 2, 1, -1, -2, -1 };
+    const int cells = hexCircleSize( radius );
+    neighbours.resize( 6 * cells );
+    for(int k=0;k<cells;k++) {
+        int x, y;
+        inflateHexCoordinate( k, x, y );
+        for(int i=0;i<6;i++) {
+            neighbours[ 6 * k + i ] = toIndex( x + dx[i], y + dy[i] );
+        }
+    }
+}
+
+int HexTorusWrapping::toIndex(int x, int y) const {
+    if( x % 3 ) return -1;
+    if( abs( x ) > 3 * columns || abs( y ) > rows ) {
+        reduceToRhombus( radius, x, y );
+    }
+    return window[ (x / 3 + columns) * (2 * rows + 1) + y + rows ];
+}
+
 bool isInvalidHexCoordinate(int x, int y) {
     if( (x%3) != 0 ) return true;
     if( ((abs(x)/3)%2) != (abs(y)%2) ) return true;
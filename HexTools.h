@@ -19,6 +19,8 @@
 
 #include <map>
 
+#include <vector>
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
@@ -29,6 +31,7 @@ int flattenHexCoordinate(int,int);
 void inflateHexCoordinate(int,int&,int&);
 void polariseHexCoordinate(int,int,int&,int&,int&);
 void cartesianiseHexCoordinate(int,int,int,int&,int&);
+int hexDistance(int,int,int,int);
 
 typedef std::pair<int,int> HexCoordinate;
 
@@ -148,89 +151,54 @@ class HexMap {
         }
 };
 
+class HexTorusWrapping {
+    // where the cells of a hex torus of a given radius lie in its core
+    // hexagon, by flat index. the torus repeats along (3r,3r) and
+    // (-3r,3r), with the cells on the core's rim shared out between
+    // the copies; a table covers a window around the core, and cells
+    // further out are brought into it along the periods first
+    private:
+        int radius;
+        int columns, rows; // the window's half-extents
+        std::vector<int> window; // flat index, or -1 where there is no cell
+        std::vector<int> neighbours; // six to a cell of the core
+
+    public:
+        explicit HexTorusWrapping(int);
+
+        int getRadius(void) const { return radius; }
+
+        int toIndex(int,int) const; // -1 for no cell
+        int getNeighbour(int k, int i) const { return neighbours[ 6 * k + i ]; }
+
+        static int canonicalIndex(int,int,int); // radius, x, y; without the table
+};
+
 template<class T>
 class HexTorusMap {
     private:
-        int radius;
+        HexTorusWrapping wrapping;
         HexMap<T> submap;
 
-        void toCore(int& x, int& y) {
-            int guard = 100;
-            int i, j, r;
-            polariseHexCoordinate( x, y, i, j, r );
-            if( r < radius ||
-                ( (r == radius) &&
-                  ( (i == 0 && j != 0) ||
-                    (i == 1) ||
-                    (i == 2) ) ) ) {
-                return;
-            }
-            if( r == radius ) switch( i ) {
-                case 0:
-                case 5:
-                    x *= -1;
-                    toCore( x, y );
-                    return;
-                case 3:
-                    cartesianiseHexCoordinate( 0, radius - j, r, x, y );
-                    toCore( x, y );
-                    return;
-                case 4:
-                    cartesianiseHexCoordinate( 1, radius - j, r, x, y );
-                    toCore( x, y );
-                    return;
-                default:
-                    throw std::logic_error( "illegal late-return state on rim of core hex" );
-            }
-            using namespace std;
-            y %= 6 * radius;
-            x %= 6 * radius;
-            x -= 6 * radius;
-            y -= 6 * radius;
-            do {
-                polariseHexCoordinate( x, y, i, j, r );
-                if( r <= radius ) {
-                    toCore(x,y);
-                    return;
-                }
-                if( y > 0 ) {
-                    if( x > 0 ) {
-                        x -= 3 * radius;
-                        y -= 3 * radius;
-                    } else {
-                        x += 3 * radius;
-                        y -= 3 * radius;
-                    }
-                } else {
-                    if( x > 0 ) {
-                        x -= 3 * radius;
-                        y += 3 * radius;
-                    } else {
-                        x += 3 * radius;
-                        y += 3 * radius;
-                    }
-                }
-                if( --guard <= 0 ) {
-                    throw std::logic_error( "illegal state - probably looping infinitely");
-                }
-            } while(true);
-        }
-
     public:
         explicit HexTorusMap(const int radius) :
-            radius ( radius ),
+            wrapping ( radius ),
             submap ( radius )
         {
         }
 
+        int toIndex(int x, int y) const { return wrapping.toIndex( x, y ); }
+        int getNeighbour(int k, int i) const { return wrapping.getNeighbour( k, i ); }
+
+        T& get(int k) { return submap.get( k ); }
+        const T& get(int k) const { return submap.get( k ); }
+
         T& get(int x, int y) {
-            toCore(x,y);
-            return submap.get(x,y);
+            return submap.get( wrapping.toIndex( x, y ) );
         }
 
         const T& get(int x, int y) const {
-            toCore(x,y);
-            return submap.get(x,y);
+            return submap.get( wrapping.toIndex( x, y ) );
         }
 };
 
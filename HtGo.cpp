@@ -3,10 +3,16 @@
 #include <cstdio>
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+
+using namespace HexTools;
 
 HexTorusGoMap::HexTorusGoMap(int radius) :
     radius ( radius ),
-    coreMap ( radius )
+    coreMap ( radius ),
+    wrapping ( radius ),
+    mark ( 0 ),
+    koActive ( false )
 {
     int i, j, r;
     for(r=1;r<=radius;r++) {
@@ -21,6 +27,141 @@ HexTorusGoMap::HexTorusGoMap(int radius) :
     }
     coreMap.get(0,0).coreX = 0;
     coreMap.get(0,0).coreY = 0;
+    marks.assign( coreMap.getSize(), 0 );
+    rebuildStrings();
+}
+
+unsigned int HexTorusGoMap::nextMark(void) {
+    if( ++mark == 0 ) {
+        std::fill( marks.begin(), marks.end(), 0 );
+        mark = 1;
+    }
+    return mark;
+}
+
+int HexTorusGoMap::findRoot(int k) {
+    int root = k;
+    while( parents[root] >= 0 ) {
+        root = parents[root];
+    }
+    while( parents[k] >= 0 ) {
+        const int next = parents[k];
+        parents[k] = root;
+        k = next;
+    }
+    return root;
+}
+
+bool HexTorusGoMap::touches(int k, int root) {
+    for(int i=0;i<6;i++) {
+        const int nk = wrapping.getNeighbour( k, i );
+        if( stateAt( nk ) != HtGoTile::BLANK && findRoot( nk ) == root ) return true;
+    }
+    return false;
+}
+
+void HexTorusGoMap::join(int a, int b) {
+    // the smaller string's liberties that the larger lacks are added to
+    // it, so only the smaller is walked
+    a = findRoot( a );
+    b = findRoot( b );
+    if( a == b ) return;
+    if( parents[a] > parents[b] ) {
+        std::swap( a, b );
+    }
+    const unsigned int m = nextMark();
+    int s = b;
+    do {
+        for(int i=0;i<6;i++) {
+            const int l = wrapping.getNeighbour( s, i );
+            if( stateAt( l ) != HtGoTile::BLANK || marks[l] == m ) continue;
+            marks[l] = m;
+            if( !touches( l, a ) ) {
+                ++liberties[a];
+            }
+        }
+        s = nextStone[s];
+    } while( s != b );
+    parents[a] += parents[b];
+    parents[b] = a;
+    std::swap( nextStone[a], nextStone[b] );
+}
+
+int HexTorusGoMap::adjacentStrings(int k, int *roots) {
+    // the distinct strings next to a cell; on small tori a string may
+    // touch it from several sides
+    int n = 0;
+    for(int i=0;i<6;i++) {
+        const int nk = wrapping.getNeighbour( k, i );
+        if( stateAt( nk ) == HtGoTile::BLANK ) continue;
+        const int root = findRoot( nk );
+        if( std::find( roots, roots + n, root ) == roots + n ) {
+            roots[n++] = root;
+        }
+    }
+    return n;
+}
+
+int HexTorusGoMap::blankNeighbours(int k) {
+    int blanks[6], n = 0;
+    for(int i=0;i<6;i++) {
+        const int nk = wrapping.getNeighbour( k, i );
+        if( stateAt( nk ) == HtGoTile::BLANK && std::find( blanks, blanks + n, nk ) == blanks + n ) {
+            blanks[n++] = nk;
+        }
+    }
+    return n;
+}
+
+void HexTorusGoMap::removeString(int root, std::vector<int>& removed) {
+    int s = root;
+    do {
+        coreMap.get( s ).state = HtGoTile::BLANK;
+        removed.push_back( s );
+        s = nextStone[s];
+    } while( s != root );
+}
+
+void HexTorusGoMap::freeLiberties(const std::vector<int>& removed) {
+    // each emptied cell is a new liberty of every string next to it
+    for(size_t i=0;i<removed.size();i++) {
+        const int k = removed[i];
+        parents[k] = -1;
+        nextStone[k] = k;
+        int roots[6];
+        const int n = adjacentStrings( k, roots );
+        for(int j=0;j<n;j++) {
+            ++liberties[ roots[j] ];
+        }
+    }
+}
+
+void HexTorusGoMap::rebuildStrings(void) {
+    const int cells = coreMap.getSize();
+    parents.assign( cells, -1 );
+    nextStone.resize( cells );
+    liberties.assign( cells, 0 );
+    for(int k=0;k<cells;k++) {
+        nextStone[k] = k;
+        if( stateAt( k ) != HtGoTile::BLANK ) {
+            liberties[k] = blankNeighbours( k );
+        }
+    }
+    for(int k=0;k<cells;k++) {
+        if( stateAt( k ) == HtGoTile::BLANK ) continue;
+        for(int i=0;i<6;i++) {
+            const int nk = wrapping.getNeighbour( k, i );
+            if( stateAt( nk ) == stateAt( k ) ) {
+                join( k, nk );
+            }
+        }
+    }
+}
+
+int HexTorusGoMap::libertyCount(int x, int y) {
+    const int k = indexOf( get( x, y ) );
+    if( stateAt( k ) == HtGoTile::BLANK ) return -1;
+    return liberties[ findRoot( k ) ];
 }
 
 void HexTorusGoMap::debugLabelCore(void) {
@@ -51,65 +192,8 @@ void HexTorusGoMap::debugLabelCore(void) {
     coreMap.getDefault().positionalLabel = "ERR";
 }
 
-HtGoTile& HexTorusGoMap::getIJR(int i,int j,int r) {
-    int x, y;
-    cartesianiseHexCoordinate( i, j, r, x, y );
-    return get( x, y );
-}
-
 HtGoTile& HexTorusGoMap::get(int x, int y) {
-    int guard = 100;
-    int i, j, r;
-    polariseHexCoordinate( x, y, i, j, r );
-    if( r < radius ||
-        ( (r == radius) &&
-          ( (i == 0 && j != 0) ||
-            (i == 1) ||
-            (i == 2) ) ) ) {
-        return coreMap.get( x, y );
-    }
-    if( r == radius ) switch( i ) {
-        case 0:
-        case 5:
-            return get( -x, y );
-        case 3:
-            return getIJR( 0, radius - j, r );
-        case 4:
-            return getIJR( 1, radius - j, r );
-        default:
-            throw std::logic_error( "illegal late-return state on rim of core hex" );
-    }
-    using namespace std;
-    y %= 6 * radius;
-    x %= 6 * radius;
-    x -= 6 * radius;
-    y -= 6 * radius;
-    do {
-        polariseHexCoordinate( x, y, i, j, r );
-        if( r <= radius ) {
-            return get(x,y);
-        }
-        if( y > 0 ) {
-            if( x > 0 ) {
-                x -= 3 * radius;
-                y -= 3 * radius;
-            } else {
-                x += 3 * radius;
-                y -= 3 * radius;
-            }
-        } else {
-            if( x > 0 ) {
-                x -= 3 * radius;
-                y += 3 * radius;
-            } else {
-                x += 3 * radius;
-                y += 3 * radius;
-            }
-        }
-        if( --guard <= 0 ) {
-            throw std::logic_error( "illegal state - probably looping infinitely");
-        }
-    } while(true);
+    return coreMap.get( wrapping.toIndex( x, y ) );
 }
 
 void PointSet::add(const HtGoTile& tile) {
@@ -129,9 +213,7 @@ bool PointSet::has(const HtGoTile& tile) const {
 }
 
 HtGoTile& HexTorusGoMap::getNeighbourOf(int x,int y,int i) {
-    const static int dx[] = { 3, 0, -3, -3, 0, 3 },
-                     dy[] = { 1, 2, 1, -1, -2, -1 };
-    return get(x + dx[i%6], y + dy[i%6]);
+    return getNeighbourOf( get( x, y ), i );
 }
 
 HtGoTile& HexTorusGoMap::get(std::pair<int,int> xy) {
@@ -139,13 +221,13 @@ HtGoTile& HexTorusGoMap::get(std::pair<int,int> xy) {
 }
 
 HtGoTile& HexTorusGoMap::getNeighbourOf(const HtGoTile& tile, int i) {
-    return getNeighbourOf(tile.coreX, tile.coreY, i );
+    return coreMap.get( wrapping.getNeighbour( indexOf( tile ), i % 6 ) );
 }
 
 PointSet HexTorusGoMap::libertiesOf(const PointSet& group) {
     PointSet rv;
     for(PointSet::const_iterator i = group.begin(); i != group.end(); i++) {
-        const HtGoTile& tile = get( *i );
+        const HtGoTile& tile = coreMap.get( i->first, i->second );
         for(int i=0;i<6;i++) {
             HtGoTile& nb = getNeighbourOf( tile, i );
             if( nb.state == HtGoTile::BLANK ) {
@@ -165,11 +247,21 @@ PointSet HexTorusGoMap::groupOf(int x, int y) {
 PointSet HexTorusGoMap::groupOf(const HtGoTile& tile) {
     using namespace std;
     PointSet rv, open;
+    if( tile.state != HtGoTile::BLANK ) {
+        const int k = indexOf( tile );
+        int s = k;
+        do {
+            rv.add( coreMap.get( s ) );
+            s = nextStone[s];
+        } while( s != k );
+        return rv;
+    }
+    // blank regions aren't kept, so they are still flooded
     open.add( tile );
     rv.add( tile );
     while( !open.empty() ) {
         std::pair<int,int> coords = open.pop();
-        HtGoTile& tile = get( coords );
+        HtGoTile& tile = coreMap.get( coords.first, coords.second );
 
         for(int i=0;i<6;i++) {
             HtGoTile& nb = getNeighbourOf( tile, i );
@@ -195,40 +287,62 @@ std::pair<int,int> PointSet::pop(void) {
 }
 
 int HexTorusGoMap::removeGroup(const PointSet& xys) {
+    // any set of stones may go, splitting strings, so they are rebuilt
     int rv = xys.size();
     for(PointSet::const_iterator i = xys.begin(); i != xys.end(); i++) {
         get( i->first, i->second ).state = HtGoTile::BLANK;
     }
+    rebuildStrings();
     return rv;
 }
 
 int HexTorusGoMap::put(int x,int y, HtGoTile::TileState st) {
     using namespace std;
-    int enemyCaptures = 0, selfCaptures = 0;
-    int singleCaptureX, singleCaptureY;
-    get(x,y).state = st;
-    for(int i=0;i<6;i++) {
-        HtGoTile& tile = getNeighbourOf( x, y, i );
-        if( tile.state == st ) continue;
-        if( tile.state == HtGoTile::BLANK ) continue;
-        PointSet group = groupOf( tile );
-        PointSet libs = libertiesOf( group );
-        if( libs.empty() ) {
-            singleCaptureX = tile.coreX;
-            singleCaptureY = tile.coreY;
-            enemyCaptures += removeGroup( group );
+    const int k = indexOf( get(x,y) );
+    if( stateAt( k ) != HtGoTile::BLANK ) {
+        // taking a stone away may split its string
+        coreMap.get( k ).state = HtGoTile::BLANK;
+        rebuildStrings();
+    }
+    koActive = false;
+    if( st == HtGoTile::BLANK ) return 0;
+
+    int roots[6];
+    const int n = adjacentStrings( k, roots );
+    for(int i=0;i<n;i++) {
+        --liberties[ roots[i] ];
+    }
+    coreMap.get( k ).state = st;
+    parents[k] = -1;
+    nextStone[k] = k;
+    liberties[k] = blankNeighbours( k );
+    for(int i=0;i<n;i++) {
+        if( stateAt( roots[i] ) == st ) {
+            join( k, roots[i] );
+        }
+    }
+
+    vector<int> removed;
+    for(int i=0;i<n;i++) {
+        if( stateAt( roots[i] ) != st && liberties[ roots[i] ] == 0 ) {
+            removeString( roots[i], removed );
         }
     }
-    PointSet selfGroup = groupOf( x, y );
-    if( libertiesOf( selfGroup ).empty() ) {
-        selfCaptures += removeGroup( selfGroup );
+    const int enemyCaptures = removed.size();
+    const int firstCapture = enemyCaptures ? removed[0] : -1;
+    freeLiberties( removed );
+
+    int selfCaptures = 0;
+    if( liberties[ findRoot( k ) ] == 0 ) {
+        removed.clear();
+        removeString( findRoot( k ), removed );
+        selfCaptures = removed.size();
+        freeLiberties( removed );
     }
     if( enemyCaptures == 1 && selfCaptures == 0 ) {
         koActive = true;
-        koCoreX = singleCaptureX;
-        koCoreY = singleCaptureY;
-    } else {
-        koActive = false;
+        koCoreX = coreMap.get( firstCapture ).coreX;
+        koCoreY = coreMap.get( firstCapture ).coreY;
     }
     return enemyCaptures;
 }
@@ -236,6 +350,12 @@ int HexTorusGoMap::put(int x,int y, HtGoTile::TileState st) {
 HexTorusGoMap::HexTorusGoMap(const HexTorusGoMap& that) :
     radius ( that.radius ),
     coreMap ( that.coreMap ),
+    wrapping ( that.wrapping ),
+    parents ( that.parents ),
+    nextStone ( that.nextStone ),
+    liberties ( that.liberties ),
+    marks ( that.marks ),
+    mark ( that.mark ),
     koActive ( that.koActive ),
     koCoreX ( that.koCoreX ),
     koCoreY ( that.koCoreY )
@@ -246,6 +366,12 @@ const HexTorusGoMap& HexTorusGoMap::operator=(const HexTorusGoMap& that) {
     if( this != &that ) {
         radius = that.radius;
         coreMap = that.coreMap;
+        wrapping = that.wrapping;
+        parents = that.parents;
+        nextStone = that.nextStone;
+        liberties = that.liberties;
+        marks = that.marks;
+        mark = that.mark;
         koActive = that.koActive;
         koCoreX = that.koCoreX;
         koCoreY = that.koCoreY;
@@ -265,9 +391,14 @@ bool HexTorusGoMap::putWouldBeLegal(int x,int y, HtGoTile::TileState st) {
         return false;
     }
     
-    HexTorusGoMap copy = *this;
-    copy.put( x, y, st );
-    if( copy.get(x,y).state != st ) return false; // suicide is illegal
-    
-    return true;
+    // suicide is illegal: the stone must have a liberty of its own,
+    // join a string with one to spare, or capture
+    const int k = indexOf( tile );
+    for(int i=0;i<6;i++) {
+        const int nk = wrapping.getNeighbour( k, i );
+        if( stateAt( nk ) == HtGoTile::BLANK ) return true;
+        const int libs = liberties[ findRoot( nk ) ];
+        if( (stateAt( nk ) == st) ? (libs > 1) : (libs == 1) ) return true;
+    }
+    return false;
 }
@@ -1,8 +1,9 @@
 #ifndef H_HTGO
 #define H_HTGO
 
-#include "hexfml.h"
+#include "HexTools.h"
 
+#include <string>
 #include <set>
 #include <vector>
 #include <map>
@@ -70,7 +71,15 @@ class PointSet {
 class HexTorusGoMap {
     private:
         int radius;
-        HexMap<HtGoTile> coreMap;
+        HexTools::HexMap<HtGoTile> coreMap;
+        HexTools::HexTorusWrapping wrapping;
+
+        // strings of stones: union-find over the cells, with minus the
+        // size at each root, a ring through the stones of each string,
+        // and the liberties of a string kept at its root
+        std::vector<int> parents, nextStone, liberties;
+        std::vector<unsigned int> marks;
+        unsigned int mark;
 
             /* Actually ko seems to be impossible in
                hex-go, but I didn't realize this initially
@@ -79,11 +88,22 @@ class HexTorusGoMap {
         bool koActive;
         int koCoreX, koCoreY;
 
-        HtGoTile& getIJR(int,int,int);
-
         HtGoTile& getNeighbourOf(int,int,int);
         HtGoTile& getNeighbourOf(const HtGoTile&,int);
 
+        int indexOf(const HtGoTile& tile) const { return HexTools::flattenHexCoordinate( tile.coreX, tile.coreY ); }
+        HtGoTile::TileState stateAt(int k) { return coreMap.get( k ).state; }
+        unsigned int nextMark(void);
+
+        int findRoot(int);
+        void join(int,int);
+        bool touches(int,int);
+        int adjacentStrings(int,int*);
+        int blankNeighbours(int);
+        void removeString(int,std::vector<int>&);
+        void freeLiberties(const std::vector<int>&);
+        void rebuildStrings(void);
+
     public:
         explicit HexTorusGoMap(int);
         HexTorusGoMap(const HexTorusGoMap&);
@@ -101,6 +121,8 @@ class HexTorusGoMap {
         bool putWouldBeLegal(int,int,HtGoTile::TileState);
         int removeGroup(const PointSet&);
 
+        int libertyCount(int,int); // of the string at a stone, or -1
+
         void debugLabelCore(void);
 };
 
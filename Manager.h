@@ -9,6 +9,10 @@
 #include <vector>
 
 #include <string>
+#include <stdexcept>
+#include <new>
+
+#include <stdint.h>
 
 #include "Sise.h"
 
@@ -39,6 +43,10 @@ class ResourceManager {
             resources[ str ] = resource;
         }
 
+        bool has(const std::string& str) const {
+            return resources.find( str ) != resources.end();
+        }
+
         T& operator[](const std::string& str) {
             return *resources[ str ];
         }
@@ -83,19 +91,10 @@ template
 void fillManagerFromFile(const std::string& filename, ResourceManager<T>& uts) {
     using namespace Sise;
     using namespace std;
-    SExpStreamParser streamParser;
-    ifstream is ( filename.c_str(), ios::in );
-    char byte;
-    if( !is.good() ) {
-        throw FileInputError();
-    }
-    while( !is.eof() ) {
-        is.read( &byte, 1 );
-        streamParser.feed( byte );
-    }
-    streamParser.end();
-    while( !streamParser.empty() ) {
-        Cons *data = asProperCons( streamParser.pop() );
+    vector<SExp*> sexps;
+    readSExpsFromFile( filename, sexps );
+    for(size_t i=0;i<sexps.size();i++) {
+        Cons *data = asProperCons( sexps[i] );
         std::string name = * asSymbol(data->getcar() );
         T *ut = new T( data );
         delete data;
@@ -108,4 +107,197 @@ ResourceManager<T>::ResourceManager(const std::string& name){
     fillManagerFromFile( name, *this );
 }
 
+template<class T>
+class FrozenResourceTable {
+    // types loaded once and never changed: ids are dense, in the order of
+    // the file, the types lie contiguously in that order, and names are
+    // found through a perfect hash built at load time. unlike
+    // ResourceManager an unknown name is an error, not a new entry
+    private:
+        T *resources; // constructed in place
+        int count;
+        std::vector<std::string> names;
+
+        // hash-and-displace: a name's bucket gives the seed that sends it
+        // to its own slot, and the slot holds its id (or -1). the name is
+        // only hashed once; the seed is mixed into that hash
+        std::vector<uint64_t> seeds;
+        std::vector<int> slots;
+        unsigned int slotMask;
+
+        FrozenResourceTable(const FrozenResourceTable&);
+        const FrozenResourceTable& operator=(const FrozenResourceTable&);
+
+        static uint64_t hash(const std::string& str) {
+            // FNV-1a
+            uint64_t h = 14695981039346656037ULL;
+            for(std::string::size_type i=0;i<str.size();i++) {
+                h ^= (unsigned char) str[i];
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+
+        size_t bucketOf(uint64_t h) const {
+            return (h >> 32) % seeds.size();
+        }
+
+        unsigned int slotOf(uint64_t h, uint64_t seed) const {
+            h ^= seed * 0x9e3779b97f4a7c15ULL;
+            h ^= h >> 29;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            return (h >> 32) & slotMask;
+        }
+
+        bool placeBuckets(const std::vector<uint64_t>&, const std::vector< std::vector<int> >&, const std::vector<int>&);
+        void buildIndex(void);
+        void destroy(void);
+
+    public:
+        explicit FrozenResourceTable(const std::string&);
+        ~FrozenResourceTable(void) { destroy(); }
+
+        int size(void) const { return count; }
+
+        const T& get(int id) const { return resources[id]; }
+        const std::string& getName(int id) const { return names[id]; }
+
+        int find(const std::string& str) const {
+            const uint64_t h = hash( str );
+            const int id = slots[ slotOf( h, seeds[ bucketOf( h ) ] ) ];
+            return (id >= 0 && names[id] == str) ? id : -1;
+        }
+
+        bool has(const std::string& str) const { return find( str ) >= 0; }
+
+        const T& operator[](const std::string& str) const {
+            const int id = find( str );
+            if( id < 0 ) {
+                throw std::runtime_error( "no such resource: " + str );
+            }
+            return resources[id];
+        }
+
+        int idOf(const T* resource) const {
+            // -1 for anything that isn't one of ours
+            if( resource < resources || resource >= resources + count ) return -1;
+            return resource - resources;
+        }
+};
+
+template<class T>
+FrozenResourceTable<T>::FrozenResourceTable(const std::string& filename) :
+    resources ( 0 ),
+    count ( 0 ),
+    names (),
+    seeds (),
+    slots (),
+    slotMask ( 0 )
+{
+    using namespace Sise;
+    using namespace std;
+    vector<SExp*> data;
+    readSExpsFromFile( filename, data );
+
+    try {
+        resources = static_cast<T*>( ::operator new( std::max<size_t>( data.size(), 1 ) * sizeof (T) ) );
+        for(size_t i=0;i<data.size();i++) {
+            Cons *entry = asProperCons( data[i] );
+            names.push_back( *asSymbol( entry->getcar() ) );
+            new (resources + count) T( entry );
+            ++count;
+        }
+        buildIndex();
+    }
+    catch( ... ) {
+        for(size_t i=0;i<data.size();i++) {
+            delete data[i];
+        }
+        destroy();
+        throw;
+    }
+    for(size_t i=0;i<data.size();i++) {
+        delete data[i];
+    }
+}
+
+template<class T>
+void FrozenResourceTable<T>::destroy(void) {
+    for(int i=count-1;i>=0;i--) {
+        resources[i].~T();
+    }
+    ::operator delete( resources );
+    resources = 0;
+    count = 0;
+}
+
+template<class T>
+bool FrozenResourceTable<T>::placeBuckets(const std::vector<uint64_t>& hashes, const std::vector< std::vector<int> >& buckets, const std::vector<int>& order) {
+    // the largest buckets go first, while there is most room
+    const uint64_t maxSeed = 1u << 16;
+    std::vector<int> taken;
+    for(size_t b=0;b<order.size();b++) {
+        const std::vector<int>& bucket = buckets[ order[b] ];
+        if( bucket.empty() ) break;
+        uint64_t seed;
+        for(seed=1;seed<maxSeed;seed++) {
+            taken.clear();
+            size_t i;
+            for(i=0;i<bucket.size();i++) {
+                const int slot = slotOf( hashes[ bucket[i] ], seed );
+                if( slots[slot] >= 0 || std::find( taken.begin(), taken.end(), slot ) != taken.end() ) break;
+                taken.push_back( slot );
+            }
+            if( i == bucket.size() ) break;
+        }
+        if( seed == maxSeed ) return false;
+        seeds[ order[b] ] = seed;
+        for(size_t i=0;i<bucket.size();i++) {
+            slots[ taken[i] ] = bucket[i];
+        }
+    }
+    return true;
+}
+
+template<class T>
+void FrozenResourceTable<T>::buildIndex(void) {
+    // equal names hash alike and could never be placed
+    std::vector<std::string> sorted ( names );
+    std::sort( sorted.begin(), sorted.end() );
+    std::vector<std::string>::iterator duplicate = std::adjacent_find( sorted.begin(), sorted.end() );
+    if( duplicate != sorted.end() ) {
+        throw std::runtime_error( "duplicate resource: " + *duplicate );
+    }
+
+    // about two names to a bucket, and a power of two of slots with at
+    // least one free; grow the slots if a bucket can't be placed
+    seeds.assign( count / 2 + 1, 0 );
+    std::vector<uint64_t> hashes;
+    std::vector< std::vector<int> > buckets ( seeds.size() );
+    for(int i=0;i<count;i++) {
+        hashes.push_back( hash( names[i] ) );
+        buckets[ bucketOf( hashes[i] ) ].push_back( i );
+    }
+    std::vector< std::pair<int,int> > bySize;
+    for(size_t b=0;b<buckets.size();b++) {
+        bySize.push_back( std::make_pair( -(int) buckets[b].size(), (int) b ) );
+    }
+    std::sort( bySize.begin(), bySize.end() );
+    std::vector<int> order;
+    for(size_t b=0;b<bySize.size();b++) {
+        order.push_back( bySize[b].second );
+    }
+
+    unsigned int slotCount = 1;
+    while( slotCount <= (unsigned int) count ) {
+        slotCount *= 2;
+    }
+    for(;;) {
+        slotMask = slotCount - 1;
+        slots.assign( slotCount, -1 );
+        if( placeBuckets( hashes, buckets, order ) ) break;
+        slotCount *= 2;
+    }
+}
+
 #endif
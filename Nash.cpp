@@ -9,8 +9,6 @@
 #include <cstdlib>
 #include <cassert>
 
-#include <list>
-#include <set>
 
 namespace Nash {
 
@@ -46,61 +44,114 @@ void NashBoard::clear(void) {
     tiles.get(border*3,-border).colour = NashTile::WHITE_BLACK;
     tiles.get(border*3,-border).status = NashTile::EDGE;
     tiles.getDefault().status = NashTile::OFF_MAP;
+    recompute();
 }
 
 NashBoard::NashBoard(int size) :
     size ( size ),
-    tiles ( size )
+    tiles ( size ),
+    border ( (size+1)/2 ),
+    side ( size + 2 ),
+    winner ( NashTile::NONE )
 {
     assert( (size%2) == 1 );
     clear();
 }
 
-NashTile::Colour NashBoard::getWinner(void) const {
-    const int border = (size+1)/2;
-    const int dx[]= { 3, 0, -3, -3, 0, 3 };
-    const int dy[]= { 1, 2, 1, -1, -2, -1 };
-    const int bx = -border*3, by = border;
-    const int ex = -bx, ey = -by;
-    typedef std::pair<int,int> N;
-    std::set< N > z;
-    std::list< N > q;
-    q.push_back( N( bx, by ) );
-    while( !q.empty() ) {
-        for(int i=0;i<6;i++) {
-            int x = q.front().first + dx[i], y = q.front().second + dy[i];
-            if( find( z.begin(), z.end(), N(x,y) ) != z.end() ) continue;
-            if( tiles.get(x,y).isColour( NashTile::BLACK ) ) {
-                q.push_back( N(x,y) );
-                z.insert( N(x,y) );
-            }
+static const int neighbourDx[]= { 3, 0, -3, -3, 0, 3 };
+static const int neighbourDy[]= { 1, 2, 1, -1, -2, -1 };
+
+int NashBoard::cellIndex(int x, int y) const {
+    if( x % 3 ) return -1;
+    const int i = x / 3;
+    if( (y - i) % 2 ) return -1;
+    const int j = (y - i) / 2;
+    if( abs(i) > border || abs(j) > border ) return -1;
+    return (i + border) * side + (j + border);
+}
+
+int NashBoard::findRoot(int colour, int k) {
+    std::vector<int>& parent = parents[ colour ];
+    int root = k;
+    while( parent[root] >= 0 ) {
+        root = parent[root];
+    }
+    while( parent[k] >= 0 ) {
+        const int next = parent[k];
+        parent[k] = root;
+        k = next;
+    }
+    return root;
+}
+
+void NashBoard::join(int colour, int a, int b) {
+    std::vector<int>& parent = parents[ colour ];
+    a = findRoot( colour, a );
+    b = findRoot( colour, b );
+    if( a == b ) return;
+    if( parent[a] > parent[b] ) {
+        std::swap( a, b );
+    }
+    parent[a] += parent[b];
+    parent[b] = a;
+}
+
+void NashBoard::connect(int x, int y, NashTile::Colour c) {
+    // with whichever neighbours count as the colour, edges included
+    const int colour = (c == NashTile::WHITE) ? 0 : 1;
+    const int k = cellIndex( x, y );
+    for(int i=0;i<6;i++) {
+        const int nx = x + neighbourDx[i], ny = y + neighbourDy[i];
+        const int nk = cellIndex( nx, ny );
+        if( nk >= 0 && tiles.get(nx,ny).isColour( c ) ) {
+            join( colour, k, nk );
         }
-        q.pop_front();
     }
-    if( find( z.begin(), z.end(), N(ex, ey) ) != z.end() ) return NashTile::BLACK;
-    q.clear();
-    z.clear();
-    q.push_back( N( bx, by ) );
-    while( !q.empty() ) {
-        for(int i=0;i<6;i++) {
-            int x = q.front().first + dx[i], y = q.front().second + dy[i];
-            if( find( z.begin(), z.end(), N(x,y) ) != z.end() ) continue;
-            if( tiles.get(x,y).isColour( NashTile::WHITE ) ) {
-                q.push_back( N(x,y) );
-                z.insert( N(x,y) );
-            }
+}
+
+void NashBoard::updateWinner(void) {
+    // a colour has won when its set joins the two corners, which are
+    // edges of both colours
+    const int start = cellIndex( -border*3, border ), end = cellIndex( border*3, -border );
+    if( findRoot( 1, start ) == findRoot( 1, end ) ) {
+        winner = NashTile::BLACK;
+    } else if( findRoot( 0, start ) == findRoot( 0, end ) ) {
+        winner = NashTile::WHITE;
+    } else {
+        winner = NashTile::NONE;
+    }
+}
+
+void NashBoard::recompute(void) {
+    for(int colour=0;colour<2;colour++) {
+        parents[colour].assign( side * side, -1 );
+    }
+    for(int i=-border;i<=border;i++) for(int j=-border;j<=border;j++) {
+        const int x = i * 3, y = 2 * j + i;
+        if( tiles.isDefault( x, y ) ) continue;
+        if( tiles.get(x,y).isColour( NashTile::WHITE ) ) {
+            connect( x, y, NashTile::WHITE );
+        }
+        if( tiles.get(x,y).isColour( NashTile::BLACK ) ) {
+            connect( x, y, NashTile::BLACK );
         }
-        q.pop_front();
     }
-    if( find( z.begin(), z.end(), N(ex, ey) ) != z.end() ) return NashTile::WHITE;
-    return NashTile::NONE;
+    updateWinner();
 }
 
 NashBoard::~NashBoard(void) {
 }
 
 void NashBoard::put(int x,int y,NashTile::Colour c) {
-    if( !isLegalMove(x,y) ) {
+    place( x, y, c );
+    if( c == NashTile::WHITE || c == NashTile::BLACK ) {
+        connect( x, y, c );
+        updateWinner();
+    }
+}
+
+void NashBoard::place(int x,int y,NashTile::Colour c) {
+    if( !isLegalMove(x,y) || cellIndex(x,y) < 0 ) {
         throw std::runtime_error( "illegal move attempted" );
     }
     NashTile& tile = tiles.get(x,y);
@@ -5,6 +5,7 @@
 using namespace HexTools;
 
 #include <string>
+#include <vector>
 
 namespace Nash {
 
@@ -41,18 +42,40 @@ class NashBoard {
         int size;
         HexMap<NashTile> tiles;
 
+        // which cells are connected through each colour, kept up to date
+        // by put() so that finding the winner takes no search. cells are
+        // numbered row by row over the rhombus the board covers; a
+        // negative parent is a root, holding minus the size of its set
+        int border, side;
+        std::vector<int> parents[2]; // white, black
+        NashTile::Colour winner;
+
+        int cellIndex(int,int) const; // or -1 off the board
+        int findRoot(int,int);
+        void join(int,int,int);
+        void connect(int,int,NashTile::Colour);
+        void updateWinner(void);
+
     public:
         NashBoard(int);
         ~NashBoard(void);
 
         void clear(void);
 
+        int getSize(void) const { return size; }
+
         bool isLegalMove(int,int) const;
         std::string getAppearance(int,int) const;
+        const NashTile& getTile(int x,int y) const { return tiles.get(x,y); }
 
         void put(int,int,NashTile::Colour);
 
-        NashTile::Colour getWinner(void) const;
+        // for restoring a position: any number of stones placed without
+        // the connections, then recomputed from scratch
+        void place(int,int,NashTile::Colour);
+        void recompute(void);
+
+        NashTile::Colour getWinner(void) const { return winner; }
 };
 
 }
@@ -0,0 +1,326 @@
+#include "NashBot.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <time.h>
+
+namespace Nash {
+
+static NashTile::Colour opponent(NashTile::Colour c) {
+    return (c == NashTile::WHITE) ? NashTile::BLACK : NashTile::WHITE;
+}
+
+static uint64_t nextRandom(uint64_t& state) {
+    // xorshift; every thread has its own
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+HexBitboard::HexBitboard(int size) :
+    size ( size )
+{
+    if( size < 1 || size > maxSize ) {
+        throw std::runtime_error( "board size out of range for a bitboard" );
+    }
+    memset( white, 0, sizeof white );
+    memset( black, 0, sizeof black );
+}
+
+HexBitboard::HexBitboard(const NashBoard& board) :
+    size ( board.getSize() )
+{
+    if( size < 1 || size > maxSize ) {
+        throw std::runtime_error( "board size out of range for a bitboard" );
+    }
+    memset( white, 0, sizeof white );
+    memset( black, 0, sizeof black );
+    for(int k=0;k<size*size;k++) {
+        int x, y;
+        toBoard( k, x, y );
+        const NashTile& tile = board.getTile( x, y );
+        if( tile.status == NashTile::PIECE ) {
+            play( k, tile.colour );
+        }
+    }
+}
+
+NashTile::Colour HexBitboard::get(int k) const {
+    const Row bit = (Row) 1 << (k % size);
+    if( white[ k / size ] & bit ) return NashTile::WHITE;
+    if( black[ k / size ] & bit ) return NashTile::BLACK;
+    return NashTile::NONE;
+}
+
+void HexBitboard::play(int k, NashTile::Colour c) {
+    Row *rows = (c == NashTile::WHITE) ? white : black;
+    rows[ k / size ] |= (Row) 1 << (k % size);
+}
+
+void HexBitboard::getEmpty(std::vector<int>& cells) const {
+    cells.clear();
+    for(int r=0;r<size;r++) {
+        const Row taken = white[r] | black[r];
+        for(int c=0;c<size;c++) {
+            if( !(taken & ((Row) 1 << c)) ) {
+                cells.push_back( r * size + c );
+            }
+        }
+    }
+}
+
+bool HexBitboard::spans(const Row *stones, int size, bool acrossRows) {
+    // a flood fill a row at a time, sweeping down and up until nothing
+    // more is reached. cell (r,c) touches (r,c+-1), (r+-1,c), (r-1,c+1)
+    // and (r+1,c-1)
+    const Row last = (Row) 1 << (size - 1);
+    Row reach[ maxSize ] = { 0 };
+    for(int r=0;r<size;r++) {
+        Row x = acrossRows ? ((r == 0) ? stones[0] : 0) : (stones[r] & 1), y;
+        do {
+            y = x;
+            x |= ((x << 1) | (x >> 1)) & stones[r];
+        } while( x != y );
+        reach[r] = x;
+        if( !acrossRows && (x & last) ) return true;
+    }
+    if( acrossRows && reach[ size - 1 ] ) return true;
+    bool changed = true;
+    while( changed ) {
+        changed = false;
+        for(int n=0;n<2*size;n++) {
+            const int r = (n < size) ? n : 2 * size - 1 - n;
+            Row x = reach[r], y;
+            if( r > 0 ) x |= reach[r-1] | (reach[r-1] >> 1);
+            if( r < size - 1 ) x |= reach[r+1] | (reach[r+1] << 1);
+            x &= stones[r];
+            if( x == reach[r] ) continue;
+            do {
+                y = x;
+                x |= ((x << 1) | (x >> 1)) & stones[r];
+            } while( x != y );
+            reach[r] = x;
+            changed = true;
+            if( acrossRows ? (r == size - 1) : ((x & last) != 0) ) return true;
+        }
+    }
+    return false;
+}
+
+NashTile::Colour HexBitboard::getWinner(void) const {
+    if( spans( white, size, true ) ) return NashTile::WHITE;
+    if( spans( black, size, false ) ) return NashTile::BLACK;
+    return NashTile::NONE;
+}
+
+int HexBitboard::fromBoard(int x, int y) const {
+    const int border = (size+1)/2;
+    if( x % 3 ) return -1;
+    const int i = x / 3;
+    if( (y - i) % 2 ) return -1;
+    const int r = i + border - 1, c = (y - i) / 2 + border - 1;
+    if( r < 0 || r >= size || c < 0 || c >= size ) return -1;
+    return r * size + c;
+}
+
+void HexBitboard::toBoard(int k, int& x, int& y) const {
+    const int border = (size+1)/2;
+    const int i = k / size - (border - 1), j = k % size - (border - 1);
+    x = 3 * i;
+    y = 2 * j + i;
+}
+
+NashTile::Colour HexBitboard::playout(NashTile::Colour colour, int *empty, int count, uint64_t& state) {
+    // on a full board exactly one colour has a chain across, so only
+    // white needs looking for
+    for(int i=count-1;i>=0;i--) {
+        std::swap( empty[i], empty[ nextRandom( state ) % (i + 1) ] );
+        play( empty[i], colour );
+        colour = opponent( colour );
+    }
+    return spans( white, size, true ) ? NashTile::WHITE : NashTile::BLACK;
+}
+
+struct SearchNode {
+    int firstChild; // -1 until expanded
+    int children;
+    int move;
+    int visits;
+    float wins; // for whoever played the move
+};
+
+static const int expandAfter = 8; // visits to a leaf before its children are made
+static const size_t maxTreeSize = 1 << 19; // nodes per bot, 10MB shared out among its threads; past this the leaves just play out
+static const double exploration = 0.7;
+
+static int selectChild(const std::vector<SearchNode>& tree, int node) {
+    // by UCT; the children are in random order, so unvisited ones are
+    // taken as they come
+    const SearchNode& parent = tree[node];
+    const double logVisits = log( (double) parent.visits + 1 );
+    int best = parent.firstChild;
+    double bestScore = -1;
+    for(int i=parent.firstChild;i<parent.firstChild+parent.children;i++) {
+        const SearchNode& child = tree[i];
+        if( child.visits == 0 ) return i;
+        const double score = child.wins / child.visits + exploration * sqrt( logVisits / child.visits );
+        if( score > bestScore ) {
+            bestScore = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void expand(std::vector<SearchNode>& tree, int node, const std::vector<int>& empty, uint64_t& state) {
+    const int first = tree.size();
+    for(size_t i=0;i<empty.size();i++) {
+        SearchNode child = { -1, 0, empty[i], 0, 0 };
+        tree.push_back( child );
+        std::swap( tree.back(), tree[ first + nextRandom( state ) % (i + 1) ] );
+    }
+    tree[node].firstChild = first;
+    tree[node].children = empty.size();
+}
+
+void NashBot::search(int index) {
+    using namespace std;
+    uint64_t state = (0x9e3779b97f4a7c15ULL * (index + 1)) ^ (uint64_t) now();
+    if( !state ) state = 1;
+
+    vector<int> rootEmpty, empty, path;
+    position.getEmpty( rootEmpty );
+    // all the room the tree may take, so that it never doubles past it
+    const size_t treeSize = maxTreeSize / threads;
+    vector<SearchNode> tree;
+    tree.reserve( treeSize );
+    SearchNode root = { -1, 0, -1, 0, 0 };
+    tree.push_back( root );
+    long count = 0;
+    while( !rootEmpty.empty() && !stopping ) {
+        if( (count % 16) == 0 && now() >= deadline ) break;
+
+        HexBitboard board ( position );
+        empty = rootEmpty;
+        NashTile::Colour colour = toMove;
+        int node = 0;
+        path.clear();
+        path.push_back( node );
+        while( !empty.empty() ) {
+            if( tree[node].firstChild < 0 ) {
+                if( tree[node].visits < expandAfter || tree.size() + empty.size() > treeSize ) break;
+                expand( tree, node, empty, state );
+            }
+            node = selectChild( tree, node );
+            board.play( tree[node].move, colour );
+            empty.erase( find( empty.begin(), empty.end(), tree[node].move ) );
+            colour = opponent( colour );
+            path.push_back( node );
+        }
+        const NashTile::Colour winner = empty.empty() ? board.getWinner()
+                                                      : board.playout( colour, &empty[0], empty.size(), state );
+        // the root's children were played by the side to move
+        NashTile::Colour mover = opponent( toMove );
+        for(size_t i=0;i<path.size();i++) {
+            SearchNode& n = tree[ path[i] ];
+            ++n.visits;
+            if( winner == mover ) {
+                n.wins += 1;
+            }
+            mover = opponent( mover );
+        }
+        ++count;
+    }
+
+    for(int i=tree[0].firstChild;i>=0 && i<tree[0].firstChild+tree[0].children;i++) {
+        visits[index][ tree[i].move ] = tree[i].visits;
+    }
+    playouts[index] = count;
+}
+
+NashBot::NashBot(int threads, double maxSeconds) :
+    threads ( std::max( 1, threads ) ),
+    maxSeconds ( maxSeconds ),
+    position ( 1 ),
+    toMove ( NashTile::NONE ),
+    deadline ( 0 ),
+    workers (),
+    stopping ( false ),
+    thinking ( false ),
+    lastPlayouts ( 0 )
+{
+}
+
+NashBot::~NashBot(void) {
+    cancel();
+}
+
+long long NashBot::now(void) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+double NashBot::budget(double remaining, int empty) const {
+    // an even share of what is left over the moves it may still need
+    // to make, which is at most half the empty cells
+    const double share = std::max( 0.0, remaining ) / std::max( 4, empty / 2 );
+    return std::min( maxSeconds, share );
+}
+
+void NashBot::start(const HexBitboard& board, NashTile::Colour colour, double seconds) {
+    cancel();
+    position = board;
+    toMove = colour;
+    deadline = now() + (long long) (seconds * 1e6);
+    stopping = false;
+    const int cells = board.getSize() * board.getSize();
+    visits.assign( threads, std::vector<long>( cells, 0 ) );
+    playouts.assign( threads, 0 );
+    for(int i=0;i<threads;i++) {
+        workers.push_back( new boost::thread( Worker( *this, i ) ) );
+    }
+    thinking = true;
+}
+
+int NashBot::finish(void) {
+    if( !thinking ) return -1;
+    for(size_t i=0;i<workers.size();i++) {
+        workers[i]->join();
+        delete workers[i];
+    }
+    workers.clear();
+    thinking = false;
+
+    int best = -1;
+    long bestVisits = -1;
+    lastPlayouts = 0;
+    for(int k=0;k<position.getSize()*position.getSize();k++) {
+        if( !position.isEmpty( k ) ) continue;
+        long total = 0;
+        for(int i=0;i<threads;i++) {
+            total += visits[i][k];
+        }
+        if( total > bestVisits ) {
+            bestVisits = total;
+            best = k;
+        }
+    }
+    for(int i=0;i<threads;i++) {
+        lastPlayouts += playouts[i];
+    }
+    return best;
+}
+
+void NashBot::cancel(void) {
+    stopping = true;
+    finish();
+}
+
+}
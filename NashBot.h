@@ -0,0 +1,104 @@
+#ifndef H_NASHBOT
+#define H_NASHBOT
+
+#include "Nash.h"
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+
+namespace Nash {
+
+class HexBitboard {
+    // a Hex position as a bit per cell and a word per row, for playing
+    // out games quickly. rows run between white's edges and columns
+    // between black's; cells are numbered row by row
+    public:
+        typedef uint32_t Row;
+        static const int maxSize = 32;
+
+    private:
+        int size;
+        Row white[ maxSize ], black[ maxSize ];
+
+        static bool spans(const Row*, int, bool); // across the rows, or the columns
+
+    public:
+        explicit HexBitboard(int);
+        explicit HexBitboard(const NashBoard&);
+
+        int getSize(void) const { return size; }
+
+        NashTile::Colour get(int) const;
+        bool isEmpty(int k) const { return get( k ) == NashTile::NONE; }
+        void play(int, NashTile::Colour);
+        void getEmpty(std::vector<int>&) const;
+
+        NashTile::Colour getWinner(void) const;
+
+        // the board's cells in NashBoard's coordinates; -1 off the board
+        int fromBoard(int, int) const;
+        void toBoard(int, int&, int&) const;
+
+        // fills the board at random, the colours taking turns, and
+        // returns the winner; the empty cells are shuffled in place
+        NashTile::Colour playout(NashTile::Colour, int*, int, uint64_t&);
+};
+
+class NashBot {
+    // plays Hex by Monte Carlo tree search on threads of its own. each
+    // thread grows a tree of its own from the position, in an equal share
+    // of a fixed number of nodes, and the visits
+    // of the first moves are summed when time is up. a search runs in
+    // the background between start() and finish()
+    private:
+        const int threads;
+        const double maxSeconds;
+
+        HexBitboard position;
+        NashTile::Colour toMove;
+        long long deadline; // in microseconds, monotonic
+
+        std::vector<boost::thread*> workers;
+        boost::atomic<bool> stopping;
+        bool thinking;
+
+        std::vector< std::vector<long> > visits; // per thread, per cell
+        std::vector<long> playouts; // per thread
+        long lastPlayouts;
+
+        struct Worker {
+            NashBot& bot;
+            int index;
+
+            Worker(NashBot& bot, int index) : bot ( bot ), index ( index ) {}
+            void operator()(void) { bot.search( index ); }
+        };
+
+        NashBot(const NashBot&);
+        const NashBot& operator=(const NashBot&);
+
+        void search(int);
+
+    public:
+        NashBot(int, double); // threads, and the most seconds to think for a move
+        ~NashBot(void);
+
+        static long long now(void); // microseconds, monotonic
+
+        double budget(double, int) const; // for a move, given the time left and the empty cells
+
+        void start(const HexBitboard&, NashTile::Colour, double);
+        bool isThinking(void) const { return thinking; }
+        int finish(void); // waits for the search to end; the chosen cell, or -1
+        void cancel(void);
+
+        long getPlayouts(void) const { return lastPlayouts; } // by the last search
+};
+
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "NashServer.h"
+#include "NashBot.h"
 
 #include "SProto.h"
 #include "Sise.h"
@@ -12,8 +13,257 @@
 
 namespace Nash {
 
-NashGame::NashGame(SProto::Server& server, int id, int size, const std::string white, const std::string black) :
+static const double startingTime = 60.0, increment = 30.0; // seconds, per player
+static const std::string botPlayer = "*bot*"; // no user can have this name
+
+static void encodeMove(int size, int x, int y, std::string& moves) {
+    const int border = (size+1)/2, i = x / 3, j = (y - i) / 2;
+    moves += (char) ('a' + i + border - 1);
+    moves += (char) ('a' + j + border - 1);
+}
+
+static void decodeMove(int size, const std::string& moves, int n, int& x, int& y) {
+    const int border = (size+1)/2;
+    const int i = moves[2*n] - 'a' - (border - 1), j = moves[2*n+1] - 'a' - (border - 1);
+    x = 3 * i;
+    y = 2 * j + i;
+}
+
+void StoredGame::getMove(int n, int& x, int& y) const {
+    decodeMove( size, moves, n, x, y );
+}
+
+void StoredGame::addMove(int x, int y) {
+    encodeMove( size, x, y, moves );
+}
+
+Sise::SExp* StoredGame::toSexp(void) const {
+    using namespace Sise;
+    return List()( new Int( id ) )
+                 ( new Int( size ) )
+                 ( new String( whitePlayer ) )
+                 ( new String( blackPlayer ) )
+                 ( new Symbol( swapped ? "swapped" : "unswapped" ) )
+                 ( new Int( (int) (remaining[0] * 1000) ) )
+                 ( new Int( (int) (remaining[1] * 1000) ) )
+                 ( new String( moves ) )
+           .make();
+}
+
+StoredGame StoredGame::fromSexp(Sise::SExp *sexp) {
+    using namespace Sise;
+    StoredGame rv;
+    Cons *fields = asProperCons( sexp );
+    rv.id = *asInt( fields->nthcar(0) );
+    rv.size = *asInt( fields->nthcar(1) );
+    rv.whitePlayer = *asString( fields->nthcar(2) );
+    rv.blackPlayer = *asString( fields->nthcar(3) );
+    rv.swapped = std::string( *asSymbol( fields->nthcar(4) ) ) == "swapped";
+    rv.remaining[0] = *asInt( fields->nthcar(5) ) / 1000.0;
+    rv.remaining[1] = *asInt( fields->nthcar(6) ) / 1000.0;
+    rv.moves = *asString( fields->nthcar(7) );
+    if( rv.size < 1 || rv.size > 26 || rv.moves.size() % 2 ) {
+        throw std::runtime_error( "malformed stored game" );
+    }
+    for(size_t i=0;i<rv.moves.size();i++) {
+        if( rv.moves[i] < 'a' || rv.moves[i] >= 'a' + rv.size ) {
+            throw std::runtime_error( "move off the board in stored game" );
+        }
+    }
+    return rv;
+}
+
+static const double syncDelay = 0.1; // seconds from a change to the journal being synced
+
+class NashGameStore::GamesSnapshot : public SProto::Snapshot {
+    private:
+        std::vector<StoredGame> stored;
+
+    public:
+        explicit GamesSnapshot(std::vector<StoredGame>& games) { stored.swap( games ); }
+
+        Sise::SExp* toSexp(void) {
+            Sise::List list;
+            for(std::vector<StoredGame>::const_iterator i = stored.begin(); i != stored.end(); i++) {
+                list( i->toSexp() );
+            }
+            return list.make();
+        }
+};
+
+NashGameStore::NashGameStore(const GameMap& games, TimerWheel& clocks) :
+    SProto::Persistable( "./persist/nash-games.lisp" ),
+    games ( games ),
+    clocks ( clocks ),
+    adjourned (),
+    byPlayer ()
+{
+    setJournalSync( false );
+}
+
+SProto::Snapshot* NashGameStore::snapshot(void) const {
+    // the running games as they are now, and the adjourned ones
+    std::vector<StoredGame> stored;
+    stored.reserve( games.size() + adjourned.size() );
+    for(GameMap::const_iterator i = games.begin(); i != games.end(); i++) {
+        if( i->second->isRunning() ) {
+            stored.push_back( i->second->stored() );
+        }
+    }
+    for(std::map<int,StoredGame>::const_iterator i = adjourned.begin(); i != adjourned.end(); i++) {
+        stored.push_back( i->second );
+    }
+    return new GamesSnapshot( stored );
+}
+
+Sise::SExp* NashGameStore::toSexp(void) const {
+    SProto::Snapshot *s = snapshot();
+    Sise::SExp *rv = s->toSexp();
+    delete s;
+    return rv;
+}
+
+void NashGameStore::fromSexp(Sise::SExp *sexp) {
+    using namespace Sise;
+    Cons *l = asCons( sexp );
+    while( l ) {
+        SExp *game = l->getcar();
+        l = asCons( l->getcdr() );
+        try {
+            adjourn( StoredGame::fromSexp( game ) );
+        }
+        catch( std::runtime_error& e ) {
+            using namespace std;
+            cerr << "warning: skipping stored game: " << e.what() << endl;
+        }
+    }
+}
+
+void NashGameStore::applyJournalEntry(Sise::SExp *entry) {
+    // (game <stored game>), (move <id> <moves before> <move> <white
+    // ms> <black ms>) or (end <id>); each sets what it changes, so that
+    // replaying one the snapshot already covers does no harm
+    using namespace Sise;
+    Cons *args = asProperCons( entry );
+    std::string type = *asSymbol( args->nthcar(0) );
+    if( type == "game" ) {
+        adjourn( StoredGame::fromSexp( args->nthcar(1) ) );
+    } else if( type == "move" ) {
+        std::map<int,StoredGame>::iterator i = adjourned.find( *asInt( args->nthcar(1) ) );
+        if( i == adjourned.end() ) {
+            throw std::runtime_error( "move in a game that is not stored" );
+        }
+        const int before = *asInt( args->nthcar(2) );
+        const std::string move = *asString( args->nthcar(3) );
+        StoredGame& game = i->second;
+        if( before < 0 || before > game.getMoves() || move.size() != 2
+            || move[0] < 'a' || move[0] >= 'a' + game.size || move[1] < 'a' || move[1] >= 'a' + game.size ) {
+            throw std::runtime_error( "malformed stored move" );
+        }
+        game.moves.resize( 2 * before );
+        game.moves += move;
+        game.remaining[0] = *asInt( args->nthcar(4) ) / 1000.0;
+        game.remaining[1] = *asInt( args->nthcar(5) ) / 1000.0;
+    } else if( type == "end" ) {
+        forget( *asInt( args->nthcar(1) ) );
+    } else {
+        throw std::runtime_error( "unknown nash game journal entry" );
+    }
+}
+
+void NashGameStore::adjourn(const StoredGame& game) {
+    if( games.find( game.id ) != games.end() ) return;
+    forget( game.id );
+    adjourned[ game.id ] = game;
+    byPlayer.insert( std::make_pair( game.whitePlayer, game.id ) );
+    byPlayer.insert( std::make_pair( game.blackPlayer, game.id ) );
+}
+
+void NashGameStore::forget(int id) {
+    std::map<int,StoredGame>::iterator i = adjourned.find( id );
+    if( i == adjourned.end() ) return;
+    const std::string players[] = { i->second.whitePlayer, i->second.blackPlayer };
+    adjourned.erase( i );
+    for(int p=0;p<2;p++) {
+        typedef std::multimap<std::string,int>::iterator It;
+        std::pair<It,It> range = byPlayer.equal_range( players[p] );
+        for(It j = range.first; j != range.second; j++) {
+            if( j->second == id ) {
+                byPlayer.erase( j );
+                break;
+            }
+        }
+    }
+}
+
+void NashGameStore::journalChange(Sise::SExp *entry) {
+    journal( entry );
+    if( isJournalUnsynced() && !isSet() ) {
+        clocks.setIn( this, syncDelay );
+    }
+}
+
+void NashGameStore::write(const StoredGame& game) {
+    using namespace Sise;
+    journalChange( List()( new Symbol( "game" ) )
+                         ( game.toSexp() )
+                   .make() );
+}
+
+void NashGameStore::writeMove(const StoredGame& game) {
+    using namespace Sise;
+    journalChange( List()( new Symbol( "move" ) )
+                         ( new Int( game.id ) )
+                         ( new Int( game.getMoves() - 1 ) )
+                         ( new String( game.moves.substr( game.moves.size() - 2 ) ) )
+                         ( new Int( (int) (game.remaining[0] * 1000) ) )
+                         ( new Int( (int) (game.remaining[1] * 1000) ) )
+                   .make() );
+}
+
+void NashGameStore::erase(int id) {
+    using namespace Sise;
+    journalChange( List()( new Symbol( "end" ) )
+                         ( new Int( id ) )
+                   .make() );
+}
+
+void NashGameStore::ring(void) {
+    syncJournalNow();
+}
+
+bool NashGameStore::isAdjournedWith(int id, const std::string& player) const {
+    std::map<int,StoredGame>::const_iterator i = adjourned.find( id );
+    return i != adjourned.end() && (i->second.whitePlayer == player || i->second.blackPlayer == player);
+}
+
+bool NashGameStore::takeAdjourned(int id, StoredGame& game) {
+    std::map<int,StoredGame>::iterator i = adjourned.find( id );
+    if( i == adjourned.end() ) return false;
+    game = i->second;
+    forget( id );
+    return true;
+}
+
+void NashGameStore::takeAdjourned(const std::string& player, std::vector<StoredGame>& rv) {
+    typedef std::multimap<std::string,int>::iterator It;
+    std::vector<int> ids;
+    std::pair<It,It> range = byPlayer.equal_range( player );
+    for(It i = range.first; i != range.second; i++) {
+        ids.push_back( i->second );
+    }
+    for(size_t i=0;i<ids.size();i++) {
+        StoredGame game;
+        if( takeAdjourned( ids[i], game ) ) {
+            rv.push_back( game );
+        }
+    }
+}
+
+NashGame::NashGame(SProto::Server& server, TimerWheel& clocks, NashGameStore& store, int id, int size, const std::string white, const std::string black) :
     server ( server ),
+    clocks ( clocks ),
+    store ( store ),
     gameId ( id ),
     board ( size ),
     whitePlayer (white),
@@ -22,14 +272,59 @@ NashGame::NashGame(SProto::Server& server, int id, int size, const std::string w
     gameRunning ( true ),
     turns (),
     swapAllowed ( false ),
-    swapped ( false )
+    swapped ( false ),
+    botName (),
+    bot ( 0 ),
+    moves ()
+{
+    turns.addParticipant( 0, startingTime, increment );
+    turns.addParticipant( 1, startingTime, increment );
+    open();
+    turns.start();
+    requestMove();
+}
+
+NashGame::NashGame(SProto::Server& server, TimerWheel& clocks, NashGameStore& store, const StoredGame& game) :
+    server ( server ),
+    clocks ( clocks ),
+    store ( store ),
+    gameId ( game.id ),
+    board ( game.size ),
+    whitePlayer ( game.whitePlayer ),
+    blackPlayer ( game.blackPlayer ),
+    moveno ( game.getMoves() + 1 ),
+    gameRunning ( true ),
+    turns (),
+    swapAllowed ( game.getMoves() == 1 && !game.swapped ),
+    swapped ( game.swapped ),
+    botName (),
+    bot ( 0 ),
+    moves ( game.moves )
 {
+    // the clocks as of the last turn, then a turn for every move and
+    // for the swap; the players are sent the moves so far
+    turns.addParticipant( 0, game.remaining[0], increment );
+    turns.addParticipant( 1, game.remaining[1], increment );
+    if( (game.getMoves() + (swapped ? 1 : 0)) % 2 ) {
+        turns.skip();
+    }
+    open();
+    for(int i=0;i<game.getMoves();i++) {
+        int x, y;
+        game.getMove( i, x, y );
+        const NashTile::Colour c = (i % 2) ? NashTile::BLACK : NashTile::WHITE;
+        board.place( x, y, c );
+        broadcastMove( x, y, c );
+    }
+    board.recompute();
+    turns.start();
+    requestMove();
+}
+
+void NashGame::open(void) {
     using namespace SProto;
     using namespace Sise;
 
-    turns.addParticipant( 0, 60.0, 30.0 );
-    turns.addParticipant( 1, 60.0, 30.0 );
-
     std::ostringstream oss;
     oss << "game-" << gameId;
     channelName = oss.str();
@@ -47,9 +342,32 @@ NashGame::NashGame(SProto::Server& server, int id, int size, const std::string w
                         ( new Int( gameId ) )
                         ( new String( channelName ) )
                   .make() );
+}
 
-    turns.start();
-    requestMove();
+StoredGame NashGame::stored(void) const {
+    StoredGame rv;
+    rv.id = gameId;
+    rv.size = board.getSize();
+    rv.whitePlayer = whitePlayer;
+    rv.blackPlayer = blackPlayer;
+    rv.swapped = swapped;
+    rv.remaining[0] = turns.getRemainingTime( 0 );
+    rv.remaining[1] = turns.getRemainingTime( 1 );
+    rv.moves = moves;
+    return rv;
+}
+
+NashGame::~NashGame(void) {
+    delete bot;
+}
+
+void NashGame::attachBot(const std::string& name, NashBot *player) {
+    delete bot;
+    botName = name;
+    bot = player;
+    if( playerToMove() == botName ) {
+        requestMove();
+    }
 }
 
 std::string NashGame::playerToMove(void) const {
@@ -82,6 +400,7 @@ void NashGame::swap(const std::string& s) {
         swapped = true;
         turns.next();
         requestMove();
+        store.write( stored() );
     } else {
         respondIllegal( s );
     }
@@ -89,6 +408,11 @@ void NashGame::swap(const std::string& s) {
 
 void NashGame::declareWin(NashTile::Colour colour) {
     gameRunning = false;
+    cancel();
+    store.erase( gameId );
+    if( bot ) {
+        bot->cancel();
+    }
     std::ostringstream oss;
     oss << "Game over. ";
     oss << "Winner: " << ((colour == NashTile::WHITE) ? whitePlayer : blackPlayer);
@@ -113,10 +437,12 @@ void NashGame::move(const std::string& s, int x, int y) {
         broadcastMove( x, y, c );
         ++moveno;
         board.put( x, y, c );
+        encodeMove( board.getSize(), x, y, moves );
         if( board.getWinner() == NashTile::NONE ) {
             broadcastInfo();
             swapAllowed = moveno == 2;
             requestMove();
+            store.writeMove( stored() );
         } else {
             declareWin( board.getWinner() );
         }
@@ -138,9 +464,23 @@ void NashGame::requestMove(void) {
     }
     broadcastMessage( oss.str() );
 
-    using namespace Sise;
+    clocks.setIn( this, turns.getCurrentRemainingTime() );
+    if( bot && playerToMove() == botName ) {
+        // the bot thinks in the background, and moves when this rings
+        HexBitboard position ( board );
+        std::vector<int> empty;
+        position.getEmpty( empty );
+        const double seconds = bot->budget( turns.getCurrentRemainingTime(), empty.size() );
+        bot->start( position, whiteToMove ? NashTile::WHITE : NashTile::BLACK, seconds );
+        clocks.setIn( this, seconds );
+    }
+
+    sendMoveRequest();
+}
 
-    delsendTo( whiteToMove ? whitePlayer : blackPlayer,
+void NashGame::sendMoveRequest(void) {
+    using namespace Sise;
+    delsendTo( playerToMove(),
                List()( new Symbol( "nash" ) )
                      ( new Symbol( "request-move" ) )
                      ( new Int( gameId ) )
@@ -148,6 +488,36 @@ void NashGame::requestMove(void) {
                .make() );
 }
 
+void NashGame::rejoin(const std::string& username) {
+    // as the game's start and its moves were sent when it was opened,
+    // to this player alone; the clocks are not touched
+    using namespace Sise;
+    SProto::RemoteClient *rc = server.getConnectedUser( username );
+    if( !rc || !gameRunning ) return;
+    rc->enterChannel( "nash", channelName );
+    delsendTo( username,
+               List()( new Symbol( "nash" ) )
+                     ( new Symbol( "welcome" ) )
+                     ( new Int( gameId ) )
+                     ( new String( channelName ) )
+               .make() );
+    for(int i=0;i<(int)moves.size()/2;i++) {
+        int x, y;
+        decodeMove( board.getSize(), moves, i, x, y );
+        delsendTo( username,
+                   List()( new Symbol( "nash" ) )
+                         ( new Symbol( "put" ) )
+                         ( new Int( gameId ) )
+                         ( new Int( x ) )
+                         ( new Int( y ) )
+                         ( new Symbol( (i % 2) ? "black" : "white" ) )
+                   .make() );
+    }
+    if( playerToMove() == username ) {
+        sendMoveRequest();
+    }
+}
+
 void NashGame::broadcastInfo(void) {
     // no metadata display yet, so no metadata to send
     // intention is stuff like move number, player to move, etc.
@@ -251,45 +621,123 @@ NashSubserver::NashSubserver( SProto::Server& server ) :
     Persistable( "./persist/nash.lisp" ),
     SubServer( "nash", server ),
     nextGameId ( 1 ),
+    reservedGameIds ( 1 ),
     games (),
-    challenges ()
+    gamesByPlayer (),
+    clocks (),
+    store ( games, clocks ),
+    challenges (),
+    botThreads ( 1 ),
+    botSeconds ( 5.0 )
 {
+    setSnapshotWriter( &server.getSnapshotWriter() );
+    store.setSnapshotWriter( &server.getSnapshotWriter() );
     restore();
+    store.restore();
 }
 
 void NashSubserver::fromSexp(Sise::SExp *sexp) {
     using namespace Sise;
-    nextGameId = *asInt( asProperCons(sexp)->nthcar(0) );
+    nextGameId = reservedGameIds = *asInt( asProperCons(sexp)->nthcar(0) );
 }
 
 Sise::SExp * NashSubserver::toSexp(void) const {
     using namespace Sise;
-    // this is more useful when we implement persisting
-    // actual games in progress (adjourning)
-    // a contained directory persistable might be useful for that
-    // (one file per game in progress)
-    return List()( new Int( nextGameId ) )
+    // the games themselves are kept by the store
+    return List()( new Int( reservedGameIds ) )
            .make();
 }
 
-void NashSubserver::tick(double dt) {
-    for(GameMap::iterator i = games.begin(); i != games.end(); i++) {
-        i->second->tick( dt );
+void NashSubserver::applyJournalEntry(Sise::SExp *entry) {
+    using namespace Sise;
+    Cons *args = asProperCons( entry );
+    std::string type = *asSymbol( args->nthcar(0) );
+    if( type != "next-game-id" ) {
+        throw std::runtime_error( "unknown nash journal entry" );
+    }
+    nextGameId = reservedGameIds = *asInt( args->nthcar(1) );
+}
+
+int NashSubserver::allocateGameId(void) {
+    if( nextGameId >= reservedGameIds ) {
+        reservedGameIds = nextGameId + gameIdBlock;
+        journal( Sise::List()( new Sise::Symbol( "next-game-id" ) )
+                             ( new Sise::Int( reservedGameIds ) )
+                 .make() );
+    }
+    return nextGameId++;
+}
+
+void NashSubserver::addGame(int id, NashGame *game, const std::string& white, const std::string& black) {
+    games[ id ] = game;
+    gamesByPlayer.insert( std::make_pair( white, id ) );
+    gamesByPlayer.insert( std::make_pair( black, id ) );
+}
+
+void NashSubserver::resume(const StoredGame& stored) {
+    NashGame *game = new NashGame( server, clocks, store, stored );
+    if( stored.whitePlayer == botPlayer || stored.blackPlayer == botPlayer ) {
+        game->attachBot( botPlayer, new NashBot( botThreads, botSeconds ) );
     }
+    addGame( stored.id, game, stored.whitePlayer, stored.blackPlayer );
+}
+
+int NashSubserver::countBotGames(const std::string& player) const {
+    int rv = 0;
+    for(GameMap::const_iterator i = games.begin(); i != games.end(); i++) {
+        if( i->second->hasBot() && i->second->hasPlayer( player ) && i->second->isRunning() ) {
+            ++rv;
+        }
+    }
+    return rv;
+}
+
+void NashSubserver::tick(double dt) {
+    // only the games whose time is up
+    clocks.advance();
 }
 
 bool NashSubserver::handle( SProto::RemoteClient* cli, const std::string& cmd, Sise::SExp* arg) {
     using namespace Sise;
     using namespace SProto;
     if( cmd == "move" || cmd == "swap" || cmd == "resign" ) { // xx inelegant
-        GameMap::iterator i = games.find( *asInt(asProperCons(arg)->nthcar(0)) );
+        const int id = *asInt(asProperCons(arg)->nthcar(0));
+        GameMap::iterator i = games.find( id );
+        StoredGame stored;
+        // only its players may bring an adjourned game back, or its
+        // clocks would start with nobody there
+        if( i == games.end() && store.isAdjournedWith( id, cli->getUsername() )
+                             && store.takeAdjourned( id, stored ) ) {
+            resume( stored );
+            i = games.find( id );
+        }
         if( i == games.end() ) {
             return false;
         }
         return i->second->handle( cli->getUsername(), cmd, asProperCons(arg)->getcdr() );
     }
     if( cmd == "hello" ) {
+        // a player back on a new connection is told the games they are
+        // in, and one back after a restart picks up their stored games.
+        // the clocks of a stored game start with the first of its
+        // players back, so the other may find it already running
         players.insert( cli->getUsername() );
+        typedef std::multimap<std::string,int>::iterator It;
+        std::pair<It,It> range = gamesByPlayer.equal_range( cli->getUsername() );
+        for(It i = range.first; i != range.second; ) {
+            NashGame *game = games[ i->second ];
+            if( game->isRunning() ) {
+                game->rejoin( cli->getUsername() );
+                i++;
+            } else {
+                gamesByPlayer.erase( i++ );
+            }
+        }
+        std::vector<StoredGame> adjourned;
+        store.takeAdjourned( cli->getUsername(), adjourned );
+        for(size_t i=0;i<adjourned.size();i++) {
+            resume( adjourned[i] );
+        }
     } else if( cmd == "users" ) {
         pruneUsers();
         List list;
@@ -324,12 +772,21 @@ bool NashSubserver::handle( SProto::RemoteClient* cli, const std::string& cmd, S
         if( i != challenges.end() && i->second == cli->getUsername() ) {
             // for now the challenger/challengee status determines colour
             // the pie rule _does_ make this perfectly fair in any case, so doesn't matter much
-            int id = nextGameId++;
-            save(); // as far as possible we want to keep game numbers unique
-                    // might want to save only sequence # there for scalability
-            NashGame *game = new NashGame( server, id, 11, challenger, cli->getUsername() );
-            games[ id ] = game;
+            const int id = allocateGameId();
+            NashGame *game = new NashGame( server, clocks, store, id, 11, challenger, cli->getUsername() );
+            addGame( id, game, challenger, cli->getUsername() );
+            store.write( game->stored() );
+        }
+    } else if( cmd == "play-bot" ) {
+        // the bot plays black
+        if( countBotGames( cli->getUsername() ) >= botGamesPerPlayer ) {
+            return false;
         }
+        const int id = allocateGameId();
+        NashGame *game = new NashGame( server, clocks, store, id, 11, cli->getUsername(), botPlayer );
+        game->attachBot( botPlayer, new NashBot( botThreads, botSeconds ) );
+        addGame( id, game, cli->getUsername(), botPlayer );
+        store.write( game->stored() );
     } else {
         return false;
     }
@@ -356,8 +813,13 @@ NashSubserver::~NashSubserver(void) {
     games.clear();
 }
 
-void NashGame::tick(double dt) {
-    if( gameRunning ) {
+void NashGame::ring(void) {
+    if( gameRunning && bot && bot->isThinking() ) {
+        const int cell = bot->finish();
+        int x, y;
+        HexBitboard( board ).toBoard( cell, x, y );
+        move( botName, x, y );
+    } else if( gameRunning ) {
         double t = turns.getCurrentRemainingTime();
         if( t < 0 ) {
             if( playerToMove() == whitePlayer ) {
@@ -365,6 +827,9 @@ void NashGame::tick(double dt) {
             } else {
                 declareWin( NashTile::WHITE );
             }
+        } else {
+            // the turn clock and the wheel's disagree by a hair
+            clocks.setIn( this, t );
         }
     }
 }
@@ -8,9 +8,37 @@
 
 namespace Nash {
 
-class NashGame {
+class NashBot;
+class NashGameStore;
+
+struct StoredGame {
+    // a game in progress as it is stored: the players, their clocks
+    // as of the last turn, and the moves, two letters each for the row
+    // and column from 'a' as in SGF. the colours alternate whether or
+    // not the players swapped, so only boards up to 26 across are kept
+    int id, size;
+    std::string whitePlayer, blackPlayer; // as they are now
+    bool swapped;
+    double remaining[2]; // seconds, by turn participant
+    std::string moves;
+
+    StoredGame(void) : id ( 0 ), size ( 0 ), swapped ( false ) {}
+
+    int getMoves(void) const { return moves.size() / 2; }
+    void getMove(int, int&, int&) const; // in NashBoard's coordinates
+    void addMove(int, int);
+
+    Sise::SExp* toSexp(void) const;
+    static StoredGame fromSexp(Sise::SExp*);
+};
+
+class NashGame : public Alarm {
+    // rings when the player to move runs out of time, or when a bot
+    // playing in the game is to make its move
     private:
         SProto::Server& server;
+        TimerWheel& clocks;
+        NashGameStore& store;
 
         int gameId;
         NashBoard board;
@@ -22,10 +50,17 @@ class NashGame {
 
         bool gameRunning;
 //        bool whiteToMove;
-        mutable FischerTurnManager turns;
+        FischerTurnManager turns;
         bool swapAllowed;
         bool swapped;
 
+        std::string botName;
+        NashBot *bot;
+
+        std::string moves; // as StoredGame keeps them
+
+        void open(void);
+
         void broadcast(Sise::SExp*);
         void sendTo(const std::string&, Sise::SExp*);
         void delbroadcast(Sise::SExp*);
@@ -36,6 +71,7 @@ class NashGame {
         void broadcastMessage(const std::string&);
 
         void requestMove(void);
+        void sendMoveRequest(void);
 
         std::string playerToMove(void) const;
 
@@ -47,39 +83,115 @@ class NashGame {
         void declareWin(NashTile::Colour);
 
     public:
-        NashGame(SProto::Server&, int, int, const std::string, const std::string);
+        NashGame(SProto::Server&, TimerWheel&, NashGameStore&, int, int, const std::string, const std::string);
+        NashGame(SProto::Server&, TimerWheel&, NashGameStore&, const StoredGame&); // resumed
+        ~NashGame(void);
 
-        void tick(double);
+        StoredGame stored(void) const;
+        bool isRunning(void) const { return gameRunning; }
+        bool hasPlayer(const std::string& name) const { return name == whitePlayer || name == blackPlayer; }
+        bool hasBot(void) const { return bot != 0; }
+
+        void attachBot(const std::string&, NashBot*); // playing as the player of that name, owned by the game
+        void rejoin(const std::string&); // a player back on a new connection is told the game so far
+
+        void ring(void);
 
         bool handle(const std::string&, const std::string&, Sise::SExp*);
         bool done(void) const;
 };
 
 
+typedef std::map<int,NashGame*> GameMap;
+
+class NashGameStore : public SProto::Persistable,
+                      public Alarm {
+    // the games in progress: a snapshot of them, and a journal of games
+    // started, moves made and games ended. the journal is synced when
+    // this rings, a moment after the first change since the last sync,
+    // so that the games' thread waits on the disk a few times a second
+    // at most rather than for every move. games read back at startup are
+    // kept as they were stored until one of their players returns
+    private:
+        class GamesSnapshot;
+
+        const GameMap& games; // running, so not kept here
+        TimerWheel& clocks;
+        std::map<int,StoredGame> adjourned;
+        std::multimap<std::string,int> byPlayer; // of the adjourned games
+
+        void adjourn(const StoredGame&);
+        void forget(int);
+        void journalChange(Sise::SExp*);
+
+    public:
+        NashGameStore(const GameMap&, TimerWheel&);
+
+        Sise::SExp* toSexp(void) const;
+        void fromSexp(Sise::SExp*);
+        void applyJournalEntry(Sise::SExp*);
+        SProto::Snapshot* snapshot(void) const;
+
+        void write(const StoredGame&); // the whole game
+        void writeMove(const StoredGame&); // only its last move and the clocks
+        void erase(int);
+
+        void ring(void);
+
+        int getAdjournedCount(void) const { return adjourned.size(); }
+        bool isAdjournedWith(int, const std::string&) const; // that player in it
+        bool takeAdjourned(int, StoredGame&);
+        void takeAdjourned(const std::string&, std::vector<StoredGame>&); // all of a player's
+};
+
 class NashSubserver : public SProto::Persistable,
                       public SProto::SubServer {
     private:
-        int nextGameId;
-        typedef std::map<int,NashGame*> GameMap;
+        // ids are reserved a block at a time, so that starting a game
+        // writes nothing here; a restart skips what is left of a block
+        static const int gameIdBlock = 1000;
+        int nextGameId, reservedGameIds; // the latter past the last reserved
         GameMap games;
+        std::multimap<std::string,int> gamesByPlayer; // of the games in the map, until seen to be over
+        TimerWheel clocks; // the games' time controls, and the store's syncs
+        NashGameStore store;
 
         typedef std::set<std::string> PlayerList;
         PlayerList players;
 
         std::map<std::string, std::string> challenges; // challenger -> challengee
 
+        int botThreads;
+        double botSeconds;
+
+        int allocateGameId(void);
+        void addGame(int, NashGame*, const std::string&, const std::string&);
+        void resume(const StoredGame&);
+        int countBotGames(const std::string&) const;
+
     public:
+        static const int botGamesPerPlayer = 2; // running at once; each bot searches on threads of its own
+
         NashSubserver(SProto::Server&);
         ~NashSubserver(void);
 
         void tick(double);
+        double untilNextDeadline(void) { return clocks.untilNext(); }
+
+        void setBotThreads(int threads) { botThreads = threads; }
+        void setBotSeconds(double seconds) { botSeconds = seconds; } // the most a bot thinks for a move
 
         bool handle(SProto::RemoteClient*,const std::string&,Sise::SExp*);
 
         Sise::SExp* toSexp(void) const;
         void fromSexp(Sise::SExp*);
-        void saveSubserver(void) const { save(); }
-        void restoreSubserver(void) { restore(); }
+        void applyJournalEntry(Sise::SExp*);
+        void saveSubserver(void) const { save(); store.save(); }
+        void snapshotSubserver(void) const { saveInBackground(); store.saveInBackground(); }
+        void restoreSubserver(void) { restore(); store.restore(); }
+
+        int getRunningGames(void) const { return games.size(); }
+        int getAdjournedGames(void) const { return store.getAdjournedCount(); }
 
         void pruneUsers(void);
 };
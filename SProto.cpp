@@ -6,6 +6,7 @@
 #define PROTOCOL_CLIENT_ID "StdClient"
 
 #include <ctime>
+#include <cmath>
 
 #include <cstdlib>
 #include <cstdio>
@@ -15,12 +16,26 @@
 #include <algorithm>
 
 #include <iomanip>
+#include <fstream>
+#include <deque>
+
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/atomic.hpp>
 
 #include <openssl/sha.h>
+#include <openssl/rand.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define CHALLENGE_SALT "123456789abcdefghi"
 #define PASSWORD_SALT  "abcdefghi123456789"
 
+#define MIN_COMPACTION_SIZE 65536
+
 namespace SProto {
 
 RemoteClient::RemoteClient(Sise::RawSocket sock,
@@ -33,7 +48,12 @@ RemoteClient::RemoteClient(Sise::RawSocket sock,
     netId ( netId ),
     username ( "" ),
     rclients ( rclients ),
-    loggingIn ( false )
+    clientIndex ( rclients.size() ),
+    detached ( false ),
+    loggingIn ( false ),
+    authPending ( 0 ),
+    outboundQueued ( false ),
+    closeRequested ( false )
 {
     rclients.push_back( this );
 }
@@ -47,16 +67,43 @@ RemoteClient::State RemoteClient::getState(void) const {
 }
 
 std::string RemoteClient::getUsername(void) const {
+    boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
     return username;
 }
 
 bool RemoteClient::hasUsername(void) const {
+    boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
     return username != "";
 }
 
 RemoteClient::~RemoteClient(void) {
-    using namespace std;
-    rclients.erase( remove( rclients.begin(), rclients.end(), this ) );
+    detach();
+}
+
+void RemoteClient::detach(void) {
+    if( detached ) return;
+    {
+        // an executor may still hold us, but won't get back in
+        boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
+        detached = true;
+        for(std::set<ChannelId>::iterator i = channels.begin(); i != channels.end(); i++) {
+            server.partChannel( *i, this );
+        }
+        channels.clear();
+        server.unindexConnection( username, this );
+    }
+    // the order of rclients doesn't matter, so the last one fills our slot
+    RemoteClient *last = rclients.back();
+    rclients[ clientIndex ] = last;
+    last->clientIndex = clientIndex;
+    rclients.pop_back();
+}
+
+void RemoteClient::setUsername(const std::string& un) {
+    boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
+    server.unindexConnection( username, this );
+    username = un;
+    server.indexConnection( username, this );
 }
 
 void SProtoSocket::close(void) {
@@ -64,6 +111,63 @@ void SProtoSocket::close(void) {
     gracefulShutdown();
 }
 
+void RemoteClient::close(void) {
+    if( Executor::current() ) {
+        queueOutbound( "", true );
+    } else {
+        SProtoSocket::close();
+    }
+}
+
+void RemoteClient::send( Sise::SExp *sexp ) {
+    if( Executor::current() ) {
+        std::ostringstream oss;
+        Sise::outputSExp( sexp, oss );
+        queueOutbound( oss.str(), false );
+    } else {
+        SProtoSocket::send( sexp );
+    }
+}
+
+void RemoteClient::send( const std::string& data ) {
+    if( Executor::current() ) {
+        queueOutbound( data, false );
+    } else {
+        SProtoSocket::send( data );
+    }
+}
+
+void RemoteClient::queueOutbound( const std::string& data, bool closing ) {
+    // the socket belongs to the network thread, so executors leave their
+    // output here and have the server pick it up
+    bool first;
+    {
+        boost::lock_guard<boost::mutex> lock ( outboundMutex );
+        outbound += data;
+        closeRequested = closeRequested || closing;
+        first = !outboundQueued;
+        outboundQueued = true;
+    }
+    if( first ) {
+        server.outboundReady( this );
+    }
+}
+
+void RemoteClient::deliverOutbound(void) {
+    std::string data;
+    bool closing;
+    {
+        boost::lock_guard<boost::mutex> lock ( outboundMutex );
+        data.swap( outbound );
+        closing = closeRequested;
+        outboundQueued = closeRequested = false;
+    }
+    SProtoSocket::send( data );
+    if( closing ) {
+        SProtoSocket::close();
+    }
+}
+
 void RemoteClient::handle( const std::string& cmd, Sise::SExp *arg ) {
     server.handle( this, cmd, arg );
 }
@@ -77,13 +181,13 @@ bool AdminSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SE
     if( cmd == "shutdown" ) {
         server.stopServer();
     } else if( cmd == "save" ) {
-        server.save();
+        server.saveInBackground();
     } else if( cmd == "change-any-password" ) {
         Cons *args = asProperCons( arg );
         std::string username = *asString( args->nthcar(0) );
         std::string password = *asString( args->nthcar(1) );
         try {
-            server.getUsers()[username].passwordhash = makePasswordHash( username, password );
+            server.getUsers().changePassword( username, password );
             cli->delsendResponse( "change-any-password", "ok" );
         }
         catch( NoSuchUserException& e ) {
@@ -99,13 +203,7 @@ bool UsersInfo::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *a
     using namespace Sise;
     if( cmd == "login-request" ) {
         Cons *args = asProperCons( arg );
-        std::string challenge = server.makeChallenge();
-        cli->setLoggingIn( *asString( args->nthcar(0) ),
-                           challenge );
-        cli->delsendPacket( "login-challenge",
-                       List()( new String( *asString( args->nthcar(0) ) ) )
-                             ( new String( challenge ) )
-                       .make() );
+        server.getAuthPool().makeChallenge( cli, *asString( args->nthcar(0) ) );
     } else if( cmd == "check-username" ) {
         Cons *args = asProperCons( arg );
         std::string uname = *asString( args->nthcar(0) );
@@ -136,23 +234,12 @@ bool UsersInfo::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *a
         } else {
             cli->setNotLoggingIn();
             std::string response = *asString( args->nthcar(0) );
-            try {
-                if( response == solveChallenge( desiredUsername,
-                                                       challenge ) ) {
-                    cli->setUsername( desiredUsername );
-                    cli->delsendPacket( "login-ok",
-                                   List()( new String( desiredUsername ) )
-                                   .make() );
-                } else {
-                    cli->delsendPacket( "login-failure",
-                                   List()( new String( "login failed" ))
-                                   .make() );
-                }
-            }
-            catch( NoSuchUserException& e ) {
-                cli->delsendPacket( "login-failure",
-                               List()( new String( "login failed" ))
-                               .make() );
+            UsersMap::const_iterator i = users.find( desiredUsername );
+            if( i == users.end() ) {
+                responseChecked( cli, desiredUsername, false );
+            } else {
+                server.getAuthPool().checkResponse( cli, desiredUsername, i->second.passwordhash,
+                                                    challenge, response );
             }
         }
     } else if( cmd == "change-password" ) {
@@ -162,7 +249,7 @@ bool UsersInfo::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *a
             Cons *args = asProperCons( arg );
             std::string username = cli->getUsername();
             std::string password = *asString( args->nthcar(0) );
-            users[username].passwordhash = makePasswordHash( username, password );
+            changePassword( username, password );
             cli->delsendPacket( "change-password-ok", 0 );
         }
     } else {
@@ -171,6 +258,35 @@ bool UsersInfo::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *a
     return true;
 }
 
+void UsersInfo::challengeMade( RemoteClient *cli, const std::string& username, const std::string& challenge ) {
+    using namespace Sise;
+    if( challenge.empty() ) {
+        cli->delsendPacket( "login-failure",
+                       List()( new String( "login failed" ))
+                       .make() );
+        return;
+    }
+    cli->setLoggingIn( username, challenge );
+    cli->delsendPacket( "login-challenge",
+                   List()( new String( username ) )
+                         ( new String( challenge ) )
+                   .make() );
+}
+
+void UsersInfo::responseChecked( RemoteClient *cli, const std::string& username, bool accepted ) {
+    using namespace Sise;
+    if( accepted ) {
+        cli->setUsername( username );
+        cli->delsendPacket( "login-ok",
+                       List()( new String( username ) )
+                       .make() );
+    } else {
+        cli->delsendPacket( "login-failure",
+                       List()( new String( "login failed" ))
+                       .make() );
+    }
+}
+
 bool DebugSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *arg ) {
     using namespace Sise;
     if( cmd == "hash" ) {
@@ -198,6 +314,38 @@ bool DebugSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SE
     return true;
 }
 
+class PacketTask : public Task {
+    private:
+        RemoteClient *cli;
+        SubServer *subserv;
+        std::string subservName, cmd;
+        Sise::SExp *arg;
+
+    public:
+        PacketTask(RemoteClient *cli, SubServer *subserv, const std::string& subservName, const std::string& cmd, Sise::SExp *arg) :
+            cli ( cli ),
+            subserv ( subserv ),
+            subservName ( subservName ),
+            cmd ( cmd ),
+            arg ( arg )
+        {
+        }
+        ~PacketTask(void) { delete arg; }
+
+        void run(void) {
+            try {
+                if( !subserv->handle( cli, cmd, arg ) ) {
+                    cli->delsendResponse( subservName, "bad-command" );
+                }
+            }
+            catch( Sise::SExpInterpretationError& e ) {
+                using namespace std;
+                cerr << "warning: error (" << e.what() << ") on socket, closing" << endl;
+                cli->close();
+            }
+        }
+};
+
 void Server::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *arg ) {
     using namespace Sise;
     if( cmd == "hello" ) {
@@ -221,6 +369,13 @@ void Server::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp *arg
         SubServer *subserv = getSubServer( cmd );
         Cons *args = asProperCons( arg );
         Symbol *cmdp = asSymbol( args->getcar() );
+        Executor *shard = getShard( subserv );
+        if( shard ) {
+            // the arguments go along with the packet, out of the
+            // expression that the caller deletes
+            shard->post( new PacketTask( cli, subserv, cmd, *cmdp, args->releasecdr() ) );
+            return;
+        }
         SExp *argp = args->getcdr();
         if( !subserv->handle( cli, *cmdp, argp ) ) {
             cli->delsendResponse( cmd, "bad-command" );
@@ -246,16 +401,20 @@ void SProtoSocket::delsendPacket( const std::string& name, Sise::SExp* cdr ) {
     delsend( new Cons( new Symbol( name ), cdr ) );
 }
 
-void SProtoSocket::send( Sise::SExp* sexp ) {
+void SProtoSocket::send( const std::string& data ) {
     if( !closing ) {
-        Sise::outputSExp( sexp, out() );
+        out().write( data.data(), data.size() );
     }
 }
 
-void SProtoSocket::delsend( Sise::SExp* sexp ) {
+void SProtoSocket::send( Sise::SExp* sexp ) {
     if( !closing ) {
         Sise::outputSExp( sexp, out() );
     }
+}
+
+void SProtoSocket::delsend( Sise::SExp* sexp ) {
+    send( sexp );
     delete sexp;
 }
 
@@ -271,17 +430,68 @@ void Server::setSubServer(const std::string& name, SubServer* subserv) {
     subservers[ name ] = subserv;
 }
 
+void Server::removeSubServer(const std::string& name, SubServer* subserv) {
+    SubserverMap::iterator i = subservers.find( name );
+    if( i != subservers.end() && i->second == subserv ) {
+        subservers.erase( i );
+    }
+    ShardMap::iterator j = shards.find( subserv );
+    if( j != shards.end() ) {
+        delete j->second;
+        shards.erase( j );
+    }
+}
+
+Executor* Server::getShard(SubServer *subserv) {
+    ShardMap::iterator i = shards.find( subserv );
+    if( i == shards.end() ) {
+        return 0;
+    }
+    return i->second;
+}
+
+bool Server::shardSubServer(const std::string& name) {
+    SubServer *subserv = getSubServer( name );
+    if( !subserv || getShard( subserv ) ) return false;
+    shards[ subserv ] = new Executor( subserv );
+    return true;
+}
+
+void Server::stopShards(void) {
+    for(ShardMap::iterator i = shards.begin(); i != shards.end(); i++) {
+        delete i->second;
+    }
+    shards.clear();
+    deliverOutbound();
+    reclaimClients();
+}
+
 SubServer::SubServer(const std::string& name, Server& server) :
+    name ( name ),
     server ( server )
 {
     server.setSubServer( name, this );
 }
 
+SubServer::~SubServer(void) {
+    server.removeSubServer( name, this );
+}
+
 Server::Server(void) :
     ConsSocketManager (),
     rclients (),
     subservers (),
+    shards (),
+    retiredClients (),
+    pendingOutbound (),
+    connectedUsers (),
+    connectionGeneration ( 1 ),
+    channelMembers (),
     running ( true ),
+    autosaveInterval ( 0 ),
+    sinceAutosave ( 0 ),
+    writer (),
+    auth ( *this ),
     users ( *this ),
     ssDebug ( *this ),
     ssAdmin ( *this ),
@@ -289,6 +499,7 @@ Server::Server(void) :
 {
     setGreeter( this );
 
+    users.setSnapshotWriter( &writer );
     restore();
 }
 
@@ -300,29 +511,39 @@ Sise::Socket* Server::greet(Sise::RawSocket sock, struct sockaddr_storage *addr,
 }
 
 std::string getHash(const std::string& data) {
+    // in hex as the stream used to write it, which padded only the first
+    // byte to two digits; stored password hashes depend on that
+    static const char digits[] = "0123456789abcdef";
     unsigned char rawhash[SHA256_DIGEST_LENGTH];
-    std::ostringstream oss;
-    SHA256_CTX ctx;
-    oss << std::setfill('0') <<  std::hex << std::right << std::setw(2);
-    SHA256_Init( &ctx );
-    SHA256_Update( &ctx, data.data(), data.length() );
-    SHA256_Final( rawhash, &ctx );
+    SHA256( (const unsigned char*) data.data(), data.length(), rawhash );
+    char hex[ 2 * SHA256_DIGEST_LENGTH ];
+    int length = 0;
     for(int i=0;i<SHA256_DIGEST_LENGTH;i++) {
-        oss << (int) rawhash[i];
+        if( i == 0 || rawhash[i] >= 16 ) {
+            hex[ length++ ] = digits[ rawhash[i] >> 4 ];
+        }
+        hex[ length++ ] = digits[ rawhash[i] & 15 ];
     }
-    return oss.str();
+    return std::string( hex, length );
 }
 
 std::string makeChallengeResponse( const std::string& username, const std::string& passwordhash, const std::string& challenge ) {
-    std::ostringstream oss;
-    oss << CHALLENGE_SALT << username << passwordhash << challenge;
-    return getHash( oss.str() );
+    std::string salted;
+    salted.reserve( sizeof CHALLENGE_SALT + username.size() + passwordhash.size() + challenge.size() );
+    salted += CHALLENGE_SALT;
+    salted += username;
+    salted += passwordhash;
+    salted += challenge;
+    return getHash( salted );
 }
 
 std::string makePasswordHash( const std::string& username, const std::string& password ) {
-    std::ostringstream oss;
-    oss << PASSWORD_SALT << username << password;
-    return getHash( oss.str() );
+    std::string salted;
+    salted.reserve( sizeof PASSWORD_SALT + username.size() + password.size() );
+    salted += PASSWORD_SALT;
+    salted += username;
+    salted += password;
+    return getHash( salted );
 }
 
 SProtoSocket::SProtoSocket( Sise::RawSocket dob ) :
@@ -335,6 +556,27 @@ void Server::stopServer(void) {
     running = false;
 }
 
+class SaveTask : public Task {
+    private:
+        const SubServer *subserv;
+        bool inBackground;
+
+    public:
+        SaveTask(const SubServer *subserv, bool inBackground) :
+            subserv ( subserv ),
+            inBackground ( inBackground )
+        {
+        }
+
+        void run(void) {
+            if( inBackground ) {
+                subserv->snapshotSubserver();
+            } else {
+                subserv->saveSubserver();
+            }
+        }
+};
+
 void Server::restore(void) {
     for(SubserverMap::iterator i = subservers.begin(); i != subservers.end(); i++) {
         i->second->restoreSubserver();
@@ -343,11 +585,29 @@ void Server::restore(void) {
 
 void Server::save(void) {
     for(SubserverMap::iterator i = subservers.begin(); i != subservers.end(); i++) {
-        i->second->saveSubserver();
+        Executor *shard = getShard( i->second );
+        if( shard ) {
+            shard->call( new SaveTask( i->second, false ) );
+        } else {
+            i->second->saveSubserver();
+        }
+    }
+}
+
+void Server::saveInBackground(void) {
+    for(SubserverMap::iterator i = subservers.begin(); i != subservers.end(); i++) {
+        Executor *shard = getShard( i->second );
+        if( shard ) {
+            shard->post( new SaveTask( i->second, true ) );
+        } else {
+            i->second->snapshotSubserver();
+        }
     }
 }
 
 Server::~Server(void) {
+    auth.stop();
+    stopShards();
     unwatchAll();
 
     save();
@@ -427,12 +687,44 @@ void Client::identify(const std::string& username_, const std::string& password_
     idState = IDST_IDENTIFYING;
 }
 
+struct RandomBytes {
+    // OpenSSL's generator costs much the same for a block as for a few
+    // bytes, so each thread draws a block at a time
+    unsigned char bytes[ 4096 ];
+    size_t used;
+
+    RandomBytes(void) : used ( sizeof bytes ) {}
+
+    unsigned char next(void) {
+        if( used == sizeof bytes ) {
+            if( RAND_bytes( bytes, sizeof bytes ) != 1 ) {
+                throw std::runtime_error( "unable to get random bytes" );
+            }
+            used = 0;
+        }
+        return bytes[ used++ ];
+    }
+};
+
+static boost::thread_specific_ptr<RandomBytes> threadRandomBytes;
+
 std::string Server::makeChallenge(void) {
-    std::ostringstream oss;
-    for(int i=0;i<64;i++) {
-        oss << (char) ('a' + rand()%26);
+    // from any thread. bytes past the last whole run of the alphabet are
+    // thrown away so that every letter is as likely
+    const size_t length = 64;
+    if( !threadRandomBytes.get() ) {
+        threadRandomBytes.reset( new RandomBytes() );
     }
-    return oss.str();
+    RandomBytes& random = *threadRandomBytes;
+    std::string rv;
+    rv.reserve( length );
+    while( rv.size() < length ) {
+        const unsigned char byte = random.next();
+        if( byte < 26 * (256 / 26) ) {
+            rv += (char) ('a' + byte % 26);
+        }
+    }
+    return rv;
 }
 
 std::string Server::usernameAvailable(const std::string& username) {
@@ -462,11 +754,42 @@ std::string UsersInfo::usernameAvailable(const std::string& username) {
 std::string UsersInfo::registerUsername( const std::string& username, const std::string& password ) {
     std::string reason = usernameAvailable( username );
     if( reason == "ok" ) {
-        users[ username ] = UserInfo( makePasswordHash( username, password ) );
+        using namespace Sise;
+        const std::string passwordhash = makePasswordHash( username, password );
+        users[ username ] = UserInfo( passwordhash );
+        journal( List()( new Symbol( "register" ) )
+                       ( new String( username ) )
+                       ( new String( passwordhash ) )
+                 .make() );
     }
     return reason;
 }
 
+void UsersInfo::changePassword( const std::string& username, const std::string& password ) {
+    using namespace Sise;
+    UserInfo& user = (*this)[ username ];
+    user.passwordhash = makePasswordHash( username, password );
+    journal( List()( new Symbol( "password" ) )
+                   ( new String( username ) )
+                   ( new String( user.passwordhash ) )
+             .make() );
+}
+
+void UsersInfo::applyJournalEntry(Sise::SExp *entry) {
+    using namespace Sise;
+    Cons *args = asProperCons( entry );
+    std::string type = *asSymbol( args->nthcar(0) );
+    std::string username = *asString( args->nthcar(1) );
+    std::string pwhash = *asString( args->nthcar(2) );
+    if( type == "register" ) {
+        users[ username ] = UserInfo( pwhash );
+    } else if( type == "password" ) {
+        users[ username ].passwordhash = pwhash;
+    } else {
+        throw std::runtime_error( "unknown users journal entry " + type );
+    }
+}
+
 std::string UsersInfo::solveChallenge( const std::string& username, const std::string& challenge ) {
     UsersMap::iterator i = users.find( username );
     if( i == users.end() ) {
@@ -482,7 +805,24 @@ UsersInfo::UserInfo::UserInfo( const std::string& passwordhash, bool admin ) :
 {
 }
 
+class UsersInfo::UsersSnapshot : public Snapshot {
+    private:
+        UsersMap users;
+    public:
+        explicit UsersSnapshot(const UsersMap& users) : users ( users ) {}
+
+        Sise::SExp* toSexp(void) { return UsersInfo::toSexp( users ); }
+};
+
+Snapshot* UsersInfo::snapshot(void) const {
+    return new UsersSnapshot( users );
+}
+
 Sise::SExp* UsersInfo::toSexp(void) const {
+    return toSexp( users );
+}
+
+Sise::SExp* UsersInfo::toSexp(const UsersMap& users) {
     using namespace Sise;
     List l;
     for(UsersMap::const_iterator i = users.begin(); i != users.end(); i++) {
@@ -509,14 +849,278 @@ void UsersInfo::fromSexp(Sise::SExp* sexp) {
     }
 }
 
+static long fileSize(const std::string& filename) {
+    struct stat st;
+    return stat( filename.c_str(), &st ) ? 0 : (long) st.st_size;
+}
+
+static bool appendFile(const std::string& from, const std::string& to) {
+    std::ifstream is ( from.c_str(), std::ios::in | std::ios::binary );
+    if( !is.good() ) return true;
+    std::ofstream os ( to.c_str(), std::ios::out | std::ios::binary | std::ios::app );
+    os << is.rdbuf();
+    os.flush();
+    return os.good();
+}
+
+struct SnapshotWriter::Worker {
+    struct Job {
+        const Persistable *persistable;
+        Snapshot *snapshot;
+    };
+    typedef std::pair<const Persistable*, long> Result; // size, or -1
+
+    boost::mutex mutex;
+    boost::condition_variable jobAvailable, jobsDone;
+    std::deque<Job> jobs;
+    std::deque<Result> results;
+    bool busy, stopping;
+    boost::thread thread;
+
+    Worker(void) :
+        busy ( false ),
+        stopping ( false ),
+        thread ( boost::ref( *this ) )
+    {
+    }
+
+    void operator()(void) {
+        // pending jobs are finished before stopping
+        boost::unique_lock<boost::mutex> lock ( mutex );
+        while( true ) {
+            while( !stopping && jobs.empty() ) {
+                jobAvailable.wait( lock );
+            }
+            if( jobs.empty() ) break;
+
+            Job job = jobs.front();
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+            long size = job.persistable->writeSnapshot( job.snapshot );
+            lock.lock();
+            results.push_back( Result( job.persistable, size ) );
+            busy = false;
+            jobsDone.notify_all();
+        }
+    }
+};
+
+SnapshotWriter::SnapshotWriter(void) :
+    worker ( new Worker() )
+{
+}
+
+SnapshotWriter::~SnapshotWriter(void) {
+    {
+        boost::lock_guard<boost::mutex> lock ( worker->mutex );
+        worker->stopping = true;
+        worker->jobAvailable.notify_all();
+    }
+    worker->thread.join();
+    collect();
+    delete worker;
+}
+
+void SnapshotWriter::submit(const Persistable *persistable, Snapshot *snapshot) {
+    Worker::Job job;
+    job.persistable = persistable;
+    job.snapshot = snapshot;
+    boost::lock_guard<boost::mutex> lock ( worker->mutex );
+    worker->jobs.push_back( job );
+    worker->jobAvailable.notify_all();
+}
+
+void SnapshotWriter::collect(void) {
+    std::deque<Worker::Result> results;
+    {
+        boost::lock_guard<boost::mutex> lock ( worker->mutex );
+        results.swap( worker->results );
+    }
+    for(std::deque<Worker::Result>::iterator i = results.begin(); i != results.end(); i++) {
+        i->first->snapshotWritten( i->second );
+    }
+}
+
+void SnapshotWriter::collect(const Persistable *persistable) {
+    std::deque<Worker::Result> results;
+    {
+        boost::lock_guard<boost::mutex> lock ( worker->mutex );
+        std::deque<Worker::Result> others;
+        for(std::deque<Worker::Result>::iterator i = worker->results.begin(); i != worker->results.end(); i++) {
+            (i->first == persistable ? results : others).push_back( *i );
+        }
+        others.swap( worker->results );
+    }
+    for(std::deque<Worker::Result>::iterator i = results.begin(); i != results.end(); i++) {
+        i->first->snapshotWritten( i->second );
+    }
+}
+
+void SnapshotWriter::flush(void) {
+    {
+        boost::unique_lock<boost::mutex> lock ( worker->mutex );
+        while( worker->busy || !worker->jobs.empty() ) {
+            worker->jobsDone.wait( lock );
+        }
+    }
+    collect();
+}
+
+void SnapshotWriter::flush(const Persistable *persistable) {
+    {
+        boost::unique_lock<boost::mutex> lock ( worker->mutex );
+        while( worker->busy || !worker->jobs.empty() ) {
+            worker->jobsDone.wait( lock );
+        }
+    }
+    collect( persistable );
+}
+
+void Persistable::closeJournal(void) const {
+    if( journalFd >= 0 ) {
+        if( journalUnsynced ) {
+            fdatasync( journalFd );
+            journalUnsynced = false;
+        }
+        close( journalFd );
+        journalFd = -1;
+    }
+}
+
+void Persistable::rotateJournal(void) const {
+    // an old journal left by a failed snapshot has to be kept, so the
+    // current one is added to it rather than replacing it
+    closeJournal();
+    if( fileSize( oldJournalFilename ) > 0 ) {
+        if( appendFile( journalFilename, oldJournalFilename ) ) {
+            remove( journalFilename.c_str() );
+        }
+    } else if( rename( journalFilename.c_str(), oldJournalFilename.c_str() ) && errno != ENOENT ) {
+        using namespace std;
+        cerr << "warning: unable to move aside " << journalFilename << endl;
+    }
+    journalSize = 0;
+}
+
 void Persistable::save(void) const {
     using namespace Sise;
+    if( writer ) {
+        writer->flush( this ); // nothing else may be writing our files
+    }
     SExp *sexp = toSexp();
-    if( !writeSExpToFile( filename, sexp ) ) {
+    bool ok = writeSExpToFileAtomic( filename, sexp );
+    delete sexp;
+    if( !ok ) {
         using namespace std;
         cerr << "warning: persistence failed" << endl;
+        return;
+    }
+    // the journals are only emptied once the snapshot covering them is safe
+    closeJournal();
+    if( truncate( journalFilename.c_str(), 0 ) && errno != ENOENT ) {
+        using namespace std;
+        cerr << "warning: unable to truncate " << journalFilename << endl;
+    }
+    remove( oldJournalFilename.c_str() );
+    journalSize = 0;
+    snapshotSize = fileSize( filename );
+}
+
+void Persistable::saveInBackground(void) const {
+    if( !writer ) {
+        save();
+        return;
     }
+    // one at a time; whatever a skipped snapshot would have covered
+    // stays in the journal until the next one
+    writer->collect( this );
+    if( snapshotPending ) return;
+    snapshotPending = true;
+    rotateJournal();
+    writer->submit( this, snapshot() );
+}
+
+long Persistable::writeSnapshot(Snapshot *snapshot) const {
+    using namespace Sise;
+    SExp *sexp = snapshot->toSexp();
+    delete snapshot;
+    bool ok = writeSExpToFileAtomic( filename, sexp );
     delete sexp;
+    if( !ok ) return -1;
+    remove( oldJournalFilename.c_str() );
+    return fileSize( filename );
+}
+
+void Persistable::snapshotWritten(long size) const {
+    snapshotPending = false;
+    if( size < 0 ) {
+        using namespace std;
+        cerr << "warning: persistence failed" << endl;
+    } else {
+        snapshotSize = size;
+    }
+}
+
+void Persistable::journal(Sise::SExp *entry) {
+    using namespace Sise;
+    std::ostringstream oss;
+    outputSExp( entry, oss, true );
+    delete entry;
+    oss << std::endl;
+    const std::string line = oss.str();
+
+    if( journalFd < 0 ) {
+        journalFd = open( journalFilename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644 );
+    }
+    bool ok = journalFd >= 0;
+    for(size_t written = 0; ok && written < line.size(); ) {
+        ssize_t rv = write( journalFd, line.data() + written, line.size() - written );
+        if( rv < 0 && errno == EINTR ) continue;
+        ok = rv > 0;
+        if( ok ) written += rv;
+    }
+    if( ok && syncJournal ) {
+        ok = fdatasync( journalFd ) == 0;
+    } else if( ok ) {
+        journalUnsynced = true;
+    }
+    if( !ok ) {
+        // fall back to a full snapshot, which also resets the journal
+        save();
+        return;
+    }
+
+    // rewriting the snapshot costs its size, so doing it when the journal
+    // has grown as large keeps the cost per change constant on average
+    journalSize += line.size();
+    if( journalSize > std::max( snapshotSize, (long) MIN_COMPACTION_SIZE ) ) {
+        saveInBackground();
+    }
+}
+
+void Persistable::syncJournalNow(void) const {
+    // a journal that cannot be synced is replaced by a snapshot, as when
+    // it cannot be written
+    if( !journalUnsynced ) return;
+    journalUnsynced = false;
+    if( journalFd >= 0 && fdatasync( journalFd ) ) {
+        save();
+    }
+}
+
+static void replayJournal(const std::string& filename, std::vector<Sise::SExp*>& entries) {
+    using namespace Sise;
+    try {
+        readSExpsFromFile( filename, entries );
+    }
+    catch( FileInputError& e ) {
+    }
+    catch( ParseError& e ) {
+        // a write torn by a crash; everything before it is good
+        using namespace std;
+        cerr << "warning: discarding damaged tail of " << filename << endl;
+    }
 }
 
 void Persistable::restore(void) {
@@ -528,12 +1132,47 @@ void Persistable::restore(void) {
     }
     catch( FileInputError& e ) {
     }
+    snapshotSize = fileSize( filename );
+
+    std::vector<SExp*> entries;
+    replayJournal( oldJournalFilename, entries );
+    replayJournal( journalFilename, entries );
+    for(std::vector<SExp*>::iterator i = entries.begin(); i != entries.end(); i++) {
+        try {
+            applyJournalEntry( *i );
+        }
+        catch( std::runtime_error& e ) {
+            using namespace std;
+            cerr << "warning: skipping bad entry in " << journalFilename << ": " << e.what() << endl;
+        }
+        delete *i;
+    }
+    if( fileSize( journalFilename ) > 0 || fileSize( oldJournalFilename ) > 0 ) {
+        save();
+    }
 }
 
 Persistable::Persistable(const std::string& filename) :
-    filename ( filename )
+    filename ( filename ),
+    journalFilename ( filename + ".journal" ),
+    oldJournalFilename ( journalFilename + ".old" ),
+    syncJournal ( true ),
+    writer ( 0 ),
+    journalFd ( -1 ),
+    journalSize ( 0 ),
+    snapshotSize ( 0 ),
+    snapshotPending ( false ),
+    journalUnsynced ( false )
 {
 }
+
+Persistable::~Persistable(void) {
+    if( writer ) {
+        writer->flush( this ); // a pending snapshot still refers to us
+    }
+    closeJournal();
+}
+
 UsersInfo::UserInfo& UsersInfo::operator[](const std::string& username) {
     UsersMap::iterator i = users.find( username );
     if( i == users.end() ) throw NoSuchUserException();
@@ -561,18 +1200,24 @@ DirectoryPersistable::DirectoryPersistable(const std::string& dirname) :
 {
 }
 
-void DirectoryPersistable::writeNamedSexp(const std::string& name, Sise::SExp* sexp) {
-    if( !Sise::writeSExpToFile( dirname + "/" + name, sexp ) ) {
+void DirectoryPersistable::writeNamedSexp(const std::string& name, Sise::SExp* sexp) const {
+    // rewritten in place, a crash could leave the file empty or cut off
+    if( !Sise::writeSExpToFileAtomic( dirname + "/" + name, sexp ) ) {
         using namespace std;
         cerr << "warning: writing to named sexp " << name << " in " << dirname << " failed" << endl;
     }
 }
 
+void DirectoryPersistable::removeNamedSexp(const std::string& name) const {
+    remove( (dirname + "/" + name).c_str() );
+}
+
 void DirectoryPersistable::clearFiles(void) {
     Sise::removeAllFilesWithExtension( dirname, extension );
 }
 
 void DirectoryPersistable::restore(void) {
+    mkdir( dirname.c_str(), 0755 );
     readSExpDir( dirname, extension, *this );
 }
 
@@ -591,19 +1236,18 @@ Sise::SExp *prepareChatMessage(const std::string& origin, const std::string& mes
            new Cons( new Int ( time(0) ))));
 }
 
+static void sendToAll(const Server::RClientList& recipients, Sise::SExp *sexp) {
+    // output once, however many recipients there are
+    std::ostringstream oss;
+    Sise::outputSExp( sexp, oss );
+    const std::string data = oss.str();
+    for(Server::RClientList::const_iterator i = recipients.begin(); i != recipients.end(); i++) {
+        (*i)->send( data );
+    }
+}
+
 bool ChatSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SExp* arg ) {
     using namespace Sise;
-    // note, obviously this is q&d and not very scalable
-    // channel broadcasting need not be linear in the number of
-    //  people on the _server_, and private messaging should be
-    //  near constant time (map lookup).
-    // however, this does not paint me into a corner; rewriting
-    //  if an efficient version is required should be relatively
-    //  simple
-
-    Server::RClientList::iterator i = server.getClients().begin();
-    Server::RClientList::iterator end = server.getClients().end();
-
     if( !cli->hasUsername() ) {
         cli->delsendResponse( cmd, "cannot use chat without being logged in" );
         return true;
@@ -621,26 +1265,12 @@ bool ChatSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SEx
                           new Cons( new String( channelName ),
                                     prepareChatMessage( cli->getUsername(),
                                                         *asString( asProperCons(arg)->nthcar(2)))))));
-            while( i != end ) {
-                if( (*i)->isInChannel( channelType, channelName ) ) {
-                    (*i)->send( sexp );
-                }
-                i++;
-            }
+            server.sendToChannel( ChannelId( channelType, channelName ), sexp );
             delete sexp;
         }
     } else if( cmd == "private-message" || cmd == "pm" ) {
         std::string targetName = *asString( asProperCons(arg)->nthcar(0) );
-        RemoteClient *target = 0;
-        int hits = 0;
-        while( i != end ) {
-            if( (*i)->hasUsername() && (*i)->getUsername() == targetName ) {
-                hits++;
-                target = *i;
-            }
-            i++;
-        }
-        assert( hits < 2 );
+        RemoteClient *target = server.getConnectedUser( targetName );
         if( target ) {
             SExp * sexp = new Cons( new Symbol( "chat" ),
                           new Cons( new Symbol( "private" ),
@@ -663,10 +1293,7 @@ bool ChatSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SEx
                           new Cons( new Symbol( "broadcast" ),
                                     prepareChatMessage( cli->getUsername(),
                                                         *asString( asProperCons(arg)->nthcar(0) ) ) ) );
-            while( i != end ) {
-                (*i)->send( sexp );
-                i++;
-            }
+            sendToAll( server.getClients(), sexp );
             delete sexp;
         }
     } else {
@@ -676,42 +1303,519 @@ bool ChatSubserver::handle( RemoteClient *cli, const std::string& cmd, Sise::SEx
 }
 
 void RemoteClient::enterChannel(const std::string& type, const std::string& name) {
-    channels.insert( ChannelId(type,name) );
+    boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
+    if( !detached && channels.insert( ChannelId(type,name) ).second ) {
+        server.joinChannel( ChannelId(type,name), this );
+    }
 }
 
 void RemoteClient::leaveChannel(const std::string& type, const std::string& name) {
-    channels.erase( ChannelId(type,name) );
+    boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
+    if( channels.erase( ChannelId(type,name) ) ) {
+        server.partChannel( ChannelId(type,name), this );
+    }
 }
 
 bool RemoteClient::isInChannel(const std::string& type, const std::string& name) {
+    boost::lock_guard<boost::mutex> lock ( server.clientsMutex );
     return channels.find( ChannelId(type,name) ) != channels.end();
 }
 
-class UsernameEqualTo {
+// the index and the channels are only touched with clientsMutex held
+
+void Server::indexConnection(const std::string& username, RemoteClient *rc) {
+    if( username == "" ) return;
+    connectedUsers[ username ].push_back( rc );
+    ++connectionGeneration;
+}
+
+void Server::unindexConnection(const std::string& username, RemoteClient *rc) {
+    if( username == "" ) return;
+    ConnectedUserMap::iterator i = connectedUsers.find( username );
+    if( i == connectedUsers.end() ) return;
+    RClientList& connections = i->second;
+    connections.erase( std::remove( connections.begin(), connections.end(), rc ), connections.end() );
+    if( connections.empty() ) {
+        connectedUsers.erase( i );
+    }
+    ++connectionGeneration;
+}
+
+void Server::joinChannel(const ChannelId& channel, RemoteClient *rc) {
+    channelMembers[ channel ].push_back( rc );
+}
+
+void Server::partChannel(const ChannelId& channel, RemoteClient *rc) {
+    ChannelMap::iterator i = channelMembers.find( channel );
+    if( i == channelMembers.end() ) return;
+    RClientList& members = i->second;
+    members.erase( std::remove( members.begin(), members.end(), rc ), members.end() );
+    if( members.empty() ) {
+        channelMembers.erase( i );
+    }
+}
+
+const Server::RClientList* Server::getChannelMembers(const ChannelId& channel) const {
+    boost::lock_guard<boost::mutex> lock ( clientsMutex );
+    ChannelMap::const_iterator i = channelMembers.find( channel );
+    if( i == channelMembers.end() ) {
+        return 0;
+    }
+    return &i->second;
+}
+
+void Server::sendToChannel(const ChannelId& channel, Sise::SExp *sexp) {
+    boost::lock_guard<boost::mutex> lock ( clientsMutex );
+    ChannelMap::const_iterator i = channelMembers.find( channel );
+    if( i != channelMembers.end() ) {
+        sendToAll( i->second, sexp );
+    }
+}
+
+RemoteClient* Server::getConnectedUser( const std::string& username ) {
+    boost::lock_guard<boost::mutex> lock ( clientsMutex );
+    ConnectedUserMap::iterator i = connectedUsers.find( username );
+    if( i == connectedUsers.end() ) {
+        return 0;
+    }
+    return i->second.front();
+}
+
+unsigned long Server::getConnectionGeneration(void) const {
+    boost::lock_guard<boost::mutex> lock ( clientsMutex );
+    return connectionGeneration;
+}
+
+void Server::outboundReady(RemoteClient *rc) {
+    {
+        boost::lock_guard<boost::mutex> lock ( pendingMutex );
+        pendingOutbound.push_back( rc );
+    }
+    wake();
+}
+
+void Server::deliverOutbound(void) {
+    RClientList ready;
+    {
+        boost::lock_guard<boost::mutex> lock ( pendingMutex );
+        ready.swap( pendingOutbound );
+    }
+    for(RClientList::iterator i = ready.begin(); i != ready.end(); i++) {
+        (*i)->deliverOutbound();
+    }
+}
+
+struct Server::RetiredClient {
+    RemoteClient *client;
+    boost::atomic<int> shardsPending;
+
+    RetiredClient(RemoteClient *client, int shards) :
+        client ( client ),
+        shardsPending ( shards )
+    {
+    }
+};
+
+class RetireTask : public Task {
     private:
-        const std::string& str;
+        Server& server;
+        boost::atomic<int>& shardsPending;
 
     public:
-        UsernameEqualTo(const std::string& str) : str(str) {}
+        RetireTask(Server& server, boost::atomic<int>& shardsPending) : server ( server ), shardsPending ( shardsPending ) {}
 
-        bool operator()(const RemoteClient* rc) const {
-            return rc->hasUsername() && rc->getUsername() == str;
+        void run(void) {
+            // the network thread may be asleep with nothing else to do
+            if( --shardsPending == 0 ) {
+                server.wake();
+            }
         }
 };
 
-RemoteClient* Server::getConnectedUser( const std::string& username ) {
-    UsernameEqualTo eq(username);
-    RClientList::iterator i = find_if( rclients.begin(), rclients.end(), eq);
-    if( i == rclients.end() ) {
-        return 0;
+void Server::dispose(Sise::Socket *socket) {
+    // anything an executor is doing with the client started before it was
+    // detached, so it is safe to delete once every executor has run a task
+    // posted after that, and the auth pool has handed back its logins
+    RemoteClient *rc = dynamic_cast<RemoteClient*>( socket );
+    if( !rc || (shards.empty() && !rc->isAuthenticating()) ) {
+        delete socket;
+        return;
+    }
+    rc->detach();
+    RetiredClient *retired = new RetiredClient( rc, shards.size() );
+    retiredClients.push_back( retired );
+    for(ShardMap::iterator i = shards.begin(); i != shards.end(); i++) {
+        i->second->post( new RetireTask( *this, retired->shardsPending ) );
     }
-    return *i;
+}
 
+void Server::reclaimClients(void) {
+    for(size_t i=0;i<retiredClients.size();) {
+        RetiredClient *retired = retiredClients[i];
+        if( (!shards.empty() && retired->shardsPending > 0) || retired->client->isAuthenticating() ) {
+            i++;
+            continue;
+        }
+        {
+            boost::lock_guard<boost::mutex> lock ( pendingMutex );
+            pendingOutbound.erase( std::remove( pendingOutbound.begin(), pendingOutbound.end(), retired->client ),
+                                   pendingOutbound.end() );
+        }
+        delete retired->client;
+        delete retired;
+        retiredClients[i] = retiredClients.back();
+        retiredClients.pop_back();
+    }
+}
+
+static void leaveExecutor(Executor*) {
+    // the executor is not the thread's to delete
+}
+
+static boost::thread_specific_ptr<Executor> currentExecutor ( leaveExecutor );
+
+struct Executor::Worker {
+    Executor *executor;
+    SubServer *subserv;
+
+    boost::lockfree::queue<Task*> tasks;
+    boost::atomic<bool> idle, stopping;
+    boost::mutex mutex;
+    boost::condition_variable wakeup;
+    boost::thread thread;
+
+    Worker(Executor *executor, SubServer *subserv) :
+        executor ( executor ),
+        subserv ( subserv ),
+        tasks ( 128 ),
+        idle ( false ),
+        stopping ( false ),
+        thread ( boost::ref( *this ) )
+    {
+    }
+
+    void wake(void) {
+        // the executor marks itself idle and checks the queue again with
+        // the lock held, so either it sees the task or we see it idle
+        boost::atomic_thread_fence( boost::memory_order_seq_cst );
+        if( idle ) {
+            boost::lock_guard<boost::mutex> lock ( mutex );
+            wakeup.notify_all();
+        }
+    }
+
+    void operator()(void) {
+        // what is posted before stopping is run before stopping. the
+        // subserver is ticked after every task and when its next deadline
+        // comes, and otherwise left to sleep
+        currentExecutor.reset( executor );
+        boost::system_time lastTick = boost::get_system_time();
+        while( true ) {
+            Task *task;
+            if( tasks.pop( task ) ) {
+                task->run();
+                delete task;
+            }
+            const boost::system_time now = boost::get_system_time();
+            subserv->tick( (now - lastTick).total_microseconds() / 1e6 );
+            lastTick = now;
+            if( !tasks.empty() ) continue;
+
+            const double wait = subserv->untilNextDeadline();
+            boost::unique_lock<boost::mutex> lock ( mutex );
+            idle = true;
+            boost::atomic_thread_fence( boost::memory_order_seq_cst );
+            if( tasks.empty() ) {
+                if( stopping ) break;
+                if( wait < 0 ) {
+                    wakeup.wait( lock );
+                } else if( wait > 0 ) {
+                    wakeup.timed_wait( lock, boost::posix_time::microseconds( (long) ceil( wait * 1e6 ) ) );
+                }
+            }
+            idle = false;
+        }
+        currentExecutor.release();
+    }
+};
+
+Executor::Executor(SubServer *subserv) :
+    worker ( new Worker( this, subserv ) )
+{
+}
+
+Executor::~Executor(void) {
+    worker->stopping = true;
+    worker->wake();
+    worker->thread.join();
+    delete worker;
+}
+
+void Executor::post(Task *task) {
+    worker->tasks.push( task );
+    worker->wake();
+}
+
+struct CallSync {
+    boost::mutex mutex;
+    boost::condition_variable done;
+    bool finished;
+};
+
+class CallTask : public Task {
+    private:
+        Task *task;
+        CallSync& sync;
+
+    public:
+        CallTask(Task *task, CallSync& sync) : task ( task ), sync ( sync ) {}
+
+        void run(void) {
+            task->run();
+            delete task;
+            boost::lock_guard<boost::mutex> lock ( sync.mutex );
+            sync.finished = true;
+            sync.done.notify_all();
+        }
+};
+
+void Executor::call(Task *task) {
+    if( current() == this ) {
+        task->run();
+        delete task;
+        return;
+    }
+    CallSync sync;
+    sync.finished = false;
+    post( new CallTask( task, sync ) );
+    boost::unique_lock<boost::mutex> lock ( sync.mutex );
+    while( !sync.finished ) {
+        sync.done.wait( lock );
+    }
+}
+
+Executor* Executor::current(void) {
+    return currentExecutor.get();
+}
+
+struct AuthPool::Worker {
+    struct Job {
+        RemoteClient *client;
+        bool checking; // a response to check, otherwise a challenge to make
+        std::string username, passwordhash, challenge, response;
+        bool accepted;
+    };
+
+    static const size_t maxBatch = 64;
+
+    Server& server;
+    boost::mutex mutex;
+    boost::condition_variable jobAvailable, jobsDone;
+    std::deque<Job> jobs, outcomes;
+    int busy, waiting;
+    bool stopping;
+    std::vector<boost::thread*> threads;
+
+    Worker(Server& server) :
+        server ( server ),
+        busy ( 0 ),
+        waiting ( 0 ),
+        stopping ( false )
+    {
+    }
+
+    void perform(Job& job) {
+        if( job.checking ) {
+            job.accepted = makeChallengeResponse( job.username, job.passwordhash, job.challenge ) == job.response;
+            return;
+        }
+        try {
+            job.challenge = server.makeChallenge();
+        }
+        catch( std::runtime_error& e ) {
+            job.challenge = "";
+        }
+    }
+
+    void operator()(void) {
+        // jobs are taken a share at a time and handed back together, so a
+        // crowd logging in costs the lock and the wakeups once a batch
+        // rather than once a login: only the first job into an empty queue
+        // wakes a thread, which wakes another if it leaves some behind.
+        // pending jobs are finished before stopping
+        std::vector<Job> batch;
+        boost::unique_lock<boost::mutex> lock ( mutex );
+        while( true ) {
+            while( !stopping && jobs.empty() ) {
+                ++waiting;
+                jobAvailable.wait( lock );
+                --waiting;
+            }
+            if( jobs.empty() ) break;
+
+            const size_t share = (jobs.size() + threads.size() - 1) / threads.size();
+            const size_t n = (share < maxBatch) ? share : maxBatch;
+            batch.assign( jobs.begin(), jobs.begin() + n );
+            jobs.erase( jobs.begin(), jobs.begin() + n );
+            if( !jobs.empty() && waiting > 0 ) {
+                jobAvailable.notify_one();
+            }
+            ++busy;
+            lock.unlock();
+            for(size_t i=0;i<batch.size();i++) {
+                perform( batch[i] );
+            }
+            lock.lock();
+            const bool first = outcomes.empty();
+            outcomes.insert( outcomes.end(), batch.begin(), batch.end() );
+            --busy;
+            jobsDone.notify_all();
+            if( first ) {
+                lock.unlock();
+                server.wake();
+                lock.lock();
+            }
+        }
+    }
+
+    void join(void) {
+        {
+            boost::lock_guard<boost::mutex> lock ( mutex );
+            stopping = true;
+            jobAvailable.notify_all();
+        }
+        for(size_t i=0;i<threads.size();i++) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        threads.clear();
+        stopping = false;
+    }
+
+    void submit(Job& job) {
+        job.client->beginAuth();
+        if( threads.empty() ) {
+            perform( job );
+            apply( job );
+            return;
+        }
+        boost::lock_guard<boost::mutex> lock ( mutex );
+        jobs.push_back( job );
+        if( jobs.size() == 1 && waiting > 0 ) {
+            jobAvailable.notify_one();
+        }
+    }
+
+    void apply(const Job& job) {
+        job.client->endAuth();
+        if( job.client->isDetached() ) return;
+        if( job.checking ) {
+            server.getUsers().responseChecked( job.client, job.username, job.accepted );
+        } else {
+            server.getUsers().challengeMade( job.client, job.username, job.challenge );
+        }
+    }
+};
+
+AuthPool::AuthPool(Server& server) :
+    worker ( new Worker( server ) ),
+    threads ( 0 )
+{
+}
+
+AuthPool::~AuthPool(void) {
+    worker->join();
+    delete worker;
+}
+
+void AuthPool::start(int threads_) {
+    stop();
+    threads = std::max( 0, threads_ );
+    for(int i=0;i<threads;i++) {
+        worker->threads.push_back( new boost::thread( boost::ref( *worker ) ) );
+    }
+}
+
+void AuthPool::stop(void) {
+    worker->join();
+    threads = 0;
+    collect();
+}
+
+void AuthPool::makeChallenge(RemoteClient *cli, const std::string& username) {
+    Worker::Job job;
+    job.client = cli;
+    job.checking = false;
+    job.username = username;
+    job.accepted = false;
+    worker->submit( job );
+}
+
+void AuthPool::checkResponse(RemoteClient *cli, const std::string& username, const std::string& passwordhash, const std::string& challenge, const std::string& response) {
+    Worker::Job job;
+    job.client = cli;
+    job.checking = true;
+    job.username = username;
+    job.passwordhash = passwordhash;
+    job.challenge = challenge;
+    job.response = response;
+    job.accepted = false;
+    worker->submit( job );
+}
+
+void AuthPool::collect(void) {
+    std::deque<Worker::Job> outcomes;
+    {
+        boost::lock_guard<boost::mutex> lock ( worker->mutex );
+        outcomes.swap( worker->outcomes );
+    }
+    for(std::deque<Worker::Job>::iterator i = outcomes.begin(); i != outcomes.end(); i++) {
+        worker->apply( *i );
+    }
+}
+
+void AuthPool::flush(void) {
+    {
+        boost::unique_lock<boost::mutex> lock ( worker->mutex );
+        while( !worker->jobs.empty() || worker->busy > 0 ) {
+            worker->jobsDone.wait( lock );
+        }
+    }
+    collect();
+}
+
+double Server::untilNextDeadline(void) {
+    double next = -1;
+    for(SubserverMap::iterator i = subservers.begin(); i != subservers.end(); i++) {
+        if( getShard( i->second ) ) continue;
+        const double t = i->second->untilNextDeadline();
+        if( t >= 0 && (next < 0 || t < next) ) {
+            next = t;
+        }
+    }
+    if( autosaveInterval > 0 ) {
+        const double t = std::max( 0.0, autosaveInterval - sinceAutosave );
+        if( next < 0 || t < next ) {
+            next = t;
+        }
+    }
+    return next;
 }
 
 void Server::tick(double dt) {
+    deliverOutbound();
+    auth.collect();
+    reclaimClients();
     for(SubserverMap::iterator i = subservers.begin(); i != subservers.end(); i++) {
-        i->second->tick( dt );
+        if( !getShard( i->second ) ) {
+            i->second->tick( dt );
+        }
+    }
+    writer.collect( &users );
+    sinceAutosave += dt;
+    if( autosaveInterval > 0 && sinceAutosave >= autosaveInterval ) {
+        sinceAutosave = 0;
+        saveInBackground();
     }
 }
 
@@ -6,6 +6,9 @@
 #include <stdexcept>
 #include <string>
 
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
 // Sise protocol? Slow-game protocol?
 
 #define SPROTO_STANDARD_PORT 8990
@@ -19,9 +22,10 @@ namespace SProto {
             SProtoSocket( Sise::RawSocket );
             virtual ~SProtoSocket(void) {}
 
-            void close(void);
+            virtual void close(void);
 
-            void send( Sise::SExp* );
+            virtual void send( Sise::SExp* );
+            virtual void send( const std::string& ); // as already output by outputSExp
             void delsend( Sise::SExp* );
             void delsendPacket( const std::string&, Sise::SExp* );
             void delsendResponse( const std::string&, const std::string& );
@@ -64,20 +68,85 @@ namespace SProto {
     class RemoteClient;
     class Server;
 
+    typedef std::pair<std::string,std::string> ChannelId; // type, name
+
     class SubServer {
+        private:
+            std::string name;
         protected:
             Server& server;
         public:
             SubServer(const std::string&, Server&);
-            virtual ~SubServer(void) {};
+            virtual ~SubServer(void);
 
             virtual void tick(double) {};
+            virtual double untilNextDeadline(void) { return -1; } // seconds until tick() has work, -1 for never
             virtual bool handle( RemoteClient*, const std::string&, Sise::SExp* ) = 0;
 
             virtual void saveSubserver(void) const {};
+            virtual void snapshotSubserver(void) const { saveSubserver(); } // may finish later
             virtual void restoreSubserver(void) {};
     };
 
+    class Task {
+        // work for an executor, deleted once it has run
+        public:
+            virtual ~Task(void) {}
+            virtual void run(void) = 0;
+    };
+
+    class Executor {
+        // runs the packets and ticks of one subserver on a thread of its
+        // own, one at a time and in the order they were posted; the
+        // subserver is ticked after each and at its deadlines. tasks are
+        // handed over through a lock-free queue; the lock is only taken
+        // to wake an executor that has gone idle
+        private:
+            struct Worker; // the thread and its queue
+            Worker *worker;
+
+            Executor(const Executor&);
+            const Executor& operator=(const Executor&);
+
+        public:
+            explicit Executor(SubServer*);
+            ~Executor(void); // runs what has been posted, then stops
+
+            void post(Task*); // takes ownership
+            void call(Task*); // takes ownership, returns once it has run
+
+            static Executor* current(void); // the one running this thread, or 0
+    };
+
+    class AuthPool {
+        // makes login challenges and checks the responses on threads of
+        // its own, so that a crowd of clients logging in at once doesn't
+        // hold up the network thread. the outcomes are handed back by
+        // collect(), on the network thread; without threads the work is
+        // done as it is submitted
+        private:
+            struct Worker; // the threads and their queues
+            Worker *worker;
+            int threads;
+
+            AuthPool(const AuthPool&);
+            const AuthPool& operator=(const AuthPool&);
+
+        public:
+            explicit AuthPool(Server&);
+            ~AuthPool(void); // drops what has not been collected
+
+            void start(int); // threads, replacing any running
+            void stop(void); // finishes what was submitted and collects it
+            int getThreads(void) const { return threads; }
+
+            void makeChallenge(RemoteClient*, const std::string&); // username
+            void checkResponse(RemoteClient*, const std::string&, const std::string&, const std::string&, const std::string&); // username, password hash, challenge, response
+
+            void collect(void);
+            void flush(void); // waits until everything submitted is done, then collects
+    };
+
     class RemoteClient : public SProtoSocket {
         public:
             enum State {
@@ -91,20 +160,42 @@ namespace SProto {
             const std::string netId;
             std::string username;
             std::vector<RemoteClient*>& rclients;
+            size_t clientIndex; // our position in rclients
+            bool detached;
 
             bool loggingIn;
             std::string desiredUsername, challenge;
+            int authPending; // jobs with the auth pool, on the network thread
 
-            typedef std::pair<std::string,std::string> ChannelId;
             std::set<ChannelId> channels;
 
+            // what executors send waits here for the network thread
+            boost::mutex outboundMutex;
+            std::string outbound;
+            bool outboundQueued, closeRequested;
+
+            void queueOutbound(const std::string&, bool);
+
         public:
             RemoteClient(Sise::RawSocket,Server&, const std::string&, std::vector<RemoteClient*>&);
             virtual ~RemoteClient(void);
 
+            void detach(void); // from the server's lists; the destructor does it too
+            bool isDetached(void) const { return detached; }
+
+            // a detached client waiting on the auth pool is kept until it's done
+            void beginAuth(void) { ++authPending; }
+            void endAuth(void) { --authPending; }
+            bool isAuthenticating(void) const { return authPending > 0; }
+
+            void close(void);
+            void send( Sise::SExp* );
+            void send( const std::string& );
+            void deliverOutbound(void); // on the network thread
+
             bool hasUsername(void) const;
             std::string getUsername(void) const;
-            void setUsername(const std::string& un) { username = un; }
+            void setUsername(const std::string&);
 
             bool getLoggingIn(std::string& du, std::string& ch) {
                 if( !loggingIn ) return false;
@@ -134,17 +225,99 @@ namespace SProto {
             bool isInChannel(const std::string&, const std::string&);
     };
 
+    class Snapshot {
+        // a copy of persistent state, taken quickly on the main thread
+        // and turned into an expression on the writer thread
+        public:
+            virtual ~Snapshot(void) {}
+            virtual Sise::SExp* toSexp(void) = 0; // called once, caller owns
+    };
+
+    class SExpSnapshot : public Snapshot {
+        private:
+            Sise::SExp *sexp;
+        public:
+            explicit SExpSnapshot(Sise::SExp* sexp) : sexp ( sexp ) {}
+            ~SExpSnapshot(void) { delete sexp; }
+
+            Sise::SExp* toSexp(void) { Sise::SExp *rv = sexp; sexp = 0; return rv; }
+    };
+
+    class Persistable;
+
+    class SnapshotWriter {
+        // writes snapshots to disk on a thread of its own, in order. the
+        // outcomes are handed back to the persistables by collect(), on
+        // the thread that runs them, so that they need no locking of their own
+        private:
+            struct Worker; // the thread and its queues
+            Worker *worker;
+
+            SnapshotWriter(const SnapshotWriter&);
+            const SnapshotWriter& operator=(const SnapshotWriter&);
+
+        public:
+            SnapshotWriter(void);
+            ~SnapshotWriter(void);
+
+            void submit(const Persistable*, Snapshot*); // takes ownership
+            void collect(void);
+            void collect(const Persistable*); // only its own, from its own thread
+            void flush(void); // waits until everything submitted is written
+            void flush(const Persistable*);
+    };
+
     class Persistable {
+        // state is a snapshot plus a journal of the changes made since,
+        // one expression per line; the journal is folded into a new
+        // snapshot once it outgrows it. journal entries are replayed
+        // over whichever snapshot survived a crash, so they must set
+        // state rather than adjust it.
+        // a background snapshot moves the journal aside to <journal>.old,
+        // which is removed once the snapshot covering it is on disk
         private:
+            friend class SnapshotWriter;
+
             std::string filename;
+            std::string journalFilename, oldJournalFilename;
+            bool syncJournal;
+            SnapshotWriter *writer;
+
+            mutable int journalFd;
+            mutable long journalSize, snapshotSize;
+            mutable bool snapshotPending;
+            mutable bool journalUnsynced; // written without syncing since the last sync
+
+            Persistable(const Persistable&);
+            const Persistable& operator=(const Persistable&);
+
+            void closeJournal(void) const;
+            void rotateJournal(void) const;
+
+            long writeSnapshot(Snapshot*) const; // on the writer thread
+            void snapshotWritten(long) const;
+
+        protected:
+            void journal(Sise::SExp*); // takes ownership
+            virtual void applyJournalEntry(Sise::SExp*) = 0;
+
         public:
             Persistable(const std::string&);
+            virtual ~Persistable(void);
             
             virtual Sise::SExp* toSexp(void) const = 0;
             virtual void fromSexp(Sise::SExp*) = 0;
+            virtual Snapshot* snapshot(void) const { return new SExpSnapshot( toSexp() ); }
 
             void save(void) const;
+            void saveInBackground(void) const; // synchronous without a writer
             void restore(void);
+
+            void setJournalSync(bool sync) { syncJournal = sync; } // every entry, or only by syncJournalNow()
+            void syncJournalNow(void) const; // all entries written so far
+            bool isJournalUnsynced(void) const { return journalUnsynced; }
+            void setSnapshotWriter(SnapshotWriter *writer_) { writer = writer_; }
+            long getJournalSize(void) const { return journalSize; }
     };
 
     class DirectoryPersistable : public Sise::NamedSexpHandler {
@@ -156,7 +329,8 @@ namespace SProto {
             std::string extension;
     
         protected:
-            void writeNamedSexp(const std::string&, Sise::SExp*);
+            void writeNamedSexp(const std::string&, Sise::SExp*) const;
+            void removeNamedSexp(const std::string&) const;
             void clearFiles(void);
 
         public:
@@ -164,7 +338,7 @@ namespace SProto {
             
             virtual void handleNamedSExp(const std::string&, Sise::SExp*) = 0;
             virtual void save(void) const = 0;
-            void restore(void);
+            void restore(void); // makes the directory if there is none
     };
 
     class UsersInfo : public Persistable,
@@ -182,6 +356,9 @@ namespace SProto {
             typedef std::map<std::string, UserInfo> UsersMap;
             UsersMap users;
 
+            class UsersSnapshot;
+            static Sise::SExp* toSexp(const UsersMap&);
+
         public:
             UserInfo& operator[](const std::string&);
             const UserInfo& operator[](const std::string&) const;
@@ -193,16 +370,25 @@ namespace SProto {
 
             Sise::SExp* toSexp(void) const;
             void fromSexp(Sise::SExp*);
+            Snapshot* snapshot(void) const;
 
             std::string usernameAvailable(const std::string&);
             std::string solveChallenge( const std::string&, const std::string& );
             std::string registerUsername( const std::string&, const std::string& );
+            void changePassword( const std::string&, const std::string& );
 
             bool isAdministrator(const std::string&) const;
 
             bool handle( RemoteClient*, const std::string&, Sise::SExp* );
 
+            // outcomes from the auth pool
+            void challengeMade(RemoteClient*, const std::string&, const std::string&); // empty on failure
+            void responseChecked(RemoteClient*, const std::string&, bool);
+
+            void applyJournalEntry(Sise::SExp*);
+
             void saveSubserver(void) const { save(); }
+            void snapshotSubserver(void) const { saveInBackground(); }
             void restoreSubserver(void) { restore(); }
     };
 
@@ -239,8 +425,43 @@ namespace SProto {
             typedef std::map<std::string,SubServer*> SubserverMap;
             SubserverMap subservers;
 
+            typedef std::map<SubServer*,Executor*> ShardMap;
+            ShardMap shards;
+
+            // clients that executors may still refer to, deleted once
+            // every executor has been past the point they were detached
+            struct RetiredClient;
+            std::vector<RetiredClient*> retiredClients;
+
+            boost::mutex pendingMutex;
+            RClientList pendingOutbound; // clients with output from executors
+
+            void deliverOutbound(void);
+            void reclaimClients(void);
+
+            friend class RemoteClient; // keeps the index up to date
+            // the index and the channels are shared with the executors;
+            // this also guards the usernames and channels of the clients
+            mutable boost::mutex clientsMutex;
+            typedef boost::unordered_map<std::string, RClientList> ConnectedUserMap;
+            ConnectedUserMap connectedUsers; // oldest connection first
+            unsigned long connectionGeneration; // changes with the index
+
+            void indexConnection(const std::string&, RemoteClient*);
+            void unindexConnection(const std::string&, RemoteClient*);
+
+            typedef boost::unordered_map<ChannelId, RClientList> ChannelMap;
+            ChannelMap channelMembers;
+
+            void joinChannel(const ChannelId&, RemoteClient*);
+            void partChannel(const ChannelId&, RemoteClient*);
+
             bool running;
 
+            double autosaveInterval, sinceAutosave;
+            SnapshotWriter writer; // before the subservers that use it
+
+            AuthPool auth; // before the users, whose logins it checks
             UsersInfo users;
 
             // not all the subservers are internally owned like this;
@@ -249,14 +470,31 @@ namespace SProto {
             AdminSubserver ssAdmin;
             ChatSubserver ssChat;
 
+            Executor* getShard(SubServer*);
+            void outboundReady(RemoteClient*);
+
+        protected:
+            void dispose(Sise::Socket*);
+
         public:
             Server(void);
             ~Server(void);
 
             void tick(double);
+            double untilNextDeadline(void); // for the subservers on this thread; -1 for none
 
             SubServer* getSubServer(const std::string&);
             void setSubServer(const std::string&, SubServer*);
+            void removeSubServer(const std::string&, SubServer*);
+
+            // moves the packets and ticks of a subserver to an executor of
+            // its own; stopShards() before any sharded subserver is destroyed
+            bool shardSubServer(const std::string&);
+            void stopShards(void);
+
+            SnapshotWriter& getSnapshotWriter(void) { return writer; }
+            AuthPool& getAuthPool(void) { return auth; }
+            void setAutosaveInterval(double seconds) { autosaveInterval = seconds; } // 0 to disable
 
             void stopServer(void);
             bool isRunning(void) const { return running; }
@@ -274,11 +512,15 @@ namespace SProto {
             void handle( RemoteClient*, const std::string&, Sise::SExp* );
 
             void save(void);
+            void saveInBackground(void);
             void restore(void);
 
             RClientList& getClients(void) { return rclients; }
 
             RemoteClient* getConnectedUser( const std::string& );
+            unsigned long getConnectionGeneration(void) const;
+            const RClientList* getChannelMembers(const ChannelId&) const; // 0 when empty
+            void sendToChannel(const ChannelId&, Sise::SExp*);
     };
 
     struct NoSuchUserException : public std::runtime_error {
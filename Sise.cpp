@@ -12,6 +12,7 @@
 #include <cstdio>
 
 #include <cctype>
+#include <algorithm>
 
 #define MAX_SEND_SIZE 4096
 #define INITIAL_BUFFER_CAPACITY 1024
@@ -25,6 +26,16 @@
 
 #include <cerrno>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <new>
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
@@ -109,6 +120,12 @@ void Cons::setcdr(SExp *cdr) {
     cdrPtr = cdr;
 }
 
+SExp* Cons::releasecdr(void) {
+    SExp *rv = cdrPtr;
+    cdrPtr = 0;
+    return rv;
+}
+
 Cons::Cons(SExp *car, SExp *cdr) :
     SExp( TYPE_CONS ),
     carPtr( 0 ),
@@ -137,8 +154,16 @@ Cons::~Cons(void) {
     if( carPtr ) {
         delete carPtr;
     }
-    if( cdrPtr ) {
-        delete cdrPtr;
+    // the spine is freed iteratively, so long lists can't exhaust the stack
+    SExp *next = cdrPtr;
+    while( next && next->isType( TYPE_CONS ) ) {
+        Cons *c = asCons( next );
+        next = c->cdrPtr;
+        c->cdrPtr = 0;
+        delete c;
+    }
+    if( next ) {
+        delete next;
     }
 }
 
@@ -227,6 +252,7 @@ bool SymbolParser::feed(char ch) {
 bool StringParser::feed(char ch) {
     if( quoted ) {
         oss << ch;
+        quoted = false;
     } else if( ch == '\\' ) {
         quoted = true;
     } else if( ch == '"' ) {
@@ -493,6 +519,245 @@ void SExpStreamParser::end(void) {
     }
 }
 
+struct SExpBuilder {
+    typedef SExp *Node;
+
+    static Node nil(void) { return 0; }
+    Node makeInt(int x) { return new Int( x ); }
+    Node makeBigRational(const std::string& text) { return new BigRational( mpq_class( text ) ); }
+    Node makeSymbol(const char *data, size_t length) { return new Symbol( std::string( data, length ) ); }
+    Node makeString(const char *data, size_t length) { return new String( std::string( data, length ) ); }
+    Node makeCons(Node car, Node cdr) { return new Cons( car, cdr ); }
+    void discard(Node node) { delete node; }
+};
+
+struct ValueBuilder {
+    typedef Value Node;
+
+    ValueHeap& heap;
+    int recentSymbols[64]; // ids, by a hash of the name; saves interning the same few again and again
+
+    explicit ValueBuilder(ValueHeap& heap) : heap ( heap ) {
+        for(int i=0;i<64;i++) recentSymbols[i] = -1;
+    }
+
+    static Node nil(void) { return Value(); }
+    Node makeInt(int x) { return heap.makeInt( x ); }
+    Node makeBigRational(const std::string& text) { return heap.makeBigRational( mpq_class( text ) ); }
+
+    Node makeSymbol(const char *data, size_t length) {
+        int& recent = recentSymbols[ (length * 7 + data[0] + data[length-1] * 3) & 63 ];
+        if( recent >= 0 ) {
+            const std::string& name = symbolName( recent );
+            if( name.size() == length && !memcmp( name.data(), data, length ) ) {
+                return Value::symbol( recent );
+            }
+        }
+        recent = internSymbol( data, length );
+        return Value::symbol( recent );
+    }
+
+    Node makeString(const char *data, size_t length) { return heap.makeString( data, length ); }
+    Node makeCons(Node car, Node cdr) { return heap.makeCons( car, cdr ); }
+    void discard(Node) {} // the heap has it
+};
+
+template<class Builder>
+class BulkParser {
+    // the whole input is at hand, so each atom is taken in one go rather
+    // than a character at a time through a chain of subparsers. accepts
+    // what SExpStreamParser accepts and builds the same expressions,
+    // through the builder
+    private:
+        typedef typename Builder::Node Node;
+
+        Builder& build;
+        const char *p, *end;
+        std::vector<Node> stack; // the items of every open list
+
+        struct Truncated {};
+
+        Node parseNumber(void);
+        Node parseSymbol(void);
+        Node parseString(void);
+        Node parseList(void);
+        Node parse(void);
+
+    public:
+        BulkParser(Builder& build, const char *data, size_t size) : build ( build ), p ( data ), end ( data + size ) {}
+
+        bool skipSpace(void) {
+            while( p < end && isspace( *p ) ) ++p;
+            return p < end;
+        }
+
+        void parseAll(std::vector<Node>&);
+};
+
+template<class Builder>
+typename Builder::Node BulkParser<Builder>::parseNumber(void) {
+    const char *start = p;
+    bool rational = false;
+    if( *p == '-' ) ++p;
+    const char *digits = p;
+    while( p < end ) {
+        if( isdigit( *p ) ) {
+            ++p;
+        } else if( *p == '/' && !rational ) {
+            rational = true;
+            ++p;
+        } else {
+            break;
+        }
+    }
+    if( !rational && p - start < 9 ) {
+        int x = 0;
+        for(const char *d = digits; d < p; d++) {
+            x = x * 10 + (*d - '0');
+        }
+        return build.makeInt( (digits > start) ? -x : x );
+    }
+    const std::string text ( start, p );
+    if( rational ) {
+        return build.makeBigRational( text );
+    }
+    mpz_class number ( text );
+    if( !number.fits_sint_p() ) {
+        return build.makeBigRational( text );
+    }
+    return build.makeInt( number.get_si() );
+}
+
+template<class Builder>
+typename Builder::Node BulkParser<Builder>::parseSymbol(void) {
+    const char *start = p;
+    while( p < end && !isspace( *p ) && *p != ')' ) {
+        if( !isprint( *p ) ) {
+            throw ParseError( "unexpected char in symbol" );
+        }
+        ++p;
+    }
+    return build.makeSymbol( start, p - start );
+}
+
+template<class Builder>
+typename Builder::Node BulkParser<Builder>::parseString(void) {
+    const char *start = p;
+    while( p < end && *p != '"' && *p != '\\' ) ++p;
+    if( p == end ) throw Truncated();
+    if( *p == '"' ) {
+        // nothing escaped, so it's taken straight from the input
+        return build.makeString( start, p++ - start );
+    }
+    std::string data ( start, p );
+    while( true ) {
+        const char *run = p;
+        while( p < end && *p != '"' && *p != '\\' ) ++p;
+        data.append( run, p );
+        if( p == end ) throw Truncated();
+        if( *p++ == '"' ) break;
+        if( p == end ) throw Truncated();
+        data += *p++;
+    }
+    return build.makeString( data.data(), data.size() );
+}
+
+template<class Builder>
+typename Builder::Node BulkParser<Builder>::parseList(void) {
+    enum { LIST_ITEMS, CDR_ITEM, WAITING_FOR_TERMINATION } phase = LIST_ITEMS;
+    const size_t base = stack.size();
+    Node terminatingCdr = Builder::nil();
+    try {
+        while( true ) {
+            if( !skipSpace() ) throw Truncated();
+            if( *p == ')' ) {
+                if( phase == CDR_ITEM ) {
+                    throw ParseError( "parse error -- unexpected end of cons" );
+                }
+                ++p;
+                break;
+            }
+            if( *p == '.' ) {
+                if( phase != LIST_ITEMS ) {
+                    throw ParseError( "parse error -- unexpected dot in cons" );
+                }
+                phase = CDR_ITEM;
+                ++p;
+                continue;
+            }
+            if( phase == WAITING_FOR_TERMINATION ) {
+                throw ParseError( "parse or internal error -- unexpected atom" );
+            }
+            Node node = parse();
+            if( phase == LIST_ITEMS ) {
+                stack.push_back( node );
+            } else {
+                terminatingCdr = node;
+                phase = WAITING_FOR_TERMINATION;
+            }
+        }
+    }
+    catch( ... ) {
+        for(size_t i=base;i<stack.size();i++) {
+            build.discard( stack[i] );
+        }
+        stack.resize( base );
+        build.discard( terminatingCdr );
+        throw;
+    }
+    if( stack.size() == base ) {
+        build.discard( terminatingCdr );
+        return Builder::nil();
+    }
+    Node rv = terminatingCdr;
+    for(size_t i=stack.size();i>base;i--) {
+        rv = build.makeCons( stack[i-1], rv );
+    }
+    stack.resize( base );
+    return rv;
+}
+
+template<class Builder>
+typename Builder::Node BulkParser<Builder>::parse(void) {
+    const char ch = *p;
+    if( isdigit( ch ) || ch == '-' ) {
+        return parseNumber();
+    } else if( ch == '"' ) {
+        ++p;
+        return parseString();
+    } else if( ch == '(' ) {
+        ++p;
+        return parseList();
+    } else if( isprint( ch ) ) {
+        return parseSymbol();
+    }
+    throw ParseError( "unexpected char" );
+}
+
+template<class Builder>
+void BulkParser<Builder>::parseAll(std::vector<Node>& rv) {
+    try {
+        while( skipSpace() ) {
+            if( *p == ')' ) {
+                throw ParseError( "parse error -- unexpected end of cons" );
+            }
+            rv.push_back( parse() );
+        }
+    }
+    catch( Truncated& ) {
+    }
+}
+
+void parseSExps(const char *data, size_t size, std::vector<SExp*>& rv) {
+    SExpBuilder build;
+    BulkParser<SExpBuilder>( build, data, size ).parseAll( rv );
+}
+
+void parseValues(const char *data, size_t size, ValueHeap& heap, std::vector<Value>& rv) {
+    ValueBuilder build ( heap );
+    BulkParser<ValueBuilder>( build, data, size ).parseAll( rv );
+}
+
 SExp* Cons::nthcar(int n) {
     Cons *c = asCons( nthtail(n) );
     if( !c ) {
@@ -658,15 +923,22 @@ void SocketManager::unwatch( Socket *s, bool noErase ) {
 
 void SocketManager::pump(int ms, SocketSet* ready) {
     fd_set readfds = fullWatched,
-           exceptfds = fullWatched;
+           exceptfds = fullWatched,
+           writefds;
     struct timeval tv = { ms / 1000, (ms%1000) * 1000 };
     using namespace std;
+    // what does not go out now is waited for along with the input, so
+    // that waiting with no timeout never strands it
+    FD_ZERO( &writefds );
     for(WatchedMap::iterator i = watched.begin(); i != watched.end();i++) {
         i->second->transmit();
+        if( i->second->wouldTransmit() && !i->second->hasFatalError() ) {
+            FD_SET( i->first, &writefds );
+        }
     }
     int rv = select( MAX( maxWatched, maxListener ) + 1,
                      &readfds,
-                     0,
+                     &writefds,
                      &exceptfds,
                      (ms < 0) ? 0 : &tv );
     if( rv < 0 ) {
@@ -698,7 +970,7 @@ void SocketManager::pump(int ms, SocketSet* ready) {
             Socket *deletable = j->second;
             watched.erase( j );
             unwatch( deletable, true );
-            delete deletable;
+            dispose( deletable );
         } else {
             i++;
         }
@@ -724,11 +996,28 @@ void SocketManager::pump(int ms, SocketSet* ready) {
     if( doCheckStdin ) {
         stdinFlag = FD_ISSET( fileno(stdin), &readfds );
     }
+    if( wakePipe[0] >= 0 && FD_ISSET( wakePipe[0], &readfds ) ) {
+        char buffer[ 64 ];
+        while( read( wakePipe[0], buffer, sizeof buffer ) > 0 );
+    }
+}
+
+void SocketManager::wake(void) {
+    // the pipe is non-blocking; if it's full, pump() will wake anyway
+    if( wakePipe[1] >= 0 ) {
+        char c = 0;
+        ssize_t rv = write( wakePipe[1], &c, 1 );
+        (void) rv;
+    }
+}
+
+void SocketManager::dispose( Socket* socket ) {
+    delete socket;
 }
 
 void SocketManager::unwatchAll(void) {
     for(WatchedMap::iterator i = watched.begin(); i != watched.end();i++) {
-        delete i->second;
+        dispose( i->second );
     }
     watched.clear();
 }
@@ -738,6 +1027,11 @@ SocketManager::~SocketManager(void) {
     for(std::vector<RawSocket>::iterator i = listeners.begin(); i != listeners.end();i++) {
         closesocket( *i );
     }
+    for(int i=0;i<2;i++) {
+        if( wakePipe[i] >= 0 ) {
+            close( wakePipe[i] );
+        }
+    }
 }
 
 void SocketManager::adopt( Socket* socket ) {
@@ -807,6 +1101,15 @@ SocketManager::SocketManager(void) :
     stdinFlag ( false )
 {
     FD_ZERO( &fullWatched );
+    if( pipe( wakePipe ) ) {
+        wakePipe[0] = wakePipe[1] = -1;
+    } else {
+        for(int i=0;i<2;i++) {
+            fcntl( wakePipe[i], F_SETFL, fcntl( wakePipe[i], F_GETFL ) | O_NONBLOCK );
+        }
+        FD_SET( wakePipe[0], &fullWatched );
+        maxListener = wakePipe[0];
+    }
 }
 
 void SocketManager::checkStdin(void) {
@@ -864,7 +1167,7 @@ void ConsSocketManager::manage(int ms) {
     for(std::vector<ConsSocket*>::iterator i = errorsocks.begin(); i != errorsocks.end(); i++) {
         using namespace std;
         unwatch( *i, false );
-        delete *i;
+        dispose( *i );
     }
 }
 
@@ -908,50 +1211,291 @@ int getPort( struct sockaddr_storage *st, socklen_t sz ) {
 }
 
 SExp * readSExpFromFile(const std::string& filename) {
-    using namespace std;
-    SExpStreamParser streamParser;
-    ifstream is ( filename.c_str(), ios::in );
-    char byte;
-    if( !is.good() ) {
+    std::vector<SExp*> sexps;
+    try {
+        readSExpsFromFile( filename, sexps );
+    }
+    catch( ... ) {
+        for(size_t i=0;i<sexps.size();i++) {
+            delete sexps[i];
+        }
+        throw;
+    }
+    if( sexps.empty() ) throw FileInputError();
+    for(size_t i=1;i<sexps.size();i++) {
+        delete sexps[i];
+    }
+    return sexps[0];
+}
+
+template<class Parse>
+static void parseFile(const std::string& filename, Parse& parse) {
+    // regular files are mapped and parsed in one go; anything else (a
+    // pipe, say) is read through first
+    int fd = open( filename.c_str(), O_RDONLY );
+    if( fd < 0 ) {
         throw FileInputError();
     }
-    while( !is.eof() ) {
-        is.read( &byte, 1 );
-        streamParser.feed( byte );
+    struct stat st;
+    if( fstat( fd, &st ) || S_ISDIR( st.st_mode ) ) {
+        close( fd );
+        throw FileInputError();
     }
-    streamParser.end();
-    if( streamParser.empty() ) throw FileInputError();
-    return streamParser.pop();
+    if( !S_ISREG( st.st_mode ) ) {
+        std::string data;
+        char buffer[ 4096 ];
+        ssize_t got;
+        while( (got = read( fd, buffer, sizeof buffer )) > 0 ) {
+            data.append( buffer, got );
+        }
+        close( fd );
+        if( got < 0 ) {
+            throw FileInputError();
+        }
+        parse( data.data(), data.size() );
+        return;
+    }
+    const size_t size = st.st_size;
+    if( !size ) {
+        close( fd );
+        return;
+    }
+    void *data = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( data == MAP_FAILED ) {
+        throw FileInputError();
+    }
+    madvise( data, size, MADV_SEQUENTIAL );
+    try {
+        parse( static_cast<const char*>( data ), size );
+    }
+    catch( ... ) {
+        munmap( data, size );
+        throw;
+    }
+    munmap( data, size );
+}
+
+struct SExpFileParse {
+    std::vector<SExp*>& rv;
+
+    explicit SExpFileParse(std::vector<SExp*>& rv) : rv ( rv ) {}
+    void operator()(const char *data, size_t size) { parseSExps( data, size, rv ); }
+};
+
+struct ValueFileParse {
+    ValueHeap& heap;
+    std::vector<Value>& rv;
+
+    ValueFileParse(ValueHeap& heap, std::vector<Value>& rv) : heap ( heap ), rv ( rv ) {}
+    void operator()(const char *data, size_t size) { parseValues( data, size, heap, rv ); }
+};
+
+void readSExpsFromFile(const std::string& filename, std::vector<SExp*>& rv) {
+    SExpFileParse parse ( rv );
+    parseFile( filename, parse );
+}
+
+void readValuesFromFile(const std::string& filename, ValueHeap& heap, std::vector<Value>& rv) {
+    ValueFileParse parse ( heap, rv );
+    parseFile( filename, parse );
 }
 
 bool writeSExpToFile(const std::string& filename, SExp *sexp) {
     using namespace std;
     ofstream os ( filename.c_str(), ios::out );
     outputSExp( sexp, os, true );
+    os.flush();
     return os.good();
 }
 
-void readSExpDir( const std::string& dirname, const std::string& ext, NamedSexpHandler& nsh ) {
+static bool syncPath(const std::string& path, int flags) {
+    int fd = open( path.c_str(), flags );
+    if( fd < 0 ) return false;
+    bool rv = fsync( fd ) == 0;
+    close( fd );
+    return rv;
+}
+
+bool writeSExpToFileAtomic(const std::string& filename, SExp *sexp) {
+    // written to a temporary file that is synced and then renamed over
+    // the target, so after a crash the file is either old or new in full
+    namespace fs = boost::filesystem;
+    const std::string tmpname = filename + ".tmp";
+    if( !writeSExpToFile( tmpname, sexp ) || !syncPath( tmpname, O_RDONLY ) ) {
+        remove( tmpname.c_str() );
+        return false;
+    }
+    if( rename( tmpname.c_str(), filename.c_str() ) ) {
+        remove( tmpname.c_str() );
+        return false;
+    }
+    std::string dirname = fs::path( filename ).parent_path().string();
+    syncPath( dirname.empty() ? "." : dirname, O_RDONLY | O_DIRECTORY );
+    return true;
+}
+
+struct DirectoryLoad {
+    // files are claimed in order by the parsing threads, which stay no
+    // more than a short window ahead of the files already handed over:
+    // a large directory is never held in memory all at once, and each
+    // expression is handed over (and freed) while it is still in cache
+    enum State {
+        PENDING,
+        PARSED,
+        INPUT_ERROR,
+        PARSE_ERROR
+    };
+
+    std::vector<std::string> filenames;
+    std::vector<SExp*> results;
+    std::vector<State> states;
+    std::vector<std::string> errors;
+
+    size_t next, handed, window;
+    bool stopping;
+
+    boost::mutex mutex;
+    boost::condition_variable parsed, consumed;
+
+    DirectoryLoad(const std::vector<std::string>& filenames, size_t window) :
+        filenames ( filenames ),
+        results ( filenames.size(), (SExp*) 0 ),
+        states ( filenames.size(), PENDING ),
+        errors ( filenames.size() ),
+        next ( 0 ),
+        handed ( 0 ),
+        window ( window ),
+        stopping ( false )
+    {
+    }
+
+    ~DirectoryLoad(void) {
+        for(size_t i=handed;i<results.size();i++) {
+            delete results[i];
+        }
+    }
+
+    void parse(size_t i) {
+        SExp *sexp = 0;
+        State state = PARSED;
+        std::string error;
+        try {
+            sexp = readSExpFromFile( filenames[i] );
+        }
+        catch( FileInputError& e ) {
+            state = INPUT_ERROR;
+        }
+        catch( std::exception& e ) {
+            state = PARSE_ERROR;
+            error = e.what();
+        }
+        boost::lock_guard<boost::mutex> lock ( mutex );
+        results[i] = sexp;
+        states[i] = state;
+        errors[i] = error;
+        parsed.notify_all();
+    }
+
+    void work(void) {
+        while( true ) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock ( mutex );
+                while( !stopping && next < filenames.size() && next >= handed + window ) {
+                    consumed.wait( lock );
+                }
+                if( stopping || next >= filenames.size() ) return;
+                i = next++;
+            }
+            parse( i );
+        }
+    }
+
+    State take(size_t i, SExp*& sexp, std::string& error) {
+        boost::unique_lock<boost::mutex> lock ( mutex );
+        while( states[i] == PENDING ) {
+            parsed.wait( lock );
+        }
+        sexp = results[i];
+        error = errors[i];
+        handed = i + 1;
+        consumed.notify_all();
+        return states[i];
+    }
+
+    void stop(void) {
+        boost::lock_guard<boost::mutex> lock ( mutex );
+        stopping = true;
+        consumed.notify_all();
+    }
+};
+
+void readSExpDir( const std::string& dirname, const std::string& ext, NamedSexpHandler& nsh, int threads ) {
     namespace fs = boost::filesystem;
     fs::path path = fs::system_complete( dirname );
     if( !fs::exists( path ) || !fs::is_directory( path ) ) {
         throw std::runtime_error( "readSExpDir called on nonexistent file or non-directory" );
     }
+    std::vector<std::string> filenames;
     fs::directory_iterator end_iter;
     for( fs::directory_iterator i ( path ); i != end_iter; i++) {
-        using namespace std;
         if( fs::is_regular_file( i->status() ) && i->path().extension() == ext ) {
-            try {
-                SExp *rv = readSExpFromFile( i->path().string() );
-                nsh.handleNamedSExp( i->path().filename(), rv );
-                delete rv;
+            filenames.push_back( i->path().string() );
+        }
+    }
+    std::sort( filenames.begin(), filenames.end() );
+
+    if( threads <= 0 ) {
+        threads = std::max( 1, (int) boost::thread::hardware_concurrency() );
+    }
+    threads = std::min( threads, (int) filenames.size() );
+
+    DirectoryLoad load ( filenames, 2 * threads );
+    std::vector<boost::thread*> workers;
+    try {
+        if( threads > 1 ) {
+            for(int i=0;i<threads;i++) {
+                workers.push_back( new boost::thread( &DirectoryLoad::work, &load ) );
             }
-            catch( FileInputError& e ) {
-                using namespace std;
-                cerr << "warning: input error on " << i->path() << endl;
+        }
+        for(size_t i=0;i<filenames.size();i++) {
+            if( workers.empty() ) {
+                load.parse( i );
+            }
+            SExp *sexp;
+            std::string error;
+            switch( load.take( i, sexp, error ) ) {
+                case DirectoryLoad::PARSED:
+                    try {
+                        nsh.handleNamedSExp( fs::path( filenames[i] ).filename().string(), sexp );
+                    }
+                    catch( ... ) {
+                        delete sexp;
+                        throw;
+                    }
+                    delete sexp;
+                    break;
+                case DirectoryLoad::INPUT_ERROR:
+                    std::cerr << "warning: input error on " << filenames[i] << std::endl;
+                    break;
+                default:
+                    throw ParseError( error );
             }
         }
     }
+    catch( ... ) {
+        load.stop();
+        for(size_t i=0;i<workers.size();i++) {
+            workers[i]->join();
+            delete workers[i];
+        }
+        throw;
+    }
+    for(size_t i=0;i<workers.size();i++) {
+        workers[i]->join();
+        delete workers[i];
+    }
 }
 
 void removeAllFilesWithExtension( const std::string& dirname, const std::string& ext ) {
@@ -992,5 +1536,304 @@ SExp *Cons::alistGet(const std::string& key) {
     return 0;
 }
 
+// symbol names are kept in pages that never move, so reading one takes
+// no lock: whoever holds an id got it after its name was stored
+#define SYMBOL_PAGE_BITS 10
+#define SYMBOL_PAGE_SIZE (1 << SYMBOL_PAGE_BITS)
+#define SYMBOL_PAGES 4096
+
+static boost::mutex symbolLock;
+static boost::unordered_map<std::string,int> symbolIds;
+static std::string *symbolPages[ SYMBOL_PAGES ];
+static int numberOfSymbols = 0;
+
+int internSymbol(const char *name, size_t length) {
+    const std::string key ( name, length );
+    boost::mutex::scoped_lock lock ( symbolLock );
+    boost::unordered_map<std::string,int>::iterator i = symbolIds.find( key );
+    if( i != symbolIds.end() ) {
+        return i->second;
+    }
+    const int id = numberOfSymbols;
+    if( (id >> SYMBOL_PAGE_BITS) >= SYMBOL_PAGES ) {
+        throw std::runtime_error( "too many symbols" );
+    }
+    if( !(id & (SYMBOL_PAGE_SIZE - 1)) ) {
+        symbolPages[ id >> SYMBOL_PAGE_BITS ] = new std::string [ SYMBOL_PAGE_SIZE ];
+    }
+    symbolPages[ id >> SYMBOL_PAGE_BITS ][ id & (SYMBOL_PAGE_SIZE - 1) ] = key;
+    symbolIds[ key ] = id;
+    ++numberOfSymbols;
+    return id;
+}
+
+int internSymbol(const std::string& name) {
+    return internSymbol( name.data(), name.size() );
+}
+
+const std::string& symbolName(int id) {
+    return symbolPages[ id >> SYMBOL_PAGE_BITS ][ id & (SYMBOL_PAGE_SIZE - 1) ];
+}
+
+Type Value::getType(void) const {
+    static const Type types[] = {
+        TYPE_CONS, TYPE_INT, TYPE_SYMBOL, TYPE_STRING, TYPE_INT, TYPE_BIG_RATIONAL
+    };
+    return types[ getTag() ];
+}
+
+void Value::typeError(Type t) const {
+    throw SExpTypeError( t, getType() );
+}
+
+const std::string& Value::asSymbol(void) const {
+    return symbolName( asSymbolId() );
+}
+
+const char *Value::getStringData(void) const {
+    if( getTag() != TAG_STRING ) typeError( TYPE_STRING );
+    return pointer<ValueString>()->data;
+}
+
+size_t Value::getStringLength(void) const {
+    if( getTag() != TAG_STRING ) typeError( TYPE_STRING );
+    return pointer<ValueString>()->length;
+}
+
+std::string Value::asString(void) const {
+    return std::string( getStringData(), getStringLength() );
+}
+
+const mpq_class& Value::asBigRational(void) const {
+    if( getTag() != TAG_BIG_RATIONAL ) typeError( TYPE_BIG_RATIONAL );
+    return *pointer<mpq_class>();
+}
+
+mpq_class Value::asMPQ(void) const {
+    if( getType() == TYPE_INT ) {
+        return mpq_class( asInt() );
+    }
+    if( getTag() != TAG_BIG_RATIONAL ) typeError( TYPE_BIG_RATIONAL );
+    return *pointer<mpq_class>();
+}
+
+Value Value::nthtail(int n) const {
+    assert( n >= 0 );
+    Value rv = *this;
+    while( n-- > 0 ) {
+        rv = rv.cdr();
+    }
+    return rv;
+}
+
+Value Value::nthcar(int n) const {
+    return nthtail( n ).car();
+}
+
+#define VALUE_CHUNK_SIZE (1 << 16)
+
+ValueHeap::ValueHeap(void) :
+    top ( 0 ),
+    limit ( 0 ),
+    bytes ( 0 )
+{
+}
+
+ValueHeap::~ValueHeap(void) {
+    clear();
+    for(size_t i=0;i<chunks.size();i++) {
+        delete [] chunks[i];
+    }
+}
+
+void ValueHeap::clear(void) {
+    // the first chunk is kept for what comes next
+    for(size_t i=0;i<rationals.size();i++) {
+        rationals[i]->~mpq_class();
+    }
+    rationals.clear();
+    for(size_t i=0;i<large.size();i++) {
+        delete [] large[i];
+    }
+    large.clear();
+    for(size_t i=1;i<chunks.size();i++) {
+        delete [] chunks[i];
+    }
+    if( !chunks.empty() ) {
+        chunks.resize( 1 );
+        top = chunks[0];
+        limit = top + VALUE_CHUNK_SIZE;
+    }
+    bytes = 0;
+}
+
+void *ValueHeap::allocateChunk(size_t size) {
+    bytes += size;
+    if( size > VALUE_CHUNK_SIZE / 4 ) {
+        char *rv = new char [ size ];
+        large.push_back( rv );
+        return rv;
+    }
+    char *chunk = new char [ VALUE_CHUNK_SIZE ];
+    chunks.push_back( chunk );
+    top = chunk + size;
+    limit = chunk + VALUE_CHUNK_SIZE;
+    return chunk;
+}
+
+Value ValueHeap::makeString(const char *data, size_t length) {
+    ValueString *s = static_cast<ValueString*>( allocate( sizeof (ValueString) + length ) );
+    s->length = length;
+    memcpy( s->data, data, length );
+    s->data[ length ] = '\0';
+    return tagged( s, Value::TAG_STRING );
+}
+
+Value ValueHeap::makeBigRational(const mpq_class& x) {
+    mpq_class *q = new (allocate( sizeof (mpq_class) )) mpq_class( x );
+    rationals.push_back( q );
+    return tagged( q, Value::TAG_BIG_RATIONAL );
+}
+
+class ValueWriter {
+    // writes what SExp::output would write for the same expression
+    private:
+        std::ostream& os;
+
+    public:
+        explicit ValueWriter(std::ostream& os) : os ( os ) {}
+
+        void visitNil(void) {
+            os.put( '(' );
+            os.put( ')' );
+        }
+
+        void visitCons(Value car, Value cdr) {
+            os.put( '(' );
+            while( true ) {
+                visitValue( car, *this );
+                if( cdr.isNil() ) break;
+                os.put( ' ' );
+                if( cdr.getTag() != Value::TAG_CONS ) {
+                    os.put( '.' );
+                    os.put( ' ' );
+                    visitValue( cdr, *this );
+                    break;
+                }
+                car = cdr.car();
+                cdr = cdr.cdr();
+            }
+            os.put( ')' );
+        }
+
+        void visitInt(int x) {
+            char buffer[16];
+            char *end = buffer + sizeof buffer, *p = end;
+            unsigned int u = (x < 0) ? -(unsigned int) x : x;
+            do {
+                *--p = '0' + u % 10;
+                u /= 10;
+            } while( u );
+            if( x < 0 ) {
+                *--p = '-';
+            }
+            os.write( p, end - p );
+        }
+
+        void visitSymbol(int id) {
+            const std::string& name = symbolName( id );
+            os.write( name.data(), name.size() );
+        }
+
+        void visitString(const char *data, size_t length) {
+            os.put( '"' );
+            const char *end = data + length;
+            while( data < end ) {
+                const char *run = data;
+                while( data < end && *data != '"' && *data != '\\' ) ++data;
+                os.write( run, data - run );
+                if( data < end ) {
+                    os.put( '\\' );
+                    os.put( *data++ );
+                }
+            }
+            os.put( '"' );
+        }
+
+        void visitBigRational(const mpq_class& x) {
+            os << x;
+        }
+};
+
+void outputValue(Value value, std::ostream& os, bool terminateWithWhitespace) {
+    ValueWriter writer ( os );
+    visitValue( value, writer );
+    if( terminateWithWhitespace ) {
+        os.put( '\n' );
+    }
+}
+
+Value toValue(SExp *sexp, ValueHeap& heap) {
+    if( !sexp ) return Value();
+    switch( sexp->getType() ) {
+        case TYPE_INT:
+            return heap.makeInt( *asInt( sexp ) );
+        case TYPE_SYMBOL:
+            return Value::symbol( *asSymbol( sexp ) );
+        case TYPE_STRING:
+            return heap.makeString( *asString( sexp ) );
+        case TYPE_BIG_RATIONAL:
+            return heap.makeBigRational( *asBigRational( sexp ) );
+        case TYPE_CONS:
+            break;
+    }
+    // down the spine without recursing, as Cons::~Cons
+    std::vector<Value> items;
+    while( sexp && sexp->isType( TYPE_CONS ) ) {
+        Cons *c = asCons( sexp );
+        items.push_back( toValue( c->getcar(), heap ) );
+        sexp = c->getcdr();
+    }
+    Value rv = toValue( sexp, heap );
+    for(size_t i=items.size();i>0;i--) {
+        rv = heap.makeCons( items[i-1], rv );
+    }
+    return rv;
+}
+
+SExp *toSExp(Value value) {
+    if( value.isNil() ) return 0;
+    switch( value.getType() ) {
+        case TYPE_INT:
+            return new Int( value.asInt() );
+        case TYPE_SYMBOL:
+            return new Symbol( value.asSymbol() );
+        case TYPE_STRING:
+            return new String( value.asString() );
+        case TYPE_BIG_RATIONAL:
+            return new BigRational( value.asBigRational() );
+        case TYPE_CONS:
+            break;
+    }
+    std::vector<SExp*> items;
+    SExp *rv = 0;
+    try {
+        while( !value.isNil() && value.getTag() == Value::TAG_CONS ) {
+            items.push_back( toSExp( value.car() ) );
+            value = value.cdr();
+        }
+        rv = toSExp( value );
+    }
+    catch( ... ) {
+        for(size_t i=0;i<items.size();i++) {
+            delete items[i];
+        }
+        throw;
+    }
+    for(size_t i=items.size();i>0;i--) {
+        rv = new Cons( items[i-1], rv );
+    }
+    return rv;
+}
 
 }
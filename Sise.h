@@ -19,6 +19,7 @@
 #include <ostream>
 #include <sstream>
 #include <queue>
+#include <vector>
 
 #include <cstring>
 
@@ -28,6 +29,8 @@
 
 #include <stdexcept>
 
+#include <stdint.h>
+
 /* Not meant to be resistant towards malicious
    activity, vulnerable to DOS by stack overflow
    or memory exhaustion. Secure if needed by
@@ -127,6 +130,7 @@ namespace Sise {
             SExp *getcdr(void) const;
             void setcar(SExp*);
             void setcdr(SExp*);
+            SExp *releasecdr(void); // the caller owns it; we end here
 
             SExp *alistGet(const std::string&);
 
@@ -394,17 +398,21 @@ namespace Sise {
             bool doCheckStdin;
             bool stdinFlag;
 
+            int wakePipe[2]; // written to by wake(), watched like a listener
+
         protected:
             void watch( Socket* );
             void unwatch( Socket*, bool );
 
             void unwatchAll(void);
 
+            virtual void dispose( Socket* ); // once unwatched; deletes it
+
         public:
             typedef std::set<Socket*> SocketSet;
 
             SocketManager(void);
-            ~SocketManager(void);
+            virtual ~SocketManager(void);
 
             void setGreeter(SocketGreeter*);
 
@@ -415,6 +423,7 @@ namespace Sise {
             bool stdinFlagged(void) const;
 
             void pump(int, SocketSet*);
+            void wake(void); // from any thread, ends the wait in pump() early
 
             int numberOfWatchedSockets(void);
 
@@ -450,13 +459,236 @@ namespace Sise {
         }
     };
 
+    // every top-level expression in the buffer, parsed in one pass; like
+    // SExpStreamParser, drops a last expression that the end cuts off
+    void parseSExps(const char*, size_t, std::vector<SExp*>&);
+
     SExp * readSExpFromFile(const std::string&);
+    void readSExpsFromFile(const std::string&, std::vector<SExp*>&); // every top-level expression
     bool writeSExpToFile(const std::string&, SExp *);
+    bool writeSExpToFileAtomic(const std::string&, SExp *); // durable, all or nothing
 
-    void readSExpDir( const std::string&, const std::string&, NamedSexpHandler& );
+    // the files are parsed on several threads (0 for one per core) but
+    // handed over on the calling thread, in order of name
+    void readSExpDir( const std::string&, const std::string&, NamedSexpHandler&, int = 0 );
 
     void removeAllFilesWithExtension( const std::string&, const std::string& );
 
+    /* A compact form for expressions that are only read. A Value is one
+       tagged word: ints that fit and interned symbols are kept in the
+       word itself, while strings, conses and rationals point into a
+       ValueHeap, which owns them and frees them all at once. Nil is the
+       null cons, as with SExp. Nothing is virtual; code that looks at
+       every kind of value hands a visitor to visitValue().
+    */
+
+    int internSymbol(const char*, size_t); // from any thread
+    int internSymbol(const std::string&);
+    const std::string& symbolName(int);
+
+    struct ValueCons;
+    struct ValueString;
+    class ValueHeap;
+
+    class Value {
+        public:
+            enum Tag {
+                TAG_CONS,
+                TAG_INT,
+                TAG_SYMBOL,
+                TAG_STRING,
+                TAG_BOXED_INT, // an int too wide for a narrow word
+                TAG_BIG_RATIONAL
+            };
+
+        private:
+            friend class ValueHeap;
+            template<class V> friend void visitValue(Value, V&);
+
+            static const int TAG_BITS = 3;
+            static const uintptr_t TAG_MASK = 7;
+
+            uintptr_t word;
+
+            explicit Value(uintptr_t word) : word ( word ) {}
+
+            template<class T>
+            T *pointer(void) const { return reinterpret_cast<T*>( word & ~TAG_MASK ); }
+
+            void typeError(Type) const;
+            const ValueCons& cons(void) const;
+
+            static bool fitsInline(int x) {
+                const intptr_t limit = (intptr_t) 1 << (sizeof (intptr_t) * 8 - TAG_BITS - 1);
+                return x >= -limit && x < limit;
+            }
+
+        public:
+            Value(void) : word ( 0 ) {}
+
+            static Value symbol(int id) { return Value( ((uintptr_t) id << TAG_BITS) | TAG_SYMBOL ); }
+            static Value symbol(const std::string& name) { return symbol( internSymbol( name ) ); }
+
+            Tag getTag(void) const { return (Tag) (word & TAG_MASK); }
+            Type getType(void) const;
+            bool isType(Type t) const { return getType() == t; }
+            bool isNil(void) const { return !word; }
+
+            // same word, same value for nil, symbols and inline ints;
+            // anything on a heap only equals itself
+            bool operator==(const Value& that) const { return word == that.word; }
+            bool operator!=(const Value& that) const { return word != that.word; }
+
+            int asInt(void) const;
+            int asSymbolId(void) const;
+            const std::string& asSymbol(void) const;
+            std::string asString(void) const;
+            const char *getStringData(void) const;
+            size_t getStringLength(void) const;
+            const mpq_class& asBigRational(void) const;
+            mpq_class asMPQ(void) const;
+
+            Value car(void) const;
+            Value cdr(void) const;
+            Value nthcar(int) const;
+            Value nthtail(int) const;
+    };
+
+    struct ValueCons {
+        Value car, cdr;
+    };
+
+    struct ValueString {
+        size_t length;
+        char data[1]; // the rest follows
+    };
+
+    class ValueHeap {
+        // bump allocation in chunks; rationals are remembered so that
+        // clear() can destroy them
+        private:
+            std::vector<char*> chunks;
+            std::vector<char*> large; // a chunk each
+            char *top, *limit;
+            std::vector<mpq_class*> rationals;
+            size_t bytes;
+
+            ValueHeap(const ValueHeap&);
+            const ValueHeap& operator=(const ValueHeap&);
+
+            void *allocateChunk(size_t);
+
+            void *allocate(size_t size) {
+                size = (size + Value::TAG_MASK) & ~(size_t) Value::TAG_MASK;
+                if( (size_t) (limit - top) < size ) {
+                    return allocateChunk( size );
+                }
+                void *rv = top;
+                top += size;
+                bytes += size;
+                return rv;
+            }
+
+            static Value tagged(void *p, Value::Tag tag) { return Value( reinterpret_cast<uintptr_t>( p ) | tag ); }
+
+        public:
+            ValueHeap(void);
+            ~ValueHeap(void);
+
+            void clear(void); // every value made here is gone
+            size_t getBytesUsed(void) const { return bytes; }
+
+            Value makeInt(int x) {
+                if( Value::fitsInline( x ) ) {
+                    return Value( ((uintptr_t) (intptr_t) x << Value::TAG_BITS) | Value::TAG_INT );
+                }
+                int *box = static_cast<int*>( allocate( sizeof (int) ) );
+                *box = x;
+                return tagged( box, Value::TAG_BOXED_INT );
+            }
+
+            Value makeCons(Value car, Value cdr) {
+                ValueCons *c = static_cast<ValueCons*>( allocate( sizeof (ValueCons) ) );
+                c->car = car;
+                c->cdr = cdr;
+                return tagged( c, Value::TAG_CONS );
+            }
+
+            Value makeSymbol(const char *name, size_t length) { return Value::symbol( internSymbol( name, length ) ); }
+            Value makeString(const char*, size_t);
+            Value makeString(const std::string& s) { return makeString( s.data(), s.size() ); }
+            Value makeBigRational(const mpq_class&);
+    };
+
+    inline const ValueCons& Value::cons(void) const {
+        if( getTag() != TAG_CONS ) typeError( TYPE_CONS );
+        if( !word ) throw UnexpectedNilError();
+        return *pointer<ValueCons>();
+    }
+
+    inline Value Value::car(void) const {
+        return cons().car;
+    }
+
+    inline Value Value::cdr(void) const {
+        return cons().cdr;
+    }
+
+    inline int Value::asInt(void) const {
+        if( getTag() == TAG_INT ) {
+            return (int) ((intptr_t) word >> TAG_BITS);
+        }
+        if( getTag() != TAG_BOXED_INT ) typeError( TYPE_INT );
+        return *pointer<int>();
+    }
+
+    inline int Value::asSymbolId(void) const {
+        if( getTag() != TAG_SYMBOL ) typeError( TYPE_SYMBOL );
+        return (int) (word >> TAG_BITS);
+    }
+
+    template<class V>
+    void visitValue(Value value, V& visitor) {
+        // calls exactly one of visitNil(), visitCons(Value car, Value cdr),
+        // visitInt(int), visitSymbol(int id), visitString(const char*, size_t)
+        // or visitBigRational(const mpq_class&)
+        switch( value.getTag() ) {
+            case Value::TAG_CONS:
+                if( value.isNil() ) {
+                    visitor.visitNil();
+                } else {
+                    const ValueCons *c = value.pointer<ValueCons>();
+                    visitor.visitCons( c->car, c->cdr );
+                }
+                break;
+            case Value::TAG_INT:
+            case Value::TAG_BOXED_INT:
+                visitor.visitInt( value.asInt() );
+                break;
+            case Value::TAG_SYMBOL:
+                visitor.visitSymbol( value.asSymbolId() );
+                break;
+            case Value::TAG_STRING:
+                {
+                    const ValueString *s = value.pointer<ValueString>();
+                    visitor.visitString( s->data, s->length );
+                }
+                break;
+            case Value::TAG_BIG_RATIONAL:
+                visitor.visitBigRational( *value.pointer<mpq_class>() );
+                break;
+        }
+    }
+
+    void outputValue(Value, std::ostream&, bool = true);
+
+    Value toValue(SExp*, ValueHeap&);
+    SExp *toSExp(Value); // the caller owns it
+
+    // as parseSExps and readSExpsFromFile
+    void parseValues(const char*, size_t, ValueHeap&, std::vector<Value>&);
+    void readValuesFromFile(const std::string&, ValueHeap&, std::vector<Value>&);
+
     template<class T>
     T *connectToAs(const std::string& addr, int port) {
         struct addrinfo hints, *res;
@@ -107,6 +107,11 @@ struct TileType {
     Sise::SExp *toSexp(void) const;
 };
 
+typedef FrozenResourceTable<TileType> TileTypeTable;
+typedef FrozenResourceTable<UnitType> UnitTypeTable;
+
+typedef unsigned char TileTypeId; // an id in a TileTypeTable
+
 void loadTileTypesFromFile(const std::string&, ResourceManager<TileType>& );
 void loadUnitTypesFromFile(const std::string&, ResourceManager<UnitType>& );
 
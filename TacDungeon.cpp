@@ -1,25 +1,49 @@
 #include "TacDungeon.h"
 
+#include <algorithm>
+
 namespace Tac {
 
 int PointCorridor::dx[6] ={ 3, 0, -3, -3, 0, 3};
 int PointCorridor::dy[6] ={ 1, 2, 1, -1, -2, -1};
 
 DungeonSketch::DungeonSketch(void) :
-    sketch ( ST_NONE )
+    sketch ( ST_NONE ),
+    componentCount ( 0 )
 {
 }
 
 RoomNode::RoomNode(void) :
-    connected ( false ),
     connections (),
-    region ()
+    region (),
+    parent ( this ),
+    rank ( 0 )
 {
 }
 
-void RoomNode::connect(RoomNode *node) {
+bool RoomNode::connect(RoomNode *node) {
     node->connections.insert( this );
     connections.insert( node );
+
+    RoomNode *a = getComponent(), *b = node->getComponent();
+    if( a == b ) return false;
+    if( a->rank < b->rank ) {
+        std::swap( a, b );
+    }
+    b->parent = a;
+    if( a->rank == b->rank ) {
+        ++a->rank;
+    }
+    return true;
+}
+
+RoomNode* RoomNode::getComponent(void) {
+    RoomNode *node = this;
+    while( node->parent != node ) {
+        node->parent = node->parent->parent;
+        node = node->parent;
+    }
+    return node;
 }
 
 void RoomNode::add(int x, int y) {
@@ -30,25 +54,19 @@ void RoomNode::remove(int x, int y){
     region.remove( x, y );
 }
 
-void RoomNode::markConnected(void) {
-    if( !connected ) {
-        connected = true;
-        for(std::set<RoomNode*>::iterator i = connections.begin(); i != connections.end(); i++){
-            (*i)->markConnected();
-        }
-    }
-}
-
-bool RoomNode::isMarkedConnected(void) const {
-    return connected;
-}
-
 int RoomNode::getRegionSize(void) const {
     return region.size();
 }
 
 void DungeonSketch::adoptRoom(RoomNode* room) {
     rooms.push_back( room );
+    ++componentCount;
+}
+
+void DungeonSketch::connectRooms(RoomNode *a, RoomNode *b) {
+    if( a->connect( b ) ) {
+        --componentCount;
+    }
 }
 
 DungeonSketch::~DungeonSketch(void) {
@@ -271,7 +289,19 @@ bool PointCorridor::check(void) {
     return n > 1;
 }
 
-void PointCorridor::dig(void) {
+void PointCorridor::getTiles(std::vector<HexTools::HexCoordinate>& tiles) const {
+    tiles.push_back( HexTools::HexCoordinate( cx, cy ) );
+    for(int i=0;i<6;i++) if( activeDir[i] ) {
+        int x = cx, y = cy;
+        do {
+            x += dx[i];
+            y += dy[i];
+            tiles.push_back( HexTools::HexCoordinate( x, y ) );
+        } while( sketch->get(x,y) != DungeonSketch::ST_META_CONNECTOR );
+    }
+}
+
+void PointCorridor::dig(std::vector<HexTools::HexCoordinate>* changed) {
     if( !checked ) {
         check();
     }
@@ -285,9 +315,15 @@ void PointCorridor::dig(void) {
                 if( sketch->get(sx, sy) == DungeonSketch::ST_NONE
                     || sketch->get(sx, sy) == DungeonSketch::ST_META_DIGGABLE ) {
                     sketch->put( sx, sy, DungeonSketch::ST_NORMAL_WALL );
+                    if( changed ) {
+                        changed->push_back( HexTools::HexCoordinate( sx, sy ) );
+                    }
                 }
             }
             sketch->put(x, y, DungeonSketch::ST_NORMAL_CORRIDOR );
+            if( changed ) {
+                changed->push_back( HexTools::HexCoordinate( x, y ) );
+            }
             using namespace std;
             x += dx[i];
             y += dy[i];
@@ -299,12 +335,15 @@ void PointCorridor::dig(void) {
             ends.insert( rv );
         }
         sketch->put( x, y, DungeonSketch::ST_NORMAL_DOORWAY );
+        if( changed ) {
+            changed->push_back( HexTools::HexCoordinate( x, y ) );
+        }
     }
 
     for(std::set<RoomNode*>::iterator i = ends.begin(); i != ends.end(); i++) {
         for(std::set<RoomNode*>::iterator j = ends.begin(); j != ends.end(); j++) {
             if( *i != *j ) {
-                (*i)->connect( *j );
+                sketch->connectRooms( *i, *j );
             }
         }
     }
@@ -360,7 +399,16 @@ SimpleLevelGenerator::SimpleLevelGenerator( MTRand_int32& prng ) :
     swcExtraCorridors ( -1 ),
     pointCorridorCandidatesGenerated ( false ),
     pccs (),
-    corridorCount ( 0 )
+    pccPools (),
+    pccPoolLength (),
+    pccPoolSlot (),
+    pccPoolSize ( 0 ),
+    pccsByTile ( 0 ),
+    pccsByRoom (),
+    corridorCount ( 0 ),
+    verifyCandidates ( false ),
+    verifyPccs (),
+    candidateMismatches ( 0 )
 {
 }
 
@@ -385,13 +433,10 @@ SimpleLevelGenerator::PainterEntry& SimpleLevelGenerator::selectPainter(void) {
 }
 
 void SimpleLevelGenerator::generateRooms(void) {
-    using namespace std;
     int count = 0;
-    cerr << "hmm+?" << endl;
     while( count < roomTarget ) {
         PainterEntry& entry = selectPainter();
         HexTools::HexCoordinate coords = placeRoomNear( 0, 0, entry.painter->getRadius() );
-        cerr << "painting " << entry.painter << endl;
         entry.painter->paint( sketch, coords.first, coords.second );
         if( entry.countTowardsTarget ) {
             ++count;
@@ -441,35 +486,166 @@ bool SimpleLevelGenerator::checkPCC( PointCorridor& corr ) {
         if( corr.getLength() > corridorLengthLimit ) return false;
     }
     if( forbidTrivialLoops ) {
-        bool hasTrivialLoops = false;
         std::vector<RoomNode*> ends;
         for(int i=0;i<6;i++) if( corr.isActive(i)) {
             ends.push_back( corr.getNode(i) );
         }
-        for(int i=0;i<(int)ends.size();i++) for(int j=0;j<(int)ends.size();j++) if( i != j ) {
-            if( ends[i] == ends[j] ) {
-                hasTrivialLoops = true;
-            }
-            if( ends[i]->isDirectlyConnected( ends[j]) ) {
-                hasTrivialLoops = true;
+        for(int i=0;i<(int)ends.size();i++) for(int j=i+1;j<(int)ends.size();j++) {
+            if( ends[i] == ends[j] || ends[i]->isDirectlyConnected( ends[j] ) ) {
+                return false;
             }
         }
-        if( hasTrivialLoops ) return false;
     }
     return true;
 }
 
 void SimpleLevelGenerator::generatePCCs(void) {
+    // only tiles that see at least two connectors along straight lines of
+    // empty tiles can be corridor centres, so find those by walking out
+    // from the connectors instead of checking every tile of the sketch
+    static const int dx[] = { 3, 0, -3, -3, 0, 3 },
+                     dy[] = { 1, 2, 1, -1, -2, -1 };
     pointCorridorCandidatesGenerated = true;
     int sz = sketch.getMaxRadius();
+    HexTools::HexMap<int> hits ( sz );
+    for(int k=0;k<hits.getSize();k++) {
+        hits.get(k) = 0;
+    }
+    const std::map<HexTools::HexCoordinate, RoomNode*>& connectors = sketch.getConnectors();
+    for(std::map<HexTools::HexCoordinate, RoomNode*>::const_iterator c = connectors.begin(); c != connectors.end(); c++) {
+        for(int i=0;i<6;i++) {
+            int x = c->first.first + dx[i], y = c->first.second + dy[i];
+            while( HexTools::hexDistance( 0, 0, x, y ) <= sz ) {
+                DungeonSketch::SketchTile tt = sketch.get(x,y);
+                if( tt != DungeonSketch::ST_NONE && tt != DungeonSketch::ST_META_DIGGABLE ) break;
+                ++hits.get(x,y);
+                x += dx[i];
+                y += dy[i];
+            }
+        }
+    }
+
+    pccsByTile = HexTools::HexMap< std::vector<int> >( sz );
+    std::vector<HexTools::HexCoordinate> tiles;
     for(int r=0;r<=sz;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
         int x, y;
         HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
+        if( hits.get(x,y) < 2 ) continue;
         PointCorridor pcc ( sketch, x, y );
-        if( checkPCC( pcc ) ) {
-            pccs.push_back( pcc );
+        if( !checkPCC( pcc ) ) continue;
+
+        int id = (int) pccs.size();
+        pccs.push_back( pcc );
+        pccPoolLength.push_back( -1 );
+        pccPoolSlot.push_back( -1 );
+        poolPCC( id );
+
+        tiles.clear();
+        pcc.getTiles( tiles );
+        for(std::vector<HexTools::HexCoordinate>::iterator t = tiles.begin(); t != tiles.end(); t++) {
+            pccsByTile.get( t->first, t->second ).push_back( id );
+        }
+        for(int d=0;d<6;d++) if( pcc.isActive(d) ) {
+            std::vector<int>& byRoom = pccsByRoom[ pcc.getNode(d) ];
+            if( byRoom.empty() || byRoom.back() != id ) {
+                byRoom.push_back( id );
+            }
+        }
+    }
+}
+
+void SimpleLevelGenerator::poolPCC(int id) {
+    std::vector<int>& pool = pccPools[ pccs[id].getLength() ];
+    pccPoolLength[id] = pccs[id].getLength();
+    pccPoolSlot[id] = (int) pool.size();
+    pool.push_back( id );
+    ++pccPoolSize;
+}
+
+void SimpleLevelGenerator::unpoolPCC(int id) {
+    std::map< int, std::vector<int> >::iterator pooli = pccPools.find( pccPoolLength[id] );
+    assert( pooli != pccPools.end() );
+    std::vector<int>& pool = pooli->second;
+    int last = pool.back();
+    pool[ pccPoolSlot[id] ] = last;
+    pccPoolSlot[last] = pccPoolSlot[id];
+    pool.pop_back();
+    if( pool.empty() ) {
+        pccPools.erase( pooli );
+    }
+    pccPoolLength[id] = pccPoolSlot[id] = -1;
+    --pccPoolSize;
+}
+
+void SimpleLevelGenerator::recheckPCCs(const std::vector<HexTools::HexCoordinate>& changed, const std::vector<RoomNode*>& ends) {
+    // a candidate can only have been affected by a dig if one of its rays
+    // crosses a changed tile, or if it joins rooms that are now connected;
+    // candidates that fail a check are dropped for good, as before
+    std::set<int> affected;
+    for(std::vector<HexTools::HexCoordinate>::const_iterator i = changed.begin(); i != changed.end(); i++) {
+        if( pccsByTile.isDefault( i->first, i->second ) ) continue;
+        const std::vector<int>& ids = pccsByTile.get( i->first, i->second );
+        affected.insert( ids.begin(), ids.end() );
+    }
+    for(std::vector<RoomNode*>::const_iterator i = ends.begin(); i != ends.end(); i++) {
+        std::map< RoomNode*, std::vector<int> >::const_iterator j = pccsByRoom.find( *i );
+        if( j != pccsByRoom.end() ) {
+            affected.insert( j->second.begin(), j->second.end() );
         }
     }
+    for(std::set<int>::iterator i = affected.begin(); i != affected.end(); i++) {
+        if( pccPoolSlot[*i] < 0 ) continue;
+        if( !checkPCC( pccs[*i] ) ) {
+            unpoolPCC( *i );
+        } else if( pccs[*i].getLength() != pccPoolLength[*i] ) {
+            unpoolPCC( *i );
+            poolPCC( *i );
+        }
+    }
+}
+
+int SimpleLevelGenerator::countPCCMismatches(void) {
+    // brings verifyPccs up to date the way candidates used to be kept,
+    // then counts the tiles where it and the pools disagree on validity
+    // or length
+    std::map< HexTools::HexCoordinate, int > kept, pooled;
+    if( verifyPccs.empty() && !corridorCount ) {
+        int sz = sketch.getMaxRadius();
+        for(int r=0;r<=sz;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
+            int x, y;
+            HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
+            PointCorridor pcc ( sketch, x, y );
+            if( checkPCC( pcc ) ) {
+                verifyPccs.push_back( pcc );
+            }
+        }
+    }
+    for(std::vector<PointCorridor>::iterator i = verifyPccs.begin(); i != verifyPccs.end();) {
+        if( !checkPCC( *i ) ) {
+            i = verifyPccs.erase( i );
+        } else {
+            kept[ i->getCentre() ] = i->getLength();
+            i++;
+        }
+    }
+    for(std::map< int, std::vector<int> >::const_iterator i = pccPools.begin(); i != pccPools.end(); i++) {
+        for(std::vector<int>::const_iterator j = i->second.begin(); j != i->second.end(); j++) {
+            pooled[ pccs[*j].getCentre() ] = i->first;
+        }
+    }
+    int mismatches = 0;
+    for(std::map< HexTools::HexCoordinate, int >::const_iterator i = kept.begin(); i != kept.end(); i++) {
+        std::map< HexTools::HexCoordinate, int >::const_iterator j = pooled.find( i->first );
+        if( j == pooled.end() || j->second != i->second ) {
+            ++mismatches;
+        }
+    }
+    for(std::map< HexTools::HexCoordinate, int >::const_iterator i = pooled.begin(); i != pooled.end(); i++) {
+        if( kept.find( i->first ) == kept.end() ) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
 }
 
 bool SimpleLevelGenerator::generatePointCorridor(void) {
@@ -480,47 +656,40 @@ bool SimpleLevelGenerator::generatePointCorridor(void) {
 
     if( !pointCorridorCandidatesGenerated ) {
         generatePCCs();
-    }
-
-    int shortestCorridorLength = 0x7fffffff;
-    int shortestCorridorN = 0;
-
-    cerr << "pc?3 ";
-    // pccs need pruning
-    int counttest = 0;
-    for(std::vector<PointCorridor>::iterator i = pccs.begin(); i != pccs.end();) {
-        ++counttest;
-        if( !checkPCC( *i ) ) {
-            i = pccs.erase( i );
-        } else {
-            if( i->getLength() < shortestCorridorLength ) {
-                shortestCorridorLength = i->getLength();
-                shortestCorridorN = 1;
-            } else if( i->getLength() == shortestCorridorLength ) {
-                shortestCorridorN++;
-            }
-            i++;
+        if( verifyCandidates ) {
+            candidateMismatches += countPCCMismatches();
         }
     }
 
-    if( !pccs.size() ) return false;
+    if( !pccPoolSize ) return false;
 
-    int n = (shortestCorridorFirst) ? shortestCorridorN : (int) pccs.size();
-    int r = prng(n);
-    std::vector<PointCorridor>::iterator i = pccs.begin();
-    while( true ) {
-        assert( i != pccs.end() );
-        if( !shortestCorridorFirst || i->getLength() == shortestCorridorLength ) {
-            --r;
+    int id;
+    if( shortestCorridorFirst ) {
+        std::vector<int>& pool = pccPools.begin()->second;
+        id = pool[ prng( pool.size() ) ];
+    } else {
+        int r = prng( pccPoolSize );
+        std::map< int, std::vector<int> >::iterator pooli = pccPools.begin();
+        while( r >= (int) pooli->second.size() ) {
+            r -= (int) pooli->second.size();
+            pooli++;
+            assert( pooli != pccPools.end() );
         }
-        if( r < 0 ) {
-            break;
-        }
-        i++;
+        id = pooli->second[r];
     }
 
-    i->dig();
+    PointCorridor& corr = pccs[id];
+    std::vector<RoomNode*> ends;
+    for(int i=0;i<6;i++) if( corr.isActive(i) ) {
+        ends.push_back( corr.getNode(i) );
+    }
+    std::vector<HexTools::HexCoordinate> changed;
+    corr.dig( &changed );
+    recheckPCCs( changed, ends );
     ++corridorCount;
+    if( verifyCandidates ) {
+        candidateMismatches += countPCCMismatches();
+    }
 
     return true;
 }
@@ -545,18 +714,7 @@ void SimpleLevelGenerator::finalChecks(void){
 }
 
 bool SimpleLevelGenerator::isConnected(void) {
-    std::vector<RoomNode*> rooms = sketch.getRooms();
-    bool notConnected = false;
-    for(std::vector<RoomNode*>::iterator i = rooms.begin(); i != rooms.end(); i++) {
-        (*i)->clearConnectedMark();
-    }
-    rooms[0]->markConnected();
-    for(std::vector<RoomNode*>::iterator i = rooms.begin(); i != rooms.end(); i++) {
-        if( !(*i)->isMarkedConnected() ) {
-            notConnected = true;
-        }
-    }
-    return !notConnected;
+    return sketch.isConnected();
 }
 
 void SimpleLevelGenerator::generate(void) {
@@ -589,7 +747,8 @@ DungeonSketch::SketchTile SimpleLevelGenerator::TileFinalizer::operator()(Dungeo
 void SimpleLevelGenerator::finalize(void) {
     TileFinalizer tilefin;
     int sz = sketch.getMaxRadius();
-    for(int r=0;r<=sz;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
+    sketch.put(0,0, tilefin( sketch.get(0,0) ) );
+    for(int r=1;r<=sz;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
         int x, y;
         HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
         sketch.put(x,y, tilefin( sketch.get(x,y) ) );
@@ -600,6 +759,14 @@ void SimpleLevelGenerator::setSWCExtraCorridors(int n) {
     swcExtraCorridors = n;
 }
 
+void SimpleLevelGenerator::setMaxCorridors(int n) {
+    maxCorridors = n;
+}
+
+void SimpleLevelGenerator::setVerifyCandidates(bool tf) {
+    verifyCandidates = tf;
+}
+
 void SimpleLevelGenerator::setRoomTarget(int n) {
     roomTarget = n;
 }
@@ -5,6 +5,7 @@
 
 #include <list>
 #include <set>
+#include <map>
 
 #include "HexTools.h"
 
@@ -29,23 +30,27 @@ class RoomPainter;
 
 class RoomNode {
     private:
-        bool connected;
         std::set<RoomNode*> connections;
         HexTools::HexRegion region; // floorspace -- spawn region
 
+        // union-find over connected rooms, kept up to date by connect()
+        RoomNode *parent;
+        int rank;
+
     public:
         RoomNode(void);
 
-        void connect(RoomNode*);
+        bool connect(RoomNode*); // true if this joined two components
         void add(int,int);
         void remove(int,int);
 
         bool isDirectlyConnected(RoomNode*) const;
 
-        void markConnected(void);
+        const std::set<RoomNode*>& getConnections(void) const { return connections; }
+        const HexTools::HexRegion& getRegion(void) const { return region; }
+
+        RoomNode* getComponent(void); // the same node for all connected rooms
         int getRegionSize(void) const;
-        bool isMarkedConnected(void) const;
-        void clearConnectedMark(void) { connected = false; }
 };
 
 class DungeonSketch {
@@ -64,6 +69,7 @@ class DungeonSketch {
         HexTools::SparseHexMap<SketchTile> sketch;
         std::vector<RoomNode*> rooms;
         std::map<HexTools::HexCoordinate, RoomNode*> rConnectors;
+        int componentCount;
 
     public:
         DungeonSketch(void);
@@ -73,6 +79,9 @@ class DungeonSketch {
         RoomNode* getConnectorRoom(int, int);
 
         void adoptRoom(RoomNode*);
+        void connectRooms(RoomNode*, RoomNode*);
+        bool isConnected(void) const { return componentCount == 1; }
+        int getComponentCount(void) const { return componentCount; }
 
         int getMaxRadius(void) const { return sketch.getMaxRadius(); }
 
@@ -82,6 +91,7 @@ class DungeonSketch {
         bool checkRoomAt(int,int,int) const;
 
         std::vector<RoomNode*>& getRooms(void) { return rooms; }
+        const std::map<HexTools::HexCoordinate, RoomNode*>& getConnectors(void) const { return rConnectors; }
 };
 
 template
@@ -111,9 +121,11 @@ class PointCorridor {
         const PointCorridor& operator=(const PointCorridor&);
 
         bool check(void);
-        void dig(void);
+        void dig(std::vector<HexTools::HexCoordinate>* = 0); // optionally lists the tiles changed
 
         int getLength(void) const { return length; }
+        HexTools::HexCoordinate getCentre(void) const { return HexTools::HexCoordinate( cx, cy ); }
+        void getTiles(std::vector<HexTools::HexCoordinate>&) const; // centre and active rays
 
         bool isActive(int j) const { return activeDir[j]; }
         RoomNode* getNode(int j) { return node[j]; }
@@ -177,6 +189,7 @@ class LevelGenerator {
 
     public:
         LevelGenerator(MTRand_int32&);
+        virtual ~LevelGenerator(void) {}
 
         virtual void generate(void) = 0;
         DungeonSketch& getSketch(void) { return sketch; }
@@ -214,14 +227,33 @@ class SimpleLevelGenerator : public LevelGenerator {
         PainterEntry& selectPainter(void);
         HexTools::HexCoordinate placeRoomNear(int,int,int);
 
+        // candidates stay in pccs once generated, and the valid ones are
+        // also pooled by length. digging a corridor only rechecks the
+        // candidates indexed under the tiles it changed and the rooms it
+        // connected (candidates never become valid again once invalid)
         bool pointCorridorCandidatesGenerated;
         std::vector< PointCorridor > pccs;
+        std::map< int, std::vector<int> > pccPools;
+        std::vector<int> pccPoolLength, pccPoolSlot; // -1 when not pooled
+        int pccPoolSize;
+        HexTools::HexMap< std::vector<int> > pccsByTile;
+        std::map< RoomNode*, std::vector<int> > pccsByRoom;
         int corridorCount;
 
+        // for testing: the pools against the candidates kept the old way,
+        // every tile checked at first and every candidate after each dig
+        bool verifyCandidates;
+        std::vector< PointCorridor > verifyPccs;
+        int candidateMismatches;
+
         void generateRooms(void);
         bool generatePointCorridor(void);
         bool checkPCC( PointCorridor& );
         void generatePCCs(void);
+        void poolPCC(int);
+        void unpoolPCC(int);
+        void recheckPCCs(const std::vector<HexTools::HexCoordinate>&, const std::vector<RoomNode*>&);
+        int countPCCMismatches(void);
         bool isConnected(void);
 
         void finalize(void);
@@ -238,8 +270,12 @@ class SimpleLevelGenerator : public LevelGenerator {
         void setShortestCorridorsFirst(bool = true);
         void setStopWhenConnected(bool = true);
         void setSWCExtraCorridors(int);
+        void setMaxCorridors(int);
+        void setVerifyCandidates(bool = true);
 
         void generate(void);
+
+        int getCandidateMismatches(void) const { return candidateMismatches; }
 };
 
 };
@@ -0,0 +1,209 @@
+#include "TacLevelFile.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Tac {
+
+static const char levelFileMagic[4] = { 'T', 'L', 'V', 'L' };
+static const uint32_t levelFileVersion = 1;
+
+static size_t paddedTo4(size_t n) {
+    return (n + 3) & ~(size_t) 3;
+}
+
+void writeLevelFile(const std::string& filename, DungeonSketch& sketch) {
+    const std::vector<RoomNode*>& rooms = sketch.getRooms();
+    std::map<RoomNode*, uint32_t> roomIndex;
+    for(int i=0;i<(int)rooms.size();i++) {
+        roomIndex[ rooms[i] ] = i;
+    }
+
+    LevelFileHeader header;
+    memcpy( header.magic, levelFileMagic, sizeof header.magic );
+    header.version = levelFileVersion;
+    header.radius = sketch.getMaxRadius();
+    header.tileCount = HexTools::hexCircleSize( header.radius );
+    header.roomCount = rooms.size();
+
+    std::vector<uint8_t> tiles ( paddedTo4( header.tileCount ), 0 );
+    for(int k=0;k<(int)header.tileCount;k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        tiles[k] = sketch.get( x, y );
+    }
+
+    std::vector<LevelFileRoom> roomTable;
+    std::vector<uint32_t> roomTiles, connections;
+    for(std::vector<RoomNode*>::const_iterator i = rooms.begin(); i != rooms.end(); i++) {
+        LevelFileRoom room;
+        room.firstTile = roomTiles.size();
+        room.firstConnection = connections.size();
+        const HexTools::HexRegion& region = (*i)->getRegion();
+        for(HexTools::HexRegion::const_iterator j = region.begin(); j != region.end(); j++) {
+            roomTiles.push_back( HexTools::flattenHexCoordinate( j->first, j->second ) );
+        }
+        const std::set<RoomNode*>& connected = (*i)->getConnections();
+        for(std::set<RoomNode*>::const_iterator j = connected.begin(); j != connected.end(); j++) {
+            connections.push_back( roomIndex[ *j ] );
+        }
+        room.tileCount = roomTiles.size() - room.firstTile;
+        room.connectionCount = connections.size() - room.firstConnection;
+        roomTable.push_back( room );
+    }
+    header.roomTileCount = roomTiles.size();
+    header.connectionCount = connections.size();
+
+    std::vector<LevelFileConnector> connectors;
+    const std::map<HexTools::HexCoordinate, RoomNode*>& rConnectors = sketch.getConnectors();
+    for(std::map<HexTools::HexCoordinate, RoomNode*>::const_iterator i = rConnectors.begin(); i != rConnectors.end(); i++) {
+        std::map<RoomNode*, uint32_t>::const_iterator j = roomIndex.find( i->second );
+        if( j == roomIndex.end() ) continue;
+        LevelFileConnector connector;
+        connector.tile = HexTools::flattenHexCoordinate( i->first.first, i->first.second );
+        connector.room = j->second;
+        connectors.push_back( connector );
+    }
+    header.connectorCount = connectors.size();
+
+    std::ofstream os ( filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+    os.write( (const char*) &header, sizeof header );
+    os.write( (const char*) &tiles[0], tiles.size() );
+    if( !roomTable.empty() ) {
+        os.write( (const char*) &roomTable[0], roomTable.size() * sizeof roomTable[0] );
+    }
+    if( !roomTiles.empty() ) {
+        os.write( (const char*) &roomTiles[0], roomTiles.size() * sizeof roomTiles[0] );
+    }
+    if( !connections.empty() ) {
+        os.write( (const char*) &connections[0], connections.size() * sizeof connections[0] );
+    }
+    if( !connectors.empty() ) {
+        os.write( (const char*) &connectors[0], connectors.size() * sizeof connectors[0] );
+    }
+    if( !os.good() ) {
+        throw std::runtime_error( "unable to write level file " + filename );
+    }
+}
+
+LevelFile::LevelFile(const std::string& filename) :
+    data ( 0 ),
+    size ( 0 ),
+    header ( 0 ),
+    tiles ( 0 ),
+    rooms ( 0 ),
+    roomTiles ( 0 ),
+    connections ( 0 ),
+    connectors ( 0 )
+{
+    int fd = open( filename.c_str(), O_RDONLY );
+    if( fd < 0 ) {
+        throw std::runtime_error( "unable to open level file " + filename );
+    }
+    struct stat st;
+    if( fstat( fd, &st ) < 0 || st.st_size < (off_t) sizeof *header ) {
+        close( fd );
+        throw std::runtime_error( "invalid level file " + filename );
+    }
+    size = st.st_size;
+    data = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( data == MAP_FAILED ) {
+        throw std::runtime_error( "unable to map level file " + filename );
+    }
+    if( !layout() ) {
+        munmap( data, size );
+        throw std::runtime_error( "invalid level file " + filename );
+    }
+}
+
+LevelFile::~LevelFile(void) {
+    munmap( data, size );
+}
+
+bool LevelFile::layout(void) {
+    // points the sections into the mapping, checking every count and
+    // index against the file so that the accessors need no checks
+    const char *base = (const char*) data;
+    header = (const LevelFileHeader*) base;
+    if( memcmp( header->magic, levelFileMagic, sizeof header->magic ) ) return false;
+    if( header->version != levelFileVersion ) return false;
+    if( header->radius < 0 || header->tileCount != (uint32_t) HexTools::hexCircleSize( header->radius ) ) return false;
+
+    size_t offset = sizeof *header;
+    const size_t sections[] = {
+        paddedTo4( header->tileCount ),
+        (size_t) header->roomCount * sizeof *rooms,
+        (size_t) header->roomTileCount * sizeof *roomTiles,
+        (size_t) header->connectionCount * sizeof *connections,
+        (size_t) header->connectorCount * sizeof *connectors
+    };
+    const char *starts[5];
+    for(int i=0;i<5;i++) {
+        if( sections[i] > size - offset ) return false;
+        starts[i] = base + offset;
+        offset += sections[i];
+    }
+    tiles = (const uint8_t*) starts[0];
+    rooms = (const LevelFileRoom*) starts[1];
+    roomTiles = (const uint32_t*) starts[2];
+    connections = (const uint32_t*) starts[3];
+    connectors = (const LevelFileConnector*) starts[4];
+
+    for(uint32_t k=0;k<header->tileCount;k++) {
+        if( tiles[k] > DungeonSketch::ST_META_CONNECTOR ) return false;
+    }
+    for(uint32_t i=0;i<header->roomCount;i++) {
+        const LevelFileRoom& room = rooms[i];
+        if( room.firstTile > header->roomTileCount || room.tileCount > header->roomTileCount - room.firstTile ) return false;
+        if( room.firstConnection > header->connectionCount || room.connectionCount > header->connectionCount - room.firstConnection ) return false;
+    }
+    for(uint32_t i=0;i<header->roomTileCount;i++) {
+        if( roomTiles[i] >= header->tileCount ) return false;
+    }
+    for(uint32_t i=0;i<header->connectionCount;i++) {
+        if( connections[i] >= header->roomCount ) return false;
+    }
+    for(uint32_t i=0;i<header->connectorCount;i++) {
+        if( connectors[i].tile >= header->tileCount || connectors[i].room >= header->roomCount ) return false;
+    }
+    return true;
+}
+
+void LevelFile::toSketch(DungeonSketch& sketch) const {
+    for(int k=0;k<(int)header->tileCount;k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        sketch.put( x, y, getTile( k ) );
+    }
+
+    std::vector<RoomNode*> nodes;
+    for(uint32_t i=0;i<header->roomCount;i++) {
+        RoomNode *node = new RoomNode();
+        sketch.adoptRoom( node );
+        nodes.push_back( node );
+        for(uint32_t j=0;j<rooms[i].tileCount;j++) {
+            int x, y;
+            HexTools::inflateHexCoordinate( roomTiles[ rooms[i].firstTile + j ], x, y );
+            node->add( x, y );
+        }
+    }
+    for(uint32_t i=0;i<header->roomCount;i++) {
+        for(uint32_t j=0;j<rooms[i].connectionCount;j++) {
+            sketch.connectRooms( nodes[i], nodes[ connections[ rooms[i].firstConnection + j ] ] );
+        }
+    }
+    for(uint32_t i=0;i<header->connectorCount;i++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( connectors[i].tile, x, y );
+        sketch.registerConnector( x, y, nodes[ connectors[i].room ] );
+    }
+}
+
+};
@@ -0,0 +1,80 @@
+#ifndef H_TAC_LEVELFILE
+#define H_TAC_LEVELFILE
+
+#include "TacDungeon.h"
+
+#include <string>
+
+#include <stdint.h>
+
+/* A level file is a finished DungeonSketch laid out so that it can be
+   used straight from a read-only mapping of the file:
+
+        LevelFileHeader
+        uint8_t tiles[tileCount]             -- SketchTile, flat hex order
+        (padding to a multiple of 4)
+        LevelFileRoom rooms[roomCount]
+        uint32_t roomTiles[roomTileCount]    -- flat indices, by room
+        uint32_t connections[connectionCount] -- room indices, by room
+        LevelFileConnector connectors[connectorCount]
+
+   Everything is in host byte order; the header's magic and version are
+   checked on loading, as are the section sizes against the file size.
+*/
+
+namespace Tac {
+
+struct LevelFileHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t radius;
+    uint32_t tileCount;
+    uint32_t roomCount;
+    uint32_t roomTileCount;
+    uint32_t connectionCount;
+    uint32_t connectorCount;
+};
+
+struct LevelFileRoom {
+    uint32_t firstTile, tileCount;
+    uint32_t firstConnection, connectionCount;
+};
+
+struct LevelFileConnector {
+    uint32_t tile;
+    uint32_t room;
+};
+
+void writeLevelFile(const std::string&, DungeonSketch&);
+
+class LevelFile {
+    private:
+        void *data;
+        size_t size;
+
+        const LevelFileHeader *header;
+        const uint8_t *tiles;
+        const LevelFileRoom *rooms;
+        const uint32_t *roomTiles;
+        const uint32_t *connections;
+        const LevelFileConnector *connectors;
+
+        LevelFile(const LevelFile&);
+        const LevelFile& operator=(const LevelFile&);
+
+        bool layout(void);
+
+    public:
+        explicit LevelFile(const std::string&);
+        ~LevelFile(void);
+
+        int getRadius(void) const { return header->radius; }
+        int getTileCount(void) const { return header->tileCount; }
+        DungeonSketch::SketchTile getTile(int k) const { return (DungeonSketch::SketchTile) tiles[k]; }
+
+        void toSketch(DungeonSketch&) const;
+};
+
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "TacLevelGen.h"
+
+#include <algorithm>
+
+namespace Tac {
+
+StandardLevelConfiguration::StandardLevelConfiguration(int roomTarget) :
+    roomTarget ( roomTarget )
+{
+}
+
+void StandardLevelConfiguration::configure(SimpleLevelGenerator& levelgen) const {
+    levelgen.setRoomTarget( roomTarget );
+    levelgen.setMaxCorridors( std::max( 100, 4 * roomTarget ) ); // big levels can't connect with fewer
+    levelgen.setShortestCorridorsFirst();
+    levelgen.setStopWhenConnected();
+    levelgen.setSWCExtraCorridors( 2 );
+
+    levelgen.adoptPainter( new HollowHexagonRoomPainter( 6, 2 ),
+                           1,
+                           false );
+    levelgen.adoptPainter( new HollowHexagonRoomPainter( 7, 3 ),
+                           1,
+                           false );
+    levelgen.adoptPainter( new BlankRoomPainter( 3 ),
+                           1,
+                           false );
+
+    levelgen.adoptPainter( new HexagonRoomPainter( 4 ),
+                           2,
+                           true );
+    levelgen.adoptPainter( new HexagonRoomPainter( 5 ),
+                           2,
+                           true );
+    levelgen.adoptPainter( new HexagonRoomPainter( 6 ),
+                           2,
+                           true );
+    levelgen.adoptPainter( new HexagonRoomPainter( 7 ),
+                           1,
+                           true );
+}
+
+GeneratedLevel::GeneratedLevel(const LevelConfiguration& configuration, unsigned long seed) :
+    seed ( seed ),
+    prng ( seed ),
+    levelgen ( prng )
+{
+    configuration.configure( levelgen );
+}
+
+bool GeneratedLevel::generate(void) {
+    try {
+        levelgen.generate();
+    }
+    catch( LevelGenerationFailure& e ) {
+        return false;
+    }
+    return true;
+}
+
+LevelGenerationService::LevelGenerationService(const LevelConfiguration& configuration, unsigned long seed, int threads, int queueSize) :
+    configuration ( configuration ),
+    queueSize ( queueSize ),
+    stopping ( false ),
+    waiting ( 0 ),
+    stored ( 0 ),
+    failures ( 0 ),
+    nextSeed ( seed ),
+    nextDelivery ( seed ),
+    resolved ()
+{
+    do {
+        workers.create_thread( Worker( *this ) );
+    } while( --threads > 0 );
+}
+
+LevelGenerationService::~LevelGenerationService(void) {
+    {
+        boost::lock_guard<boost::mutex> lock ( mutex );
+        stopping = true;
+        workAvailable.notify_all();
+    }
+    workers.join_all();
+    for(std::map<unsigned long, GeneratedLevel*>::iterator i = resolved.begin(); i != resolved.end(); i++) {
+        delete i->second;
+    }
+}
+
+bool LevelGenerationService::needsWork(void) const {
+    // attempts in progress are not counted, so while someone is waiting
+    // every worker keeps trying seeds; surplus levels stay queued
+    return stored < queueSize + waiting;
+}
+
+void LevelGenerationService::work(void) {
+    boost::unique_lock<boost::mutex> lock ( mutex );
+    while( true ) {
+        while( !stopping && !needsWork() ) {
+            workAvailable.wait( lock );
+        }
+        if( stopping ) break;
+
+        const unsigned long seed = nextSeed++;
+        lock.unlock();
+        GeneratedLevel *level = new GeneratedLevel( configuration, seed );
+        if( !level->generate() ) {
+            delete level;
+            level = 0;
+        }
+        lock.lock();
+
+        resolved[ seed ] = level;
+        if( level ) {
+            ++stored;
+        } else {
+            ++failures;
+        }
+        levelResolved.notify_all();
+    }
+}
+
+GeneratedLevel* LevelGenerationService::next(void) {
+    boost::unique_lock<boost::mutex> lock ( mutex );
+    ++waiting;
+    workAvailable.notify_all();
+    while( true ) {
+        std::map<unsigned long, GeneratedLevel*>::iterator i;
+        while( (i = resolved.find( nextDelivery )) != resolved.end() ) {
+            GeneratedLevel *level = i->second;
+            resolved.erase( i );
+            ++nextDelivery;
+            if( level ) {
+                --stored;
+                --waiting;
+                workAvailable.notify_all();
+                return level;
+            }
+        }
+        levelResolved.wait( lock );
+    }
+}
+
+int LevelGenerationService::getFailures(void) {
+    boost::lock_guard<boost::mutex> lock ( mutex );
+    return failures;
+}
+
+};
@@ -0,0 +1,95 @@
+#ifndef H_TAC_LEVELGEN
+#define H_TAC_LEVELGEN
+
+#include "TacDungeon.h"
+
+#include "mtrand.h"
+
+#include <map>
+
+#include <boost/thread.hpp>
+
+namespace Tac {
+
+class LevelConfiguration {
+    public:
+        virtual ~LevelConfiguration(void) {}
+
+        virtual void configure(SimpleLevelGenerator&) const = 0;
+};
+
+class StandardLevelConfiguration : public LevelConfiguration {
+    // the painters and corridor settings spserver has always used
+    private:
+        int roomTarget;
+
+    public:
+        explicit StandardLevelConfiguration(int = 5);
+
+        void configure(SimpleLevelGenerator&) const;
+};
+
+class GeneratedLevel {
+    // a level generator with its own seeded prng; constructing one with
+    // the same configuration and seed always generates the same level
+    private:
+        unsigned long seed;
+        MTRand_int32 prng;
+        SimpleLevelGenerator levelgen;
+
+        GeneratedLevel(const GeneratedLevel&);
+        const GeneratedLevel& operator=(const GeneratedLevel&);
+
+    public:
+        GeneratedLevel(const LevelConfiguration&, unsigned long);
+
+        bool generate(void); // false on LevelGenerationFailure
+
+        unsigned long getSeed(void) const { return seed; }
+        DungeonSketch& getSketch(void) { return levelgen.getSketch(); }
+};
+
+class LevelGenerationService {
+    // tries consecutive seeds on worker threads, and keeps up to
+    // queueSize successful levels ready in the background. levels are
+    // handed out in seed order, so the sequence is the same whatever the
+    // number of threads; when the queue is empty, every worker works
+    // speculatively on the next seeds until one of them succeeds
+    private:
+        const LevelConfiguration& configuration;
+        const int queueSize;
+
+        boost::mutex mutex;
+        boost::condition_variable workAvailable, levelResolved;
+        boost::thread_group workers;
+
+        bool stopping;
+        int waiting, stored, failures;
+        unsigned long nextSeed, nextDelivery;
+        std::map<unsigned long, GeneratedLevel*> resolved; // 0 for failed seeds
+
+        struct Worker {
+            LevelGenerationService& service;
+
+            explicit Worker(LevelGenerationService& service) : service ( service ) {}
+            void operator()(void) { service.work(); }
+        };
+
+        LevelGenerationService(const LevelGenerationService&);
+        const LevelGenerationService& operator=(const LevelGenerationService&);
+
+        bool needsWork(void) const;
+        void work(void);
+
+    public:
+        LevelGenerationService(const LevelConfiguration&, unsigned long, int, int);
+        ~LevelGenerationService(void);
+
+        GeneratedLevel* next(void); // blocks until a level is ready; caller owns it
+
+        int getFailures(void);
+};
+
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "TacRecord.h"
+
+#include "TacServer.h"
+
+#include <stdexcept>
+
+namespace Tac {
+
+GameRecord::GameRecord(const std::string& filename) :
+    os ( filename.c_str(), std::ios::out | std::ios::trunc )
+{
+    if( !os.good() ) {
+        throw std::runtime_error( "unable to open game record " + filename );
+    }
+}
+
+void GameRecord::append(Sise::SExp *entry) {
+    Sise::outputSExp( entry, os, true );
+    delete entry;
+}
+
+void GameRecord::flush(void) {
+    os.flush();
+}
+
+GameReplay::GameReplay(const TileTypeTable& tileTypes, const UnitTypeTable& unitTypes) :
+    tileTypes ( tileTypes ),
+    unitTypes ( unitTypes ),
+    smap ( 0 )
+{
+}
+
+GameReplay::~GameReplay(void) {
+    delete smap;
+}
+
+ServerMap& GameReplay::getInitializedMap(void) {
+    if( !smap ) {
+        throw std::runtime_error( "game record does not begin with a map" );
+    }
+    return *smap;
+}
+
+static const TileType& lookupTileType(const TileTypeTable& tileTypes, const std::string& symbol) {
+    const int id = tileTypes.find( symbol );
+    if( id < 0 ) {
+        throw std::runtime_error( "game record uses unknown tile type " + symbol );
+    }
+    return tileTypes.get( id );
+}
+
+static ServerUnit& lookupUnit(ServerMap& smap, Sise::SExp *sexp) {
+    ServerUnit *rv = smap.getUnitById( *Sise::asInt( sexp ) );
+    if( !rv ) {
+        throw std::runtime_error( "game record refers to unknown unit" );
+    }
+    return *rv;
+}
+
+static ServerPlayer& lookupPlayer(ServerMap& smap, Sise::SExp *sexp) {
+    ServerPlayer *rv = smap.getPlayerById( *Sise::asInt( sexp ) );
+    if( !rv ) {
+        throw std::runtime_error( "game record refers to unknown player" );
+    }
+    return *rv;
+}
+
+void GameReplay::apply(Sise::SExp *entry) {
+    using namespace Sise;
+    Cons *args = asProperCons( entry );
+    const std::string& type = *asSymbol( args->nthcar(0) );
+
+    if( type == "map" ) {
+        if( smap ) {
+            throw std::runtime_error( "game record has more than one map" );
+        }
+        const int seed = *asInt( args->nthcar(1) );
+        const int radius = *asInt( args->nthcar(3) );
+        smap = new ServerMap( radius, tileTypes, &lookupTileType( tileTypes, *asSymbol( args->nthcar(4) ) ), seed );
+        int k = 0;
+        for(Cons *run = asCons( args->nthcar(5) ); run; run = asCons( run->getcdr() )) {
+            Cons *tileRun = asCons( run->getcar() );
+            const TileType& tt = lookupTileType( tileTypes, *asSymbol( tileRun->getcar() ) );
+            const int length = *asInt( tileRun->getcdr() );
+            for(int i=0;i<length;i++,k++) {
+                int x, y;
+                HexTools::inflateHexCoordinate( k, x, y );
+                smap->setTileType( x, y, &tt );
+            }
+        }
+        smap->recalculateMinimumStepCost();
+        smap->seedCombatPrng( asMPQ( args->nthcar(2) ).get_num().get_ui() );
+        return;
+    }
+
+    ServerMap& smap = getInitializedMap();
+
+    if( type == "seed-combat" ) {
+        smap.seedCombatPrng( asMPQ( args->nthcar(1) ).get_num().get_ui() );
+    } else if( type == "adopt-player" ) {
+        Cons *colour = asProperCons( args->nthcar(3) );
+        smap.adoptPlayer( new ServerPlayer( 0, smap,
+                                            *asInt( args->nthcar(1) ),
+                                            *asString( args->nthcar(2) ),
+                                            ServerColour( *asInt( colour->nthcar(0) ),
+                                                          *asInt( colour->nthcar(1) ),
+                                                          *asInt( colour->nthcar(2) ) ) ) );
+    } else if( type == "adopt-unit" ) {
+        const std::string& unitType = *asSymbol( args->nthcar(2) );
+        const int unitTypeId = unitTypes.find( unitType );
+        if( unitTypeId < 0 ) {
+            throw std::runtime_error( "game record uses unknown unit type " + unitType );
+        }
+        ServerUnit *unit = new ServerUnit( *asInt( args->nthcar(1) ), unitTypes.get( unitTypeId ) );
+        if( *asInt( args->nthcar(3) ) >= 0 ) {
+            unit->setController( &lookupPlayer( smap, args->nthcar(3) ) );
+        }
+        unit->setHP( *asInt( args->nthcar(4) ) );
+        unit->getAP() = ActivityPoints::fromSexp( args->nthcar(5) );
+        smap.adoptUnit( unit );
+    } else if( type == "new-player" ) {
+        smap.actionNewPlayer( lookupPlayer( smap, args->nthcar(1) ) );
+    } else if( type == "turn-begins" ) {
+        smap.actionPlayerTurnBegins( lookupPlayer( smap, args->nthcar(1) ), asMPQ( args->nthcar(2) ).get_d() );
+    } else if( type == "place-unit" ) {
+        smap.actionPlaceUnit( &lookupUnit( smap, args->nthcar(1) ), *asInt( args->nthcar(2) ), *asInt( args->nthcar(3) ) );
+    } else if( type == "move-unit" ) {
+        smap.actionMoveUnit( &lookupUnit( smap, args->nthcar(1) ), *asInt( args->nthcar(2) ), *asInt( args->nthcar(3) ) );
+    } else if( type == "remove-unit" ) {
+        smap.actionRemoveUnit( &lookupUnit( smap, args->nthcar(1) ) );
+    } else if( type == "melee-attack" ) {
+        smap.actionMeleeAttack( lookupUnit( smap, args->nthcar(1) ), lookupUnit( smap, args->nthcar(2) ) );
+    } else if( type == "cmd-move-unit" ) {
+        smap.cmdMoveUnit( smap.getPlayerById( *asInt( args->nthcar(1) ) ),
+                          *asInt( args->nthcar(2) ), *asInt( args->nthcar(3) ), *asInt( args->nthcar(4) ) );
+    } else if( type == "cmd-move-unit-path" ) {
+        HexPath steps;
+        for(Cons *step = asCons( args->nthcar(3) ); step; step = asCons( step->getcdr() )) {
+            Cons *delta = asProperCons( step->getcar() );
+            steps.push_back( HexTools::HexCoordinate( *asInt( delta->nthcar(0) ),
+                                                      *asInt( delta->nthcar(1) ) ) );
+        }
+        smap.cmdMoveUnitPath( smap.getPlayerById( *asInt( args->nthcar(1) ) ), *asInt( args->nthcar(2) ), steps );
+    } else if( type == "cmd-move-unit-to" ) {
+        smap.cmdMoveUnitTo( smap.getPlayerById( *asInt( args->nthcar(1) ) ),
+                            *asInt( args->nthcar(2) ), *asInt( args->nthcar(3) ), *asInt( args->nthcar(4) ) );
+    } else if( type == "cmd-melee-attack" ) {
+        smap.cmdMeleeAttack( smap.getPlayerById( *asInt( args->nthcar(1) ) ),
+                             *asInt( args->nthcar(2) ), *asInt( args->nthcar(3) ) );
+    } else {
+        throw std::runtime_error( "unknown game record entry " + type );
+    }
+}
+
+};
@@ -0,0 +1,74 @@
+#ifndef H_TAC_RECORD
+#define H_TAC_RECORD
+
+#include "Tac.h"
+#include "Manager.h"
+
+#include "Sise.h"
+
+#include <fstream>
+#include <string>
+
+/* A game record is the list of calls made on a ServerMap (the outermost
+   action* and cmd* calls, plus adopting players and units), one
+   S-expression per line, headed by the map's seeds and terrain. Since
+   everything random in those calls comes from the map's own generators,
+   applying the entries in order to a fresh map reproduces the game.
+
+        (map <prng-seed> <combat-seed> <radius> <default-tile> ((<tile> . <run>) ...))
+        (seed-combat <seed>)
+        (adopt-player <id> <username> (<r> <g> <b>))
+        (adopt-unit <id> <type> <controller-id or -1> <hp> <activity>)
+        (new-player <id>)
+        (turn-begins <player-id> <time-left>)
+        (place-unit <id> <x> <y>)
+        (move-unit <id> <dx> <dy>)
+        (remove-unit <id>)
+        (melee-attack <id> <target-id>)
+        (cmd-move-unit <player-id> <id> <dx> <dy>)
+        (cmd-move-unit-path <player-id> <id> ((<dx> <dy>) ...))
+        (cmd-move-unit-to <player-id> <id> <x> <y>)
+        (cmd-melee-attack <player-id> <id> <target-id>)
+*/
+
+namespace Tac {
+
+class ServerMap;
+
+class GameRecord {
+    private:
+        std::ofstream os;
+
+    public:
+        explicit GameRecord(const std::string&);
+
+        void append(Sise::SExp*); // takes ownership
+        void flush(void);
+};
+
+class GameReplay {
+    // rebuilds a recorded game headlessly: players get no server
+    // connection, so nothing is sent anywhere
+    private:
+        const TileTypeTable& tileTypes;
+        const UnitTypeTable& unitTypes;
+
+        ServerMap *smap;
+
+        GameReplay(const GameReplay&);
+        const GameReplay& operator=(const GameReplay&);
+
+        ServerMap& getInitializedMap(void);
+
+    public:
+        GameReplay(const TileTypeTable&, const UnitTypeTable&);
+        ~GameReplay(void);
+
+        void apply(Sise::SExp*);
+
+        ServerMap& getMap(void) { return getInitializedMap(); }
+};
+
+};
+
+#endif
@@ -264,6 +264,16 @@ bool AttackResult::operator==(const AttackResult& that) const {
     throw std::logic_error( "invalid state" );
 }
 
+std::size_t hash_value(const AttackResult& result) {
+    // misses compare equal whatever their damage, so it can't be hashed
+    if( result.status == AttackResult::MISS ) {
+        return 0;
+    }
+    std::size_t seed = result.status;
+    boost::hash_combine( seed, result.damage );
+    return seed;
+}
+
 ActivityPoints ActivityPoints::fromSexp(Sise::SExp* sexp) {
     using namespace Sise;
     Cons *args = asProperCons( sexp );
@@ -312,6 +322,109 @@ Outcomes<AttackResult> makeAttackBetween(const AttackCapability& att, const Defe
     return rv;
 }
 
+static unsigned long long exportULL(const mpz_class& z) {
+    unsigned long long rv = 0;
+    mpz_export( &rv, 0, -1, sizeof rv, 0, 0, z.get_mpz_t() );
+    return rv;
+}
+
+CombatOdds::CombatOdds(const Outcomes<AttackResult>& exact) {
+    const int n = exact.getNumberOfOutcomes();
+    if( n < 1 ) {
+        throw std::logic_error( "combat odds built from empty outcomes" );
+    }
+    const mpq_class& totw = exact.getTotalWeight();
+    std::vector<mpq_class> scaled;
+    std::vector<int> small, large;
+    for(int i=0;i<n;i++) {
+        outcomes.push_back( exact.getOutcome(i) );
+        probabilities.push_back( exact.getWeight(i) / totw );
+        scaled.push_back( probabilities[i] * n );
+        if( scaled[i] < 1 ) {
+            small.push_back( i );
+        } else {
+            large.push_back( i );
+        }
+    }
+
+    // Vose's construction, done in exact arithmetic so that whatever is
+    // left over at the end is exactly one
+    std::vector<mpq_class> exactThresholds ( n, mpq_class(1) );
+    aliases.resize( n );
+    for(int i=0;i<n;i++) {
+        aliases[i] = i;
+    }
+    while( !small.empty() && !large.empty() ) {
+        int l = small.back(), g = large.back();
+        small.pop_back();
+        large.pop_back();
+        exactThresholds[l] = scaled[l];
+        aliases[l] = g;
+        scaled[g] = (scaled[g] + scaled[l]) - 1;
+        if( scaled[g] < 1 ) {
+            small.push_back( g );
+        } else {
+            large.push_back( g );
+        }
+    }
+
+    const mpz_class one64 = mpz_class(1) << 64;
+    for(int i=0;i<n;i++) {
+        if( exactThresholds[i] >= 1 ) {
+            aliases[i] = i;
+            thresholds.push_back( ~0ULL );
+        } else {
+            mpz_class t = (exactThresholds[i].get_num() * one64) / exactThresholds[i].get_den();
+            thresholds.push_back( exportULL( t ) );
+        }
+    }
+}
+
+AttackResult CombatOdds::sample(gmp_randclass& prng) const {
+    const int bucket = mpz_class( prng.get_z_range( outcomes.size() ) ).get_ui();
+    const unsigned long long r = exportULL( prng.get_z_bits( 64 ) );
+    if( r < thresholds[bucket] ) {
+        return outcomes[bucket];
+    }
+    return outcomes[aliases[bucket]];
+}
+
+CombatOddsCache::Key::Key(const AttackCapability& att, const DefenseCapability& def) :
+    attack ( att.attack ),
+    shots ( att.shots ),
+    firepower ( att.firepower ),
+    defense ( def.defense ),
+    reduction ( def.reduction ),
+    resistance ( def.resistance )
+{
+}
+
+bool CombatOddsCache::Key::operator<(const Key& that) const {
+    if( attack != that.attack ) return attack < that.attack;
+    if( shots != that.shots ) return shots < that.shots;
+    if( firepower != that.firepower ) return firepower < that.firepower;
+    if( defense != that.defense ) return defense < that.defense;
+    if( reduction != that.reduction ) return reduction < that.reduction;
+    return resistance < that.resistance;
+}
+
+CombatOddsCache::~CombatOddsCache(void) {
+    for(OddsMap::iterator i = odds.begin(); i != odds.end(); i++) {
+        delete i->second;
+    }
+}
+
+const CombatOdds& CombatOddsCache::get(const AttackCapability& att, const DefenseCapability& def) {
+    Key key ( att, def );
+    OddsMap::iterator i = odds.find( key );
+    if( i != odds.end() ) {
+        return *i->second;
+    }
+    CombatOdds *rv = new CombatOdds( makeAttackBetween( att, def ) );
+    odds[ key ] = rv;
+    return *rv;
+}
+
 void ActivityPoints::forbidMovement(void) {
     movementEnergy = 0;
     movementPoints = 0;
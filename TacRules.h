@@ -10,6 +10,9 @@
 
 #include "BoxRandom.h"
 
+#include <vector>
+#include <map>
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
@@ -101,6 +104,8 @@ struct AttackResult {
     static AttackResult fromSexp(Sise::SExp*);
 };
 
+std::size_t hash_value(const AttackResult&); // for HashedOutcomes
+
 Outcomes<AttackResult> makeAttack(int,int);
 Outcomes<AttackResult> makeAttackBetween(const AttackCapability&, const DefenseCapability&);
 
@@ -162,6 +167,51 @@ struct DamageDealer : public NondeterministicTransform<AttackResult,AttackResult
 
 int getDamageOfAttack(AttackResult);
 
+class CombatOdds {
+    // the final distribution of an attack, built once from the exact
+    // Outcomes and then sampled in constant time by the alias method.
+    // the probabilities are kept exactly for display and checking; the
+    // sampler's thresholds are those probabilities rounded to 2^-64
+    private:
+        std::vector<AttackResult> outcomes;
+        std::vector<mpq_class> probabilities;
+        std::vector<unsigned long long> thresholds;
+        std::vector<int> aliases;
+
+    public:
+        explicit CombatOdds(const Outcomes<AttackResult>&);
+
+        int getNumberOfOutcomes(void) const { return outcomes.size(); }
+        const AttackResult& getOutcome(int j) const { return outcomes[j]; }
+        const mpq_class& getProbability(int j) const { return probabilities[j]; }
+
+        AttackResult sample(gmp_randclass&) const;
+};
+
+class CombatOddsCache {
+    private:
+        struct Key {
+            int attack, shots, firepower;
+            int defense, reduction;
+            mpq_class resistance;
+
+            Key(const AttackCapability&, const DefenseCapability&);
+            bool operator<(const Key&) const;
+        };
+
+        typedef std::map<Key, CombatOdds*> OddsMap;
+        OddsMap odds;
+
+        CombatOddsCache(const CombatOddsCache&);
+        const CombatOddsCache& operator=(const CombatOddsCache&);
+
+    public:
+        CombatOddsCache(void) : odds () {}
+        ~CombatOddsCache(void);
+
+        const CombatOdds& get(const AttackCapability&, const DefenseCapability&);
+};
+
 void findAllAccessible(const UnitType&, const TileTypeMap&, int, int, mpq_class, HexTools::HexReceiver&);
 
 };
@@ -1,4 +1,5 @@
 #include "TacServer.h"
+#include "TacLevelFile.h"
 
 #include "HexTools.h"
 
@@ -8,6 +9,9 @@
 #include "TacRules.h"
 
 #include <algorithm>
+#include <queue>
+#include <functional>
+#include <limits>
 
 namespace Tac {
 
@@ -25,13 +29,15 @@ void IdGenerator::addUsed(int id) {
     usedIds.insert( id );
 }
 
-ServerPlayer::ServerPlayer(SProto::Server& server, ServerMap& smap, int id, const std::string& username, ServerColour playerColour) :
+ServerPlayer::ServerPlayer(SProto::Server *server, ServerMap& smap, int id, const std::string& username, ServerColour playerColour) :
     id ( id ),
     username ( username ),
     memory ( smap.getMapSize() ),
     server ( server ),
     smap ( smap ),
-    playerColour ( playerColour )
+    playerColour ( playerColour ),
+    connection ( 0 ),
+    connectionGeneration ( 0 )
 {
     using namespace std;
     int sz = memory.getSize();
@@ -41,6 +47,28 @@ ServerPlayer::ServerPlayer(SProto::Server& server, ServerMap& smap, int id, cons
     }
 }
 
+SProto::RemoteClient* ServerPlayer::getConnection(void) const {
+    if( !server ) return 0;
+    // any login or disconnect moves the generation on, which is rare
+    // next to the packets we send
+    if( connectionGeneration != server->getConnectionGeneration() ) {
+        connection = server->getConnectedUser( username );
+        connectionGeneration = server->getConnectionGeneration();
+    }
+    return connection;
+}
+
+static TileTypeId tileTypeId(const TileTypeTable& tileTypes, const TileType *tt) {
+    const int id = tileTypes.idOf( tt );
+    if( id < 0 ) {
+        throw std::runtime_error( "tile type is not from the map's table" );
+    }
+    if( id > std::numeric_limits<TileTypeId>::max() ) {
+        throw std::runtime_error( "too many tile types for a tile" );
+    }
+    return id;
+}
+
 ServerTile::ServerTile(void) :
     tileType(  0 )
 {
@@ -51,53 +79,154 @@ ServerTile::ServerTile(void) :
     // warnings if we miss that
 }
 
-ServerMap::ServerMap(DungeonSketch& sketch, const DungeonTileMapper<TileType*>& mapper, int seed) :
+ServerMap::ServerMap(DungeonSketch& sketch, const TileTypeTable& tileTypes, const DungeonTileMapper<const TileType*>& mapper, int seed) :
     mapSize ( sketch.getMaxRadius() ),
+    tileTypes ( tileTypes ),
     prng ( seed ),
     unitIdGen ( prng() ),
     playerIdGen ( prng() ),
     tiles ( mapSize ),
     players (),
     units (),
-    gmpPrng( gmp_randinit_mt )
+    gmpPrng( gmp_randinit_mt ),
+    combatOdds (),
+    minimumStepCost ( 0 ),
+    pathGeneration ( 0 ),
+    prngSeed ( seed ),
+    combatSeed ( 0 ),
+    record ( 0 ),
+    recordDepth ( 0 )
 {
+    combatSeed = prng();
+    gmpPrng.seed( combatSeed );
     for(int r=1;r<=mapSize;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
         int x, y;
         HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
         tiles.get(x,y).setXY(x,y);
-        tiles.get(x,y).setTileType( mapper( sketch.get(x,y) ) );
+        setTileType( x, y, mapper( sketch.get(x,y) ) );
     }
     tiles.get(0,0).setXY(0,0);
-    tiles.get(0,0).setTileType( mapper( sketch.get(0,0) ) );
-    tiles.getDefault().setTileType( mapper( DungeonSketch::ST_NONE ) );
+    setTileType( 0, 0, mapper( sketch.get(0,0) ) );
+    tiles.getDefault().setTileTypeId( tileTypeId( tileTypes, mapper( DungeonSketch::ST_NONE ) ) );
+    recalculateMinimumStepCost();
 }
 
+ServerMap::ServerMap(const LevelFile& level, const TileTypeTable& tileTypes, const DungeonTileMapper<const TileType*>& mapper, int seed) :
+    mapSize ( level.getRadius() ),
+    tileTypes ( tileTypes ),
+    prng ( seed ),
+    unitIdGen ( prng() ),
+    playerIdGen ( prng() ),
+    tiles ( mapSize ),
+    players (),
+    units (),
+    gmpPrng( gmp_randinit_mt ),
+    combatOdds (),
+    minimumStepCost ( 0 ),
+    pathGeneration ( 0 ),
+    prngSeed ( seed ),
+    combatSeed ( 0 ),
+    record ( 0 ),
+    recordDepth ( 0 )
+{
+    combatSeed = prng();
+    gmpPrng.seed( combatSeed );
+    // the file is already in flat order; each sketch tile type is only
+    // mapped once, the first time it turns up
+    const int types = DungeonSketch::ST_META_CONNECTOR + 1;
+    int mapped[ types ];
+    for(int i=0;i<types;i++) {
+        mapped[i] = -1;
+    }
+    const int sz = level.getTileCount();
+    for(int k=0;k<sz;k++) {
+        const DungeonSketch::SketchTile st = level.getTile( k );
+        if( mapped[st] < 0 ) {
+            mapped[st] = tileTypeId( tileTypes, mapper( st ) );
+        }
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        tiles.get(k).setXY(x,y);
+        tiles.get(k).setTileTypeId( mapped[st] );
+    }
+    tiles.getDefault().setTileTypeId( tileTypeId( tileTypes, mapper( DungeonSketch::ST_NONE ) ) );
+    recalculateMinimumStepCost();
+}
 
-ServerMap::ServerMap(int mapSize, TileType *defaultTt, int seed) :
+ServerMap::ServerMap(int mapSize, const TileTypeTable& tileTypes, const TileType *defaultTt, int seed) :
     mapSize ( mapSize ),
+    tileTypes ( tileTypes ),
     prng ( seed ),
     unitIdGen ( prng() ),
     playerIdGen ( prng() ),
     tiles ( mapSize ),
     players (),
     units (),
-    gmpPrng( gmp_randinit_mt )
+    gmpPrng( gmp_randinit_mt ),
+    combatOdds (),
+    minimumStepCost ( 0 ),
+    pathGeneration ( 0 ),
+    prngSeed ( seed ),
+    combatSeed ( 0 ),
+    record ( 0 ),
+    recordDepth ( 0 )
 {
-    gmpPrng.seed( prng() );
+    combatSeed = prng();
+    gmpPrng.seed( combatSeed );
     reinitialize( defaultTt );
 }
 
-void ServerMap::reinitialize(TileType *defaultTt) {
+void ServerMap::seedCombatPrng(unsigned long seed) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "seed-combat" ) )
+                              ( new BigRational( mpq_class( mpz_class( seed ) ) ) )
+                        .make() );
+    }
+    combatSeed = seed;
+    gmpPrng.seed( seed );
+}
+
+void ServerMap::setRecord(GameRecord *newRecord) {
+    using namespace Sise;
+    record = newRecord;
+    if( !record ) return;
+
+    // the terrain, in flattened order, as (tile-type . run-length)
+    List runs;
+    const int sz = tiles.getSize();
+    for(int k=0;k<sz;) {
+        const TileTypeId tt = tiles.get(k).getTileTypeId();
+        int length = 0;
+        while( k < sz && tiles.get(k).getTileTypeId() == tt ) {
+            ++length;
+            ++k;
+        }
+        runs( new Cons( new Symbol( tileTypes.get( tt ).symbol ), new Int( length ) ) );
+    }
+    record->append( List()( new Symbol( "map" ) )
+                          ( new Int( prngSeed ) )
+                          ( new BigRational( mpq_class( mpz_class( combatSeed ) ) ) )
+                          ( new Int( mapSize ) )
+                          ( new Symbol( getTileType( tiles.getDefault() ).symbol ) )
+                          ( runs.make() )
+                    .make() );
+}
+
+void ServerMap::reinitialize(const TileType *defaultTt) {
     using namespace std;
+    const TileTypeId tt = tileTypeId( tileTypes, defaultTt );
     for(int r=1;r<=mapSize;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
         int x, y;
         HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
         tiles.get(x,y).setXY(x,y);
-        tiles.get(x,y).setTileType( defaultTt );
+        tiles.get(x,y).setTileTypeId( tt );
     }
     tiles.get(0,0).setXY(0,0);
-    tiles.get(0,0).setTileType( defaultTt );
-    tiles.getDefault().setTileType( defaultTt );
+    tiles.get(0,0).setTileTypeId( tt );
+    tiles.getDefault().setTileTypeId( tt );
+    recalculateMinimumStepCost();
 }
 
 ServerUnit::ServerUnit(int id, const UnitType& unitType) :
@@ -110,15 +239,16 @@ ServerUnit::ServerUnit(int id, const UnitType& unitType) :
 {
 }
 
-void trivialLevelGenerator(ServerMap& smap, TileType* wall, TileType* floor, double wallDensity, int seed) {
+void trivialLevelGenerator(ServerMap& smap, const TileType* wall, const TileType* floor, double wallDensity, int seed) {
     const int mapSize = smap.getMapSize();
     MTRand prng ( seed );
-    smap.getTile(0,0).setTileType( (prng() < wallDensity) ? wall : floor );
+    smap.setTileType( 0, 0, (prng() < wallDensity) ? wall : floor );
     for(int r=1;r<=mapSize;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
         int x, y;
         HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
-        smap.getTile(x,y).setTileType( (prng() < wallDensity) ? wall : floor );
+        smap.setTileType( x, y, (prng() < wallDensity) ? wall : floor );
     }
+    smap.recalculateMinimumStepCost();
 }
 
 void ServerTile::setUnit(ServerUnit* unit, int layer) {
@@ -159,8 +289,16 @@ int ServerUnit::leaveTile(void) {
     return -1;
 }
 
-bool ServerTile::mayEnter(const ServerUnit* unit) const {
-    if( !tileType->mayTraverse( unit->getUnitType() ) ) return false;
+void ServerMap::setTileType(int x, int y, const TileType *tt) {
+    tiles.get(x,y).setTileTypeId( tileTypeId( tileTypes, tt ) );
+}
+
+bool ServerMap::mayEnter(const ServerTile& tile, const ServerUnit* unit) const {
+    if( !getTileType( tile ).mayTraverse( unit->getUnitType() ) ) return false;
+    return tile.isFreeFor( unit );
+}
+
+bool ServerTile::isFreeFor(const ServerUnit* unit) const {
     int layer = unit->getLayer();
     if( layer < 0 ) return false; // !?
     return units[layer] == 0;
@@ -198,7 +336,7 @@ ServerTile* ServerMap::getTileForNear(const ServerUnit* unit, int cx, int cy) {
         int x, y;
         HexTools::inflateHexCoordinate( i, x, y );
         ServerTile& tile = tiles.get( x + cx, y + cy );
-        if( tile.mayEnter( unit ) ) {
+        if( mayEnter( tile, unit ) ) {
             return &tile;
         }
         i++;
@@ -214,7 +352,7 @@ ServerTile* ServerMap::getRandomTileFor(const ServerUnit* unit) {
         int guess = abs(prng()) % mapIndexableSize;
         ServerTile& tile = tiles.get( guess );
         using namespace std;
-        if( tile.mayEnter( unit ) ) {
+        if( mayEnter( tile, unit ) ) {
             int x, y;
             tile.getXY( x, y );
             return &tiles.get( guess );
@@ -239,6 +377,15 @@ void ServerMap::adoptPlayer(ServerPlayer* player) {
     if( i != players.end() ) {
         throw std::runtime_error( "oops: reusing player id or readopting player" );
     }
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "adopt-player" ) )
+                              ( new Int( player->getId() ) )
+                              ( new String( player->getUsername() ) )
+                              ( player->getColour().toSexp() )
+                        .make() );
+    }
     players[ player->getId() ] = player;
 }
 
@@ -247,6 +394,17 @@ void ServerMap::adoptUnit(ServerUnit* unit) {
     if( i != units.end() ) {
         throw std::runtime_error( "oops: reusing unit id or readopting unit" );
     }
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "adopt-unit" ) )
+                              ( new Int( unit->getId() ) )
+                              ( new Symbol( unit->getUnitType().symbol ) )
+                              ( new Int( unit->getController() ? unit->getController()->getId() : -1 ) )
+                              ( new Int( unit->getHP() ) )
+                              ( unit->getAP().toSexp() )
+                        .make() );
+    }
     units[ unit->getId() ] = unit;
 }
 
@@ -261,7 +419,7 @@ void ServerUnit::gatherFov( const ServerMap& smap, HexTools::HexFovRegion& regio
 }
 
 bool ServerMap::isOpaque(int x, int y) const {
-    return tiles.get(x,y).getTileType().opacity == Type::BLOCK;
+    return getTileType( x, y ).opacity == Type::BLOCK;
 }
 
 void ServerPlayer::gatherIndividualFov(const ServerMap& smap) {
@@ -284,6 +442,13 @@ ServerUnit* ServerMap::getUnitById(int id) {
 }
 
 bool ServerMap::actionRemoveUnit(ServerUnit *unit) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "remove-unit" ) )
+                              ( new Int( unit->getId() ) )
+                        .make() );
+    }
     ServerTile* tile = unit->getTile();
     unit->leaveTile();
 
@@ -295,8 +460,17 @@ bool ServerMap::actionRemoveUnit(ServerUnit *unit) {
 }
 
 bool ServerMap::actionPlaceUnit(ServerUnit *unit, int x, int y ) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "place-unit" ) )
+                              ( new Int( unit->getId() ) )
+                              ( new Int( x ) )
+                              ( new Int( y ) )
+                        .make() );
+    }
     ServerTile& enteringTile = tiles.get( x, y );
-    if( !enteringTile.mayEnter( unit ) ) return false;
+    if( !mayEnter( enteringTile, unit ) ) return false;
 
     using namespace std;
     unit->enterTile( &enteringTile, unit->getLayer() );
@@ -307,6 +481,15 @@ bool ServerMap::actionPlaceUnit(ServerUnit *unit, int x, int y ) {
 }
 
 bool ServerMap::actionMoveUnit(ServerUnit *unit, int dx, int dy) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "move-unit" ) )
+                              ( new Int( unit->getId() ) )
+                              ( new Int( dx ) )
+                              ( new Int( dy ) )
+                        .make() );
+    }
     if( !((abs(dx) == 3 && abs(dy) == 1)
           ||(dx == 0 && abs(dy) == 2)) ) return false;
     ServerTile *leavingTile = unit->getTile();
@@ -314,7 +497,7 @@ bool ServerMap::actionMoveUnit(ServerUnit *unit, int dx, int dy) {
     int x, y;
     leavingTile->getXY( x, y );
     ServerTile& enteringTile = tiles.get( x + dx, y + dy );
-    if( !enteringTile.mayEnter( unit ) ) return false;
+    if( !mayEnter( enteringTile, unit ) ) return false;
 
     // ok!
     unit->enterTile( &enteringTile, unit->getLayer() );
@@ -326,9 +509,116 @@ bool ServerMap::actionMoveUnit(ServerUnit *unit, int dx, int dy) {
     return true;
 }
 
+void ServerMap::recalculateMinimumStepCost(void) {
+    const int sz = tiles.getSize();
+    bool found = false;
+    for(int i=0;i<sz;i++) {
+        const TileType& tt = getTileType( tiles.get(i) );
+        if( tt.border || tt.mobility == Type::WALL ) continue;
+        if( !found || tt.baseCost < minimumStepCost ) {
+            minimumStepCost = tt.baseCost;
+            found = true;
+        }
+    }
+    if( !found ) {
+        minimumStepCost = 0;
+    }
+}
+
+bool ServerMap::findPath(const ServerUnit* unit, int tx, int ty, HexPath& path, mpq_class& totalCost) {
+    using namespace HexTools;
+    static const int dx[] = { 3, 0, -3, -3, 0, 3 },
+                     dy[] = { 1, 2, 1, -1, -2, -1 };
+    typedef std::pair<mpq_class,int> OpenEntry;
+
+    const ServerTile *startTile = unit->getTile();
+    if( !startTile ) return false;
+    if( isInvalidHexCoordinate( tx, ty ) ) return false;
+
+    const int sz = tiles.getSize();
+    int sx, sy;
+    startTile->getXY( sx, sy );
+    const int start = flattenHexCoordinate( sx, sy );
+    const int goal = flattenHexCoordinate( tx, ty );
+    if( goal < 0 || goal >= sz ) return false;
+
+    path.clear();
+    totalCost = 0;
+    if( goal == start ) return true;
+    if( !mayEnter( tiles.get( goal ), unit ) ) return false;
+
+    if( (int) pathCost.size() != sz ) {
+        pathOpenStamp.assign( sz, 0 );
+        pathClosedStamp.assign( sz, 0 );
+        pathParent.assign( sz, -1 );
+        pathCost.assign( sz, mpq_class(0) );
+        pathGeneration = 0;
+    }
+    if( ++pathGeneration == 0 ) {
+        // wrapped around; stale stamps could now look current
+        pathOpenStamp.assign( sz, 0 );
+        pathClosedStamp.assign( sz, 0 );
+        pathGeneration = 1;
+    }
+    const unsigned int gen = pathGeneration;
+
+    std::priority_queue< OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry> > open;
+    pathOpenStamp[start] = gen;
+    pathCost[start] = 0;
+    pathParent[start] = -1;
+    open.push( OpenEntry( minimumStepCost * hexDistance( sx, sy, tx, ty ), start ) );
+
+    while( !open.empty() ) {
+        const int k = open.top().second;
+        open.pop();
+        if( pathClosedStamp[k] == gen ) continue;
+        pathClosedStamp[k] = gen;
+        if( k == goal ) break;
+
+        int x, y;
+        tiles.get( k ).getXY( x, y );
+        for(int i=0;i<6;i++) {
+            const int nx = x + dx[i], ny = y + dy[i];
+            const int nk = flattenHexCoordinate( nx, ny );
+            if( nk < 0 || nk >= sz ) continue;
+            if( pathClosedStamp[nk] == gen ) continue;
+            const ServerTile& tile = tiles.get( nk );
+            mpq_class stepCost;
+            if( !getTileType( tile ).mayTraverse( unit->getUnitType(), stepCost ) ) continue;
+            if( !tile.isFreeFor( unit ) ) continue;
+            mpq_class cost = pathCost[k] + stepCost;
+            if( pathOpenStamp[nk] != gen || cost < pathCost[nk] ) {
+                pathOpenStamp[nk] = gen;
+                pathCost[nk] = cost;
+                pathParent[nk] = k;
+                open.push( OpenEntry( cost + minimumStepCost * hexDistance( nx, ny, tx, ty ), nk ) );
+            }
+        }
+    }
+
+    if( pathClosedStamp[goal] != gen ) return false;
+
+    totalCost = pathCost[goal];
+    for(int k = goal; k != start; k = pathParent[k]) {
+        int x, y;
+        tiles.get( k ).getXY( x, y );
+        path.push_back( HexCoordinate( x, y ) );
+    }
+    std::reverse( path.begin(), path.end() );
+    return true;
+}
+
 bool ServerMap::actionMeleeAttack(ServerUnit& attacker, ServerUnit& defender) {
-    Outcomes<AttackResult> results = makeAttackBetween( *attacker.getUnitType().meleeAttack, defender.getUnitType().defense );
-    AttackResult result = chooseRandomOutcome( results, gmpPrng );
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "melee-attack" ) )
+                              ( new Int( attacker.getId() ) )
+                              ( new Int( defender.getId() ) )
+                        .make() );
+    }
+    const CombatOdds& odds = combatOdds.get( *attacker.getUnitType().meleeAttack, defender.getUnitType().defense );
+    AttackResult result = odds.sample( gmpPrng );
 
     evtMeleeAttack( attacker, defender, result );
     
@@ -336,6 +626,15 @@ bool ServerMap::actionMeleeAttack(ServerUnit& attacker, ServerUnit& defender) {
 }
 
 bool ServerMap::cmdMeleeAttack(ServerPlayer* player,int unitId, int targetId ) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "cmd-melee-attack" ) )
+                              ( new Int( player ? player->getId() : -1 ) )
+                              ( new Int( unitId ) )
+                              ( new Int( targetId ) )
+                        .make() );
+    }
     ServerUnit *unit = getUnitById( unitId );
     ServerUnit *target = getUnitById( targetId );
     if( !unit || !target ) return false;
@@ -372,6 +671,16 @@ bool ServerMap::cmdMeleeAttack(ServerPlayer* player,int unitId, int targetId ) {
 }
 
 bool ServerMap::cmdMoveUnit(ServerPlayer* player,int unitId, int dx, int dy) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "cmd-move-unit" ) )
+                              ( new Int( player ? player->getId() : -1 ) )
+                              ( new Int( unitId ) )
+                              ( new Int( dx ) )
+                              ( new Int( dy ) )
+                        .make() );
+    }
     ServerUnit *unit = getUnitById(unitId);
     if( !player || !unit ) return false;
     if( player != unit->getController() ) return false;
@@ -383,7 +692,7 @@ bool ServerMap::cmdMoveUnit(ServerPlayer* player,int unitId, int dx, int dy) {
     leavingTile->getXY( x, y );
     ServerTile& enteringTile = tiles.get( x + dx, y + dy );
     mpq_class cost;
-    if( !enteringTile.getTileType().mayTraverse( unit->getUnitType(), cost ) ) return false;
+    if( !getTileType( enteringTile ).mayTraverse( unit->getUnitType(), cost ) ) return false;
     if( !unit->getAP().maySpendMovementEnergy( cost ) ) return false;
 
     bool rv = actionMoveUnit( unit, dx, dy );
@@ -397,6 +706,99 @@ bool ServerMap::cmdMoveUnit(ServerPlayer* player,int unitId, int dx, int dy) {
     return rv;
 }
 
+bool ServerMap::cmdMoveUnitPath(ServerPlayer* player, int unitId, const HexPath& steps) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        List deltas;
+        for(HexPath::const_iterator i = steps.begin(); i != steps.end(); i++) {
+            deltas( List()( new Int( i->first ) )
+                          ( new Int( i->second ) )
+                    .make() );
+        }
+        record->append( List()( new Symbol( "cmd-move-unit-path" ) )
+                              ( new Int( player ? player->getId() : -1 ) )
+                              ( new Int( unitId ) )
+                              ( deltas.make() )
+                        .make() );
+    }
+    ServerUnit *unit = getUnitById(unitId);
+    if( !player || !unit ) return false;
+    if( player != unit->getController() ) return false;
+    if( steps.empty() ) return false;
+
+    ServerTile *leavingTile = unit->getTile();
+    if( !leavingTile ) return false;
+    int x, y;
+    leavingTile->getXY( x, y );
+
+    // the whole path is checked up front: a path that turns out to be
+    // bad halfway should not leave the unit stranded halfway
+    mpq_class totalCost = 0;
+    for(HexPath::const_iterator i = steps.begin(); i != steps.end(); i++) {
+        const int dx = i->first, dy = i->second;
+        if( !((abs(dx) == 3 && abs(dy) == 1)
+              ||(dx == 0 && abs(dy) == 2)) ) return false;
+        x += dx;
+        y += dy;
+        const ServerTile& tile = tiles.get( x, y );
+        mpq_class cost;
+        if( !getTileType( tile ).mayTraverse( unit->getUnitType(), cost ) ) return false;
+        if( !tile.isFreeFor( unit ) ) return false;
+        totalCost += cost;
+    }
+    if( !unit->getAP().maySpendMovementEnergy( totalCost ) ) return false;
+
+    bool rv = true;
+    for(HexPath::const_iterator i = steps.begin(); i != steps.end(); i++) {
+        int cx, cy;
+        unit->getTile()->getXY( cx, cy );
+        mpq_class cost;
+        getTileType( cx + i->first, cy + i->second ).mayTraverse( unit->getUnitType(), cost );
+        if( !actionMoveUnit( unit, i->first, i->second ) ) {
+            rv = false;
+            break;
+        }
+        unit->getAP().spendMovementEnergy( cost );
+    }
+
+    // one activity update for the whole path rather than one per step
+    evtUnitActivityChanged( *unit );
+
+    return rv;
+}
+
+bool ServerMap::cmdMoveUnitTo(ServerPlayer* player, int unitId, int tx, int ty) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "cmd-move-unit-to" ) )
+                              ( new Int( player ? player->getId() : -1 ) )
+                              ( new Int( unitId ) )
+                              ( new Int( tx ) )
+                              ( new Int( ty ) )
+                        .make() );
+    }
+    ServerUnit *unit = getUnitById(unitId);
+    if( !player || !unit ) return false;
+    if( player != unit->getController() ) return false;
+
+    HexPath path;
+    mpq_class cost;
+    if( !findPath( unit, tx, ty, path, cost ) ) return false;
+    if( !unit->getAP().maySpendMovementEnergy( cost ) ) return false;
+
+    int x, y;
+    unit->getTile()->getXY( x, y );
+    HexPath steps;
+    for(HexPath::const_iterator i = path.begin(); i != path.end(); i++) {
+        steps.push_back( HexTools::HexCoordinate( i->first - x, i->second - y ) );
+        x = i->first;
+        y = i->second;
+    }
+    return cmdMoveUnitPath( player, unitId, steps );
+}
+
 void ServerPlayer::updateFov(const ServerMap& smap) {
     gatherIndividualFov( smap );
     // and share with allies!
@@ -518,7 +920,7 @@ void ServerPlayer::sendPlayerTurnBegins(const ServerPlayer& player, double timeL
     using namespace std;
     using namespace SProto;
     using namespace Sise;
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) return;
     rc->delsend( List()( new Symbol( "tac" ) )
                        ( new Symbol( "player-turn-begins" ) )
@@ -531,7 +933,7 @@ void ServerPlayer::sendUnitDisappears(const ServerUnit& unit) {
     using namespace std;
     using namespace SProto;
     using namespace Sise;
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) return;
     rc->delsend( List()( new Symbol( "tac" ) )
                        ( new Symbol( "unit-disappears" ) )
@@ -549,7 +951,7 @@ void ServerPlayer::sendUnitDiscovered(const ServerUnit& unit) {
 void ServerPlayer::sendUnitAP(const ServerUnit& unit) {
     using namespace Sise;
     using namespace SProto;
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) return;
     rc->delsend( List()( new Symbol( "tac" ) )
                        ( new Symbol( "ap-update" ) )
@@ -565,7 +967,7 @@ void ServerPlayer::sendUnitDiscoveredAt(const ServerUnit& unit, const ServerTile
     int x, y;
     int unitTeam = 0;
     const ServerPlayer* controller = unit.getController();
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) return;
     tile.getXY( x, y );
     rc->delsend( List()( new Symbol( "tac" ) )
@@ -587,7 +989,7 @@ void ServerPlayer::sendUnitMoved(const ServerUnit& unit, const ServerTile& fromT
     using namespace std;
     using namespace SProto;
     using namespace Sise;
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     int x0, y0, x1, y1;
     if( !rc ) return;
     fromTile.getXY( x0, y0 );
@@ -605,8 +1007,22 @@ TacTestServer::TacTestServer(SProto::Server& server, const std::string& unitsfn,
     tileTypes( tilesfn ),
     unitTypes( unitsfn ),
     tilesetMapper( tileTypes ),
-    myMap ( sketch, tilesetMapper, seed )
+    myMap ( sketch, tileTypes, tilesetMapper, seed )
 {
+    addColours();
+}
+
+TacTestServer::TacTestServer(SProto::Server& server, const std::string& unitsfn, const std::string& tilesfn, int seed, const LevelFile& level) :
+    SProto::SubServer( "tactest", server ),
+    tileTypes( tilesfn ),
+    unitTypes( unitsfn ),
+    tilesetMapper( tileTypes ),
+    myMap ( level, tileTypes, tilesetMapper, seed )
+{
+    addColours();
+}
+
+void TacTestServer::addColours(void) {
     // fill this from a lisp file? or is that overkill?
     colourPool.add( 255, 0, 0 );
     colourPool.add( 0, 255, 0 );
@@ -614,7 +1030,6 @@ TacTestServer::TacTestServer(SProto::Server& server, const std::string& unitsfn,
     colourPool.add( 255, 255, 0 );
     colourPool.add( 255, 0, 255 );
     colourPool.add( 0, 255, 255 );
-
 }
 
 void TacTestServer::delbroadcast(Sise::SExp* sexp) {
@@ -630,6 +1045,7 @@ void TacTestServer::delbroadcast(Sise::SExp* sexp) {
 }
 
 void TacTestServer::tick(double dt) {
+    myMap.flushRecord(); // here, on whichever thread runs the game
     if( turns.getNumberOfParticipants() == 0) return;
     using namespace std;
     if( turns.getCurrentRemainingTime() <= 0 ) {
@@ -638,6 +1054,12 @@ void TacTestServer::tick(double dt) {
     }
 }
 
+double TacTestServer::untilNextDeadline(void) {
+    // the end of the current turn
+    if( turns.getNumberOfParticipants() == 0 ) return -1;
+    return std::max( 0.0, turns.getCurrentRemainingTime() );
+}
+
 bool TacTestServer::hasTurn(ServerPlayer* player) {
     return player->getId() == turns.current();
 }
@@ -676,6 +1098,14 @@ void TacTestServer::announceTurn(void) {
 }
 
 void ServerMap::actionPlayerTurnBegins(ServerPlayer& turnPlayer, double timeLeft) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "turn-begins" ) )
+                              ( new Int( turnPlayer.getId() ) )
+                              ( new BigRational( mpq_class( timeLeft ) ) )
+                        .make() );
+    }
     turnPlayer.beginTurn();
 
     for(std::map<int,ServerPlayer*>::iterator i = players.begin(); i != players.end(); i++) {
@@ -719,6 +1149,26 @@ bool TacTestServer::handle( SProto::RemoteClient* cli, const std::string& cmd, S
         int dx = *asInt( args->nthcar(1) );
         int dy = *asInt( args->nthcar(2) );
         myMap.cmdMoveUnit( player, unitId, dx, dy );
+    } else if( cmd == "move-unit-path" ) {
+        Cons *args = asProperCons( arg );
+        if( !player ) return false;
+        if( !hasTurn(player) ) return false;
+        int unitId = *asInt( args->nthcar(0) );
+        HexPath steps;
+        for(Cons *step = asCons( args->nthcar(1) ); step; step = asCons( step->getcdr() )) {
+            Cons *delta = asProperCons( step->getcar() );
+            steps.push_back( HexTools::HexCoordinate( *asInt( delta->nthcar(0) ),
+                                                      *asInt( delta->nthcar(1) ) ) );
+        }
+        myMap.cmdMoveUnitPath( player, unitId, steps );
+    } else if( cmd == "move-unit-to" ) {
+        Cons *args = asProperCons( arg );
+        if( !player ) return false;
+        if( !hasTurn(player) ) return false;
+        int unitId = *asInt( args->nthcar(0) );
+        int x = *asInt( args->nthcar(1) );
+        int y = *asInt( args->nthcar(2) );
+        myMap.cmdMoveUnitTo( player, unitId, x, y );
     } else if( cmd == "test-spawn" ) {
         cli->enterChannel( "tactest", "tactest" );
         clients.insert( cli->getUsername() );
@@ -744,7 +1194,7 @@ bool TacTestServer::handle( SProto::RemoteClient* cli, const std::string& cmd, S
 //            turns.addParticipant( player->getId(), 10.0, 10.0 );
             return true;
         }
-        player = new ServerPlayer( server, myMap, myMap.generatePlayerId(), cli->getUsername(), colourPool.next() );
+        player = new ServerPlayer( &server, myMap, myMap.generatePlayerId(), cli->getUsername(), colourPool.next() );
         myMap.adoptPlayer( player );
         myMap.actionNewPlayer(*player);
         spawnPlayerUnits( player );
@@ -812,8 +1262,11 @@ void ServerPlayer::sendMemories(void) {
         }
     }
     if( recall ) {
-        RemoteClient *rc = server.getConnectedUser( username );
-        if( !rc ) return;
+        RemoteClient *rc = getConnection();
+        if( !rc ) {
+            delete recall;
+            return;
+        }
         rc->delsend( new Cons( new Symbol( "tac" ),
                      new Cons( new Symbol( "terrain-discovered" ),
                                recall )));
@@ -850,7 +1303,7 @@ void ServerPlayer::sendFovDelta(void) {
     for(HexRegion::const_iterator i = currentFov.begin(); i != currentFov.end(); i++) {
         if( !transmittedActive.contains( i->first, i->second ) ) {
             const ServerTile& tile = smap.getTile( i->first, i->second );
-            const TileType *tt = &tile.getTileType();
+            const TileType *tt = &smap.getTileType( tile );
             const TileType*& mem = memory.get( i->first, i->second );
 
             for(int j=0;j<UNIT_LAYERS;j++) {
@@ -878,10 +1331,14 @@ void ServerPlayer::sendFovDelta(void) {
 
     transmittedActive = currentFov;
 
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) {
         using namespace std;
-        cerr << "warning: failed to get connected user (" << username << ")" << endl;
+        if( server ) {
+            cerr << "warning: failed to get connected user (" << username << ")" << endl;
+        }
+        delete newlyBright;
+        delete newlyDark;
         return;
     }
     if( newlyBright ) {
@@ -919,6 +1376,13 @@ bool ServerUnit::isDead(void) const {
 }
 
 void ServerMap::actionNewPlayer(ServerPlayer& player) {
+    RecordScope scope ( recordDepth );
+    if( isRecording() ) {
+        using namespace Sise;
+        record->append( List()( new Symbol( "new-player" ) )
+                              ( new Int( player.getId() ) )
+                        .make() );
+    }
     for(std::map<int,ServerPlayer*>::iterator i = players.begin(); i != players.end(); i++) {
         player.sendPlayer( *i->second );
         i->second->sendPlayer( player );
@@ -929,7 +1393,7 @@ void ServerPlayer::sendPlayer(const ServerPlayer& player) {
     using namespace Sise;
     using namespace SProto;
     using namespace HexTools;
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) return;
     rc->delsend( List()( new Symbol( "tac" ) )
                        ( new Symbol( "introduce-player" ) )
@@ -950,7 +1414,7 @@ void ServerPlayer::sendMeleeAttack(const ServerUnit& attacker, const ServerUnit&
     using namespace Sise;
     using namespace SProto;
     using namespace HexTools;
-    RemoteClient *rc = server.getConnectedUser( username );
+    RemoteClient *rc = getConnection();
     if( !rc ) return;
     rc->delsend( List()( new Symbol( "tac" ) )
                        ( new Symbol( "melee-attack" ) )
@@ -969,9 +1433,9 @@ void TacTestServer::spawnPlayerUnits(ServerPlayer* player) {
     int x, y;
     ServerTile *tile1 = myMap.getRandomTileFor( unit1 );
     assert( tile1 );
-    myMap.adoptUnit( unit1 );
     unit1->setController( player );
     unit1->getAP() = ActivityPoints( unit1->getUnitType(), 1, 1, 1 );
+    myMap.adoptUnit( unit1 ); // after setup, so that the record has it all
     tile1->getXY( x, y );
     myMap.actionPlaceUnit( unit1, x, y );
 
@@ -979,18 +1443,18 @@ void TacTestServer::spawnPlayerUnits(ServerPlayer* player) {
     ServerTile *tile2 = myMap.getTileForNear( unit2, x, y );
     assert( tile2 );
     tile2->getXY( x, y );
-    myMap.adoptUnit( unit2 );
     unit2->setController( player );
     unit2->getAP() = ActivityPoints( unit2->getUnitType(), 1, 1, 1 );
+    myMap.adoptUnit( unit2 );
     myMap.actionPlaceUnit( unit2, x, y );
 
     unit3 = new ServerUnit( myMap.generateUnitId(), unitTypes["shieldmaiden"] );
     ServerTile *tile3 = myMap.getTileForNear( unit3, x, y );
     assert( tile3 );
     tile3->getXY( x, y );
-    myMap.adoptUnit( unit3 );
     unit3->setController( player );
     unit3->getAP() = ActivityPoints( unit3->getUnitType(), 1, 1, 1 );
+    myMap.adoptUnit( unit3 );
     myMap.actionPlaceUnit( unit3, x, y );
 }
 
@@ -1025,16 +1489,23 @@ Sise::SExp* ServerColour::toSexp(void) const {
            .make();
 }
 
-TileType* SimpleTileset::operator()(DungeonSketch::SketchTile t) const {
+SimpleTileset::SimpleTileset(const TileTypeTable& tileTypes) :
+    border ( &tileTypes[ "border" ] ),
+    floor ( &tileTypes[ "std-floor" ] ),
+    wall ( &tileTypes[ "std-wall" ] )
+{
+}
+
+const TileType* SimpleTileset::operator()(DungeonSketch::SketchTile t) const {
     switch( t ) {
         case DungeonSketch::ST_NONE:
-            return &tileTypes[ "border" ];
+            return border;
         case DungeonSketch::ST_NORMAL_DOORWAY:
         case DungeonSketch::ST_NORMAL_CORRIDOR:
         case DungeonSketch::ST_NORMAL_FLOOR:
-            return &tileTypes[ "std-floor" ];
+            return floor;
         case DungeonSketch::ST_NORMAL_WALL:
-            return &tileTypes[ "std-wall" ];
+            return wall;
         default:
             throw std::runtime_error( "encountered unknown tile sketch type (meta unstripped?)" );
     }
@@ -23,6 +23,8 @@
 
 #include "TacDungeon.h"
 
+#include "TacRecord.h"
+
 /* Thoughts.
    
    Server needs: - to keep track of the REAL map,
@@ -49,6 +51,9 @@
 namespace Tac {
 
 class ServerMap;
+class LevelFile;
+
+typedef std::vector<HexTools::HexCoordinate> HexPath;
 
 class IdGenerator { // this actually DOES need high-quality seeding, for security, if we're picky
                     // (and if we're not picky what's the use of randomizing IDs at all?)
@@ -101,13 +106,18 @@ class ServerPlayer {
         HexTools::HexFovRegion individualFov;
         std::vector<ServerUnit*> controlledUnits;
 
-        SProto::Server& server; // use getConnectedUser to, well, get a connected user
+        SProto::Server *server; // null for headless players (e.g. in replays)
         ServerMap& smap;
 
         ServerColour playerColour;
 
+        mutable SProto::RemoteClient *connection;
+        mutable unsigned long connectionGeneration; // server's, when looked up
+
+        SProto::RemoteClient* getConnection(void) const;
+
     public:
-        ServerPlayer(SProto::Server&, ServerMap&, int, const std::string&, ServerColour);
+        ServerPlayer(SProto::Server*, ServerMap&, int, const std::string&, ServerColour);
 
         ServerColour getColour(void) const { return playerColour; }
 
@@ -162,6 +172,7 @@ class ServerUnit {
         void applyAttack(AttackResult);
 
         int getHP(void) const { return hp; }
+        void setHP(int hp_) { hp = hp_; }
         int getMaxHP(void) const { return maxHp; }
 
         bool isDead(void) const;
@@ -191,9 +202,7 @@ class ServerUnit {
 
 class ServerTile {
     private:
-        TileType* tileType; // shan't be null but can change
-                            // however, will be null when first constructing
-                            // the map for practical reasons
+        TileTypeId tileType; // in the map's table; can change
         ServerUnit *units[ UNIT_LAYERS ];
 
         int x, y;
@@ -203,8 +212,8 @@ class ServerTile {
         void setXY(int x_, int y_) { x = x_; y = y_; }
         void getXY(int& x_, int& y_) const { x_ = x; y_ = y; }
 
-        void setTileType(TileType*tt) { tileType = tt; }
-        const TileType& getTileType(void) const { return *tileType; }
+        void setTileTypeId(TileTypeId tt) { tileType = tt; }
+        TileTypeId getTileTypeId(void) const { return tileType; }
 
         ServerUnit *getUnit(int j) { return units[j]; }
         const ServerUnit *getUnit(int j) const { return units[j]; }
@@ -213,13 +222,15 @@ class ServerTile {
         int clearUnit(const ServerUnit*);
         int findUnit(const ServerUnit*) const;
 
-        bool mayEnter(const ServerUnit*) const;
+        bool isFreeFor(const ServerUnit*) const;
 };
 
 class ServerMap : public HexTools::HexOpacityMap {
     private:
         int mapSize;
 
+        const TileTypeTable& tileTypes;
+
         MTRand_int32 prng;
 
         IdGenerator unitIdGen;
@@ -231,6 +242,30 @@ class ServerMap : public HexTools::HexOpacityMap {
         std::map<int, ServerUnit*> units;
 
         gmp_randclass gmpPrng;
+        CombatOddsCache combatOdds;
+
+        // scratch space for findPath, indexed by flat tile index; the
+        // stamps say whether an entry belongs to the current search so
+        // that nothing needs clearing between queries
+        mpq_class minimumStepCost;
+        unsigned int pathGeneration;
+        std::vector<unsigned int> pathOpenStamp, pathClosedStamp;
+        std::vector<int> pathParent;
+        std::vector<mpq_class> pathCost;
+
+        // calls on the map nest (cmds delegate to actions, attacks remove
+        // units), so only the outermost one goes into the record
+        int prngSeed;
+        unsigned long combatSeed;
+        GameRecord *record;
+        int recordDepth;
+
+        struct RecordScope {
+            int& depth;
+            explicit RecordScope(int& depth) : depth ( depth ) { ++depth; }
+            ~RecordScope(void) { --depth; }
+        };
+        bool isRecording(void) const { return record && recordDepth == 1; }
 
         void evtUnitAppears(ServerUnit&, ServerTile&);
         void evtUnitDisappears(ServerUnit&, ServerTile&);
@@ -239,13 +274,20 @@ class ServerMap : public HexTools::HexOpacityMap {
         void evtUnitActivityChanged(ServerUnit&);
 
     public:
-        ServerMap(int,TileType*,int);
-        ServerMap(DungeonSketch&, const DungeonTileMapper<TileType*>&,int);
-        ~ServerMap(void);
+        ServerMap(int, const TileTypeTable&, const TileType*,int);
+        ServerMap(DungeonSketch&, const TileTypeTable&, const DungeonTileMapper<const TileType*>&,int);
+        ServerMap(const LevelFile&, const TileTypeTable&, const DungeonTileMapper<const TileType*>&,int);
+        virtual ~ServerMap(void);
 
         MTRand_int32& getPrng(void) { return prng; }
+        void seedCombatPrng(unsigned long);
+
+        // starts the record with the seeds and the terrain; attach before
+        // any players or units are added, and don't change tiles afterwards
+        void setRecord(GameRecord*);
+        void flushRecord(void) { if( record ) record->flush(); }
 
-        void reinitialize(TileType*);
+        void reinitialize(const TileType*);
 
         ServerPlayer* getPlayerByUsername(const std::string&);
 
@@ -263,17 +305,35 @@ class ServerMap : public HexTools::HexOpacityMap {
 
         int getMapSize(void) const { return mapSize; }
 
+        const TileTypeTable& getTileTypes(void) const { return tileTypes; }
+        const TileType& getTileType(const ServerTile& tile) const { return tileTypes.get( tile.getTileTypeId() ); }
+        const TileType& getTileType(int x, int y) const { return getTileType( tiles.get(x,y) ); }
+        // the type must be from the map's table
+        void setTileType(int, int, const TileType*);
+
+        // the tile's type allows the unit and its layer is free
+        bool mayEnter(const ServerTile&, const ServerUnit*) const;
+
         ServerTile* getRandomTileFor(const ServerUnit*);
         ServerTile* getTileForNear(const ServerUnit*, int, int);
 
         bool isOpaque(int,int) const;
 
+        // call after changing tile types behind the map's back (the
+        // pathfinding heuristic depends on the cheapest floor)
+        void recalculateMinimumStepCost(void);
+
+        // A* from the unit's tile to the given tile, avoiding occupied
+        // tiles; the path excludes the starting tile
+        bool findPath(const ServerUnit*, int, int, HexPath&, mpq_class&);
 
         // the "cmd" family handle direct responses from the player, responses
         // which may be unreasonable. return true for success or false for failure
         // of any kind. may send information to the player (d'oh), even on failure.
         // [such as reason for failure]
         bool cmdMoveUnit(ServerPlayer*,int,int,int);
+        bool cmdMoveUnitPath(ServerPlayer*,int,const HexPath&); // relative steps
+        bool cmdMoveUnitTo(ServerPlayer*,int,int,int);
         bool cmdMeleeAttack(ServerPlayer*,int,int);
 
         // actions, like cmds, but originate from the server and so authority
@@ -288,15 +348,15 @@ class ServerMap : public HexTools::HexOpacityMap {
 
 };
 
-void trivialLevelGenerator(ServerMap&, TileType*, TileType*, double = 0.5, int = 1337);
+void trivialLevelGenerator(ServerMap&, const TileType*, const TileType*, double = 0.5, int = 1337);
 
-class SimpleTileset : public DungeonTileMapper<TileType*> {
+class SimpleTileset : public DungeonTileMapper<const TileType*> {
     private:
-        ResourceManager<TileType>& tileTypes;
+        const TileType *border, *floor, *wall;
 
     public:
-        SimpleTileset(ResourceManager<TileType>& tts) : tileTypes(tts) {}
-        TileType* operator()(DungeonSketch::SketchTile) const;
+        explicit SimpleTileset(const TileTypeTable&);
+        const TileType* operator()(DungeonSketch::SketchTile) const;
 };
 
 class TacTestServer : public SProto::SubServer {
@@ -307,8 +367,8 @@ class TacTestServer : public SProto::SubServer {
 
         std::set<std::string> clients;
 
-        ResourceManager<TileType> tileTypes;
-        ResourceManager<UnitType> unitTypes;
+        TileTypeTable tileTypes;
+        UnitTypeTable unitTypes;
 
         SimpleTileset tilesetMapper;
 
@@ -317,11 +377,15 @@ class TacTestServer : public SProto::SubServer {
         std::set<std::string> defeatedPlayers;
         ServerColourPool colourPool;
 
+        void addColours(void);
+
     public:
         TacTestServer(SProto::Server&, const std::string&, const std::string&, int, DungeonSketch& );
+        TacTestServer(SProto::Server&, const std::string&, const std::string&, int, const LevelFile& );
 
         bool handle( SProto::RemoteClient*, const std::string&, Sise::SExp* );
         void tick(double dt);
+        double untilNextDeadline(void);
 
         bool hasTurn(ServerPlayer*);
         void announceTurn(void);
@@ -330,6 +394,8 @@ class TacTestServer : public SProto::SubServer {
 
         void checkWinLossCondition(void);
         void spawnPlayerUnits(ServerPlayer*);
+
+        void setRecord(GameRecord* record) { myMap.setRecord( record ); }
 };
 
 
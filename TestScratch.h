@@ -0,0 +1,43 @@
+#ifndef H_TEST_SCRATCH
+#define H_TEST_SCRATCH
+
+#include <boost/filesystem.hpp>
+
+#include <string>
+
+class ScratchDirectory {
+    // a directory of a test's own for the server's persistent files,
+    // entered with an empty ./persist inside, and left and removed with
+    // everything in it when done. anything a crashed run left behind is
+    // removed first
+    private:
+        boost::filesystem::path outside, path;
+
+        ScratchDirectory(const ScratchDirectory&);
+        const ScratchDirectory& operator=(const ScratchDirectory&);
+
+    public:
+        explicit ScratchDirectory(const std::string& name) :
+            outside ( boost::filesystem::current_path() ),
+            path ( boost::filesystem::absolute( name ) )
+        {
+            boost::filesystem::remove_all( path );
+            boost::filesystem::create_directories( path );
+            boost::filesystem::current_path( path );
+            reset();
+        }
+
+        ~ScratchDirectory(void) {
+            boost::system::error_code ec;
+            boost::filesystem::current_path( outside, ec );
+            boost::filesystem::remove_all( path, ec );
+        }
+
+        void reset(void) {
+            // nothing persisted, as if new
+            boost::filesystem::remove_all( path / "persist" );
+            boost::filesystem::create_directory( path / "persist" );
+        }
+};
+
+#endif
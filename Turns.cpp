@@ -5,80 +5,104 @@
 
 #include <sstream>
 #include <iomanip>
+#include <cmath>
+
+#include <time.h>
 
 FischerTurnManager::FischerTurnManager(void) :
     clock (),
-    indices (),
-    increments (),
-    allocations (),
-    participants (),
+    overflow (),
+    count ( 0 ),
     index ( 0 ),
     running ( false )
 {
 }
 
+int FischerTurnManager::find(int id) const {
+    for(int i=0;i<count;i++) {
+        if( at(i).id == id ) return i;
+    }
+    return -1;
+}
+
 void FischerTurnManager::addParticipant(int id, double seconds, double increment) {
-    using namespace std;
-    increments[id] = increment;
-    allocations[id] = seconds;
-    indices[id] = participants.size();
-    participants.push_back( id );
+    Participant participant;
+    participant.id = id;
+    participant.remaining = seconds;
+    participant.increment = increment;
+    if( count < inlineParticipants ) {
+        inlined[ count ] = participant;
+    } else {
+        overflow.push_back( participant );
+    }
+    ++count;
 }
 
 void FischerTurnManager::addTime(int id, double seconds) {
-    if( participants[id] < 0 ) {
+    const int i = find( id );
+    if( i < 0 ) return;
+    flushTime();
+    if( at(i).remaining < 0 ) {
         // you can never go into negative time
         // if you get, say, 30 seconds when you're
         // technically 10 seconds past, you still
         // have 30 seconds to move, not 20
-        participants[ id ] = seconds;
+        at(i).remaining = seconds;
     } else {
-        participants[ id ] += seconds;
+        at(i).remaining += seconds;
     }
 }
 
-double FischerTurnManager::getRemainingTime(int id) {
-    flushTime();
-    return allocations[ indices[ id ] ];
+double FischerTurnManager::getRemainingTime(int id) const {
+    const int i = find( id );
+    if( i < 0 ) return 0;
+    if( i == index ) return getCurrentRemainingTime();
+    return at(i).remaining;
 }
 
-double FischerTurnManager::getCurrentRemainingTime(void) {
-    flushTime();
-    return allocations[participants[index]];
+double FischerTurnManager::getCurrentRemainingTime(void) const {
+    return getCurrentRemainingTime( running ? Timer::now() : 0 );
+}
+
+double FischerTurnManager::getCurrentRemainingTime(double now) const {
+    if( !count ) return 0;
+    if( !running ) return at(index).remaining;
+    return at(index).remaining - clock.getElapsedTime( now );
 }
 
 void FischerTurnManager::wrapIndex(void) {
-    if( index >= (int) participants.size() ) {
+    if( index >= count ) {
         index = 0;
     }
 }
 
 int FischerTurnManager::skip(void) {
-    using namespace std;
-    if( !participants.size() ) {
+    if( !count ) {
         return -1;
     }
+    flushTime();
     ++index;
     wrapIndex();
     return current();
 }
 
 int FischerTurnManager::next(void) {
-    using namespace std;
-    if( !participants.size() ) {
+    // the mover pays for the turn, then gets the increment
+    if( !count ) {
         return -1;
     }
-    allocations[participants[index]] += increments[participants[index]];
+    flushTime();
+    at(index).remaining += at(index).increment;
     ++index;
     wrapIndex();
     return current();
 }
 
-int FischerTurnManager::current(void) {
-    if( !participants.size() ) {
+int FischerTurnManager::current(void) const {
+    if( !count ) {
         return -1;
     }
-    return participants[index];
+    return at(index).id;
 }
 
 void FischerTurnManager::start(void) {
@@ -92,26 +116,31 @@ void FischerTurnManager::stop(void) {
 }
 
 void FischerTurnManager::flushTime(void) {
-    if( running ) {
-        allocations[ participants[index] ] -= clock.getElapsedTime();
+    const double elapsed = clock.lap();
+    if( running && count ) {
+        at(index).remaining -= elapsed;
     }
-    clock.reset();
 }
 
 void FischerTurnManager::removeParticipant(int id) {
     // because this is so terribly useful? yeah, I don't know
     // hackish because it's pretty much only useful for test code
-    std::vector<int>::iterator i = find( participants.begin(), participants.end(), id );
-    if( i == participants.end() ) {
+    const int i = find( id );
+    if( i < 0 ) {
         return;
     }
-    participants.erase( i );
-    increments.erase( id );
-    allocations.erase( id );
-
-    indices.clear();
-    for(std::map<int,double>::iterator j = allocations.begin(); j != allocations.end(); j++) {
-        indices[j->second] = j->first;
+    flushTime();
+    for(int j=i;j<count-1;j++) {
+        at(j) = at(j+1);
+    }
+    if( count > inlineParticipants ) {
+        overflow.pop_back();
+    }
+    --count;
+    // whoever was to move still is, unless it was the one removed, in
+    // which case it is the one after
+    if( i < index ) {
+        --index;
     }
     wrapIndex();
 }
@@ -120,15 +149,25 @@ Timer::Timer(void) {
     reset();
 }
 
+double Timer::now(void) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
 void Timer::reset(void) {
-    gettimeofday( &t0, 0 );
+    t0 = now();
+}
+
+double Timer::lap(void) {
+    const double t = now();
+    const double rv = t - t0;
+    t0 = t;
+    return rv;
 }
 
-double Timer::getElapsedTime(void) {
-    struct timeval t1, dt;
-    gettimeofday( &t1, 0 );
-    timersub( &t1, &t0, &dt );
-    return dt.tv_sec + 0.000001 * dt.tv_usec;
+double Timer::getElapsedTime(void) const {
+    return now() - t0;
 }
 
 std::string formatTimeCoarse(double seconds) {
@@ -168,7 +207,203 @@ std::string formatTime(double seconds) {
     return oss.str();
 }
 
-int FischerTurnManager::getNumberOfParticipants(void) {
-    return participants.size();
+static void unlinkAlarm(AlarmLink *link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = link;
+}
+
+static void linkAlarmBefore(AlarmLink *link, AlarmLink *at) {
+    link->prev = at->prev;
+    link->next = at;
+    at->prev->next = link;
+    at->prev = link;
+}
+
+Alarm::Alarm(void) :
+    wheel ( 0 ),
+    due ( 0 ),
+    level ( 0 ),
+    slot ( 0 )
+{
+    prev = next = this;
+}
+
+Alarm::~Alarm(void) {
+    cancel();
+}
+
+void Alarm::cancel(void) {
+    if( wheel ) {
+        wheel->cancel( this );
+    }
+}
+
+TimerWheel::TimerWheel(void) :
+    current ( now() ),
+    count ( 0 )
+{
+    for(int i=0;i<levels;i++) {
+        occupied[i] = 0;
+        for(int j=0;j<slotsPerLevel;j++) {
+            slots[i][j].prev = slots[i][j].next = &slots[i][j];
+        }
+    }
+}
+
+TimerWheel::~TimerWheel(void) {
+    for(int i=0;i<levels;i++) {
+        for(int j=0;j<slotsPerLevel;j++) {
+            while( slots[i][j].next != &slots[i][j] ) {
+                Alarm *alarm = static_cast<Alarm*>( slots[i][j].next );
+                unlinkAlarm( alarm );
+                alarm->wheel = 0;
+            }
+        }
+    }
+}
+
+long long TimerWheel::now(void) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::file(Alarm *alarm) {
+    // on the finest level whose slots, from now, reach the due time;
+    // anything due by now goes in the slot being rung. the top level
+    // wraps round, so it holds anything less than a full turn away
+    long long due = std::max( alarm->due, current );
+    if( due - current >= (1LL << (levelBits * levels)) ) {
+        // beyond the wheel; it comes round again before it's due
+        due = current + (1LL << (levelBits * levels)) - 1;
+    }
+    int level = 0;
+    while( level < levels - 1 && ((due ^ current) >> (levelBits * (level + 1))) != 0 ) {
+        ++level;
+    }
+    alarm->level = level;
+    alarm->slot = (due >> (levelBits * level)) & (slotsPerLevel - 1);
+    linkAlarmBefore( alarm, &slots[ level ][ alarm->slot ] );
+    occupied[ level ] |= 1ULL << alarm->slot;
+}
+
+void TimerWheel::unfile(Alarm *alarm) {
+    unlinkAlarm( alarm );
+    if( alarm->level >= 0 ) {
+        AlarmLink& head = slots[ alarm->level ][ alarm->slot ];
+        if( head.next == &head ) {
+            occupied[ alarm->level ] &= ~(1ULL << alarm->slot);
+        }
+    }
+}
+
+void TimerWheel::set(Alarm *alarm, long long due) {
+    alarm->cancel();
+    alarm->wheel = this;
+    alarm->due = std::max( due, current + 1 );
+    file( alarm );
+    ++count;
+}
+
+void TimerWheel::setIn(Alarm *alarm, double seconds) {
+    set( alarm, now() + (long long) ceil( seconds * 1000 ) );
+}
+
+void TimerWheel::cancel(Alarm *alarm) {
+    if( alarm->wheel != this ) return;
+    unfile( alarm );
+    alarm->wheel = 0;
+    --count;
+}
+
+void TimerWheel::cascade(int level) {
+    const int slot = (current >> (levelBits * level)) & (slotsPerLevel - 1);
+    if( !(occupied[ level ] & (1ULL << slot)) ) return;
+    occupied[ level ] &= ~(1ULL << slot);
+    AlarmLink& head = slots[ level ][ slot ];
+    AlarmLink moving;
+    moving.prev = moving.next = &moving;
+    while( head.next != &head ) {
+        AlarmLink *link = head.next;
+        unlinkAlarm( link );
+        linkAlarmBefore( link, &moving );
+    }
+    while( moving.next != &moving ) {
+        Alarm *alarm = static_cast<Alarm*>( moving.next );
+        unlinkAlarm( alarm );
+        file( alarm );
+    }
+}
+
+void TimerWheel::ringSlot(void) {
+    // alarms are taken off one at a time, so ringing one may cancel or
+    // set any of the others
+    const int slot = current & (slotsPerLevel - 1);
+    if( !(occupied[0] & (1ULL << slot)) ) return;
+    occupied[0] &= ~(1ULL << slot);
+    AlarmLink& head = slots[0][ slot ];
+    AlarmLink ringing;
+    ringing.prev = ringing.next = &ringing;
+    while( head.next != &head ) {
+        AlarmLink *link = head.next;
+        unlinkAlarm( link );
+        static_cast<Alarm*>( link )->level = -1;
+        linkAlarmBefore( link, &ringing );
+    }
+    while( ringing.next != &ringing ) {
+        Alarm *alarm = static_cast<Alarm*>( ringing.next );
+        unlinkAlarm( alarm );
+        alarm->wheel = 0;
+        --count;
+        alarm->ring();
+    }
+}
+
+long long TimerWheel::nextEvent(void) const {
+    // the start of the next non-empty slot on any level: a level 0 slot
+    // is due to ring then, one further up is due to be moved down
+    long long next = -1;
+    for(int level=0;level<levels;level++) {
+        if( !occupied[ level ] ) continue;
+        const int shift = levelBits * level;
+        const int index = (current >> shift) & (slotsPerLevel - 1);
+        const unsigned long long later = (index == slotsPerLevel - 1) ? 0 : occupied[ level ] & (~0ULL << (index + 1));
+        long long rotation = (current >> (shift + levelBits)) << (shift + levelBits);
+        int slot;
+        if( later ) {
+            slot = __builtin_ctzll( later );
+        } else {
+            slot = __builtin_ctzll( occupied[ level ] );
+            rotation += 1LL << (shift + levelBits);
+        }
+        const long long t = rotation + ((long long) slot << shift);
+        if( next < 0 || t < next ) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+double TimerWheel::untilNext(void) const {
+    const long long next = nextEvent();
+    if( next < 0 ) return -1;
+    return std::max( 0LL, next - now() ) / 1000.0;
+}
+
+void TimerWheel::advanceTo(long long to) {
+    // from one event to the next, skipping the empty slots in between
+    while( count > 0 ) {
+        const long long next = nextEvent();
+        if( next < 0 || next > to ) break;
+        current = next;
+        for(int level=levels-1;level>0;level--) {
+            if( (current & ((1LL << (levelBits * level)) - 1)) == 0 ) {
+                cascade( level );
+            }
+        }
+        ringSlot();
+    }
+    current = std::max( current, to );
 }
 
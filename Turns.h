@@ -6,29 +6,47 @@
 
 #include <string>
 
-#include <sys/time.h>
-
 class Timer {
+    // seconds on the monotonic clock, which never jumps with the wall
+    // clock; nothing to allocate, and cheap enough to read every tick
     private:
-        struct timeval t0;
+        double t0;
 
     public:
         Timer(void);
 
+        static double now(void);
+
         void reset(void);
-        double getElapsedTime(void);
+        double lap(void); // the elapsed time, starting again from the same reading
+        double getElapsedTime(void) const;
+        double getElapsedTime(double t) const { return t - t0; } // as of this now()
 };
 
 class FischerTurnManager {
+    // the participants sit in one small array in turn order, the first
+    // few inside the manager itself, so that a game's clock is a single
+    // block and finding a participant by id is a short scan
     private:
+        struct Participant {
+            int id;
+            double remaining;
+            double increment;
+        };
+
+        static const int inlineParticipants = 2;
+
         Timer clock;
-        std::map<int,int> indices;
-        std::map<int,double> increments;
-        std::map<int,double> allocations;
-        std::vector<int> participants;
+        Participant inlined[ inlineParticipants ];
+        std::vector<Participant> overflow; // any beyond those
+        int count;
         int index;
         bool running;
 
+        Participant& at(int i) { return (i < inlineParticipants) ? inlined[i] : overflow[i - inlineParticipants]; }
+        const Participant& at(int i) const { return (i < inlineParticipants) ? inlined[i] : overflow[i - inlineParticipants]; }
+        int find(int) const;
+
         void wrapIndex(void);
         void flushTime(void);
     public:
@@ -36,7 +54,7 @@ class FischerTurnManager {
 
         int skip(void);
         int next(void);
-        int current(void);
+        int current(void) const;
 
         // obv. players can't pause unilaterally or
         // this would be meaningless..
@@ -46,10 +64,81 @@ class FischerTurnManager {
         void removeParticipant(int);
         void addParticipant(int, double, double);
         void addTime(int, double);
-        double getCurrentRemainingTime(void);
-        double getRemainingTime(int);
+        double getCurrentRemainingTime(void) const;
+        double getCurrentRemainingTime(double) const; // as of this Timer::now()
+        double getRemainingTime(int) const;
+
+        int getNumberOfParticipants(void) const { return count; }
+};
+
+class TimerWheel;
+
+struct AlarmLink {
+    AlarmLink *prev, *next;
+};
+
+class Alarm : private AlarmLink {
+    // something that wants to know when a deadline has passed; it is
+    // set on one wheel at a time, and cancelled when destroyed
+    private:
+        friend class TimerWheel;
+        TimerWheel *wheel;
+        long long due; // in TimerWheel::now() milliseconds
+        int level, slot; // where on the wheel, or level -1 while ringing
+
+        Alarm(const Alarm&);
+        const Alarm& operator=(const Alarm&);
+
+    public:
+        Alarm(void);
+        virtual ~Alarm(void);
+
+        virtual void ring(void) = 0; // may set the alarm again
+
+        bool isSet(void) const { return wheel != 0; }
+        long long getDue(void) const { return due; }
+        void cancel(void);
+};
+
+class TimerWheel {
+    // a hierarchical timing wheel with millisecond resolution: alarms are
+    // filed by how far off they are, and move down to finer wheels as
+    // they come closer, so setting, cancelling and ringing take the same
+    // time however many alarms are set, and a wheel with nothing due
+    // costs nothing to advance. times are from a monotonic clock
+    private:
+        static const int levelBits = 6;
+        static const int slotsPerLevel = 1 << levelBits;
+        static const int levels = 4; // 2^24 ms, four and a half hours; longer waits are refiled
+
+        AlarmLink slots[ levels ][ slotsPerLevel ];
+        unsigned long long occupied[ levels ]; // a bit per non-empty slot
+        long long current;
+        int count;
+
+        void file(Alarm*);
+        void unfile(Alarm*);
+        void cascade(int);
+        void ringSlot(void);
+
+    public:
+        TimerWheel(void);
+        ~TimerWheel(void);
+
+        static long long now(void); // milliseconds, monotonic
+
+        void set(Alarm*, long long); // at this time, or as soon as possible if it has passed
+        void setIn(Alarm*, double); // in this many seconds
+        void cancel(Alarm*);
+
+        void advance(void) { advanceTo( now() ); }
+        void advanceTo(long long); // rings everything due by then, in order
+
+        long long getTime(void) const { return current; }
+        long long nextEvent(void) const; // when the wheel next needs advancing, or -1
+        double untilNext(void) const; // seconds until then, 0 if overdue, or -1
 
-        int getNumberOfParticipants(void);
+        int size(void) const { return count; }
 };
 
 std::string formatTime(double);
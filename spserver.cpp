@@ -4,10 +4,15 @@
 #include "TacServer.h"
 
 #include <csignal>
+#include <cmath>
 
 #include <sys/time.h>
 
+#include <boost/program_options.hpp>
+
 #include "TacDungeon.h"
+#include "TacLevelGen.h"
+#include "TacLevelFile.h"
 
 bool keepRunning = true;
 
@@ -19,56 +24,75 @@ void signal_stop(int sig) {
 
 int main(int argc, char *argv[]) {
     using namespace std;
+    namespace po = boost::program_options;
+
+    // logins are checked on the network thread when there is no core to spare
+    const int authThreads = std::min( 2, std::max( 0, (int) boost::thread::hardware_concurrency() - 1 ) );
+    // every bot game searches on this many, so a few games can't take every core
+    const int botThreads = std::min( 2, std::max( 1, (int) boost::thread::hardware_concurrency() ) );
+
+    po::options_description desc( "Allowed options" );
+    desc.add_options()
+        ("help", "display option help")
+        ("record", po::value<string>(), "write a replayable record of the tac game to this file")
+        ("level-seed", po::value<unsigned long>()->default_value( time(0) ), "first seed to try for the tac level")
+        ("level-threads", po::value<int>()->default_value( boost::thread::hardware_concurrency() ), "threads generating the tac level")
+        ("load-level", po::value<string>(), "load the tac level from this level file instead of generating one")
+        ("save-level", po::value<string>(), "save the generated tac level to this level file")
+        ("autosave", po::value<double>()->default_value( 300 ), "seconds between background saves, 0 for none")
+        ("single-threaded", "run the games on the network thread instead of executors of their own")
+        ("auth-threads", po::value<int>()->default_value( authThreads ), "threads checking logins, 0 to check them on the network thread")
+        ("nash-bot-threads", po::value<int>()->default_value( botThreads ), "threads searching for each hex bot's moves")
+        ;
+    po::variables_map vm;
+    po::store( po::parse_command_line( argc, argv, desc ), vm );
+    po::notify( vm );
+
+    if( vm.count( "help" ) ) {
+        cout << desc << endl;
+        return 1;
+    }
 
     SProto::Server server;
+    server.setAutosaveInterval( vm["autosave"].as<double>() );
 
     Nash::NashSubserver ssNash ( server );
+    ssNash.setBotThreads( vm["nash-bot-threads"].as<int>() );
 
     using namespace Tac;
-    MTRand_int32 prng ( time(0) );
-    SimpleLevelGenerator *levelgen = 0;
-    while( !levelgen ) {
-        try {
-            levelgen = new SimpleLevelGenerator( prng );
-            levelgen->setRoomTarget( 5 );
-            levelgen->setShortestCorridorsFirst();
-            levelgen->setStopWhenConnected();
-            levelgen->setSWCExtraCorridors( 2 );
-
-            levelgen->adoptPainter( new Tac::HollowHexagonRoomPainter( 6, 2 ),
-                                   1,
-                                   false );
-            levelgen->adoptPainter( new Tac::HollowHexagonRoomPainter( 7, 3 ),
-                                   1,
-                                   false );
-            levelgen->adoptPainter( new Tac::BlankRoomPainter( 3 ),
-                                   1,
-                                   false );
-
-            levelgen->adoptPainter( new Tac::HexagonRoomPainter( 4 ),
-                                   2,
-                                   true );
-            levelgen->adoptPainter( new Tac::HexagonRoomPainter( 5 ),
-                                   2,
-                                   true );
-            levelgen->adoptPainter( new Tac::HexagonRoomPainter( 6 ),
-                                   2,
-                                   true );
-            levelgen->adoptPainter( new Tac::HexagonRoomPainter( 7 ),
-                                   1,
-                                   true );
-
-            levelgen->generate();
+    Tac::TacTestServer *ssTacTest;
+    if( vm.count( "load-level" ) ) {
+        LevelFile levelFile ( vm["load-level"].as<string>() );
+        ssTacTest = new Tac::TacTestServer( server, "./config/unit-types.lisp", "./config/tile-types.lisp", time(0), levelFile );
+    } else {
+        StandardLevelConfiguration levelConfiguration;
+        GeneratedLevel *level;
+        {
+            LevelGenerationService levels ( levelConfiguration, vm["level-seed"].as<unsigned long>(), vm["level-threads"].as<int>(), 0 );
+            level = levels.next();
+            if( levels.getFailures() > 0 ) {
+                cerr << "warning: " << levels.getFailures() << " level generation failures" << endl;
+            }
         }
-        catch( LevelGenerationFailure& e ) {
-            using namespace std;
-            cerr << "warning: level generation failure, trying again.. (" << e.what() << ")" << endl;
-            delete levelgen;
-            levelgen = 0;
+        cerr << "Generated level from seed " << level->getSeed() << "." << endl;
+        if( vm.count( "save-level" ) ) {
+            writeLevelFile( vm["save-level"].as<string>(), level->getSketch() );
         }
+        ssTacTest = new Tac::TacTestServer( server, "./config/unit-types.lisp", "./config/tile-types.lisp", time(0), level->getSketch() );
+        delete level;
+    }
+
+    Tac::GameRecord *record = 0;
+    if( vm.count( "record" ) ) {
+        record = new Tac::GameRecord( vm["record"].as<string>() );
+        ssTacTest->setRecord( record );
+    }
+
+    if( !vm.count( "single-threaded" ) ) {
+        server.shardSubServer( "nash" );
+        server.shardSubServer( "tactest" );
     }
-    Tac::TacTestServer ssTacTest ( server, "./config/unit-types.lisp", "./config/tile-types.lisp", time(0), levelgen->getSketch() );
-    delete levelgen;
+    server.getAuthPool().start( vm["auth-threads"].as<int>() );
 
     server.addListener( SPROTO_STANDARD_PORT );
 
@@ -77,15 +101,28 @@ int main(int argc, char *argv[]) {
 
     cerr << "Server running. Listening on " << SPROTO_STANDARD_PORT << "." << endl;
 
+    // asleep until there is input or something on this thread is due;
+    // the signals interrupt the wait
+    Timer timer;
     while( server.isRunning() && keepRunning ) {
-        Timer timer;
-        server.manage( 100 );
+        const double wait = server.untilNextDeadline();
+        server.manage( (wait < 0) ? -1 : (int) ceil( wait * 1000 ) );
         server.tick( timer.getElapsedTime() );
+        timer.reset();
     }
 
+    server.stopShards();
+
     cerr << "Server terminating. Writing persistent data..";
 
     server.save();
 
+    if( record ) {
+        ssTacTest->setRecord( 0 );
+        delete record;
+    }
+
+    delete ssTacTest;
+
     cerr << "..done." << endl;
 }
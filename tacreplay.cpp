@@ -0,0 +1,67 @@
+// replays a game record (see TacRecord.h) headlessly, as fast as it can;
+// with --repeat it doubles as a benchmark of the server's game logic
+
+#include "TacServer.h"
+#include "TacRecord.h"
+
+#include "Turns.h"
+
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+    using namespace Tac;
+    namespace po = boost::program_options;
+
+    po::positional_options_description pd;
+
+    pd.add( "record", 1 );
+
+    po::options_description desc( "Allowed options" );
+    desc.add_options()
+        ("help", "display option help")
+        ("record", po::value<string>(), "game record to replay")
+        ("units", po::value<string>()->default_value( "./config/unit-types.lisp" ), "unit type file")
+        ("tiles", po::value<string>()->default_value( "./config/tile-types.lisp" ), "tile type file")
+        ("repeat", po::value<int>()->default_value( 1 ), "number of times to replay")
+        ;
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv ).options( desc ).positional( pd ).run(), vm );
+    po::notify( vm );
+
+    if( vm.count( "help" ) || !vm.count( "record" ) ) {
+        cout << desc << endl;
+        return 1;
+    }
+
+    TileTypeTable tileTypes ( vm["tiles"].as<string>() );
+    UnitTypeTable unitTypes ( vm["units"].as<string>() );
+
+    std::vector<Sise::SExp*> entries;
+    Timer timer;
+    Sise::readSExpsFromFile( vm["record"].as<string>(), entries );
+    double parseTime = timer.getElapsedTime();
+
+    const int repeat = vm["repeat"].as<int>();
+    timer.reset();
+    for(int r=0;r<repeat;r++) {
+        GameReplay replay ( tileTypes, unitTypes );
+        for(std::vector<Sise::SExp*>::iterator i = entries.begin(); i != entries.end(); i++) {
+            replay.apply( *i );
+        }
+    }
+    double replayTime = timer.getElapsedTime();
+
+    for(std::vector<Sise::SExp*>::iterator i = entries.begin(); i != entries.end(); i++) {
+        delete *i;
+    }
+
+    cout << entries.size() << " entries parsed in " << parseTime << "s" << endl;
+    cout << "replayed " << repeat << " times in " << replayTime << "s: "
+         << (repeat / replayTime) << " games/sec, "
+         << (repeat * entries.size() / replayTime) << " entries/sec" << endl;
+
+    return 0;
+}
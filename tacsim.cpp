@@ -0,0 +1,483 @@
+// headless battle simulator for balance testing: pits two groups of
+// units against each other on an empty arena, many times over, using the
+// same rules code as the server (ServerMap::actionMeleeAttack and friends)
+
+#include "TacServer.h"
+#include "TacDungeon.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+using namespace Tac;
+
+static const int dx[] = { 3, 0, -3, -3, 0, 3 },
+                 dy[] = { 1, 2, 1, -1, -2, -1 };
+
+struct SkirmishSetup {
+    std::vector<const UnitType*> sides[2];
+    std::vector<HexTools::HexCoordinate> positions[2];
+    int maxTurns;
+    unsigned long seed;
+};
+
+struct SkirmishStats {
+    long long skirmishes;
+    long long wins[2];
+    long long draws;
+    long long attacks[2];
+    std::map<int,long long> turns; // length of decided skirmishes
+    std::map<int,long long> damage[2]; // damage per attack, by attacking side
+
+    SkirmishStats(void) : skirmishes(0), draws(0), turns() {
+        for(int i=0;i<2;i++) {
+            wins[i] = attacks[i] = 0;
+        }
+    }
+
+    void merge(const SkirmishStats& that) {
+        skirmishes += that.skirmishes;
+        draws += that.draws;
+        for(int i=0;i<2;i++) {
+            wins[i] += that.wins[i];
+            attacks[i] += that.attacks[i];
+            for(std::map<int,long long>::const_iterator j = that.damage[i].begin(); j != that.damage[i].end(); j++) {
+                damage[i][j->first] += j->second;
+            }
+        }
+        for(std::map<int,long long>::const_iterator j = that.turns.begin(); j != that.turns.end(); j++) {
+            turns[j->first] += j->second;
+        }
+    }
+};
+
+// seeding gmp's mersenne twister is far more expensive than a whole
+// skirmish, so skirmishes are seeded in blocks of this many
+const long long SKIRMISH_BLOCK = 1024;
+
+class SkirmishWorker {
+    // runs every stride'th block of skirmishes, starting from block
+    // first, on its own map. block b is seeded with setup.seed + b alone,
+    // so the totals do not depend on the number of threads
+    private:
+        ServerMap& smap;
+        const SkirmishSetup& setup;
+        SkirmishStats& stats;
+        long long first, count, stride;
+
+        std::vector<ServerUnit*> units[2];
+
+        ServerUnit *adjacentEnemy(ServerUnit*, int);
+        int distanceToEnemy(int, int, int);
+        void advance(ServerUnit*, int);
+        void act(ServerUnit*, int);
+        void run(long long);
+
+    public:
+        SkirmishWorker(ServerMap& smap, const SkirmishSetup& setup, SkirmishStats& stats, long long first, long long count, long long stride) :
+            smap ( smap ), setup ( setup ), stats ( stats ),
+            first ( first ), count ( count ), stride ( stride )
+        {
+        }
+
+        void operator()(void) {
+            for(long long b=first;b*SKIRMISH_BLOCK<count;b+=stride) {
+                smap.seedCombatPrng( setup.seed + b );
+                for(long long i=b*SKIRMISH_BLOCK;i<count && i<(b+1)*SKIRMISH_BLOCK;i++) {
+                    run( i );
+                }
+            }
+        }
+};
+
+ServerUnit *SkirmishWorker::adjacentEnemy(ServerUnit *unit, int side) {
+    int x, y;
+    unit->getTile()->getXY( x, y );
+    ServerUnit *rv = 0;
+    for(int i=0;i<6;i++) {
+        ServerTile& tile = smap.getTile( x + dx[i], y + dy[i] );
+        for(int j=0;j<UNIT_LAYERS;j++) {
+            ServerUnit *other = tile.getUnit( j );
+            if( !other ) continue;
+            if( find( units[1-side].begin(), units[1-side].end(), other ) == units[1-side].end() ) continue;
+            // go for the weakest adjacent enemy
+            if( !rv || other->getHP() < rv->getHP() ) {
+                rv = other;
+            }
+        }
+    }
+    return rv;
+}
+
+int SkirmishWorker::distanceToEnemy(int x, int y, int side) {
+    int rv = -1;
+    for(std::vector<ServerUnit*>::iterator i = units[1-side].begin(); i != units[1-side].end(); i++) {
+        if( !(*i)->getTile() ) continue;
+        int ex, ey;
+        (*i)->getTile()->getXY( ex, ey );
+        int d = HexTools::hexDistance( x, y, ex, ey );
+        if( rv < 0 || d < rv ) {
+            rv = d;
+        }
+    }
+    return rv;
+}
+
+void SkirmishWorker::advance(ServerUnit *unit, int side) {
+    // greedy: step towards the nearest enemy for as long as that helps
+    while( !adjacentEnemy( unit, side ) ) {
+        int x, y;
+        unit->getTile()->getXY( x, y );
+        int best = distanceToEnemy( x, y, side ), bestI = -1;
+        mpq_class bestCost;
+        for(int i=0;i<6;i++) {
+            const int nx = x + dx[i], ny = y + dy[i];
+            const ServerTile& tile = smap.getTile( nx, ny );
+            mpq_class cost;
+            if( !smap.getTileType( tile ).mayTraverse( unit->getUnitType(), cost ) ) continue;
+            if( !tile.isFreeFor( unit ) ) continue;
+            if( !unit->getAP().maySpendMovementEnergy( cost ) ) continue;
+            int d = distanceToEnemy( nx, ny, side );
+            if( d < best ) {
+                best = d;
+                bestI = i;
+                bestCost = cost;
+            }
+        }
+        if( bestI < 0 ) break;
+        smap.actionMoveUnit( unit, dx[bestI], dy[bestI] );
+        unit->getAP().spendMovementEnergy( bestCost );
+    }
+}
+
+void SkirmishWorker::act(ServerUnit *unit, int side) {
+    unit->beginTurn();
+
+    if( !unit->getUnitType().meleeAttack ) return;
+
+    ServerUnit *target = adjacentEnemy( unit, side );
+    if( !target ) {
+        advance( unit, side );
+        target = adjacentEnemy( unit, side );
+    }
+    if( !target || !unit->getAP().maySpendActionPoints( 1 ) ) return;
+
+    const int hp = target->getHP();
+    smap.actionMeleeAttack( *unit, *target );
+    unit->getAP().spendActionPoint( 1 );
+    unit->getAP().forbidMovement();
+
+    stats.attacks[side]++;
+    stats.damage[side][ hp - target->getHP() ]++;
+}
+
+void SkirmishWorker::run(long long index) {
+    int nextId = 1;
+    for(int s=0;s<2;s++) {
+        units[s].clear();
+        for(int i=0;i<(int)setup.sides[s].size();i++) {
+            ServerUnit *unit = new ServerUnit( nextId++, *setup.sides[s][i] );
+            smap.actionPlaceUnit( unit, setup.positions[s][i].first, setup.positions[s][i].second );
+            units[s].push_back( unit );
+        }
+    }
+
+    // alternate who moves first, so that initiative evens out
+    const int firstSide = index % 2;
+    int winner = -1, turn;
+    for(turn=1;winner < 0 && turn<=setup.maxTurns;turn++) {
+        for(int k=0;winner < 0 && k<2;k++) {
+            const int side = (firstSide + k) % 2;
+            for(std::vector<ServerUnit*>::iterator i = units[side].begin(); i != units[side].end(); i++) {
+                if( (*i)->getTile() ) {
+                    act( *i, side );
+                }
+            }
+            winner = side;
+            for(std::vector<ServerUnit*>::iterator i = units[1-side].begin(); i != units[1-side].end(); i++) {
+                if( (*i)->getTile() ) {
+                    winner = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    stats.skirmishes++;
+    if( winner < 0 ) {
+        stats.draws++;
+    } else {
+        stats.wins[winner]++;
+        stats.turns[turn-1]++;
+    }
+
+    for(int s=0;s<2;s++) {
+        for(std::vector<ServerUnit*>::iterator i = units[s].begin(); i != units[s].end(); i++) {
+            (*i)->leaveTile();
+            delete *i;
+        }
+        units[s].clear();
+    }
+}
+
+struct DuelState {
+    // live states share the current turn, so only decided ones record it
+    int hp[2];
+    int winner;
+    int turn;
+
+    bool operator==(const DuelState& that) const {
+        return hp[0] == that.hp[0] && hp[1] == that.hp[1]
+            && winner == that.winner && turn == that.turn;
+    }
+};
+
+std::size_t hash_value(const DuelState& state) {
+    std::size_t seed = 0;
+    boost::hash_combine( seed, state.hp[0] );
+    boost::hash_combine( seed, state.hp[1] );
+    boost::hash_combine( seed, state.winner );
+    boost::hash_combine( seed, state.turn );
+    return seed;
+}
+
+struct DuelStrike : public NondeterministicTransform<DuelState,DuelState> {
+    const CombatOdds& odds;
+    const int side, turn;
+
+    DuelStrike(const CombatOdds& odds, int side, int turn) : odds ( odds ), side ( side ), turn ( turn ) {}
+
+    Outcomes<DuelState> transform(DuelState x) {
+        Outcomes<DuelState> rv;
+        if( x.winner >= 0 ) {
+            rv.add( 1, x );
+            return rv;
+        }
+        for(int i=0;i<odds.getNumberOfOutcomes();i++) {
+            DuelState y = x;
+            y.hp[1-side] -= getDamageOfAttack( odds.getOutcome(i) );
+            if( y.hp[1-side] <= 0 ) {
+                y.hp[0] = y.hp[1] = 0;
+                y.winner = side;
+                y.turn = turn;
+            }
+            rv.add( odds.getProbability(i), y );
+        }
+        return rv;
+    }
+};
+
+void runExactDuel(const UnitType& a, const UnitType& b, int maxTurns) {
+    // an engaged melee duel (no approach), with a striking first
+    using namespace std;
+    if( !a.meleeAttack || !b.meleeAttack ) {
+        throw std::runtime_error( "exact mode needs two units with melee attacks" );
+    }
+    CombatOdds odds[2] = {
+        CombatOdds( makeAttackBetween( *a.meleeAttack, b.defense ) ),
+        CombatOdds( makeAttackBetween( *b.meleeAttack, a.defense ) )
+    };
+
+    DuelState initial;
+    initial.hp[0] = a.maxHp;
+    initial.hp[1] = b.maxHp;
+    initial.winner = -1;
+    initial.turn = 0;
+    HashedOutcomes<DuelState> state;
+    state.add( 1, initial );
+
+    // misses can drag a duel out forever; once so little probability
+    // is left undecided that it could not show in the output, stop
+    const mpq_class cutoff ( mpz_class( 1 ), mpz_class( "1000000000000" ) );
+
+    Timer timer;
+    int turn;
+    mpq_class live = 1;
+    for(turn=1;turn<=maxTurns && live > cutoff;turn++) {
+        for(int side=0;side<2;side++) {
+            state = DuelStrike( odds[side], side, turn )( state );
+        }
+        live = 0;
+        for(int i=0;i<state.getNumberOfOutcomes();i++) {
+            if( state.getOutcome(i).winner < 0 ) {
+                live += state.getWeight(i);
+            }
+        }
+    }
+    double elapsed = timer.getElapsedTime();
+
+    mpq_class wins[2] = { 0, 0 }, turns = 0;
+    std::map<int,mpq_class> turnHistogram;
+    for(int i=0;i<state.getNumberOfOutcomes();i++) {
+        const DuelState& x = state.getOutcome(i);
+        if( x.winner < 0 ) continue;
+        wins[x.winner] += state.getWeight(i);
+        turns += x.turn * state.getWeight(i);
+        turnHistogram[x.turn] += state.getWeight(i);
+    }
+
+    cout << "exact duel " << a.symbol << " vs " << b.symbol
+         << " (" << a.symbol << " strikes first), " << turn-1 << " turns in " << elapsed << "s" << endl;
+    cout << "  " << a.symbol << " wins " << 100 * wins[0].get_d() << "%, "
+         << b.symbol << " wins " << 100 * wins[1].get_d() << "%, "
+         << "undecided " << 100 * live.get_d() << "%" << endl;
+    if( live < 1 ) {
+        cout << "  mean turns when decided " << mpq_class( turns / (1 - live) ).get_d() << endl;
+    }
+    for(std::map<int,mpq_class>::iterator i = turnHistogram.begin(); i != turnHistogram.end(); i++) {
+        cout << "    " << setw(4) << i->first << ": " << 100 * i->second.get_d() << "%" << endl;
+    }
+}
+
+std::vector<const UnitType*> parseSide(const UnitTypeTable& unitTypes, const std::string& spec) {
+    std::vector<const UnitType*> rv;
+    std::istringstream iss ( spec );
+    std::string name;
+    while( getline( iss, name, ',' ) ) {
+        if( !unitTypes.has( name ) ) {
+            throw std::runtime_error( "unknown unit type: " + name );
+        }
+        rv.push_back( &unitTypes[ name ] );
+    }
+    if( rv.empty() ) {
+        throw std::runtime_error( "empty side: " + spec );
+    }
+    return rv;
+}
+
+void placeSide(std::vector<HexTools::HexCoordinate>& rv, int n, int column) {
+    // a line of units along the column, centred on the x axis; y must
+    // have the same parity as x/3
+    const int parity = (abs(column) + n - 1) % 2;
+    for(int j=0;j<n;j++) {
+        rv.push_back( HexTools::HexCoordinate( 3 * column, 2 * j - (n - 1) + parity ) );
+    }
+}
+
+void outputHistogram(std::ostream& os, const std::map<int,long long>& histogram, long long total) {
+    using namespace std;
+    for(std::map<int,long long>::const_iterator i = histogram.begin(); i != histogram.end(); i++) {
+        os << "    " << setw(4) << i->first << ": " << (100.0 * i->second / total) << "%" << endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+    namespace po = boost::program_options;
+
+    po::options_description desc( "Allowed options" );
+    desc.add_options()
+        ("help", "display option help")
+        ("units", po::value<string>()->default_value( "./config/unit-types.lisp" ), "unit type file")
+        ("tiles", po::value<string>()->default_value( "./config/tile-types.lisp" ), "tile type file")
+        ("side-a", po::value<string>(), "comma-separated unit types of the first side")
+        ("side-b", po::value<string>(), "comma-separated unit types of the second side")
+        ("skirmishes", po::value<long long>()->default_value( 100000 ), "number of skirmishes")
+        ("threads", po::value<int>()->default_value( boost::thread::hardware_concurrency() ), "number of worker threads")
+        ("seed", po::value<unsigned long>()->default_value( 1337 ), "seed of the first block of skirmishes")
+        ("max-turns", po::value<int>()->default_value( 100 ), "turns before a skirmish is a draw")
+        ("distance", po::value<int>()->default_value( 6 ), "initial distance between the sides")
+        ("exact", "compute a 1v1 duel exactly instead of simulating")
+        ;
+    po::variables_map vm;
+    po::store( po::parse_command_line( argc, argv, desc ), vm );
+    po::notify( vm );
+
+    if( vm.count( "help" ) || !vm.count( "side-a" ) || !vm.count( "side-b" ) ) {
+        cout << desc << endl;
+        return 1;
+    }
+
+    TileTypeTable tileTypes ( vm["tiles"].as<string>() );
+    UnitTypeTable unitTypes ( vm["units"].as<string>() );
+    SimpleTileset tileset ( tileTypes );
+
+    SkirmishSetup setup;
+    setup.sides[0] = parseSide( unitTypes, vm["side-a"].as<string>() );
+    setup.sides[1] = parseSide( unitTypes, vm["side-b"].as<string>() );
+    setup.maxTurns = vm["max-turns"].as<int>();
+    setup.seed = vm["seed"].as<unsigned long>();
+
+    if( vm.count( "exact" ) ) {
+        if( setup.sides[0].size() != 1 || setup.sides[1].size() != 1 ) {
+            cerr << "exact mode is for 1v1 fights only" << endl;
+            return 1;
+        }
+        runExactDuel( *setup.sides[0][0], *setup.sides[1][0], setup.maxTurns );
+        return 0;
+    }
+
+    const int distance = vm["distance"].as<int>();
+    placeSide( setup.positions[0], setup.sides[0].size(), -distance / 2 );
+    placeSide( setup.positions[1], setup.sides[1].size(), distance - distance / 2 );
+
+    DungeonSketch sketch;
+    int radius = 0;
+    for(int s=0;s<2;s++) {
+        for(int i=0;i<(int)setup.positions[s].size();i++) {
+            radius = MAX( radius, HexTools::hexDistance( 0, 0, setup.positions[s][i].first, setup.positions[s][i].second ) );
+        }
+    }
+    radius += 3;
+    sketch.put( 0, 0, DungeonSketch::ST_NORMAL_FLOOR );
+    for(int r=1;r<=radius;r++) for(int i=0;i<6;i++) for(int j=0;j<r;j++) {
+        int x, y;
+        HexTools::cartesianiseHexCoordinate( i, j, r, x, y );
+        sketch.put( x, y, (r < radius) ? DungeonSketch::ST_NORMAL_FLOOR : DungeonSketch::ST_NORMAL_WALL );
+    }
+
+    const long long skirmishes = vm["skirmishes"].as<long long>();
+    const int threads = MAX( 1, vm["threads"].as<int>() );
+
+    // one map per worker, so that the workers share nothing mutable
+    std::vector<ServerMap*> maps;
+    std::vector<SkirmishStats> stats ( threads );
+    for(int i=0;i<threads;i++) {
+        maps.push_back( new ServerMap( sketch, tileTypes, tileset, 1337 ) );
+    }
+
+    Timer timer;
+    boost::thread_group workers;
+    for(int i=0;i<threads;i++) {
+        workers.create_thread( SkirmishWorker( *maps[i], setup, stats[i], i, skirmishes, threads ) );
+    }
+    workers.join_all();
+    double elapsed = timer.getElapsedTime();
+
+    SkirmishStats total;
+    for(int i=0;i<threads;i++) {
+        total.merge( stats[i] );
+        delete maps[i];
+    }
+
+    const string names[2] = { vm["side-a"].as<string>(), vm["side-b"].as<string>() };
+    cout << names[0] << " vs " << names[1] << ": "
+         << total.skirmishes << " skirmishes on " << threads << " threads in " << elapsed << "s"
+         << " (" << (total.skirmishes / elapsed) << " sims/sec)" << endl;
+    cout << "  side A wins " << (100.0 * total.wins[0] / total.skirmishes) << "%, "
+         << "side B wins " << (100.0 * total.wins[1] / total.skirmishes) << "%, "
+         << "draws " << (100.0 * total.draws / total.skirmishes) << "%" << endl;
+    const long long decided = total.wins[0] + total.wins[1];
+    if( decided > 0 ) {
+        double meanTurns = 0;
+        for(std::map<int,long long>::iterator i = total.turns.begin(); i != total.turns.end(); i++) {
+            meanTurns += (double) i->first * i->second / decided;
+        }
+        cout << "  turns when decided (mean " << meanTurns << "):" << endl;
+        outputHistogram( cout, total.turns, decided );
+    }
+    for(int s=0;s<2;s++) {
+        if( total.attacks[s] == 0 ) continue;
+        cout << "  damage per attack by side " << (char)('A' + s) << " (" << total.attacks[s] << " attacks):" << endl;
+        outputHistogram( cout, total.damage[s], total.attacks[s] );
+    }
+
+    return 0;
+}
@@ -0,0 +1,356 @@
+#include "SProto.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cstdio>
+#include <csignal>
+
+#include <openssl/sha.h>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+// checks the hex of getHash against the stream that used to write it, and
+// that challenges are letters drawn evenly and not repeated; logs clients
+// in and out through the auth pool with and without threads, dropping one
+// in the middle. then measures 10000 clients reconnecting at once, on the
+// network thread and across the pool
+
+using namespace SProto;
+
+const std::string scratchDir = "./test-auth-scratch"; // for the server's persistent files
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+std::string numbered(const std::string& prefix, int i) {
+    std::ostringstream oss;
+    oss << prefix << i;
+    return oss.str();
+}
+
+std::string streamHash(const std::string& data) {
+    // getHash as it was
+    unsigned char rawhash[SHA256_DIGEST_LENGTH];
+    std::ostringstream oss;
+    oss << std::setfill('0') <<  std::hex << std::right << std::setw(2);
+    SHA256( (const unsigned char*) data.data(), data.length(), rawhash );
+    for(int i=0;i<SHA256_DIGEST_LENGTH;i++) {
+        oss << (int) rawhash[i];
+    }
+    return oss.str();
+}
+
+bool checkHashes(int count) {
+    unsigned long state = 17;
+    for(int n=0;n<count;n++) {
+        std::string data ( nextRandom( state ) % 200, ' ' );
+        for(size_t i=0;i<data.size();i++) {
+            data[i] = (char) nextRandom( state );
+        }
+        if( getHash( data ) != streamHash( data ) ) return false;
+    }
+    return getHash( "" ) == streamHash( "" );
+}
+
+bool checkChallenges(Server& server, int count) {
+    std::set<std::string> seen;
+    std::vector<long> letters ( 26, 0 );
+    for(int n=0;n<count;n++) {
+        const std::string challenge = server.makeChallenge();
+        if( challenge.size() != 64 || !seen.insert( challenge ).second ) return false;
+        for(size_t i=0;i<challenge.size();i++) {
+            if( challenge[i] < 'a' || challenge[i] > 'z' ) return false;
+            ++letters[ challenge[i] - 'a' ];
+        }
+    }
+    const double expected = 64.0 * count / 26;
+    for(int i=0;i<26;i++) {
+        if( letters[i] < 0.9 * expected || letters[i] > 1.1 * expected ) return false;
+    }
+    return true;
+}
+
+struct Connection {
+    RemoteClient *client;
+    int peer;
+    std::string partial;
+};
+
+Connection connect(Server& server) {
+    int fds[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) ) {
+        throw std::runtime_error( "unable to make socket pair" );
+    }
+    Connection rv;
+    rv.client = new RemoteClient( fds[0], server, "test", server.getClients() );
+    rv.client->setState( RemoteClient::ST_VERSION_OK );
+    rv.peer = fds[1];
+    server.adopt( rv.client );
+    return rv;
+}
+
+void sendPacket(Connection& c, const std::string& packet) {
+    const std::string line = packet + "\n";
+    if( write( c.peer, line.data(), line.size() ) != (ssize_t) line.size() ) {
+        throw std::runtime_error( "unable to write to server" );
+    }
+}
+
+std::vector<std::string> words(std::string line) {
+    std::replace( line.begin(), line.end(), '(', ' ' );
+    std::replace( line.begin(), line.end(), ')', ' ' );
+    std::replace( line.begin(), line.end(), '"', ' ' );
+    std::istringstream iss ( line );
+    std::vector<std::string> rv;
+    std::string word;
+    while( iss >> word ) {
+        rv.push_back( word );
+    }
+    return rv;
+}
+
+std::vector<std::string> await(Server& server, Connection& c, const std::string& packet) {
+    // the words of the next packet of that name, or none after a while
+    Timer timer;
+    while( timer.getElapsedTime() < 5 ) {
+        server.manage( 10 );
+        server.tick( 0 );
+        char buffer[ 4096 ];
+        ssize_t got;
+        while( (got = recv( c.peer, buffer, sizeof buffer, MSG_DONTWAIT )) > 0 ) {
+            c.partial.append( buffer, got );
+        }
+        size_t end;
+        while( (end = c.partial.find( '\n' )) != std::string::npos ) {
+            std::vector<std::string> w = words( c.partial.substr( 0, end ) );
+            c.partial.erase( 0, end + 1 );
+            if( !w.empty() && w[0] == packet ) return w;
+        }
+    }
+    return std::vector<std::string>();
+}
+
+bool login(Server& server, Connection& c, const std::string& username, const std::string& password) {
+    sendPacket( c, "(user login-request \"" + username + "\")" );
+    std::vector<std::string> challenge = await( server, c, "login-challenge" );
+    if( challenge.size() != 3 || challenge[1] != username ) return false;
+    const std::string response = makeChallengeResponse( username, makePasswordHash( username, password ), challenge[2] );
+    sendPacket( c, "(user login-response \"" + response + "\")" );
+    server.manage( 10 );
+    server.tick( 0 );
+    server.getAuthPool().flush();
+    return c.client->hasUsername() && c.client->getUsername() == username;
+}
+
+bool checkLogins(Server& server, int threads) {
+    server.getAuthPool().start( threads );
+    Connection c = connect( server );
+    bool ok = login( server, c, "alice", "secret" ) && !await( server, c, "login-ok" ).empty();
+    Connection d = connect( server );
+    ok = ok && !login( server, d, "alice", "guess" ) && !await( server, d, "login-failure" ).empty();
+    ok = ok && !login( server, d, "nobody", "secret" ) && !await( server, d, "login-failure" ).empty();
+
+    // gone before the pool is done with it
+    sendPacket( d, "(user login-request \"alice\")" );
+    std::vector<std::string> challenge = await( server, d, "login-challenge" );
+    ok = ok && challenge.size() == 3;
+    if( ok ) {
+        sendPacket( d, "(user login-response \"" + makeChallengeResponse( "alice", makePasswordHash( "alice", "secret" ), challenge[2] ) + "\")" );
+    }
+    close( d.peer );
+    Timer timer;
+    while( server.getClients().size() > 1 && timer.getElapsedTime() < 5 ) {
+        server.manage( 10 );
+        server.tick( 0 );
+    }
+    ok = ok && server.getClients().size() == 1 && server.getConnectedUser( "alice" ) == c.client;
+
+    close( c.peer );
+    timer.reset();
+    while( !server.getClients().empty() && timer.getElapsedTime() < 5 ) {
+        server.manage( 10 );
+        server.tick( 0 );
+    }
+    server.getAuthPool().stop();
+    return ok && server.getClients().empty();
+}
+
+RemoteClient* quietClient(Server& server) {
+    // not watched by the server, which would read the end of /dev/null
+    RemoteClient *rc = new RemoteClient( open( "/dev/null", O_WRONLY ), server, "test", server.getClients() );
+    rc->setState( RemoteClient::ST_VERSION_OK );
+    return rc;
+}
+
+void userPacket(Server& server, RemoteClient *cli, const std::string& cmd, const std::string& value) {
+    Sise::SExp *packet = Sise::List()( new Sise::Symbol( cmd ) )
+                                     ( new Sise::String( value ) )
+                         .make();
+    server.handle( cli, "user", packet );
+    delete packet;
+}
+
+struct StormTimes {
+    double challenged, checked, busy; // seconds
+};
+
+double threadTime(void) {
+    // the cpu time of this thread, which the pool's threads don't count
+    // towards even when they share its core
+    struct timespec ts;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool reconnectStorm(Server& server, const std::vector<RemoteClient*>& clients, const std::vector<std::string>& usernames,
+                    const std::vector<std::string>& passwordHashes, StormTimes& times) {
+    // every client asks for a challenge at once and answers at once; the
+    // clients' own hashing is left out of the time, and the polling for
+    // outcomes out of the network thread's
+    using namespace std;
+    const int n = clients.size();
+    for(int i=0;i<n;i++) {
+        clients[i]->setUsername( "" );
+    }
+
+    Timer total;
+    double cpu = threadTime();
+    for(int i=0;i<n;i++) {
+        userPacket( server, clients[i], "login-request", usernames[i] );
+    }
+    times.busy = threadTime() - cpu;
+    vector<string> challenges ( n );
+    int challenged = 0;
+    while( challenged < n && total.getElapsedTime() < 60 ) {
+        cpu = threadTime();
+        server.manage( 10 );
+        server.tick( 0 );
+        times.busy += threadTime() - cpu;
+        challenged = 0;
+        for(int i=0;i<n;i++) {
+            string username;
+            challenged += clients[i]->getLoggingIn( username, challenges[i] );
+        }
+    }
+    times.challenged = total.getElapsedTime();
+
+    vector<string> responses ( n );
+    for(int i=0;i<n;i++) {
+        responses[i] = makeChallengeResponse( usernames[i], passwordHashes[i], challenges[i] );
+    }
+
+    Timer checks;
+    cpu = threadTime();
+    for(int i=0;i<n;i++) {
+        userPacket( server, clients[i], "login-response", responses[i] );
+    }
+    times.busy += threadTime() - cpu;
+    int loggedIn = 0;
+    while( loggedIn < n && checks.getElapsedTime() < 60 ) {
+        cpu = threadTime();
+        server.manage( 10 );
+        server.tick( 0 );
+        times.busy += threadTime() - cpu;
+        loggedIn = 0;
+        for(int i=0;i<n;i++) {
+            loggedIn += clients[i]->hasUsername();
+        }
+    }
+    times.checked = checks.getElapsedTime();
+    for(int i=0;i<n;i++) {
+        clients[i]->transmit();
+    }
+    return challenged == n && loggedIn == n;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+    // a client is dropped while the server still has something to send it
+    signal( SIGPIPE, SIG_IGN );
+
+    bool ok = checkHashes( 100000 );
+    cout << "hashes against the stream " << (ok ? "ok" : "FAILED") << endl;
+
+    Server *server = new Server();
+    const bool challenges = checkChallenges( *server, 10000 );
+    ok = ok && challenges;
+    cout << "challenges " << (challenges ? "ok" : "FAILED") << endl;
+
+    server->registerUsername( "alice", "secret" );
+    const bool logins = checkLogins( *server, 0 ) && checkLogins( *server, 2 );
+    ok = ok && logins;
+    cout << "logins on the network thread and through the pool " << (logins ? "ok" : "FAILED") << endl;
+
+    {
+        unsigned long state = 3;
+        vector<string> inputs ( 100000 );
+        for(size_t i=0;i<inputs.size();i++) {
+            inputs[i] = numbered( "abcdefghi123456789user", nextRandom( state ) ) + numbered( "secret", i );
+        }
+        size_t sum = 0;
+        Timer timer;
+        for(size_t i=0;i<inputs.size();i++) {
+            sum += streamHash( inputs[i] ).size();
+        }
+        const double streamed = timer.getElapsedTime();
+        timer.reset();
+        for(size_t i=0;i<inputs.size();i++) {
+            sum -= getHash( inputs[i] ).size();
+        }
+        const double tabled = timer.getElapsedTime();
+        ok = ok && sum == 0;
+        cout << "hashing: " << (1e9 * streamed / inputs.size()) << "ns through the stream, "
+             << (1e9 * tabled / inputs.size()) << "ns by table" << endl;
+    }
+
+    const int users = 10000;
+    vector<string> usernames ( users ), passwordHashes ( users );
+    for(int i=0;i<users;i++) {
+        usernames[i] = numbered( "user", i );
+        server->registerUsername( usernames[i], numbered( "password", i ) );
+        passwordHashes[i] = makePasswordHash( usernames[i], numbered( "password", i ) );
+    }
+    vector<RemoteClient*> clients;
+    for(int i=0;i<users;i++) {
+        clients.push_back( quietClient( *server ) );
+    }
+    cout << users << " clients reconnecting at once, best of 3:" << endl;
+    const int threads[] = { 0, 1, 2, 4 };
+    for(int i=0;i<4;i++) {
+        server->getAuthPool().start( threads[i] );
+        StormTimes best;
+        for(int run=0;run<3;run++) {
+            StormTimes times;
+            ok = reconnectStorm( *server, clients, usernames, passwordHashes, times ) && ok;
+            if( run == 0 || times.challenged + times.checked < best.challenged + best.checked ) {
+                best = times;
+            }
+        }
+        server->getAuthPool().stop();
+        cout << "  " << threads[i] << " threads: all logged in after " << (1e3 * (best.challenged + best.checked)) << "ms ("
+             << (1e3 * best.challenged) << "ms to challenge, " << (1e3 * best.checked) << "ms to check), network thread cpu "
+             << (1e3 * best.busy) << "ms" << endl;
+    }
+
+    for(int i=0;i<users;i++) {
+        delete clients[i];
+    }
+    delete server;
+
+    return ok ? 0 : 1;
+}
@@ -2,6 +2,8 @@
 
 #include <iostream>
 
+#include <ctime>
+
 struct MaybeAdd10IfOddTransform : public NondeterministicTransform<int,int> {
     Outcomes<int> transform(int x) {
         Outcomes<int> rv;
@@ -87,5 +89,39 @@ int main(int argc, char *argv[]) {
     }
     cout << "E(successes): 49%" << endl;
     cout << "Successes: " << successes << "/" << trials2 << endl;
+
+    cout << endl;
+
+    const int distinct[] = { 10, 100, 1000 };
+    const int chained = 10;
+    for(int k=0;k<3;k++) {
+        Outcomes<int> plain;
+        for(int i=0;i<distinct[k];i++) {
+            plain.add( mpq_class(1, distinct[k]), 2 * i );
+        }
+        HashedOutcomes<int> hashed ( plain );
+
+        clock_t t0 = clock();
+        for(int i=0;i<chained;i++) {
+            plain = AddBernoulliTrial(mpq_class(1,3))( plain );
+        }
+        clock_t t1 = clock();
+        for(int i=0;i<chained;i++) {
+            hashed = AddBernoulliTrial(mpq_class(1,3))( hashed );
+        }
+        clock_t t2 = clock();
+
+        Outcomes<int> exported = hashed.toOutcomes();
+        bool same = exported.getNumberOfOutcomes() == plain.getNumberOfOutcomes();
+        for(int i=0;same && i<plain.getNumberOfOutcomes();i++) {
+            same = exported.getOutcome(i) == plain.getOutcome(i)
+                && exported.getWeight(i) == plain.getWeight(i);
+        }
+
+        cout << distinct[k] << " distinct outcomes, " << chained << " transforms: "
+             << "linear " << (double)(t1-t0) / CLOCKS_PER_SEC << "s, "
+             << "hashed " << (double)(t2-t1) / CLOCKS_PER_SEC << "s, "
+             << (same ? "identical" : "DIFFERENT") << endl;
+    }
     return 0;
 }
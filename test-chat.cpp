@@ -0,0 +1,196 @@
+#include "SProto.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// checks that channel messages reach exactly the members of the channel
+// through joins, parts and disconnects, then measures channel chat with
+// 10000 users spread over 1000 channels, delivering through the channel
+// registry and, as before, by checking every client for membership
+
+using namespace SProto;
+
+const std::string scratchDir = "./test-chat-scratch"; // for the server's persistent files
+
+std::string numbered(const std::string& prefix, int i) {
+    std::ostringstream oss;
+    oss << prefix << i;
+    return oss.str();
+}
+
+RemoteClient* connect(Server& server, int fd, const std::string& name) {
+    RemoteClient *rc = new RemoteClient( fd, server, "test", server.getClients() );
+    rc->setState( RemoteClient::ST_VERSION_OK );
+    rc->setUsername( name );
+    return rc;
+}
+
+Sise::SExp* channelMessage(const std::string& channel, const std::string& text) {
+    using namespace Sise;
+    return List()( new Symbol( "cm" ) )
+                 ( new Symbol( "user" ) )
+                 ( new String( channel ) )
+                 ( new String( text ) )
+           .make();
+}
+
+void say(Server& server, RemoteClient *cli, const std::string& channel, const std::string& text) {
+    Sise::SExp *arg = channelMessage( channel, text );
+    server.handle( cli, "chat", arg );
+    delete arg;
+}
+
+int countMessages(RemoteClient *rc, int peer) {
+    // every message is one line
+    rc->transmit();
+    char buffer[ 4096 ];
+    int lines = 0;
+    ssize_t got;
+    while( (got = recv( peer, buffer, sizeof buffer, MSG_DONTWAIT )) > 0 ) {
+        lines += std::count( buffer, buffer + got, '\n' );
+    }
+    return lines;
+}
+
+bool checkDelivery(void) {
+    Server server;
+    std::vector<RemoteClient*> clients;
+    std::vector<int> peers;
+    for(int i=0;i<4;i++) {
+        int fds[2];
+        if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) ) return false;
+        clients.push_back( connect( server, fds[0], numbered( "user", i ) ) );
+        peers.push_back( fds[1] );
+    }
+    clients[0]->enterChannel( "user", "a" );
+    clients[1]->enterChannel( "user", "a" );
+    clients[1]->enterChannel( "user", "a" );
+    clients[2]->enterChannel( "user", "b" );
+    clients[3]->enterChannel( "user", "a" );
+    clients[3]->leaveChannel( "user", "a" );
+
+    say( server, clients[0], "a", "hello" );
+    bool ok = countMessages( clients[0], peers[0] ) == 1
+              && countMessages( clients[1], peers[1] ) == 1
+              && countMessages( clients[2], peers[2] ) == 0
+              && countMessages( clients[3], peers[3] ) == 0;
+
+    delete clients[1];
+    say( server, clients[0], "a", "still there?" );
+    ok = ok && countMessages( clients[0], peers[0] ) == 1
+            && server.getChannelMembers( ChannelId( "user", "a" ) )->size() == 1;
+
+    say( server, clients[3], "a", "not a member" );
+    ok = ok && countMessages( clients[0], peers[0] ) == 0
+            && countMessages( clients[3], peers[3] ) == 1; // the refusal
+
+    delete clients[0];
+    delete clients[2];
+    delete clients[3];
+    ok = ok && server.getChannelMembers( ChannelId( "user", "a" ) ) == 0
+            && server.getChannelMembers( ChannelId( "user", "b" ) ) == 0;
+    for(int i=0;i<4;i++) {
+        close( peers[i] );
+    }
+    return ok;
+}
+
+void sayToEveryMember(Server& server, RemoteClient *cli, const std::string& channel, const std::string& text) {
+    // the old delivery: every client checked, every copy output separately
+    using namespace Sise;
+    SExp *sexp = List()( new Symbol( "chat" ) )
+                       ( new Symbol( "channel" ) )
+                       ( new Symbol( "user" ) )
+                       ( new String( channel ) )
+                       ( new String( cli->getUsername() ) )
+                       ( new String( text ) )
+                       ( new Int( time(0) ) )
+                 .make();
+    Server::RClientList& clients = server.getClients();
+    for(Server::RClientList::iterator i = clients.begin(); i != clients.end(); i++) {
+        if( (*i)->isInChannel( "user", channel ) ) {
+            (*i)->send( sexp );
+        }
+    }
+    delete sexp;
+}
+
+void benchmark(Server& server, bool registry, int messages) {
+    using namespace std;
+    const int users = server.getClients().size(), channels = 1000, memberships = 3;
+    const string text = "a chat message of moderate length, as they tend to be";
+
+    vector<double> latencies;
+    unsigned long state = 12345;
+    Timer total;
+    double elapsed = 0;
+    for(int m=0;m<messages;m++) {
+        state = state * 1103515245 + 12345;
+        const int user = (state >> 8) % users;
+        const int channel = (user * 7 + 131 * ((state >> 20) % memberships)) % channels;
+        RemoteClient *cli = server.getConnectedUser( numbered( "user", user ) );
+        const string name = numbered( "channel", channel );
+
+        Timer timer;
+        if( registry ) {
+            say( server, cli, name, text );
+        } else {
+            sayToEveryMember( server, cli, name, text );
+        }
+        latencies.push_back( timer.getElapsedTime() );
+        elapsed += latencies.back();
+
+        if( m % 1000 == 999 ) {
+            Server::RClientList& clients = server.getClients();
+            for(Server::RClientList::iterator i = clients.begin(); i != clients.end(); i++) {
+                (*i)->transmit();
+            }
+        }
+    }
+    sort( latencies.begin(), latencies.end() );
+    cout << "  " << (registry ? "channel registry" : "checking every client") << ": "
+         << (messages / elapsed) << " messages/sec"
+         << ", latency p50 " << (1e6 * latencies[ messages / 2 ]) << "us"
+         << " p99 " << (1e6 * latencies[ (messages * 99) / 100 ]) << "us" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkDelivery();
+    cout << "channel delivery " << (ok ? "ok" : "FAILED") << endl;
+
+    const int users = 10000, channels = 1000, memberships = 3;
+    {
+        Server server;
+        for(int i=0;i<users;i++) {
+            RemoteClient *rc = connect( server, open( "/dev/null", O_WRONLY ), numbered( "user", i ) );
+            for(int j=0;j<memberships;j++) {
+                rc->enterChannel( "user", numbered( "channel", (i * 7 + 131 * j) % channels ) );
+            }
+        }
+        cout << users << " users in " << channels << " channels, "
+             << memberships << " channels each:" << endl;
+        benchmark( server, false, 2000 );
+        benchmark( server, true, 100000 );
+
+        while( !server.getClients().empty() ) {
+            delete server.getClients().back();
+        }
+    }
+
+    return ok ? 0 : 1;
+}
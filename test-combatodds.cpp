@@ -0,0 +1,64 @@
+#include "TacRules.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+    using namespace Tac;
+
+    const char *names[] = { "scout", "swordsman", "shieldmaiden" };
+    const int nnames = 3;
+    UnitTypeTable unitTypes ( "./config/unit-types.lisp" );
+    gmp_randclass prng (gmp_randinit_mt);
+    CombatOddsCache cache;
+
+    const int trials = 20000;
+
+    bool ok = true;
+    for(int a=0;a<nnames;a++) for(int d=0;d<nnames;d++) {
+        const UnitType& att = unitTypes[ names[a] ];
+        const UnitType& def = unitTypes[ names[d] ];
+
+        // the cached table must hold exactly the distribution that
+        // makeAttackBetween computes
+        Outcomes<AttackResult> exact = makeAttackBetween( *att.meleeAttack, def.defense );
+        const CombatOdds& odds = cache.get( *att.meleeAttack, def.defense );
+        bool same = exact.getNumberOfOutcomes() == odds.getNumberOfOutcomes();
+        for(int i=0;same && i<exact.getNumberOfOutcomes();i++) {
+            same = exact.getOutcome(i) == odds.getOutcome(i)
+                && exact.getWeight(i) / exact.getTotalWeight() == odds.getProbability(i);
+        }
+
+        ok = ok && same;
+
+        mpq_class exval = 0;
+        for(int i=0;i<odds.getNumberOfOutcomes();i++) {
+            exval += odds.getProbability(i) * getDamageOfAttack( odds.getOutcome(i) );
+        }
+
+        double oldSum = 0, newSum = 0;
+        Timer timer;
+        for(int i=0;i<trials;i++) {
+            oldSum += getDamageOfAttack( chooseRandomOutcome( makeAttackBetween( *att.meleeAttack, def.defense ), prng ) );
+        }
+        double oldRate = trials / timer.getElapsedTime();
+        timer.reset();
+        for(int i=0;i<trials;i++) {
+            newSum += getDamageOfAttack( cache.get( *att.meleeAttack, def.defense ).sample( prng ) );
+        }
+        double newRate = trials / timer.getElapsedTime();
+
+        cout << names[a] << " vs " << names[d] << ": "
+             << (same ? "exact match" : "MISMATCH") << ", "
+             << odds.getNumberOfOutcomes() << " outcomes, "
+             << "E(damage) " << exval.get_d()
+             << " (old avg " << oldSum / trials
+             << ", new avg " << newSum / trials << "); "
+             << oldRate << " -> " << newRate << " attacks/sec" << endl;
+    }
+
+    return ok ? 0 : 1;
+}
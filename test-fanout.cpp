@@ -0,0 +1,141 @@
+#include "SProto.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// checks the server's index of connected users through logins, repeated
+// logins and disconnects, then measures sending one packet to each of
+// 5000 connected users, looking them up by scanning the client list as
+// before, through the index, and through a cached connection
+
+using namespace SProto;
+
+const std::string scratchDir = "./test-fanout-scratch"; // for the server's persistent files
+
+std::string username(int i) {
+    std::ostringstream oss;
+    oss << "user" << i;
+    return oss.str();
+}
+
+RemoteClient* connect(Server& server, const std::string& name) {
+    RemoteClient *rc = new RemoteClient( open( "/dev/null", O_WRONLY ), server, "test", server.getClients() );
+    if( name != "" ) {
+        rc->setUsername( name );
+    }
+    return rc;
+}
+
+RemoteClient* scanForUser(Server& server, const std::string& name) {
+    Server::RClientList& clients = server.getClients();
+    for(Server::RClientList::iterator i = clients.begin(); i != clients.end(); i++) {
+        if( (*i)->hasUsername() && (*i)->getUsername() == name ) {
+            return *i;
+        }
+    }
+    return 0;
+}
+
+bool checkIndex(void) {
+    Server server;
+    RemoteClient *anonymous = connect( server, "" );
+    RemoteClient *alice = connect( server, "alice" );
+    RemoteClient *bob = connect( server, "bob" );
+    RemoteClient *alice2 = connect( server, "alice" );
+    bool ok = server.getConnectedUser( "alice" ) == alice
+              && server.getConnectedUser( "bob" ) == bob
+              && server.getConnectedUser( "" ) == 0
+              && server.getClients().size() == 4;
+
+    unsigned long generation = server.getConnectionGeneration();
+    delete alice;
+    ok = ok && server.getConnectedUser( "alice" ) == alice2
+            && server.getConnectionGeneration() != generation;
+    delete alice2;
+    ok = ok && server.getConnectedUser( "alice" ) == 0;
+
+    bob->setUsername( "carol" );
+    ok = ok && server.getConnectedUser( "bob" ) == 0
+            && server.getConnectedUser( "carol" ) == bob;
+    delete anonymous;
+    ok = ok && server.getClients().size() == 1 && server.getClients()[0] == bob;
+    delete bob;
+    return ok && server.getClients().empty();
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkIndex();
+    cout << "connected user index " << (ok ? "ok" : "FAILED") << endl;
+
+    const int users = 5000, packets = 20;
+    Server *server_ = new Server();
+    Server& server = *server_;
+    vector<string> names;
+    for(int i=0;i<users;i++) {
+        names.push_back( username(i) );
+        connect( server, names.back() );
+    }
+    Sise::SExp *packet = Sise::List()( new Sise::Symbol( "tac" ) )
+                                     ( new Sise::Symbol( "update" ) )
+                                     ( new Sise::Int( 42 ) )
+                         .make();
+
+    // the packets themselves are the same in every run
+    Timer timer;
+    for(int p=0;p<packets;p++) {
+        for(int i=0;i<users;i++) {
+            scanForUser( server, names[i] )->send( packet );
+        }
+    }
+    double scanning = timer.getElapsedTime() / packets;
+
+    timer.reset();
+    for(int p=0;p<packets;p++) {
+        for(int i=0;i<users;i++) {
+            server.getConnectedUser( names[i] )->send( packet );
+        }
+    }
+    double indexed = timer.getElapsedTime() / packets;
+
+    vector<RemoteClient*> cache ( users, (RemoteClient*) 0 );
+    vector<unsigned long> cacheGeneration ( users, 0 );
+    timer.reset();
+    for(int p=0;p<packets;p++) {
+        for(int i=0;i<users;i++) {
+            if( cacheGeneration[i] != server.getConnectionGeneration() ) {
+                cache[i] = server.getConnectedUser( names[i] );
+                cacheGeneration[i] = server.getConnectionGeneration();
+            }
+            cache[i]->send( packet );
+        }
+    }
+    double cached = timer.getElapsedTime() / packets;
+    delete packet;
+
+    timer.reset();
+    while( !server.getClients().empty() ) {
+        delete server.getClients()[ server.getClients().size() / 2 ];
+    }
+    double disconnecting = timer.getElapsedTime();
+
+    cout << "one packet to each of " << users << " users: " << scanning << "s scanning the clients"
+         << ", " << indexed << "s through the index, " << cached << "s through cached connections" << endl;
+    cout << "disconnecting all of them: " << disconnecting << "s" << endl;
+
+    delete server_;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+#include "HexTools.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+#include <stdexcept>
+
+// checks HexTorusWrapping against the old recursive search for the core
+// cell, for every cell of several periods around the core and for cells
+// far off, on tori of radius 1 to 30, then measures lookups both ways
+
+using namespace HexTools;
+
+const int dx[] = { 3, 0, -3, -3, 0, 3 };
+const int dy[] = { 1, 2, 1, -1, -2, -1 };
+
+void searchToCore(int radius, int& x, int& y) {
+    // HexTorusMap::toCore as it was
+    int guard = 100;
+    int i, j, r;
+    polariseHexCoordinate( x, y, i, j, r );
+    if( r < radius ||
+        ( (r == radius) &&
+          ( (i == 0 && j != 0) ||
+            (i == 1) ||
+            (i == 2) ) ) ) {
+        return;
+    }
+    if( r == radius ) switch( i ) {
+        case 0:
+        case 5:
+            x *= -1;
+            searchToCore( radius, x, y );
+            return;
+        case 3:
+            cartesianiseHexCoordinate( 0, radius - j, r, x, y );
+            searchToCore( radius, x, y );
+            return;
+        case 4:
+            cartesianiseHexCoordinate( 1, radius - j, r, x, y );
+            searchToCore( radius, x, y );
+            return;
+        default:
+            throw std::logic_error( "illegal late-return state on rim of core hex" );
+    }
+    y %= 6 * radius;
+    x %= 6 * radius;
+    x -= 6 * radius;
+    y -= 6 * radius;
+    do {
+        polariseHexCoordinate( x, y, i, j, r );
+        if( r <= radius ) {
+            searchToCore( radius, x, y );
+            return;
+        }
+        if( y > 0 ) {
+            if( x > 0 ) {
+                x -= 3 * radius;
+                y -= 3 * radius;
+            } else {
+                x += 3 * radius;
+                y -= 3 * radius;
+            }
+        } else {
+            if( x > 0 ) {
+                x -= 3 * radius;
+                y += 3 * radius;
+            } else {
+                x += 3 * radius;
+                y += 3 * radius;
+            }
+        }
+        if( --guard <= 0 ) {
+            throw std::logic_error( "illegal state - probably looping infinitely");
+        }
+    } while(true);
+}
+
+int searchIndex(int radius, int x, int y) {
+    searchToCore( radius, x, y );
+    return flattenHexCoordinate( x, y );
+}
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+void randomCell(unsigned long& state, int spread, int& x, int& y) {
+    const int i = (int) (nextRandom( state ) % (2 * spread + 1)) - spread;
+    x = 3 * i;
+    y = 2 * ((int) (nextRandom( state ) % (2 * spread + 1)) - spread) + i;
+}
+
+bool checkRadius(int radius) {
+    HexTorusWrapping wrapping ( radius );
+    // every cell within two periods each way
+    const int columns = 4 * radius, rows = 12 * radius;
+    for(int i=-columns;i<=columns;i++) for(int y=-rows;y<=rows;y++) {
+        if( isInvalidHexCoordinate( 3 * i, y ) ) {
+            if( wrapping.toIndex( 3 * i, y ) != -1 ) return false;
+            continue;
+        }
+        const int k = searchIndex( radius, 3 * i, y );
+        if( wrapping.toIndex( 3 * i, y ) != k
+            || HexTorusWrapping::canonicalIndex( radius, 3 * i, y ) != k ) return false;
+    }
+    // and far off
+    unsigned long state = radius;
+    for(int n=0;n<20000;n++) {
+        int x, y;
+        randomCell( state, 1000000, x, y );
+        if( wrapping.toIndex( x, y ) != searchIndex( radius, x, y ) ) return false;
+    }
+    for(int k=0;k<hexCircleSize(radius);k++) {
+        int x, y;
+        inflateHexCoordinate( k, x, y );
+        for(int i=0;i<6;i++) {
+            if( wrapping.getNeighbour( k, i ) != searchIndex( radius, x + dx[i], y + dy[i] ) ) return false;
+        }
+    }
+    return true;
+}
+
+bool benchmark(int radius, int lookups) {
+    // the neighbours of random cells of the core, as a Go map asks for
+    // them, and cells far off
+    using namespace std;
+    HexTorusWrapping wrapping ( radius );
+    unsigned long state = 3;
+    vector<int> cells ( lookups ), cxs ( lookups ), cys ( lookups ), xs ( lookups ), ys ( lookups );
+    for(int n=0;n<lookups;n++) {
+        cells[n] = nextRandom( state ) % hexCircleSize( radius );
+        inflateHexCoordinate( cells[n], cxs[n], cys[n] );
+        randomCell( state, 100000, xs[n], ys[n] );
+    }
+    long sums[5] = { 0, 0, 0, 0, 0 }; // each way, which must agree
+    Timer timer;
+    for(int n=0;n<lookups;n++) {
+        const int x = cxs[n], y = cys[n];
+        for(int i=0;i<6;i++) {
+            sums[0] += searchIndex( radius, x + dx[i], y + dy[i] );
+        }
+    }
+    const double searched = timer.getElapsedTime();
+    timer.reset();
+    for(int n=0;n<lookups;n++) {
+        const int x = cxs[n], y = cys[n];
+        for(int i=0;i<6;i++) {
+            sums[1] += wrapping.toIndex( x + dx[i], y + dy[i] );
+        }
+    }
+    const double windowed = timer.getElapsedTime();
+    timer.reset();
+    for(int n=0;n<lookups;n++) {
+        for(int i=0;i<6;i++) {
+            sums[2] += wrapping.getNeighbour( cells[n], i );
+        }
+    }
+    const double tabled = timer.getElapsedTime();
+    timer.reset();
+    for(int n=0;n<lookups;n++) {
+        sums[3] += searchIndex( radius, xs[n], ys[n] );
+    }
+    const double farSearched = timer.getElapsedTime();
+    timer.reset();
+    for(int n=0;n<lookups;n++) {
+        sums[4] += wrapping.toIndex( xs[n], ys[n] );
+    }
+    const double farWindowed = timer.getElapsedTime();
+
+    const double neighbours = 6.0 * lookups;
+    cout << "  radius " << radius << ": neighbours " << (1e9 * searched / neighbours) << "ns searching, "
+         << (1e9 * windowed / neighbours) << "ns by window, "
+         << (1e9 * tabled / neighbours) << "ns by table; far cells "
+         << (1e9 * farSearched / lookups) << "ns searching, "
+         << (1e9 * farWindowed / lookups) << "ns by window" << endl;
+    return sums[0] == sums[1] && sums[1] == sums[2] && sums[3] == sums[4];
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    bool ok = true;
+    for(int radius=1;radius<=30 && ok;radius++) {
+        ok = checkRadius( radius );
+        if( !ok ) {
+            cout << "radius " << radius << ": ";
+        }
+    }
+    cout << "torus wrapping against the search for radii 1-30 " << (ok ? "ok" : "FAILED") << endl;
+
+    cout << "lookups:" << endl;
+    const int radii[] = { 5, 10, 20 };
+    for(int i=0;i<3;i++) {
+        ok = benchmark( radii[i], 1000000 ) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+#include "HtGo.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+// plays random games of Go on hex tori of radius 2 to 10 with the strings
+// kept by HexTorusGoMap and with the groups flooded on every move, as put
+// used to, checking that moves, captures, liberties and positions agree,
+// then measures random games per second both ways on radius 5, 10 and 20
+
+using namespace HexTools;
+
+const int dx[] = { 3, 0, -3, -3, 0, 3 };
+const int dy[] = { 1, 2, 1, -1, -2, -1 };
+
+class FloodGoMap {
+    // the old put, flooding each neighbouring group and its liberties
+    // into sets; cells are found through another HexTorusGoMap's get
+    private:
+        HexTorusGoMap *wrap;
+        HexMap<HtGoTile> tiles;
+        bool koActive;
+        int koCoreX, koCoreY;
+
+    public:
+        FloodGoMap(HexTorusGoMap& wrap, int radius) :
+            wrap ( &wrap ),
+            tiles ( radius ),
+            koActive ( false )
+        {
+            for(int k=0;k<tiles.getSize();k++) {
+                int x, y;
+                inflateHexCoordinate( k, x, y );
+                tiles.get( k ).coreX = x;
+                tiles.get( k ).coreY = y;
+            }
+        }
+
+        HtGoTile& get(int x, int y) {
+            const HtGoTile& tile = wrap->get( x, y );
+            return tiles.get( tile.coreX, tile.coreY );
+        }
+
+        HtGoTile& getNeighbourOf(const HtGoTile& tile, int i) {
+            return get( tile.coreX + dx[i], tile.coreY + dy[i] );
+        }
+
+        PointSet groupOf(const HtGoTile& start) {
+            PointSet rv, open;
+            open.add( start );
+            rv.add( start );
+            while( !open.empty() ) {
+                std::pair<int,int> coords = open.pop();
+                HtGoTile& tile = get( coords.first, coords.second );
+                for(int i=0;i<6;i++) {
+                    HtGoTile& nb = getNeighbourOf( tile, i );
+                    if( nb.state == tile.state && !rv.has( nb ) ) {
+                        open.add( nb );
+                        rv.add( nb );
+                    }
+                }
+            }
+            return rv;
+        }
+
+        PointSet libertiesOf(const PointSet& group) {
+            PointSet rv;
+            for(PointSet::const_iterator i = group.begin(); i != group.end(); i++) {
+                const HtGoTile& tile = get( i->first, i->second );
+                for(int j=0;j<6;j++) {
+                    HtGoTile& nb = getNeighbourOf( tile, j );
+                    if( nb.state == HtGoTile::BLANK ) {
+                        rv.add( nb );
+                    }
+                }
+            }
+            return rv;
+        }
+
+        int removeGroup(const PointSet& xys) {
+            for(PointSet::const_iterator i = xys.begin(); i != xys.end(); i++) {
+                get( i->first, i->second ).state = HtGoTile::BLANK;
+            }
+            return xys.size();
+        }
+
+        int put(int x, int y, HtGoTile::TileState st) {
+            int enemyCaptures = 0, selfCaptures = 0;
+            int singleCaptureX = 0, singleCaptureY = 0;
+            HtGoTile& placed = get( x, y );
+            placed.state = st;
+            for(int i=0;i<6;i++) {
+                HtGoTile& tile = getNeighbourOf( placed, i );
+                if( tile.state == st || tile.state == HtGoTile::BLANK ) continue;
+                PointSet group = groupOf( tile );
+                if( libertiesOf( group ).empty() ) {
+                    singleCaptureX = tile.coreX;
+                    singleCaptureY = tile.coreY;
+                    enemyCaptures += removeGroup( group );
+                }
+            }
+            PointSet selfGroup = groupOf( placed );
+            if( libertiesOf( selfGroup ).empty() ) {
+                selfCaptures += removeGroup( selfGroup );
+            }
+            koActive = enemyCaptures == 1 && selfCaptures == 0;
+            koCoreX = singleCaptureX;
+            koCoreY = singleCaptureY;
+            return enemyCaptures;
+        }
+
+        bool putWouldBeLegal(int x, int y, HtGoTile::TileState st) {
+            HtGoTile& tile = get( x, y );
+            if( tile.state != HtGoTile::BLANK ) return false;
+            if( koActive && koCoreX == tile.coreX && koCoreY == tile.coreY ) return false;
+            FloodGoMap copy = *this;
+            copy.put( x, y, st );
+            return copy.get( x, y ).state == st;
+        }
+};
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+void torusCells(HexTorusGoMap& map, int radius, std::vector< std::pair<int,int> >& cells) {
+    // the cells of the core that get() hands out, one for each on the torus
+    cells.clear();
+    for(int k=0;k<hexCircleSize(radius);k++) {
+        int x, y;
+        inflateHexCoordinate( k, x, y );
+        const HtGoTile& tile = map.get( x, y );
+        if( tile.coreX == x && tile.coreY == y ) {
+            cells.push_back( std::make_pair( x, y ) );
+        }
+    }
+}
+
+template<class M>
+bool randomMove(M& map, const std::vector< std::pair<int,int> >& cells, HtGoTile::TileState colour, unsigned long& state, int& captures) {
+    // a few tries at a random legal move; false to pass
+    for(int tries=0;tries<8;tries++) {
+        const std::pair<int,int>& cell = cells[ nextRandom( state ) % cells.size() ];
+        if( map.putWouldBeLegal( cell.first, cell.second, colour ) ) {
+            captures += map.put( cell.first, cell.second, colour );
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class M>
+int randomGame(M& map, const std::vector< std::pair<int,int> >& cells, unsigned long& state) {
+    // until both pass or the board has been filled twice over; the moves
+    int moves = 0, passes = 0, captures = 0;
+    HtGoTile::TileState colour = HtGoTile::BLACK;
+    while( passes < 2 && moves < 2 * (int) cells.size() ) {
+        if( randomMove( map, cells, colour, state, captures ) ) {
+            passes = 0;
+            ++moves;
+        } else {
+            ++passes;
+        }
+        colour = (colour == HtGoTile::BLACK) ? HtGoTile::WHITE : HtGoTile::BLACK;
+    }
+    return moves;
+}
+
+bool checkGames(int radius, int games) {
+    HexTorusGoMap wrap ( radius );
+    std::vector< std::pair<int,int> > cells;
+    torusCells( wrap, radius, cells );
+    unsigned long state = 1000 + radius;
+    int totalCaptures = 0;
+    for(int g=0;g<games;g++) {
+        HexTorusGoMap map ( radius );
+        FloodGoMap flood ( wrap, radius );
+        HtGoTile::TileState colour = HtGoTile::BLACK;
+        for(int move=0;move<2*(int)cells.size();move++) {
+            unsigned long floodState = state;
+            int captures = 0, floodCaptures = 0;
+            const bool moved = randomMove( map, cells, colour, state, captures );
+            const bool floodMoved = randomMove( flood, cells, colour, floodState, floodCaptures );
+            if( moved != floodMoved || captures != floodCaptures || state != floodState ) return false;
+            totalCaptures += captures;
+            for(size_t i=0;i<cells.size();i++) {
+                const int x = cells[i].first, y = cells[i].second;
+                const HtGoTile& tile = flood.get( x, y );
+                if( map.get( x, y ).state != tile.state ) return false;
+                const int libs = map.libertyCount( x, y );
+                if( tile.state == HtGoTile::BLANK ) {
+                    if( libs != -1 ) return false;
+                } else if( libs != flood.libertiesOf( flood.groupOf( tile ) ).size()
+                           || map.groupOf( x, y ).size() != flood.groupOf( tile ).size() ) {
+                    return false;
+                }
+            }
+            colour = (colour == HtGoTile::BLACK) ? HtGoTile::WHITE : HtGoTile::BLACK;
+        }
+    }
+    // random play on a torus captures plenty; make sure some were checked
+    return totalCaptures > 0;
+}
+
+template<class M>
+void benchmark(M& empty, int radius, const std::vector< std::pair<int,int> >& cells, const char *way, double duration) {
+    using namespace std;
+    unsigned long state = 55 + radius;
+    long games = 0, moves = 0;
+    Timer timer;
+    while( games == 0 || timer.getElapsedTime() < duration ) {
+        M map = empty;
+        moves += randomGame( map, cells, state );
+        ++games;
+    }
+    const double elapsed = timer.getElapsedTime();
+    cout << "  radius " << radius << ", " << way << ": " << (games / elapsed) << " games/sec, "
+         << (1e6 * elapsed / moves) << "us per move (" << games << " games, " << moves << " moves)" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    bool ok = true;
+    const int radii[] = { 2, 3, 5, 10 }, checked[] = { 40, 20, 6, 1 };
+    for(int i=0;i<4;i++) {
+        ok = ok && checkGames( radii[i], checked[i] );
+    }
+    cout << "strings against flooded groups " << (ok ? "ok" : "FAILED") << endl;
+
+    cout << "random games:" << endl;
+    const int benchmarked[] = { 5, 10, 20 };
+    for(int i=0;i<3;i++) {
+        const int radius = benchmarked[i];
+        HexTorusGoMap empty ( radius );
+        vector< pair<int,int> > cells;
+        torusCells( empty, radius, cells );
+        FloodGoMap floodEmpty ( empty, radius );
+        benchmark( floodEmpty, radius, cells, "flooding groups", 2 );
+        benchmark( empty, radius, cells, "keeping strings", 2 );
+    }
+
+    return ok ? 0 : 1;
+}
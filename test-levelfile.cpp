@@ -0,0 +1,176 @@
+#include "TacServer.h"
+#include "TacLevelGen.h"
+#include "TacLevelFile.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <sys/stat.h>
+
+// round-trips generated levels through level files, and compares the
+// time to get a ServerMap by regenerating, by reading an S-expression
+// dump and by mapping a level file
+
+using namespace Tac;
+
+Sise::SExp *sketchToSexp(DungeonSketch& sketch) {
+    using namespace Sise;
+    const int radius = sketch.getMaxRadius();
+    List tiles;
+    for(int k=0;k<HexTools::hexCircleSize( radius );k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        tiles( new Int( sketch.get( x, y ) ) );
+    }
+    List rooms;
+    std::map<RoomNode*, int> roomIndex;
+    for(int i=0;i<(int)sketch.getRooms().size();i++) {
+        roomIndex[ sketch.getRooms()[i] ] = i;
+    }
+    for(std::vector<RoomNode*>::iterator i = sketch.getRooms().begin(); i != sketch.getRooms().end(); i++) {
+        List region, connections;
+        for(HexTools::HexRegion::const_iterator j = (*i)->getRegion().begin(); j != (*i)->getRegion().end(); j++) {
+            region( new Int( HexTools::flattenHexCoordinate( j->first, j->second ) ) );
+        }
+        for(std::set<RoomNode*>::const_iterator j = (*i)->getConnections().begin(); j != (*i)->getConnections().end(); j++) {
+            connections( new Int( roomIndex[ *j ] ) );
+        }
+        rooms( List()( region.make() )( connections.make() ).make() );
+    }
+    return List()( new Symbol( "level" ) )
+                 ( new Int( radius ) )
+                 ( tiles.make() )
+                 ( rooms.make() )
+           .make();
+}
+
+ServerMap *sexpToServerMap(Sise::SExp *sexp, const TileTypeTable& tileTypes, const DungeonTileMapper<const TileType*>& mapper) {
+    using namespace Sise;
+    Cons *args = asProperCons( sexp );
+    ServerMap *rv = new ServerMap( *asInt( args->nthcar(1) ), tileTypes, mapper( DungeonSketch::ST_NONE ), 1337 );
+    int k = 0;
+    for(Cons *tile = asCons( args->nthcar(2) ); tile; tile = asCons( tile->getcdr() ), k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        rv->setTileType( x, y, mapper( (DungeonSketch::SketchTile) (int) *asInt( tile->getcar() ) ) );
+    }
+    rv->recalculateMinimumStepCost();
+    return rv;
+}
+
+bool sameMap(ServerMap& a, ServerMap& b) {
+    if( a.getMapSize() != b.getMapSize() ) return false;
+    for(int k=0;k<HexTools::hexCircleSize( a.getMapSize() );k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        if( &a.getTileType( x, y ) != &b.getTileType( x, y ) ) return false;
+    }
+    return true;
+}
+
+bool sameSketch(DungeonSketch& a, DungeonSketch& b) {
+    if( a.getMaxRadius() != b.getMaxRadius() ) return false;
+    for(int k=0;k<HexTools::hexCircleSize( a.getMaxRadius() );k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        if( a.get( x, y ) != b.get( x, y ) ) return false;
+    }
+    if( a.getRooms().size() != b.getRooms().size() ) return false;
+    for(int i=0;i<(int)a.getRooms().size();i++) {
+        if( a.getRooms()[i]->getRegionSize() != b.getRooms()[i]->getRegionSize() ) return false;
+        if( a.getRooms()[i]->getConnections().size() != b.getRooms()[i]->getConnections().size() ) return false;
+    }
+    return a.getConnectors().size() == b.getConnectors().size();
+}
+
+long fileSize(const std::string& filename) {
+    struct stat st;
+    return stat( filename.c_str(), &st ) ? -1 : (long) st.st_size;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    TileTypeTable tileTypes ( "./config/tile-types.lisp" );
+    SimpleTileset tileset ( tileTypes );
+
+    const int roomTargets[] = { 5, 50, 500 };
+    const int regenerations[] = { 20, 3, 1 };
+    const int loads[] = { 200, 50, 10 };
+
+    bool ok = true;
+    for(int t=0;t<3;t++) {
+        StandardLevelConfiguration configuration ( roomTargets[t] );
+        unsigned long seed = 1;
+        GeneratedLevel *level = 0;
+        while( true ) {
+            level = new GeneratedLevel( configuration, seed );
+            if( level->generate() ) break;
+            delete level;
+            ++seed;
+        }
+        ServerMap reference ( level->getSketch(), tileTypes, tileset, 1337 );
+
+        ostringstream oss;
+        oss << "./test-levelfile-" << roomTargets[t];
+        const string binaryName = oss.str() + ".level", sexpName = oss.str() + ".lisp";
+        writeLevelFile( binaryName, level->getSketch() );
+        Sise::SExp *dump = sketchToSexp( level->getSketch() );
+        Sise::writeSExpToFile( sexpName, dump );
+        delete dump;
+
+        bool same;
+        {
+            LevelFile levelFile ( binaryName );
+            DungeonSketch sketch;
+            levelFile.toSketch( sketch );
+            ServerMap loaded ( levelFile, tileTypes, tileset, 1337 );
+            same = sameSketch( sketch, level->getSketch() ) && sameMap( loaded, reference );
+        }
+        {
+            Sise::SExp *sexp = Sise::readSExpFromFile( sexpName );
+            ServerMap *loaded = sexpToServerMap( sexp, tileTypes, tileset );
+            same = same && sameMap( *loaded, reference );
+            delete loaded;
+            delete sexp;
+        }
+        ok = ok && same;
+        delete level;
+
+        Timer timer;
+        for(int i=0;i<regenerations[t];i++) {
+            GeneratedLevel again ( configuration, seed );
+            again.generate();
+            ServerMap smap ( again.getSketch(), tileTypes, tileset, 1337 );
+        }
+        double regenerate = timer.getElapsedTime() / regenerations[t];
+
+        timer.reset();
+        for(int i=0;i<loads[t];i++) {
+            Sise::SExp *sexp = Sise::readSExpFromFile( sexpName );
+            delete sexpToServerMap( sexp, tileTypes, tileset );
+            delete sexp;
+        }
+        double sexpLoad = timer.getElapsedTime() / loads[t];
+
+        timer.reset();
+        for(int i=0;i<loads[t];i++) {
+            LevelFile levelFile ( binaryName );
+            ServerMap smap ( levelFile, tileTypes, tileset, 1337 );
+        }
+        double mmapLoad = timer.getElapsedTime() / loads[t];
+
+        cout << "room target " << roomTargets[t] << " (radius " << reference.getMapSize() << "): "
+             << (same ? "round trip ok" : "ROUND TRIP FAILED") << endl;
+        cout << "  regenerate " << regenerate << "s"
+             << ", s-expression " << sexpLoad << "s (" << fileSize( sexpName ) << " bytes)"
+             << ", level file " << mmapLoad << "s (" << fileSize( binaryName ) << " bytes)" << endl;
+
+        remove( binaryName.c_str() );
+        remove( sexpName.c_str() );
+    }
+
+    return ok ? 0 : 1;
+}
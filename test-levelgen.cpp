@@ -0,0 +1,148 @@
+#include "TacDungeon.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace Tac;
+
+bool floodConnected(std::vector<RoomNode*> rooms) {
+    // what connectivity checks used to cost: copying the room list, a
+    // flood fill from the first room, then a pass over every room
+    std::set<RoomNode*> seen;
+    std::vector<RoomNode*> stack;
+    stack.push_back( rooms[0] );
+    seen.insert( rooms[0] );
+    while( !stack.empty() ) {
+        RoomNode *room = stack.back();
+        stack.pop_back();
+        for(std::set<RoomNode*>::const_iterator i = room->getConnections().begin(); i != room->getConnections().end(); i++) {
+            if( seen.insert( *i ).second ) {
+                stack.push_back( *i );
+            }
+        }
+    }
+    bool notConnected = false;
+    for(std::vector<RoomNode*>::iterator i = rooms.begin(); i != rooms.end(); i++) {
+        if( seen.find( *i ) == seen.end() ) {
+            notConnected = true;
+        }
+    }
+    return !notConnected;
+}
+
+void benchmarkConnectivity(MTRand_int32& prng, int n, bool flood) {
+    // joins n rooms into a chain in random order, checking whether the
+    // whole sketch is connected after each join as the generator does
+    using namespace std;
+    DungeonSketch sketch;
+    for(int i=0;i<n;i++) {
+        sketch.adoptRoom( new RoomNode() );
+    }
+    std::vector<int> order;
+    for(int i=1;i<n;i++) {
+        order.push_back( i );
+    }
+    for(int i=(int)order.size()-1;i>0;i--) {
+        std::swap( order[i], order[ prng( i + 1 ) ] );
+    }
+    std::vector<RoomNode*>& rooms = sketch.getRooms();
+    int connectedAt = -1;
+    Timer timer;
+    for(int i=0;i<(int)order.size();i++) {
+        sketch.connectRooms( rooms[ order[i] - 1 ], rooms[ order[i] ] );
+        if( connectedAt < 0 && (flood ? floodConnected( rooms ) : sketch.isConnected()) ) {
+            connectedAt = i;
+        }
+    }
+    double elapsed = timer.getElapsedTime();
+    cout << n << " rooms, " << (flood ? "flood fill" : "union-find") << ": "
+         << (elapsed / order.size()) << "s per join and check"
+         << " (connected after " << (connectedAt + 1) << " joins)" << endl;
+}
+
+bool checkCandidates(MTRand_int32& prng, int roomTarget, int levels, bool shortestFirst) {
+    // the pooled candidates must be what checking every tile afresh finds,
+    // after the first pass and after every corridor
+    using namespace std;
+    int mismatches = 0;
+    for(int k=0;k<levels;k++) {
+        SimpleLevelGenerator levelgen ( prng );
+        try {
+            levelgen.setRoomTarget( roomTarget );
+            levelgen.setMaxCorridors( 4 * roomTarget );
+            levelgen.setShortestCorridorsFirst( shortestFirst );
+            levelgen.setVerifyCandidates();
+            levelgen.adoptPainter( new HollowHexagonRoomPainter( 6, 2 ), 1, false );
+            levelgen.adoptPainter( new HexagonRoomPainter( 4 ), 2, true );
+            levelgen.adoptPainter( new HexagonRoomPainter( 5 ), 2, true );
+            levelgen.adoptPainter( new HexagonRoomPainter( 6 ), 2, true );
+            levelgen.generate();
+        }
+        catch( LevelGenerationFailure& e ) {
+        }
+        mismatches += levelgen.getCandidateMismatches();
+    }
+    cout << "room target " << roomTarget << ", " << (shortestFirst ? "shortest" : "any") << " corridors first: "
+         << "candidate pools " << (mismatches ? "do NOT match" : "match") << " a full recheck"
+         << " (" << mismatches << " differences)" << endl;
+    return mismatches == 0;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    const int roomTargets[] = { 5, 50, 500, 1000 };
+    const int levels[] = { 20, 5, 1, 1 };
+
+    MTRand_int32 prng ( 1337 );
+
+    bool ok = true;
+    ok = checkCandidates( prng, 5, 20, true ) && ok;
+    ok = checkCandidates( prng, 5, 20, false ) && ok;
+    ok = checkCandidates( prng, 50, 2, true ) && ok;
+    ok = checkCandidates( prng, 50, 2, false ) && ok;
+
+    for(int t=0;t<4;t++) {
+        int failures = 0, rooms = 0, radius = 0;
+        Timer timer;
+        for(int k=0;k<levels[t];k++) {
+            while( true ) {
+                SimpleLevelGenerator levelgen ( prng );
+                try {
+                    levelgen.setRoomTarget( roomTargets[t] );
+                    levelgen.setMaxCorridors( 4 * roomTargets[t] );
+                    levelgen.setShortestCorridorsFirst();
+                    levelgen.setStopWhenConnected();
+                    levelgen.setSWCExtraCorridors( 2 );
+                    levelgen.adoptPainter( new HollowHexagonRoomPainter( 6, 2 ), 1, false );
+                    levelgen.adoptPainter( new HexagonRoomPainter( 4 ), 2, true );
+                    levelgen.adoptPainter( new HexagonRoomPainter( 5 ), 2, true );
+                    levelgen.adoptPainter( new HexagonRoomPainter( 6 ), 2, true );
+                    levelgen.generate();
+                    rooms += levelgen.getSketch().getRooms().size();
+                    radius += levelgen.getSketch().getMaxRadius();
+                    break;
+                }
+                catch( LevelGenerationFailure& e ) {
+                    ++failures;
+                }
+            }
+        }
+        double elapsed = timer.getElapsedTime();
+        cout << "room target " << roomTargets[t] << ": "
+             << (elapsed / levels[t]) << "s per level"
+             << " (" << levels[t] << " levels, " << failures << " failed attempts"
+             << ", mean " << (rooms / levels[t]) << " rooms"
+             << ", mean radius " << (radius / levels[t]) << ")" << endl;
+    }
+
+    benchmarkConnectivity( prng, 1000, true );
+    benchmarkConnectivity( prng, 10000, true );
+    benchmarkConnectivity( prng, 1000, false );
+    benchmarkConnectivity( prng, 10000, false );
+    benchmarkConnectivity( prng, 1000000, false );
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include "TacLevelGen.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+
+// checks that levels from the generation service can be regenerated from
+// their seeds and come out in the same order whatever the thread count,
+// then measures throughput and time to first level
+
+using namespace Tac;
+
+bool sameSketch(DungeonSketch& a, DungeonSketch& b) {
+    const int radius = a.getMaxRadius();
+    if( radius != b.getMaxRadius() ) return false;
+    for(int k=0;k<HexTools::hexCircleSize( radius );k++) {
+        int x, y;
+        HexTools::inflateHexCoordinate( k, x, y );
+        if( a.get(x,y) != b.get(x,y) ) return false;
+    }
+    return true;
+}
+
+bool checkReproducible(const LevelConfiguration& configuration, int threads, int count) {
+    using namespace std;
+    LevelGenerationService serial ( configuration, 1000, 1, 0 );
+    LevelGenerationService parallel ( configuration, 1000, threads, count );
+    for(int i=0;i<count;i++) {
+        GeneratedLevel *a = serial.next(), *b = parallel.next();
+        GeneratedLevel again ( configuration, b->getSeed() );
+        bool ok = a->getSeed() == b->getSeed()
+                  && again.generate()
+                  && sameSketch( a->getSketch(), b->getSketch() )
+                  && sameSketch( again.getSketch(), b->getSketch() );
+        if( !ok ) {
+            cout << "level " << i << " (seed " << b->getSeed() << ") is not reproducible" << endl;
+        }
+        delete a;
+        delete b;
+        if( !ok ) return false;
+    }
+    return true;
+}
+
+void benchmark(const LevelConfiguration& configuration, int threads, int levels, int trials) {
+    using namespace std;
+
+    Timer timer;
+    int failures;
+    {
+        LevelGenerationService service ( configuration, 1, threads, 2 * threads );
+        for(int i=0;i<levels;i++) {
+            delete service.next();
+        }
+        failures = service.getFailures();
+    }
+    double elapsed = timer.getElapsedTime();
+
+    std::vector<double> firstLevel;
+    for(int i=0;i<trials;i++) {
+        LevelGenerationService service ( configuration, 1000000 + 1000 * i, threads, 0 );
+        timer.reset();
+        delete service.next();
+        firstLevel.push_back( timer.getElapsedTime() );
+    }
+    std::sort( firstLevel.begin(), firstLevel.end() );
+
+    std::vector<double> queued;
+    {
+        LevelGenerationService service ( configuration, 2000000, threads, 4 );
+        delete service.next();
+        for(int i=0;i<trials;i++) {
+            usleep( 1000 * (int) (1000 * firstLevel.back()) + 1000 );
+            timer.reset();
+            delete service.next();
+            queued.push_back( timer.getElapsedTime() );
+        }
+    }
+    std::sort( queued.begin(), queued.end() );
+
+    cout << "  " << threads << " threads: " << (levels / elapsed) << " levels/sec"
+         << " (" << failures << " failed seeds); time to first level"
+         << " p50 " << firstLevel[ trials / 2 ] << "s"
+         << " p99 " << firstLevel[ (trials * 99) / 100 ] << "s"
+         << ", from a warm queue p99 " << queued[ (trials * 99) / 100 ] << "s" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    // the large levels are slow to generate, so fewer of them
+    const int roomTargets[] = { 5, 50 };
+    const int levels[] = { 500, 5 };
+    const int trials[] = { 200, 5 };
+    const int reproduced[] = { 10, 3 };
+
+    // no more threads than there are cores to run them, but at least two
+    // for the check that the order does not depend on the thread count
+    const int maxThreads = std::max( 1, (int) boost::thread::hardware_concurrency() );
+    const int checkThreads = std::max( 2, maxThreads );
+
+    bool ok = true;
+    for(int t=0;t<2;t++) {
+        StandardLevelConfiguration configuration ( roomTargets[t] );
+        bool reproducible = checkReproducible( configuration, checkThreads, reproduced[t] );
+        cout << "room target " << roomTargets[t] << ": levels "
+             << (reproducible ? "are" : "are NOT") << " reproducible from their seeds" << endl;
+        ok = ok && reproducible;
+        for(int threads=1;threads<=maxThreads;threads*=2) {
+            benchmark( configuration, threads, levels[t], trials[t] );
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include "Nash.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+#include <list>
+#include <set>
+#include <algorithm>
+
+// plays random games of Hex on boards of 11, 19 and 41, checking the
+// winner kept by NashBoard::put against a search of the board as the
+// games go and against a position restored all at once, then measures
+// whole games with the winner found both ways after every move, as
+// NashGame asks for it
+
+using namespace Nash;
+
+NashTile::Colour searchForWinner(const NashBoard& board, int size) {
+    // the old search, from one corner through each colour in turn
+    const int border = (size+1)/2;
+    const int dx[]= { 3, 0, -3, -3, 0, 3 };
+    const int dy[]= { 1, 2, 1, -1, -2, -1 };
+    const int bx = -border*3, by = border;
+    const int ex = -bx, ey = -by;
+    typedef std::pair<int,int> N;
+    const NashTile::Colour colours[] = { NashTile::BLACK, NashTile::WHITE };
+    for(int c=0;c<2;c++) {
+        std::set< N > z;
+        std::list< N > q;
+        q.push_back( N( bx, by ) );
+        while( !q.empty() ) {
+            for(int i=0;i<6;i++) {
+                int x = q.front().first + dx[i], y = q.front().second + dy[i];
+                if( find( z.begin(), z.end(), N(x,y) ) != z.end() ) continue;
+                if( board.getTile(x,y).isColour( colours[c] ) ) {
+                    q.push_back( N(x,y) );
+                    z.insert( N(x,y) );
+                }
+            }
+            q.pop_front();
+        }
+        if( find( z.begin(), z.end(), N(ex, ey) ) != z.end() ) return colours[c];
+    }
+    return NashTile::NONE;
+}
+
+struct Move {
+    int x, y;
+    NashTile::Colour colour;
+};
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+void randomGame(NashBoard& board, int size, unsigned long& state, std::vector<Move>& moves) {
+    // the free cells in a random order, white and black taking turns
+    const int border = (size+1)/2;
+    std::vector<Move> cells;
+    for(int i=-border;i<=border;i++) for(int j=-border;j<=border;j++) {
+        Move move;
+        move.x = 3 * i;
+        move.y = 2 * j + i;
+        if( board.isLegalMove( move.x, move.y ) ) {
+            cells.push_back( move );
+        }
+    }
+    for(int i=(int)cells.size()-1;i>0;i--) {
+        std::swap( cells[i], cells[ nextRandom( state ) % (i + 1) ] );
+    }
+    moves.clear();
+    for(size_t i=0;i<cells.size();i++) {
+        cells[i].colour = (i % 2) ? NashTile::BLACK : NashTile::WHITE;
+        moves.push_back( cells[i] );
+    }
+}
+
+bool checkGames(int size, int games) {
+    unsigned long state = 99 + size;
+    std::vector<Move> moves;
+    for(int g=0;g<games;g++) {
+        NashBoard board ( size ), restored ( size );
+        randomGame( board, size, state, moves );
+        // on the largest board the search is too slow for every move
+        const size_t stride = (size < 30) ? 1 : 50;
+        size_t played = 0;
+        while( board.getWinner() == NashTile::NONE && played < moves.size() ) {
+            board.put( moves[played].x, moves[played].y, moves[played].colour );
+            restored.place( moves[played].x, moves[played].y, moves[played].colour );
+            ++played;
+            if( (played % stride == 0 || board.getWinner() != NashTile::NONE)
+                && board.getWinner() != searchForWinner( board, size ) ) return false;
+        }
+        restored.recompute();
+        if( board.getWinner() == NashTile::NONE || restored.getWinner() != board.getWinner() ) return false;
+    }
+    return true;
+}
+
+void benchmark(int size, int games, bool search) {
+    // the move orders are made beforehand and the same both ways
+    using namespace std;
+    unsigned long state = 7 + size;
+    vector< vector<Move> > orders ( games );
+    {
+        NashBoard empty ( size );
+        for(int g=0;g<games;g++) {
+            randomGame( empty, size, state, orders[g] );
+        }
+    }
+    long moves = 0;
+    Timer timer;
+    for(int g=0;g<games;g++) {
+        NashBoard board ( size );
+        for(size_t i=0;i<orders[g].size();i++) {
+            board.put( orders[g][i].x, orders[g][i].y, orders[g][i].colour );
+            ++moves;
+            if( (search ? searchForWinner( board, size ) : board.getWinner()) != NashTile::NONE ) break;
+        }
+    }
+    const double elapsed = timer.getElapsedTime();
+    cout << "  " << size << "x" << size << ", " << (search ? "searching" : "kept by put") << ": "
+         << (games / elapsed) << " games/sec, " << (1e6 * elapsed / moves) << "us per move"
+         << " (" << games << " games, " << moves << " moves)" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    const int sizes[] = { 11, 19, 41 };
+    bool ok = true;
+    for(int i=0;i<3;i++) {
+        ok = ok && checkGames( sizes[i], 200 / sizes[i] );
+    }
+    cout << "winners against a search of the board " << (ok ? "ok" : "FAILED") << endl;
+
+    cout << "random games, winner checked after every move:" << endl;
+    const int searched[] = { 200, 20, 2 }, kept[] = { 20000, 5000, 1000 };
+    for(int i=0;i<3;i++) {
+        benchmark( sizes[i], searched[i], true );
+        benchmark( sizes[i], kept[i], false );
+    }
+
+    return ok ? 0 : 1;
+}
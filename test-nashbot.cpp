@@ -0,0 +1,316 @@
+#include "SProto.h"
+#include "NashServer.h"
+#include "NashBot.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+#include <boost/thread/thread.hpp>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// checks the bitboard against NashBoard through random games and
+// playouts, that the bot beats a random player, that a bot in a game on
+// the server plays out a whole game against a client, and that a player
+// can only have a few bot games at once. then measures random playouts
+// per second on one core and the bot's playouts across threads
+
+using namespace Nash;
+
+const std::string scratchDir = "./test-nashbot-scratch"; // for the server's persistent files
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+void legalMoves(const NashBoard& board, std::vector< std::pair<int,int> >& moves) {
+    const int border = (board.getSize()+1)/2;
+    moves.clear();
+    for(int i=-border;i<=border;i++) for(int j=-border;j<=border;j++) {
+        if( board.isLegalMove( 3 * i, 2 * j + i ) ) {
+            moves.push_back( std::make_pair( 3 * i, 2 * j + i ) );
+        }
+    }
+}
+
+bool checkBitboard(int size, int games) {
+    unsigned long state = 31 * size;
+    uint64_t playoutState = 12345;
+    std::vector< std::pair<int,int> > moves;
+    for(int g=0;g<games;g++) {
+        NashBoard board ( size );
+        NashTile::Colour colour = NashTile::WHITE;
+        legalMoves( board, moves );
+        if( (int) moves.size() != size * size ) return false;
+        for(size_t i=0;i<moves.size();i++) {
+            HexBitboard bits ( size );
+            int x, y;
+            bits.toBoard( i, x, y );
+            if( bits.fromBoard( x, y ) != (int) i || !board.isLegalMove( x, y ) ) return false;
+        }
+        while( board.getWinner() == NashTile::NONE ) {
+            legalMoves( board, moves );
+            const std::pair<int,int> move = moves[ nextRandom( state ) % moves.size() ];
+            board.put( move.first, move.second, colour );
+            colour = (colour == NashTile::WHITE) ? NashTile::BLACK : NashTile::WHITE;
+
+            HexBitboard bits ( board );
+            if( bits.getWinner() != board.getWinner() ) return false;
+            if( nextRandom( state ) % 8 ) continue;
+
+            // the same playout on both
+            std::vector<int> empty;
+            bits.getEmpty( empty );
+            if( empty.empty() ) continue;
+            const NashTile::Colour winner = bits.playout( colour, &empty[0], empty.size(), playoutState );
+            NashBoard filled ( board );
+            for(int k=0;k<size*size;k++) {
+                int x, y;
+                bits.toBoard( k, x, y );
+                if( filled.isLegalMove( x, y ) ) {
+                    filled.put( x, y, bits.get( k ) );
+                }
+            }
+            if( winner != filled.getWinner() ) return false;
+        }
+    }
+    return true;
+}
+
+int botAgainstRandom(int size, int games, double seconds) {
+    // the bot takes white and black in turn; its wins
+    unsigned long state = 5;
+    NashBot bot ( 1, seconds );
+    std::vector< std::pair<int,int> > moves;
+    int wins = 0;
+    for(int g=0;g<games;g++) {
+        NashBoard board ( size );
+        const NashTile::Colour botColour = (g % 2) ? NashTile::BLACK : NashTile::WHITE;
+        NashTile::Colour colour = NashTile::WHITE;
+        while( board.getWinner() == NashTile::NONE ) {
+            int x, y;
+            if( colour == botColour ) {
+                HexBitboard position ( board );
+                bot.start( position, colour, seconds );
+                position.toBoard( bot.finish(), x, y );
+            } else {
+                legalMoves( board, moves );
+                const std::pair<int,int> move = moves[ nextRandom( state ) % moves.size() ];
+                x = move.first;
+                y = move.second;
+            }
+            board.put( x, y, colour );
+            colour = (colour == NashTile::WHITE) ? NashTile::BLACK : NashTile::WHITE;
+        }
+        if( board.getWinner() == botColour ) {
+            ++wins;
+        }
+    }
+    return wins;
+}
+
+struct Connection {
+    SProto::RemoteClient *client;
+    int peer;
+    std::string partial;
+};
+
+void sendPacket(Connection& c, const std::string& packet) {
+    const std::string line = packet + "\n";
+    if( write( c.peer, line.data(), line.size() ) != (ssize_t) line.size() ) {
+        throw std::runtime_error( "unable to write to server" );
+    }
+}
+
+void receiveLines(Connection& c, std::vector<std::string>& lines) {
+    char buffer[ 16384 ];
+    ssize_t got;
+    while( (got = recv( c.peer, buffer, sizeof buffer, MSG_DONTWAIT )) > 0 ) {
+        c.partial.append( buffer, got );
+    }
+    size_t end;
+    while( (end = c.partial.find( '\n' )) != std::string::npos ) {
+        lines.push_back( c.partial.substr( 0, end ) );
+        c.partial.erase( 0, end + 1 );
+    }
+}
+
+std::vector<std::string> words(std::string line) {
+    std::replace( line.begin(), line.end(), '(', ' ' );
+    std::replace( line.begin(), line.end(), ')', ' ' );
+    std::istringstream iss ( line );
+    std::vector<std::string> rv;
+    std::string word;
+    while( iss >> word ) {
+        rv.push_back( word );
+    }
+    return rv;
+}
+
+bool botGame(double seconds) {
+    // a client playing at random against a bot in a game on the server,
+    // with the server running its loop as spserver does
+    using namespace SProto;
+    Server *server = new Server();
+    NashSubserver *nash = new NashSubserver( *server );
+    nash->setBotThreads( 2 );
+    nash->setBotSeconds( seconds );
+
+    int fds[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) ) return false;
+    Connection human;
+    human.client = new RemoteClient( fds[0], *server, "test", server->getClients() );
+    human.client->setState( RemoteClient::ST_VERSION_OK );
+    human.client->setUsername( "human" );
+    human.peer = fds[1];
+    server->adopt( human.client );
+    sendPacket( human, "(nash play-bot)" );
+
+    NashBoard board ( 11 );
+    unsigned long state = 77;
+    bool over = false, ok = true;
+    int botMoves = 0;
+    Timer total, timer;
+    while( !over && ok && total.getElapsedTime() < 60 ) {
+        const double wait = server->untilNextDeadline();
+        server->manage( (wait < 0 || wait > 0.1) ? 100 : (int) ceil( wait * 1000 ) );
+        server->tick( timer.getElapsedTime() );
+        timer.reset();
+
+        std::vector<std::string> lines;
+        receiveLines( human, lines );
+        for(size_t i=0;i<lines.size();i++) {
+            std::vector<std::string> w = words( lines[i] );
+            if( lines[i].find( "Game over" ) != std::string::npos ) {
+                over = true;
+            } else if( w.size() >= 6 && w[0] == "nash" && w[1] == "put" ) {
+                const int x = atoi( w[3].c_str() ), y = atoi( w[4].c_str() );
+                const NashTile::Colour colour = (w[5] == "white") ? NashTile::WHITE : NashTile::BLACK;
+                ok = ok && board.isLegalMove( x, y );
+                if( ok ) {
+                    board.put( x, y, colour );
+                }
+                if( colour == NashTile::BLACK ) {
+                    ++botMoves;
+                }
+            } else if( w.size() >= 3 && w[0] == "nash" && w[1] == "request-move" ) {
+                std::vector< std::pair<int,int> > moves;
+                legalMoves( board, moves );
+                const std::pair<int,int> move = moves[ nextRandom( state ) % moves.size() ];
+                std::ostringstream oss;
+                oss << "(nash move " << w[2] << " " << move.first << " " << move.second << ")";
+                sendPacket( human, oss.str() );
+            }
+        }
+    }
+    ok = ok && over && botMoves > 0 && board.getWinner() == NashTile::BLACK;
+
+    delete nash;
+    close( human.peer );
+    delete server;
+    return ok;
+}
+
+bool botGameLimit(void) {
+    // a player can't have more than a few bot games running at once,
+    // though others still can
+    using namespace SProto;
+    Server *server = new Server();
+    NashSubserver *nash = new NashSubserver( *server );
+    Connection players[2];
+    const char *names[] = { "greedy", "other" };
+    for(int p=0;p<2;p++) {
+        int fds[2];
+        if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) ) return false;
+        players[p].client = new RemoteClient( fds[0], *server, "test", server->getClients() );
+        players[p].client->setState( RemoteClient::ST_VERSION_OK );
+        players[p].client->setUsername( names[p] );
+        players[p].peer = fds[1];
+        server->adopt( players[p].client );
+    }
+    for(int i=0;i<NashSubserver::botGamesPerPlayer+3;i++) {
+        sendPacket( players[0], "(nash play-bot)" );
+    }
+    sendPacket( players[1], "(nash play-bot)" );
+    for(int i=0;i<10;i++) {
+        server->manage( 10 );
+        server->tick( 0 );
+    }
+    const bool ok = nash->getRunningGames() == NashSubserver::botGamesPerPlayer + 1;
+
+    delete nash;
+    for(int p=0;p<2;p++) {
+        close( players[p].peer );
+    }
+    delete server;
+    return ok;
+}
+
+double playoutRate(int size, double duration) {
+    HexBitboard empty ( size );
+    std::vector<int> cells, scratch;
+    empty.getEmpty( cells );
+    uint64_t state = 88172645463325252ULL;
+    long count = 0;
+    Timer timer;
+    while( timer.getElapsedTime() < duration ) {
+        for(int i=0;i<1000;i++) {
+            HexBitboard board ( empty );
+            scratch = cells;
+            board.playout( NashTile::WHITE, &scratch[0], scratch.size(), state );
+        }
+        count += 1000;
+    }
+    return count / timer.getElapsedTime();
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkBitboard( 5, 50 ) && checkBitboard( 11, 20 ) && checkBitboard( 19, 5 );
+    cout << "bitboard against NashBoard " << (ok ? "ok" : "FAILED") << endl;
+
+    const int games = 10;
+    const int wins = botAgainstRandom( 7, games, 0.05 );
+    ok = ok && wins >= games - 1;
+    cout << "bot against random moves on 7x7, 0.05s a move: " << wins << " of " << games << " won" << endl;
+
+    const bool played = botGame( 0.05 );
+    ok = ok && played;
+    cout << "a whole game against the bot on the server " << (played ? "ok" : "FAILED") << endl;
+    const bool limited = botGameLimit();
+    ok = ok && limited;
+    cout << "bot games per player limited " << (limited ? "ok" : "FAILED") << endl;
+
+    cout << "random playouts/sec on one core: 11x11 " << playoutRate( 11, 2 )
+         << ", 19x19 " << playoutRate( 19, 2 ) << endl;
+
+    cout << "bot playouts/sec from the empty 11x11 board, "
+         << boost::thread::hardware_concurrency() << " cores:" << endl;
+    HexBitboard start ( 11 );
+    const int threads[] = { 1, 2, 4 };
+    for(int i=0;i<3;i++) {
+        NashBot bot ( threads[i], 10 );
+        const double seconds = 2;
+        bot.start( start, NashTile::WHITE, seconds );
+        const int move = bot.finish();
+        ok = ok && move >= 0;
+        cout << "  " << threads[i] << " threads: " << (bot.getPlayouts() / seconds) << " total, "
+             << (bot.getPlayouts() / seconds / threads[i]) << " per thread" << endl;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,446 @@
+#include "SProto.h"
+#include "NashServer.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// plays part of a Hex game with a swap, drops the server without saving
+// and starts another, checking that the game comes back with its moves
+// once a player says hello (and not when anyone else names it), and that
+// once played on to the end it does not come back after another restart.
+// a player connecting only after the game came back still joins it.
+// also checks that starting games writes nothing to nash.lisp past the
+// first of a block of ids, and that ids stay unique across the restarts.
+// then measures a restart with 100000 stored games, and what resuming
+// all of them would cost
+
+using namespace SProto;
+using namespace Nash;
+
+const std::string scratchDir = "./test-nashpersist-scratch"; // for the server's persistent files
+const std::string gamesFile = "./persist/nash-games.lisp";
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+std::string numbered(const std::string& prefix, int i) {
+    std::ostringstream oss;
+    oss << prefix << i;
+    return oss.str();
+}
+
+struct Connection {
+    RemoteClient *client;
+    int peer;
+    std::string partial;
+};
+
+Connection connect(Server& server, const std::string& username) {
+    int fds[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) ) {
+        throw std::runtime_error( "unable to make socket pair" );
+    }
+    Connection rv;
+    rv.client = new RemoteClient( fds[0], server, "test", server.getClients() );
+    rv.client->setState( RemoteClient::ST_VERSION_OK );
+    rv.client->setUsername( username );
+    rv.peer = fds[1];
+    server.adopt( rv.client );
+    return rv;
+}
+
+void sendPacket(Connection& c, const std::string& packet) {
+    const std::string line = packet + "\n";
+    if( write( c.peer, line.data(), line.size() ) != (ssize_t) line.size() ) {
+        throw std::runtime_error( "unable to write to server" );
+    }
+}
+
+void receiveLines(Connection& c, std::vector<std::string>& lines) {
+    char buffer[ 16384 ];
+    ssize_t got;
+    while( (got = recv( c.peer, buffer, sizeof buffer, MSG_DONTWAIT )) > 0 ) {
+        c.partial.append( buffer, got );
+    }
+    size_t end;
+    while( (end = c.partial.find( '\n' )) != std::string::npos ) {
+        lines.push_back( c.partial.substr( 0, end ) );
+        c.partial.erase( 0, end + 1 );
+    }
+}
+
+std::vector<std::string> words(std::string line) {
+    std::replace( line.begin(), line.end(), '(', ' ' );
+    std::replace( line.begin(), line.end(), ')', ' ' );
+    std::istringstream iss ( line );
+    std::vector<std::string> rv;
+    std::string word;
+    while( iss >> word ) {
+        rv.push_back( word );
+    }
+    return rv;
+}
+
+void legalMoves(const NashBoard& board, std::vector< std::pair<int,int> >& moves) {
+    const int border = (board.getSize()+1)/2;
+    moves.clear();
+    for(int i=-border;i<=border;i++) for(int j=-border;j<=border;j++) {
+        if( board.isLegalMove( 3 * i, 2 * j + i ) ) {
+            moves.push_back( std::make_pair( 3 * i, 2 * j + i ) );
+        }
+    }
+}
+
+struct Player {
+    Connection connection;
+    NashBoard board; // as the player has been told
+    int gameId;
+    bool over;
+    std::string request; // a request for a move heard but not yet answered
+
+    Player(void) : board ( 11 ), gameId ( -1 ), over ( false ) {}
+};
+
+bool takeLine(Player& player, const std::string& line) {
+    // keeps the player's view of the game; whether it was a move
+    std::vector<std::string> w = words( line );
+    if( line.find( "Game over" ) != std::string::npos ) {
+        player.over = true;
+    } else if( w.size() >= 4 && w[0] == "nash" && w[1] == "welcome" ) {
+        player.gameId = atoi( w[2].c_str() );
+        player.board.clear();
+    } else if( w.size() >= 6 && w[0] == "nash" && w[1] == "put" ) {
+        player.board.put( atoi( w[3].c_str() ), atoi( w[4].c_str() ),
+                          (w[5] == "white") ? NashTile::WHITE : NashTile::BLACK );
+        return true;
+    }
+    return false;
+}
+
+void listen(Server& server, Player& player) {
+    // what the server has to tell one player, without answering
+    for(int i=0;i<10;i++) {
+        server.manage( 10 );
+        server.tick( 0 );
+        std::vector<std::string> lines;
+        receiveLines( player.connection, lines );
+        for(size_t j=0;j<lines.size();j++) {
+            if( !takeLine( player, lines[j] ) && lines[j].find( "request-move" ) != std::string::npos ) {
+                player.request = lines[j];
+            }
+        }
+    }
+}
+
+int play(Server& server, Player *players, int moves, bool swap, unsigned long& state) {
+    // the players answer requests for moves at random, swapping when
+    // asked to and allowed, until that many moves are seen or the game
+    // ends; the moves seen
+    int seen = 0;
+    Timer timer;
+    while( seen < moves && !players[0].over && timer.getElapsedTime() < 10 ) {
+        server.manage( 10 );
+        server.tick( 0 );
+        for(int p=0;p<2;p++) {
+            std::vector<std::string> lines;
+            if( !players[p].request.empty() ) {
+                lines.push_back( players[p].request );
+                players[p].request.clear();
+            }
+            receiveLines( players[p].connection, lines );
+            for(size_t i=0;i<lines.size();i++) {
+                std::vector<std::string> w = words( lines[i] );
+                if( takeLine( players[p], lines[i] ) ) {
+                    if( p == 0 ) {
+                        ++seen;
+                    }
+                } else if( w.size() >= 4 && w[0] == "nash" && w[1] == "request-move" ) {
+                    std::ostringstream oss;
+                    if( swap && w[3] == "may-swap" ) {
+                        oss << "(nash swap " << w[2] << ")";
+                        swap = false;
+                    } else {
+                        std::vector< std::pair<int,int> > cells;
+                        legalMoves( players[p].board, cells );
+                        const std::pair<int,int> move = cells[ nextRandom( state ) % cells.size() ];
+                        oss << "(nash move " << w[2] << " " << move.first << " " << move.second << ")";
+                    }
+                    sendPacket( players[p].connection, oss.str() );
+                }
+            }
+        }
+    }
+    return seen;
+}
+
+bool sameBoards(const NashBoard& a, const NashBoard& b) {
+    const int border = (a.getSize()+1)/2;
+    for(int i=-border;i<=border;i++) for(int j=-border;j<=border;j++) {
+        const NashTile &ta = a.getTile( 3 * i, 2 * j + i ), &tb = b.getTile( 3 * i, 2 * j + i );
+        if( ta.status != tb.status || (ta.status == NashTile::PIECE && ta.colour != tb.colour) ) return false;
+    }
+    return true;
+}
+
+void nashCommand(Server& server, RemoteClient *cli, const std::string& cmd, const std::string& name) {
+    Sise::SExp *arg = Sise::List()( new Sise::Symbol( cmd ) )
+                                  ( new Sise::String( name ) )
+                      .make();
+    server.handle( cli, "nash", arg );
+    delete arg;
+}
+
+RemoteClient* quietClient(Server& server) {
+    RemoteClient *rc = new RemoteClient( open( "/dev/null", O_WRONLY ), server, "test", server.getClients() );
+    rc->setState( RemoteClient::ST_VERSION_OK );
+    return rc;
+}
+
+int startGames(Server& server, int games, const std::string& prefix) {
+    // between players who never connect again; the number of files
+    RemoteClient *white = quietClient( server ), *black = quietClient( server );
+    for(int i=0;i<games;i++) {
+        white->setUsername( numbered( prefix + "-white", i ) );
+        black->setUsername( numbered( prefix + "-black", i ) );
+        nashCommand( server, white, "challenge", black->getUsername() );
+        nashCommand( server, black, "accept", white->getUsername() );
+        white->transmit();
+        black->transmit();
+    }
+    delete white;
+    delete black;
+    return games;
+}
+
+bool checkRestart(void) {
+    unsigned long state = 2024;
+    Player players[2];
+    const std::string names[] = { "alice", "bob" };
+
+    Server *server = new Server();
+    NashSubserver *nash = new NashSubserver( *server );
+    for(int p=0;p<2;p++) {
+        players[p].connection = connect( *server, names[p] );
+        sendPacket( players[p].connection, "(nash hello)" );
+    }
+    sendPacket( players[0].connection, "(nash challenge \"bob\")" );
+    server->manage( 10 );
+    server->tick( 0 );
+    sendPacket( players[1].connection, "(nash accept \"alice\")" );
+    // bob swaps after the first move, so alice plays black from then on
+    bool ok = play( *server, players, 7, true, state ) == 7 && !players[0].over;
+    const int id = players[0].gameId;
+    ok = ok && id >= 1;
+
+    // only the first game of a block writes to nash.lisp
+    const long journalled = nash->getJournalSize();
+    startGames( *server, 50, "before" );
+    ok = ok && journalled > 0 && nash->getJournalSize() == journalled;
+
+    NashBoard before = players[0].board;
+    // as if the server crashed: nothing saved
+    delete nash;
+    for(int p=0;p<2;p++) {
+        close( players[p].connection.peer );
+    }
+    delete server;
+
+    server = new Server();
+    nash = new NashSubserver( *server );
+    ok = ok && nash->getRunningGames() == 0 && nash->getAdjournedGames() == 51;
+    for(int p=0;p<2;p++) {
+        players[p].connection = connect( *server, names[p] );
+        players[p].gameId = -1;
+    }
+    // nobody else can bring it back by naming it
+    Connection mallory = connect( *server, "mallory" );
+    sendPacket( mallory, "(nash move " + numbered( "", id ) + " 0 0)" );
+    sendPacket( mallory, "(nash resign " + numbered( "", id ) + ")" );
+    server->manage( 10 );
+    server->tick( 0 );
+    ok = ok && nash->getRunningGames() == 0 && nash->getAdjournedGames() == 51;
+    // alice's hello brings the game back, and both hear of it
+    sendPacket( players[0].connection, "(nash hello)" );
+    play( *server, players, 7, false, state );
+    ok = ok && nash->getRunningGames() == 1 && nash->getAdjournedGames() == 50;
+    ok = ok && players[0].gameId == id && players[1].gameId == id;
+    ok = ok && sameBoards( before, players[0].board ) && sameBoards( before, players[1].board );
+
+    // played on to the end, it is gone after the next restart
+    play( *server, players, 1000, false, state );
+    ok = ok && players[0].over && players[0].board.getWinner() != NashTile::NONE;
+    delete nash;
+    nash = new NashSubserver( *server );
+    ok = ok && nash->getRunningGames() == 0 && nash->getAdjournedGames() == 50;
+
+    // past the block reserved before the restart
+    for(int p=0;p<2;p++) {
+        players[p].gameId = -1;
+        players[p].over = false;
+    }
+    sendPacket( players[0].connection, "(nash challenge \"bob\")" );
+    server->manage( 10 );
+    server->tick( 0 );
+    sendPacket( players[1].connection, "(nash accept \"alice\")" );
+    play( *server, players, 1, false, state );
+    ok = ok && players[0].gameId > id + 50;
+
+    delete nash;
+    for(int p=0;p<2;p++) {
+        close( players[p].connection.peer );
+    }
+    close( mallory.peer );
+    delete server;
+    return ok;
+}
+
+bool checkLateOpponent(void) {
+    // after a restart a game comes back with the first of its players to
+    // say hello; the other, connecting only afterwards, is told the game
+    // so far and asked for their move
+    unsigned long state = 7;
+    Player players[2];
+    const std::string names[] = { "carol", "dave" };
+
+    Server *server = new Server();
+    NashSubserver *nash = new NashSubserver( *server );
+    for(int p=0;p<2;p++) {
+        players[p].connection = connect( *server, names[p] );
+        sendPacket( players[p].connection, "(nash hello)" );
+    }
+    sendPacket( players[0].connection, "(nash challenge \"dave\")" );
+    server->manage( 10 );
+    server->tick( 0 );
+    sendPacket( players[1].connection, "(nash accept \"carol\")" );
+    // five moves, so that it is dave's (black's) turn
+    bool ok = play( *server, players, 5, false, state ) == 5 && !players[0].over;
+    const int id = players[0].gameId;
+    NashBoard before = players[0].board;
+    delete nash;
+    for(int p=0;p<2;p++) {
+        close( players[p].connection.peer );
+        players[p].gameId = -1;
+        players[p].request.clear();
+    }
+    delete server;
+
+    server = new Server();
+    nash = new NashSubserver( *server );
+    players[0].connection = connect( *server, names[0] );
+    sendPacket( players[0].connection, "(nash hello)" );
+    listen( *server, players[0] );
+    ok = ok && nash->getRunningGames() == 1 && players[0].gameId == id;
+    ok = ok && sameBoards( before, players[0].board );
+
+    players[1].connection = connect( *server, names[1] );
+    sendPacket( players[1].connection, "(nash hello)" );
+    listen( *server, players[1] );
+    ok = ok && players[1].gameId == id && sameBoards( before, players[1].board );
+    ok = ok && !players[1].request.empty();
+
+    play( *server, players, 1000, false, state );
+    ok = ok && players[0].over && players[1].over;
+
+    delete nash;
+    for(int p=0;p<2;p++) {
+        close( players[p].connection.peer );
+    }
+    delete server;
+    return ok;
+}
+
+long writeStoredGames(int games) {
+    // part-played games between players who each have one, as a snapshot
+    // of the store; the bytes written
+    unsigned long state = 99;
+    std::vector< std::pair<int,int> > cells;
+    legalMoves( NashBoard( 11 ), cells );
+    Sise::List list;
+    for(int g=0;g<games;g++) {
+        StoredGame game;
+        game.id = g + 1;
+        game.size = 11;
+        game.whitePlayer = numbered( "white", g );
+        game.blackPlayer = numbered( "black", g );
+        game.swapped = (g % 3) == 0;
+        game.remaining[0] = 40 + nextRandom( state ) % 100;
+        game.remaining[1] = 40 + nextRandom( state ) % 100;
+        const int moves = 10 + nextRandom( state ) % 40;
+        for(int i=0;i<moves;i++) {
+            std::swap( cells[i], cells[ i + nextRandom( state ) % (cells.size() - i) ] );
+            game.addMove( cells[i].first, cells[i].second );
+        }
+        list( game.toSexp() );
+    }
+    Sise::SExp *sexp = list.make();
+    Sise::writeSExpToFile( gamesFile, sexp );
+    delete sexp;
+    struct stat st;
+    return stat( gamesFile.c_str(), &st ) ? 0 : (long) st.st_size;
+}
+
+bool restartBenchmark(int games) {
+    using namespace std;
+    Timer timer;
+    const long bytes = writeStoredGames( games );
+    cout << games << " stored games written in " << timer.getElapsedTime() << "s, "
+         << (bytes / (double) games) << " bytes each" << endl;
+
+    timer.reset();
+    Server *server = new Server();
+    NashSubserver *nash = new NashSubserver( *server );
+    const double restart = timer.getElapsedTime();
+    bool ok = nash->getAdjournedGames() == games && nash->getRunningGames() == 0;
+
+    RemoteClient *player = quietClient( *server );
+    timer.reset();
+    for(int g=0;g<games;g++) {
+        player->setUsername( numbered( "white", g ) );
+        server->handle( player, "nash", Sise::List()( new Sise::Symbol( "hello" ) ).make() );
+        player->transmit();
+    }
+    const double resumed = timer.getElapsedTime();
+    ok = ok && nash->getRunningGames() == games && nash->getAdjournedGames() == 0;
+
+    cout << "  restart, games kept as stored: " << restart << "s" << endl;
+    cout << "  then resuming every game: " << resumed << "s more, "
+         << (1e6 * resumed / games) << "us a game" << endl;
+
+    delete player;
+    delete nash;
+    delete server;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkRestart();
+    cout << "a game across a restart " << (ok ? "ok" : "FAILED") << endl;
+
+    scratch.reset();
+    const bool late = checkLateOpponent();
+    cout << "an opponent back after the game resumed " << (late ? "ok" : "FAILED") << endl;
+    ok = late && ok;
+
+    scratch.reset();
+
+    ok = restartBenchmark( 100000 ) && ok;
+
+    return ok ? 0 : 1;
+}
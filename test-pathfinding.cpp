@@ -0,0 +1,172 @@
+#include "TacServer.h"
+#include "TacDungeon.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <queue>
+#include <functional>
+
+// checks findPath against a plain Dijkstra from the unit over random
+// targets on generated levels -- the same reachability and least cost,
+// and a path that really takes that many steps at that cost -- then
+// measures how many queries a second it answers
+
+Tac::SimpleLevelGenerator *makeLevel(MTRand_int32& prng, int roomTarget) {
+    using namespace Tac;
+    while( true ) {
+        SimpleLevelGenerator *levelgen = new SimpleLevelGenerator( prng );
+        try {
+            levelgen->setRoomTarget( roomTarget );
+            levelgen->setShortestCorridorsFirst();
+            levelgen->setStopWhenConnected();
+            levelgen->setSWCExtraCorridors( 2 );
+            levelgen->adoptPainter( new HexagonRoomPainter( 4 ), 2, true );
+            levelgen->adoptPainter( new HexagonRoomPainter( 5 ), 2, true );
+            levelgen->adoptPainter( new HexagonRoomPainter( 6 ), 2, true );
+            levelgen->adoptPainter( new HollowHexagonRoomPainter( 7, 3 ), 1, false );
+            levelgen->generate();
+            return levelgen;
+        }
+        catch( LevelGenerationFailure& e ) {
+            delete levelgen;
+        }
+    }
+}
+
+static const int dx[] = { 3, 0, -3, -3, 0, 3 },
+                 dy[] = { 1, 2, 1, -1, -2, -1 };
+
+void leastCosts(Tac::ServerMap& smap, const Tac::ServerUnit *unit, std::vector<mpq_class>& cost, std::vector<bool>& reached) {
+    // from the unit's tile to every tile, by flat index
+    using namespace HexTools;
+    typedef std::pair<mpq_class,int> Entry;
+    const int sz = hexCircleSize( smap.getMapSize() );
+    cost.assign( sz, mpq_class( 0 ) );
+    reached.assign( sz, false );
+    std::vector<bool> done ( sz, false );
+    std::priority_queue< Entry, std::vector<Entry>, std::greater<Entry> > open;
+    int x, y;
+    unit->getTile()->getXY( x, y );
+    const int start = flattenHexCoordinate( x, y );
+    reached[start] = true;
+    open.push( Entry( mpq_class( 0 ), start ) );
+    while( !open.empty() ) {
+        const int k = open.top().second;
+        open.pop();
+        if( done[k] ) continue;
+        done[k] = true;
+        inflateHexCoordinate( k, x, y );
+        for(int i=0;i<6;i++) {
+            const int nk = flattenHexCoordinate( x + dx[i], y + dy[i] );
+            if( nk < 0 || nk >= sz || done[nk] ) continue;
+            mpq_class step;
+            if( !smap.getTileType( x + dx[i], y + dy[i] ).mayTraverse( unit->getUnitType(), step ) ) continue;
+            if( !smap.getTile( x + dx[i], y + dy[i] ).isFreeFor( unit ) ) continue;
+            if( !reached[nk] || cost[k] + step < cost[nk] ) {
+                reached[nk] = true;
+                cost[nk] = cost[k] + step;
+                open.push( Entry( cost[nk], nk ) );
+            }
+        }
+    }
+}
+
+bool validPath(Tac::ServerMap& smap, const Tac::ServerUnit *unit, const Tac::HexPath& path, int tx, int ty, const mpq_class& cost) {
+    // adjacent steps onto tiles the unit may enter, ending at the target
+    // and costing what was claimed
+    int x, y;
+    unit->getTile()->getXY( x, y );
+    mpq_class total = 0;
+    for(Tac::HexPath::const_iterator i = path.begin(); i != path.end(); i++) {
+        if( HexTools::hexDistance( x, y, i->first, i->second ) != 1 ) return false;
+        mpq_class step;
+        if( !smap.getTileType( i->first, i->second ).mayTraverse( unit->getUnitType(), step ) ) return false;
+        if( !smap.getTile( i->first, i->second ).isFreeFor( unit ) ) return false;
+        total += step;
+        x = i->first;
+        y = i->second;
+    }
+    return x == tx && y == ty && total == cost;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+    using namespace Tac;
+
+    TileTypeTable tileTypes ( "./config/tile-types.lisp" );
+    UnitTypeTable unitTypes ( "./config/unit-types.lisp" );
+    SimpleTileset tileset ( tileTypes );
+    MTRand_int32 prng ( 1337 );
+
+    const int roomTargets[] = { 5, 10, 20, 40 };
+    const int queries = 2000;
+    bool ok = true;
+
+    for(int t=0;t<4;t++) {
+        SimpleLevelGenerator *levelgen = makeLevel( prng, roomTargets[t] );
+        ServerMap smap ( levelgen->getSketch(), tileTypes, tileset, 42 );
+        delete levelgen;
+
+        ServerUnit *unit = new ServerUnit( smap.generateUnitId(), unitTypes["scout"] );
+        smap.adoptUnit( unit );
+        int x, y;
+        smap.getRandomTileFor( unit )->getXY( x, y );
+        smap.actionPlaceUnit( unit, x, y );
+
+        std::vector<HexTools::HexCoordinate> targets;
+        for(int i=0;i<queries;i++) {
+            ServerTile *tile = smap.getRandomTileFor( unit );
+            int tx, ty;
+            tile->getXY( tx, ty );
+            targets.push_back( HexTools::HexCoordinate( tx, ty ) );
+        }
+
+        HexPath path;
+        mpq_class cost;
+        int found = 0;
+        long steps = 0;
+        Timer timer;
+        for(int i=0;i<queries;i++) {
+            if( smap.findPath( unit, targets[i].first, targets[i].second, path, cost ) ) {
+                ++found;
+                steps += path.size();
+            }
+        }
+        double elapsed = timer.getElapsedTime();
+
+        std::vector<mpq_class> least;
+        std::vector<bool> reached;
+        leastCosts( smap, unit, least, reached );
+        // the timed targets, and then tiles from all over the map, walls
+        // and tiles walled off included
+        const int tilesOnMap = HexTools::hexCircleSize( smap.getMapSize() );
+        for(int k=0;k<tilesOnMap;k+=7) {
+            int tx, ty;
+            HexTools::inflateHexCoordinate( k, tx, ty );
+            targets.push_back( HexTools::HexCoordinate( tx, ty ) );
+        }
+        int agreed = 0, unreachable = 0;
+        for(size_t i=0;i<targets.size();i++) {
+            const int tx = targets[i].first, ty = targets[i].second;
+            const int k = HexTools::flattenHexCoordinate( tx, ty );
+            unreachable += !reached[k];
+            const bool got = smap.findPath( unit, tx, ty, path, cost );
+            if( got != reached[k] ) continue;
+            if( got && (cost != least[k] || !validPath( smap, unit, path, tx, ty, cost )) ) continue;
+            ++agreed;
+        }
+        const bool same = agreed == (int) targets.size();
+        ok = ok && same;
+
+        cout << "rooms " << roomTargets[t]
+             << " radius " << smap.getMapSize()
+             << ": " << found << "/" << queries << " paths found"
+             << ", mean length " << (found ? (double) steps / found : 0.0)
+             << ", " << (queries / elapsed) << " queries/sec"
+             << "; against Dijkstra on " << targets.size() << " targets, "
+             << unreachable << " unreachable, " << (same ? "ok" : "FAILED") << endl;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+#include "SProto.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// checks that registrations survive a crash through the users journal,
+// including a journal with a torn last line or one moved aside for a
+// background snapshot, then measures registration throughput against
+// rewriting the whole file, recovery time, and how long saving stalls
+// the main loop with and without the snapshot writer
+
+using namespace SProto;
+
+const std::string scratchDir = "./test-persist-scratch";
+const std::string usersFile = "./persist/users.lisp";
+
+std::string username(int i) {
+    std::ostringstream oss;
+    oss << "user" << i;
+    return oss.str();
+}
+
+long fileSize(const std::string& filename) {
+    struct stat st;
+    return stat( filename.c_str(), &st ) ? 0 : (long) st.st_size;
+}
+
+bool checkUsers(Server& server, int count, int changed) {
+    for(int i=0;i<count;i++) {
+        const std::string password = i < changed ? "changed" : "secret";
+        try {
+            if( server.getUsers()[ username(i) ].passwordhash != makePasswordHash( username(i), password ) ) {
+                return false;
+            }
+        }
+        catch( NoSuchUserException& e ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool checkRecovery(ScratchDirectory& scratch) {
+    using namespace std;
+    scratch.reset();
+
+    // servers that are never deleted stand in for crashes: nothing is
+    // saved but what has already gone to disk
+    Server *crashed = new Server();
+    for(int i=0;i<100;i++) {
+        crashed->registerUsername( username(i), "secret" );
+    }
+    for(int i=0;i<10;i++) {
+        crashed->getUsers().changePassword( username(i), "changed" );
+    }
+    Server *recovered = new Server();
+    bool ok = checkUsers( *recovered, 100, 10 );
+
+    recovered->registerUsername( username(100), "secret" );
+    {
+        ofstream os ( (usersFile + ".journal").c_str(), ios::out | ios::app );
+        os << "(register \"user101\" \"0123";
+    }
+    Server *torn = new Server();
+    ok = ok && checkUsers( *torn, 101, 10 );
+    try {
+        torn->getUsers()[ username(101) ];
+        ok = false;
+    }
+    catch( NoSuchUserException& e ) {
+    }
+    ok = ok && fileSize( usersFile + ".journal" ) == 0;
+
+    torn->registerUsername( username(101), "secret" );
+    Server *again = new Server();
+    ok = ok && checkUsers( *again, 102, 10 );
+
+    // as if we crashed after a background snapshot moved the journal
+    // aside but before it was written
+    again->registerUsername( username(102), "secret" );
+    rename( (usersFile + ".journal").c_str(), (usersFile + ".journal.old").c_str() );
+    Server *interrupted = new Server();
+    ok = ok && checkUsers( *interrupted, 103, 10 );
+
+    interrupted->registerUsername( username(103), "secret" );
+    interrupted->setAutosaveInterval( 1 );
+    interrupted->tick( 2 );
+    interrupted->registerUsername( username(104), "secret" );
+    interrupted->getSnapshotWriter().flush();
+    ok = ok && fileSize( usersFile + ".journal.old" ) == 0;
+    Server *autosaved = new Server();
+    ok = ok && checkUsers( *autosaved, 105, 10 );
+    return ok;
+}
+
+double registrationRate(ScratchDirectory& scratch, int count, bool journalled, bool sync) {
+    scratch.reset();
+    Server *server = new Server();
+    server->getUsers().setJournalSync( sync );
+    Timer timer;
+    for(int i=0;i<count;i++) {
+        server->registerUsername( username(i), "secret" );
+        if( !journalled ) {
+            server->getUsers().save();
+        }
+    }
+    const double rate = count / timer.getElapsedTime();
+    // the server is left running; a snapshot it is still writing would
+    // race with the next one reading the files
+    server->getSnapshotWriter().flush();
+    return rate;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkRecovery( scratch );
+    cout << "recovery from the journal " << (ok ? "ok" : "FAILED") << endl;
+
+    cout << "registrations/sec, 2000 users: rewriting the file "
+         << registrationRate( scratch, 2000, false, true )
+         << ", journal with fdatasync " << registrationRate( scratch, 2000, true, true )
+         << ", journal without " << registrationRate( scratch, 2000, true, false ) << endl;
+
+    const int users = 1000000;
+    cout << "registrations/sec, " << users << " users, journal without fdatasync "
+         << registrationRate( scratch, users, true, false ) << endl;
+
+    const long journalSize = fileSize( usersFile + ".journal" );
+    Timer timer;
+    Server *recovered = new Server();
+    double replay = timer.getElapsedTime();
+    ok = ok && checkUsers( *recovered, users, 0 );
+
+    timer.reset();
+    Server *restarted = new Server();
+    double snapshotOnly = timer.getElapsedTime();
+    ok = ok && checkUsers( *restarted, users, 0 );
+
+    cout << "recovery of " << users << " users: " << replay << "s from a "
+         << fileSize( usersFile ) << " byte snapshot and " << journalSize << " byte journal"
+         << ", " << snapshotOnly << "s from the snapshot alone" << endl;
+
+    timer.reset();
+    restarted->getUsers().save();
+    double blocking = timer.getElapsedTime();
+
+    timer.reset();
+    restarted->getUsers().saveInBackground();
+    double background = timer.getElapsedTime();
+    restarted->getSnapshotWriter().flush();
+    double written = timer.getElapsedTime();
+
+    cout << "main loop stall saving " << users << " users: " << blocking << "s writing in place"
+         << ", " << background << "s taking a snapshot for the writer thread"
+         << " (written after " << written << "s)" << endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+#include "TacServer.h"
+#include "TacDungeon.h"
+#include "TacRecord.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <cassert>
+#include <sstream>
+
+// plays a recorded bot game between headless players, then replays the
+// record and checks that the replay ends in exactly the same state
+
+using namespace Tac;
+
+Tac::SimpleLevelGenerator *makeLevel(MTRand_int32& prng, int roomTarget) {
+    while( true ) {
+        SimpleLevelGenerator *levelgen = new SimpleLevelGenerator( prng );
+        try {
+            levelgen->setRoomTarget( roomTarget );
+            levelgen->setShortestCorridorsFirst();
+            levelgen->setStopWhenConnected();
+            levelgen->setSWCExtraCorridors( 2 );
+            levelgen->adoptPainter( new HexagonRoomPainter( 4 ), 2, true );
+            levelgen->adoptPainter( new HexagonRoomPainter( 5 ), 2, true );
+            levelgen->adoptPainter( new HollowHexagonRoomPainter( 7, 3 ), 1, false );
+            levelgen->generate();
+            return levelgen;
+        }
+        catch( LevelGenerationFailure& e ) {
+            delete levelgen;
+        }
+    }
+}
+
+ServerUnit *nearestEnemy(ServerMap& smap, const std::vector<ServerUnit*>& units, ServerUnit *unit) {
+    int x, y;
+    unit->getTile()->getXY( x, y );
+    ServerUnit *rv = 0;
+    int best = 0;
+    for(std::vector<ServerUnit*>::const_iterator i = units.begin(); i != units.end(); i++) {
+        if( !(*i)->getTile() || (*i)->getController() == unit->getController() ) continue;
+        int ex, ey;
+        (*i)->getTile()->getXY( ex, ey );
+        int d = HexTools::hexDistance( x, y, ex, ey );
+        if( !rv || d < best ) {
+            rv = *i;
+            best = d;
+        }
+    }
+    return rv;
+}
+
+void playUnit(ServerMap& smap, const std::vector<ServerUnit*>& units, ServerUnit *unit) {
+    static const int dx[] = { 3, 0, -3, -3, 0, 3 },
+                     dy[] = { 1, 2, 1, -1, -2, -1 };
+    ServerPlayer *player = unit->getController();
+    ServerUnit *enemy = nearestEnemy( smap, units, unit );
+    if( !enemy ) return;
+
+    int x, y, ex, ey;
+    unit->getTile()->getXY( x, y );
+    enemy->getTile()->getXY( ex, ey );
+    if( HexTools::hexDistance( x, y, ex, ey ) > 1 ) {
+        // walk as far as we can afford towards a tile next to the enemy
+        for(int i=0;i<6;i++) {
+            HexPath path;
+            mpq_class cost;
+            if( !smap.findPath( unit, ex + dx[i], ey + dy[i], path, cost ) ) continue;
+            HexPath steps;
+            mpq_class spent = 0;
+            int px = x, py = y;
+            for(HexPath::iterator j = path.begin(); j != path.end(); j++) {
+                mpq_class stepCost;
+                smap.getTileType( j->first, j->second ).mayTraverse( unit->getUnitType(), stepCost );
+                if( !unit->getAP().maySpendMovementEnergy( spent + stepCost ) ) break;
+                spent += stepCost;
+                steps.push_back( HexTools::HexCoordinate( j->first - px, j->second - py ) );
+                px = j->first;
+                py = j->second;
+            }
+            if( !steps.empty() ) {
+                smap.cmdMoveUnitPath( player, unit->getId(), steps );
+            }
+            break;
+        }
+        unit->getTile()->getXY( x, y );
+    }
+    if( HexTools::hexDistance( x, y, ex, ey ) == 1 ) {
+        smap.cmdMeleeAttack( player, unit->getId(), enemy->getId() );
+    }
+}
+
+int playRecordedGame(const UnitTypeTable& unitTypes, ServerMap& smap, int numberOfPlayers, int maxTurns, std::vector<int>& unitIds) {
+    const char *names[] = { "scout", "swordsman", "shieldmaiden" };
+    std::vector<ServerPlayer*> players;
+    std::vector<ServerUnit*> units;
+    ServerColourPool colours;
+    colours.add( 255, 0, 0 );
+    colours.add( 0, 0, 255 );
+
+    for(int i=0;i<numberOfPlayers;i++) {
+        std::ostringstream oss;
+        oss << "bot" << i;
+        ServerPlayer *player = new ServerPlayer( 0, smap, smap.generatePlayerId(), oss.str(), colours.next() );
+        smap.adoptPlayer( player );
+        smap.actionNewPlayer( *player );
+        players.push_back( player );
+        int x = 0, y = 0;
+        for(int j=0;j<3;j++) {
+            ServerUnit *unit = new ServerUnit( smap.generateUnitId(), unitTypes[ names[j] ] );
+            ServerTile *tile = (j == 0) ? smap.getRandomTileFor( unit ) : smap.getTileForNear( unit, x, y );
+            assert( tile );
+            tile->getXY( x, y );
+            unit->setController( player );
+            unit->getAP() = ActivityPoints( unit->getUnitType(), 1, 1, 1 );
+            smap.adoptUnit( unit );
+            smap.actionPlaceUnit( unit, x, y );
+            units.push_back( unit );
+            unitIds.push_back( unit->getId() );
+        }
+    }
+
+    int turn;
+    for(turn=0;turn<maxTurns;turn++) {
+        int alive = 0;
+        for(std::vector<ServerPlayer*>::iterator i = players.begin(); i != players.end(); i++) {
+            if( (*i)->getNumberOfUnits() == 0 ) continue;
+            ++alive;
+            smap.actionPlayerTurnBegins( **i, 30.0 );
+            for(std::vector<ServerUnit*>::iterator j = units.begin(); j != units.end(); j++) {
+                if( (*j)->getController() == *i && (*j)->getTile() ) {
+                    playUnit( smap, units, *j );
+                }
+            }
+        }
+        if( alive <= 1 ) break;
+    }
+    return turn;
+}
+
+bool sameState(ServerMap& a, ServerMap& b, const std::vector<int>& unitIds) {
+    for(std::vector<int>::const_iterator i = unitIds.begin(); i != unitIds.end(); i++) {
+        ServerUnit *ua = a.getUnitById( *i ), *ub = b.getUnitById( *i );
+        if( !ua || !ub ) return false;
+        if( ua->getHP() != ub->getHP() ) return false;
+        if( !ua->getTile() != !ub->getTile() ) return false;
+        if( ua->getTile() ) {
+            int xa, ya, xb, yb;
+            ua->getTile()->getXY( xa, ya );
+            ub->getTile()->getXY( xb, yb );
+            if( xa != xb || ya != yb ) return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    const std::string filename = (argc > 1) ? argv[1] : "./test-replay-session.lisp";
+
+    TileTypeTable tileTypes ( "./config/tile-types.lisp" );
+    UnitTypeTable unitTypes ( "./config/unit-types.lisp" );
+    SimpleTileset tileset ( tileTypes );
+    MTRand_int32 prng ( 1337 );
+
+    SimpleLevelGenerator *levelgen = makeLevel( prng, 10 );
+    ServerMap smap ( levelgen->getSketch(), tileTypes, tileset, 42 );
+    delete levelgen;
+
+    GameRecord *record = new GameRecord( filename );
+    smap.setRecord( record );
+    Timer timer;
+    std::vector<int> unitIds;
+    int turns = playRecordedGame( unitTypes, smap, 4, 200, unitIds );
+    double playTime = timer.getElapsedTime();
+    smap.setRecord( 0 );
+    delete record;
+
+    std::vector<Sise::SExp*> entries;
+    timer.reset();
+    Sise::readSExpsFromFile( filename, entries );
+    double parseTime = timer.getElapsedTime();
+
+    const int repetitions = 20;
+    bool same = true;
+    timer.reset();
+    for(int r=0;r<repetitions;r++) {
+        GameReplay replay ( tileTypes, unitTypes );
+        for(std::vector<Sise::SExp*>::iterator i = entries.begin(); i != entries.end(); i++) {
+            replay.apply( *i );
+        }
+        same = same && sameState( smap, replay.getMap(), unitIds );
+    }
+    double replayTime = timer.getElapsedTime() / repetitions;
+
+    for(std::vector<Sise::SExp*>::iterator i = entries.begin(); i != entries.end(); i++) {
+        delete *i;
+    }
+
+    cout << "played " << turns << " turns (" << playTime << "s), "
+         << entries.size() << " record entries parsed in " << parseTime << "s" << endl;
+    cout << "replay " << (same ? "matches" : "DIFFERS FROM") << " the original game ("
+         << unitIds.size() << " units compared); "
+         << replayTime << "s per replay, " << (entries.size() / replayTime) << " entries/sec" << endl;
+
+    return same ? 0 : 1;
+}
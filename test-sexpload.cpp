@@ -0,0 +1,280 @@
+#include "Sise.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// checks that the bulk parser builds what SExpStreamParser builds, on
+// tricky input and on config/, and that readSExpDir hands a directory
+// over in the same order with any number of threads; then measures the
+// old byte-at-a-time reading against mapping the file, on config/ and on
+// a generated persistence directory (100MB unless given in MB)
+
+using namespace Sise;
+
+const std::string scratchDir = "./test-sexpload-scratch";
+
+std::string show(const std::vector<SExp*>& sexps) {
+    std::ostringstream oss;
+    for(size_t i=0;i<sexps.size();i++) {
+        outputSExp( sexps[i], oss );
+    }
+    return oss.str();
+}
+
+void clear(std::vector<SExp*>& sexps) {
+    for(size_t i=0;i<sexps.size();i++) {
+        delete sexps[i];
+    }
+    sexps.clear();
+}
+
+void streamParse(const std::string& data, std::vector<SExp*>& rv) {
+    SExpStreamParser streamParser;
+    for(size_t i=0;i<data.size();i++) {
+        streamParser.feed( data[i] );
+        while( !streamParser.empty() ) {
+            rv.push_back( streamParser.pop() );
+        }
+    }
+    streamParser.end();
+    while( !streamParser.empty() ) {
+        rv.push_back( streamParser.pop() );
+    }
+}
+
+void streamReadFile(const std::string& filename, std::vector<SExp*>& rv) {
+    // as the loaders used to: one byte per read
+    using namespace std;
+    SExpStreamParser streamParser;
+    ifstream is ( filename.c_str(), ios::in );
+    char byte;
+    if( !is.good() ) {
+        throw FileInputError();
+    }
+    while( is.read( &byte, 1 ) ) {
+        streamParser.feed( byte );
+    }
+    streamParser.end();
+    while( !streamParser.empty() ) {
+        rv.push_back( streamParser.pop() );
+    }
+}
+
+bool sameParse(const std::string& data) {
+    std::vector<SExp*> a, b;
+    streamParse( data, a );
+    parseSExps( data.data(), data.size(), b );
+    const bool rv = a.size() == b.size() && show( a ) == show( b );
+    if( !rv ) {
+        std::cerr << "parsers disagree on: " << data << std::endl
+                  << "stream: " << show( a ) << "bulk: " << show( b );
+    }
+    clear( a );
+    clear( b );
+    return rv;
+}
+
+bool parseError(const std::string& data) {
+    std::vector<SExp*> sexps;
+    try {
+        parseSExps( data.data(), data.size(), sexps );
+    }
+    catch( ParseError& e ) {
+        clear( sexps );
+        return true;
+    }
+    clear( sexps );
+    return false;
+}
+
+bool checkParser(void) {
+    const char *cases[] = {
+        "",
+        "  \n\t ",
+        "(a b c)\n",
+        "(a (b (c d) ()) \"e f\" . g)\n",
+        "(1 -2 12345678 123456789 -99999999999 12345678901234567890 3/4 -6/8 0/1)\n",
+        "(\"esc\\\"aped\" \"back\\\\slash\" \"\" \"new\nline\")\n",
+        "(sym-bol with:odd*chars! a(b c\"d)\n",
+        "(a.b . c) (1.5)\n",
+        "(list) (list 2)\nsymbol \"string\"\n",
+        "(())",
+        "(a b) (c (d e",
+        "(a b) \"unterminated",
+        "(a b) (c . d)(e)",
+        0
+    };
+    for(int i=0;cases[i];i++) {
+        if( !sameParse( cases[i] ) ) return false;
+    }
+    return parseError( "(a . b c)" ) && parseError( "(a . . b)" ) && parseError( "(a .)" )
+        && parseError( "(1.5 a)" ) && parseError( ")" ) && parseError( "(a \x01)" );
+}
+
+bool checkConfig(const std::vector<std::string>& filenames) {
+    for(size_t i=0;i<filenames.size();i++) {
+        std::vector<SExp*> a, b;
+        streamReadFile( filenames[i], a );
+        readSExpsFromFile( filenames[i], b );
+        const bool same = !a.empty() && a.size() == b.size() && show( a ) == show( b );
+        clear( a );
+        clear( b );
+        if( !same ) {
+            std::cerr << "readSExpsFromFile differs on " << filenames[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Collector : public NamedSexpHandler {
+    std::vector<std::string> names;
+    std::ostringstream contents;
+    bool keep;
+
+    explicit Collector(bool keep) : keep ( keep ) {}
+
+    void handleNamedSExp(const std::string& name, SExp *sexp) {
+        names.push_back( name );
+        if( keep ) {
+            outputSExp( sexp, contents );
+        }
+    }
+};
+
+SExp *record(int i) {
+    // shaped like a persisted game: a header and a long move list
+    List moves;
+    for(int j=0;j<120;j++) {
+        moves( List()( new Int( (i * 7 + j * 13) % 19 - 9 ) )
+                     ( new Int( (i * 3 + j * 5) % 19 - 9 ) )
+                     ( new Symbol( (j % 2) ? "black" : "white" ) )
+               .make() );
+    }
+    std::ostringstream oss;
+    oss << "player-" << i;
+    return List()( new Symbol( "game" ) )
+                 ( new Int( i ) )
+                 ( new String( oss.str() ) )
+                 ( new String( "a \"quoted\" opponent" ) )
+                 ( new BigRational( mpq_class( i * 1000003 + 1, 7 ) ) )
+                 ( moves.make() )
+           .make();
+}
+
+long generate(const std::string& dirname, long bytes) {
+    mkdir( dirname.c_str(), 0755 );
+    long total = 0;
+    int files = 0;
+    while( total < bytes ) {
+        std::ostringstream oss;
+        oss << dirname << "/" << files << ".lisp";
+        SExp *sexp = record( files++ );
+        writeSExpToFile( oss.str(), sexp );
+        delete sexp;
+        struct stat st;
+        if( !stat( oss.str().c_str(), &st ) ) {
+            total += st.st_size;
+        }
+    }
+    return files;
+}
+
+double serialDirectory(const std::string& dirname, const std::vector<std::string>& names) {
+    // the old readSExpDir, byte at a time and one file after another
+    Timer timer;
+    for(size_t i=0;i<names.size();i++) {
+        std::vector<SExp*> sexps;
+        streamReadFile( dirname + "/" + names[i], sexps );
+        clear( sexps );
+    }
+    return timer.getElapsedTime();
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    const long megabytes = (argc > 1) ? atol( argv[1] ) : 100;
+
+    vector<string> config;
+    config.push_back( "./config/tile-types.lisp" );
+    config.push_back( "./config/unit-types.lisp" );
+    config.push_back( "./config/sprites.lisp" );
+    config.push_back( "./config/sound-effects.lisp" );
+
+    bool ok = checkParser();
+    cout << "bulk parser against the stream parser " << (ok ? "ok" : "FAILED") << endl;
+    const bool configOk = checkConfig( config );
+    ok = ok && configOk;
+    cout << "config/ read both ways " << (configOk ? "ok" : "FAILED") << endl;
+
+    mkdir( scratchDir.c_str(), 0755 );
+    const string small = scratchDir + "/small";
+    const int smallFiles = generate( small, 1 << 20 );
+    Collector serial ( true );
+    readSExpDir( small, ".lisp", serial, 1 );
+    bool ordered = (int) serial.names.size() == smallFiles;
+    for(size_t i=1;i<serial.names.size();i++) {
+        ordered = ordered && serial.names[i-1] < serial.names[i];
+    }
+    const int threadCounts[] = { 2, 4, 16 };
+    for(int t=0;t<3;t++) {
+        Collector parallel ( true );
+        readSExpDir( small, ".lisp", parallel, threadCounts[t] );
+        ordered = ordered && parallel.names == serial.names && parallel.contents.str() == serial.contents.str();
+    }
+    ok = ok && ordered;
+    cout << "directory of " << smallFiles << " files handed over in order with 1-16 threads "
+         << (ordered ? "ok" : "FAILED") << endl;
+
+    const int rounds = 200;
+    Timer timer;
+    for(int r=0;r<rounds;r++) for(size_t i=0;i<config.size();i++) {
+        vector<SExp*> sexps;
+        streamReadFile( config[i], sexps );
+        clear( sexps );
+    }
+    const double oldConfig = timer.getElapsedTime() / rounds;
+    timer.reset();
+    for(int r=0;r<rounds;r++) for(size_t i=0;i<config.size();i++) {
+        vector<SExp*> sexps;
+        readSExpsFromFile( config[i], sexps );
+        clear( sexps );
+    }
+    const double newConfig = timer.getElapsedTime() / rounds;
+    cout << "config/*.lisp: byte at a time " << (oldConfig * 1e6) << "us, mapped "
+         << (newConfig * 1e6) << "us" << endl;
+
+    const string big = scratchDir + "/big";
+    const int bigFiles = generate( big, megabytes << 20 );
+    Collector warm ( false );
+    readSExpDir( big, ".lisp", warm, 1 ); // into the page cache, and the names
+    cout << megabytes << "MB in " << bigFiles << " files:" << endl;
+    cout << "  byte at a time, serially: " << serialDirectory( big, warm.names ) << "s" << endl;
+    const int bigThreads[] = { 1, 2, 4 };
+    for(int t=0;t<3;t++) {
+        Collector collector ( false );
+        timer.reset();
+        readSExpDir( big, ".lisp", collector, bigThreads[t] );
+        const double elapsed = timer.getElapsedTime();
+        ok = ok && collector.names == warm.names;
+        cout << "  mapped, " << bigThreads[t] << " threads: " << elapsed << "s" << endl;
+    }
+
+    removeAllFilesWithExtension( small, ".lisp" );
+    rmdir( small.c_str() );
+    removeAllFilesWithExtension( big, ".lisp" );
+    rmdir( big.c_str() );
+    rmdir( scratchDir.c_str() );
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+#include "Sise.h"
+
+#include "Turns.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <climits>
+
+// checks that Values parse, print and convert exactly as SExps do, on
+// tricky input and on config/, and that access to them fails the same
+// way; then measures parsing, printing and walking a recorded Tac game
+// (./test-replay-session.lisp, as test-replay leaves it, unless given)
+// both ways
+
+using namespace Sise;
+
+std::string show(const std::vector<SExp*>& sexps) {
+    std::ostringstream oss;
+    for(size_t i=0;i<sexps.size();i++) {
+        outputSExp( sexps[i], oss );
+    }
+    return oss.str();
+}
+
+std::string show(const std::vector<Value>& values) {
+    std::ostringstream oss;
+    for(size_t i=0;i<values.size();i++) {
+        outputValue( values[i], oss );
+    }
+    return oss.str();
+}
+
+void clear(std::vector<SExp*>& sexps) {
+    for(size_t i=0;i<sexps.size();i++) {
+        delete sexps[i];
+    }
+    sexps.clear();
+}
+
+bool sameParse(const std::string& data) {
+    std::vector<SExp*> sexps;
+    std::vector<Value> values;
+    ValueHeap heap;
+    parseSExps( data.data(), data.size(), sexps );
+    parseValues( data.data(), data.size(), heap, values );
+    bool rv = sexps.size() == values.size() && show( sexps ) == show( values );
+    for(size_t i=0;rv && i<values.size();i++) {
+        SExp *back = toSExp( values[i] );
+        std::vector<SExp*> one ( 1, back );
+        std::vector<Value> again ( 1, toValue( sexps[i], heap ) );
+        rv = show( one ) == show( again );
+        clear( one );
+    }
+    if( !rv ) {
+        std::cerr << "values differ on: " << data << std::endl
+                  << "sexps: " << show( sexps ) << "values: " << show( values );
+    }
+    clear( sexps );
+    return rv;
+}
+
+bool parseError(const std::string& data) {
+    ValueHeap heap;
+    std::vector<Value> values;
+    try {
+        parseValues( data.data(), data.size(), heap, values );
+    }
+    catch( ParseError& e ) {
+        return true;
+    }
+    return false;
+}
+
+bool checkParser(void) {
+    const char *cases[] = {
+        "",
+        "(a b c)\n",
+        "(a (b (c d) ()) \"e f\" . g)\n",
+        "(1 -2 12345678 123456789 -99999999999 12345678901234567890 3/4 -6/8 0/1 -)\n",
+        "(2147483647 -2147483648 2147483648)\n",
+        "(\"esc\\\"aped\" \"back\\\\slash\" \"\" \"new\nline\")\n",
+        "(sym-bol with:odd*chars! a(b c\"d)\n",
+        "(list) (list 2)\nsymbol \"string\"\n",
+        "(()) (() . ())",
+        "(a b) (c (d e",
+        "(a b) (c . d)(e)",
+        0
+    };
+    for(int i=0;cases[i];i++) {
+        if( !sameParse( cases[i] ) ) return false;
+    }
+    return parseError( "(a . b c)" ) && parseError( "(a .)" ) && parseError( ")" ) && parseError( "(a \x01)" );
+}
+
+bool checkConfig(const std::vector<std::string>& filenames) {
+    for(size_t i=0;i<filenames.size();i++) {
+        std::vector<SExp*> sexps;
+        std::vector<Value> values, converted;
+        ValueHeap heap;
+        readSExpsFromFile( filenames[i], sexps );
+        readValuesFromFile( filenames[i], heap, values );
+        for(size_t j=0;j<sexps.size();j++) {
+            converted.push_back( toValue( sexps[j], heap ) );
+        }
+        const bool same = !sexps.empty() && show( sexps ) == show( values ) && show( sexps ) == show( converted );
+        clear( sexps );
+        if( !same ) {
+            std::cerr << "values differ on " << filenames[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class E>
+bool throws(Value v, int what) {
+    try {
+        switch( what ) {
+            case 0: v.asInt(); break;
+            case 1: v.asSymbol(); break;
+            case 2: v.asString(); break;
+            case 3: v.car(); break;
+            case 4: v.asMPQ(); break;
+            case 5: v.nthcar( 3 ); break;
+        }
+    }
+    catch( E& e ) {
+        return true;
+    }
+    return false;
+}
+
+bool checkAccess(void) {
+    const std::string data = "(move-unit 12 -3 \"a \\\"b\\\"\" 3/4 2147483647 -2147483648 (x . y))";
+    ValueHeap heap;
+    std::vector<Value> values;
+    parseValues( data.data(), data.size(), heap, values );
+    if( values.size() != 1 ) return false;
+    const Value v = values[0];
+    ValueHeap other;
+    if( v.car() != Value::symbol( "move-unit" ) || v.car() != other.makeSymbol( "move-unit", 9 ) ) return false;
+    if( v.car().asSymbol() != "move-unit" || v.car() == Value::symbol( "move-units" ) ) return false;
+    if( v.nthcar(1).asInt() != 12 || v.nthcar(2).asInt() != -3 || v.nthcar(2).asMPQ() != -3 ) return false;
+    if( v.nthcar(3).asString() != "a \"b\"" || v.nthcar(3).getStringLength() != 5 ) return false;
+    if( v.nthcar(4).asBigRational() != mpq_class( 3, 4 ) || v.nthcar(4).getType() != TYPE_BIG_RATIONAL ) return false;
+    if( v.nthcar(5).asInt() != INT_MAX || v.nthcar(6).asInt() != INT_MIN ) return false;
+    const Value pair = v.nthcar(7);
+    if( pair.car().asSymbol() != "x" || pair.cdr().asSymbol() != "y" || !v.nthtail(8).isNil() ) return false;
+    if( !throws<SExpTypeError>( v.car(), 0 ) || !throws<SExpTypeError>( v.nthcar(1), 1 )
+     || !throws<SExpTypeError>( v.car(), 2 ) || !throws<SExpTypeError>( v.nthcar(3), 3 )
+     || !throws<SExpTypeError>( v.car(), 4 ) || !throws<SExpTypeError>( pair, 5 ) ) return false;
+    if( !throws<UnexpectedNilError>( Value(), 3 ) || !throws<UnexpectedNilError>( v.nthtail(7), 5 ) ) return false;
+    if( Value().getType() != TYPE_CONS || !throws<SExpTypeError>( Value(), 0 ) ) return false;
+
+    // the heap can be emptied and used again
+    const std::string before = show( values );
+    heap.clear();
+    values.clear();
+    parseValues( data.data(), data.size(), heap, values );
+    std::string big ( 100000, 'x' );
+    heap.makeString( big );
+    return show( values ) == before && heap.getBytesUsed() > big.size() && sizeof (Value) == sizeof (void*);
+}
+
+// what walking a record costs: dispatch on the head symbol, as a replay
+// does, then visit everything below it
+
+const char *kinds[] = { "map", "adopt-unit", "turn-begins", "move-unit", "melee-attack", "cmd-move-unit-path", 0 };
+
+struct Tally {
+    long kind[7];
+    long atoms, sum;
+
+    Tally(void) : atoms ( 0 ), sum ( 0 ) {
+        for(int i=0;i<7;i++) kind[i] = 0;
+    }
+
+    bool operator==(const Tally& that) const {
+        for(int i=0;i<7;i++) if( kind[i] != that.kind[i] ) return false;
+        return atoms == that.atoms && sum == that.sum;
+    }
+};
+
+void tallySExp(SExp *sexp, Tally& tally) {
+    while( sexp ) switch( sexp->getType() ) {
+        case TYPE_CONS:
+            {
+                Cons *c = asCons( sexp );
+                tallySExp( c->getcar(), tally );
+                sexp = c->getcdr();
+            }
+            break;
+        case TYPE_INT:
+            tally.sum += *asInt( sexp );
+            // fallthrough
+        default:
+            ++tally.atoms;
+            return;
+    }
+}
+
+void tallyEntry(SExp *entry, Tally& tally) {
+    const std::string& type = *asSymbol( asProperCons( entry )->getcar() );
+    int k = 0;
+    while( kinds[k] && type != kinds[k] ) ++k;
+    ++tally.kind[k];
+    tallySExp( entry, tally );
+}
+
+struct ValueTally {
+    Tally& tally;
+
+    explicit ValueTally(Tally& tally) : tally ( tally ) {}
+
+    void visitNil(void) {}
+
+    void visitCons(Value car, Value cdr) {
+        visitValue( car, *this );
+        while( !cdr.isNil() && cdr.getTag() == Value::TAG_CONS ) {
+            visitValue( cdr.car(), *this );
+            cdr = cdr.cdr();
+        }
+        visitValue( cdr, *this );
+    }
+
+    void visitInt(int x) { tally.sum += x; ++tally.atoms; }
+    void visitSymbol(int) { ++tally.atoms; }
+    void visitString(const char*, size_t) { ++tally.atoms; }
+    void visitBigRational(const mpq_class&) { ++tally.atoms; }
+};
+
+void tallyEntry(Value entry, const std::vector<int>& kindIds, Tally& tally) {
+    const int type = entry.car().asSymbolId();
+    size_t k = 0;
+    while( k < kindIds.size() && type != kindIds[k] ) ++k;
+    ++tally.kind[k];
+    ValueTally visitor ( tally );
+    visitValue( entry, visitor );
+}
+
+std::string readAll(const std::string& filename) {
+    std::ifstream is ( filename.c_str() );
+    std::ostringstream oss;
+    oss << is.rdbuf();
+    return oss.str();
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    vector<string> config;
+    config.push_back( "./config/tile-types.lisp" );
+    config.push_back( "./config/unit-types.lisp" );
+    config.push_back( "./config/sprites.lisp" );
+    config.push_back( "./config/sound-effects.lisp" );
+
+    bool ok = checkParser();
+    cout << "values parse and convert as SExps do " << (ok ? "ok" : "FAILED") << endl;
+    const bool configOk = checkConfig( config );
+    ok = ok && configOk;
+    cout << "config/ read both ways " << (configOk ? "ok" : "FAILED") << endl;
+    const bool accessOk = checkAccess();
+    ok = ok && accessOk;
+    cout << "access, interning and errors " << (accessOk ? "ok" : "FAILED") << endl;
+
+    const string filename = (argc > 1) ? argv[1] : "./test-replay-session.lisp";
+    string data = readAll( filename );
+    if( data.empty() ) {
+        cout << "no recorded game in " << filename << " (run test-replay first); using config/ instead" << endl;
+        for(size_t i=0;i<config.size();i++) {
+            data += readAll( config[i] );
+        }
+    }
+
+    vector<int> kindIds;
+    for(int k=0;kinds[k];k++) {
+        kindIds.push_back( internSymbol( kinds[k] ) );
+    }
+
+    vector<SExp*> sexps;
+    vector<Value> values;
+    ValueHeap heap;
+    parseSExps( data.data(), data.size(), sexps );
+    parseValues( data.data(), data.size(), heap, values );
+    const bool sessionOk = show( sexps ) == show( values );
+    ok = ok && sessionOk;
+    cout << data.size() << " bytes, " << values.size() << " entries read both ways "
+         << (sessionOk ? "ok" : "FAILED") << "; " << heap.getBytesUsed() << " bytes of value heap" << endl;
+
+    const int rounds = 2000;
+    cout << "per pass over it, " << rounds << " passes:" << endl;
+
+    Timer timer;
+    for(int r=0;r<rounds;r++) {
+        vector<SExp*> rv;
+        parseSExps( data.data(), data.size(), rv );
+        clear( rv );
+    }
+    const double sexpParse = timer.getElapsedTime() / rounds;
+    timer.reset();
+    for(int r=0;r<rounds;r++) {
+        ValueHeap scratch;
+        vector<Value> rv;
+        parseValues( data.data(), data.size(), scratch, rv );
+    }
+    const double valueParse = timer.getElapsedTime() / rounds;
+    timer.reset();
+    {
+        ValueHeap scratch;
+        vector<Value> rv;
+        for(int r=0;r<rounds;r++) {
+            rv.clear();
+            scratch.clear();
+            parseValues( data.data(), data.size(), scratch, rv );
+        }
+    }
+    const double valueReparse = timer.getElapsedTime() / rounds;
+    cout << "  parse and free: SExp " << (sexpParse * 1e6) << "us, Value " << (valueParse * 1e6)
+         << "us, Value into a reused heap " << (valueReparse * 1e6) << "us" << endl;
+
+    ostringstream oss;
+    timer.reset();
+    for(int r=0;r<rounds;r++) {
+        oss.str( "" );
+        for(size_t i=0;i<sexps.size();i++) {
+            outputSExp( sexps[i], oss );
+        }
+    }
+    const double sexpOutput = timer.getElapsedTime() / rounds;
+    const size_t sexpBytes = oss.str().size();
+    timer.reset();
+    for(int r=0;r<rounds;r++) {
+        oss.str( "" );
+        for(size_t i=0;i<values.size();i++) {
+            outputValue( values[i], oss );
+        }
+    }
+    const double valueOutput = timer.getElapsedTime() / rounds;
+    ok = ok && oss.str().size() == sexpBytes;
+    cout << "  print: SExp " << (sexpOutput * 1e6) << "us, Value " << (valueOutput * 1e6) << "us" << endl;
+
+    Tally sexpTally, valueTally;
+    timer.reset();
+    for(int r=0;r<rounds;r++) {
+        for(size_t i=0;i<sexps.size();i++) {
+            tallyEntry( sexps[i], sexpTally );
+        }
+    }
+    const double sexpWalk = timer.getElapsedTime() / rounds;
+    timer.reset();
+    for(int r=0;r<rounds;r++) {
+        for(size_t i=0;i<values.size();i++) {
+            tallyEntry( values[i], kindIds, valueTally );
+        }
+    }
+    const double valueWalk = timer.getElapsedTime() / rounds;
+    ok = ok && sexpTally == valueTally;
+    cout << "  dispatch and walk: SExp " << (sexpWalk * 1e6) << "us, Value " << (valueWalk * 1e6) << "us" << endl;
+
+    cout << "  a Value is " << sizeof (Value) << " bytes and a cons " << sizeof (ValueCons)
+         << " inside the heap; an Int is " << sizeof (Int) << ", a Symbol " << sizeof (Symbol)
+         << " and a Cons " << sizeof (Cons) << ", each a separate allocation" << endl;
+
+    clear( sexps );
+
+    return ok ? 0 : 1;
+}
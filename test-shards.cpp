@@ -0,0 +1,299 @@
+#include "SProto.h"
+#include "NashServer.h"
+#include "TacServer.h"
+#include "TacLevelGen.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// checks that packets for a sharded subserver are handled on its executor
+// with the replies delivered by the network thread, and that a client
+// disconnecting meanwhile is taken out of the server's lists at once.
+// then runs many Hex games next to a Tac game whose players keep
+// respawning, which resends everything they have seen, and measures how
+// long the Hex players wait for replies and how many respawns get done,
+// with every game on the network thread and with the games sharded
+
+using namespace SProto;
+
+const std::string scratchDir = "./test-shards-scratch"; // for the server's persistent files
+
+std::string numbered(const std::string& prefix, int i) {
+    std::ostringstream oss;
+    oss << prefix << i;
+    return oss.str();
+}
+
+struct Connection {
+    // the server's end of a socket pair, and the other end, as a client
+    RemoteClient *client;
+    int peer;
+    std::string partial; // received, short of a whole line
+};
+
+Connection* connect(Server& server, const std::string& name) {
+    int fds[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) ) {
+        throw std::runtime_error( "unable to make a socket pair" );
+    }
+    fcntl( fds[1], F_SETFL, fcntl( fds[1], F_GETFL ) | O_NONBLOCK );
+    Connection *c = new Connection();
+    c->client = new RemoteClient( fds[0], server, "test", server.getClients() );
+    c->client->setState( RemoteClient::ST_VERSION_OK );
+    c->client->setUsername( name );
+    c->peer = fds[1];
+    server.adopt( c->client );
+    return c;
+}
+
+void sendPacket(Connection *c, const std::string& packet) {
+    const std::string line = packet + "\n";
+    for(size_t written = 0; written < line.size(); ) {
+        ssize_t rv = write( c->peer, line.data() + written, line.size() - written );
+        if( rv > 0 ) {
+            written += rv;
+        } else if( rv < 0 && errno != EAGAIN && errno != EINTR ) {
+            throw std::runtime_error( "unable to write to server" );
+        }
+    }
+}
+
+void receiveLines(Connection *c, std::vector<std::string>& lines) {
+    char buffer[ 16384 ];
+    ssize_t got;
+    while( (got = recv( c->peer, buffer, sizeof buffer, MSG_DONTWAIT )) > 0 ) {
+        c->partial.append( buffer, got );
+    }
+    size_t end;
+    while( (end = c->partial.find( '\n' )) != std::string::npos ) {
+        lines.push_back( c->partial.substr( 0, end ) );
+        c->partial.erase( 0, end + 1 );
+    }
+}
+
+void serve(Server& server) {
+    Timer timer;
+    server.manage( 10 );
+    server.tick( timer.getElapsedTime() );
+}
+
+bool await(Server& server, Connection *c, const std::string& fragment) {
+    // runs the server until c receives a line with the fragment in it
+    Timer timer;
+    while( timer.getElapsedTime() < 5 ) {
+        serve( server );
+        std::vector<std::string> lines;
+        receiveLines( c, lines );
+        for(std::vector<std::string>::iterator i = lines.begin(); i != lines.end(); i++) {
+            if( i->find( fragment ) != std::string::npos ) return true;
+        }
+    }
+    return false;
+}
+
+bool checkShards(void) {
+    Server *server = new Server();
+    Nash::NashSubserver *nash = new Nash::NashSubserver( *server );
+    bool ok = server->shardSubServer( "nash" ) && !server->shardSubServer( "nash" );
+
+    Connection *alice = connect( *server, "alice" ), *bob = connect( *server, "bob" );
+    sendPacket( alice, "(nash challenge \"bob\")" );
+    ok = ok && await( *server, bob, "(nash challenge \"alice\")" );
+    sendPacket( bob, "(nash accept \"alice\")" );
+    ok = ok && await( *server, alice, "(nash welcome" );
+    sendPacket( bob, "(nash frobnicate)" );
+    ok = ok && await( *server, bob, "bad-command" );
+
+    close( alice->peer );
+    Timer timer;
+    while( server->getClients().size() > 1 && timer.getElapsedTime() < 5 ) {
+        serve( *server );
+    }
+    ok = ok && server->getClients().size() == 1
+            && server->getConnectedUser( "alice" ) == 0
+            && server->getConnectedUser( "bob" ) == bob->client;
+    sendPacket( bob, "(nash move 1 0 0)" ); // alice is white, so to move
+    ok = ok && await( *server, bob, "Illegal move" );
+
+    server->stopShards();
+    sendPacket( bob, "(nash users)" );
+    ok = ok && await( *server, bob, "(nash users" );
+
+    delete nash;
+    close( bob->peer );
+    delete server;
+    delete alice;
+    delete bob;
+    return ok;
+}
+
+struct Load {
+    // the clients, on a thread of their own: each Hex player keeps one
+    // move out of turn in flight, which the game refuses, and each Tac
+    // player keeps respawning
+    std::vector<Connection*> hex, tac;
+    std::vector<int> gameIds;
+    double duration;
+
+    std::vector<double> latencies;
+    int respawns;
+    boost::atomic<bool> finished;
+
+    Load(void) : duration ( 0 ), respawns ( 0 ), finished ( false ) {}
+
+    void operator()(void) {
+        using namespace std;
+        vector<Timer> sent ( hex.size() );
+        for(size_t i=0;i<hex.size();i++) {
+            sendPacket( hex[i], numbered( "(nash move ", gameIds[i] ) + " 0 0)" );
+            sent[i].reset();
+        }
+        for(size_t i=0;i<tac.size();i++) {
+            sendPacket( tac[i], "(tactest test-spawn)" );
+        }
+
+        vector<Connection*> all ( hex );
+        all.insert( all.end(), tac.begin(), tac.end() );
+        vector<struct pollfd> fds ( all.size() );
+        for(size_t i=0;i<all.size();i++) {
+            fds[i].fd = all[i]->peer;
+            fds[i].events = POLLIN;
+        }
+        Timer timer;
+        while( timer.getElapsedTime() < duration ) {
+            if( poll( &fds[0], fds.size(), 10 ) <= 0 ) continue;
+            for(size_t i=0;i<all.size();i++) {
+                if( !(fds[i].revents & POLLIN) ) continue;
+                vector<string> lines;
+                receiveLines( all[i], lines );
+                for(vector<string>::iterator j = lines.begin(); j != lines.end(); j++) {
+                    if( i < hex.size() ) {
+                        latencies.push_back( sent[i].getElapsedTime() );
+                        sendPacket( hex[i], numbered( "(nash move ", gameIds[i] ) + " 0 0)" );
+                        sent[i].reset();
+                    } else if( j->find( "(tactest welcome" ) != string::npos ) {
+                        ++respawns;
+                        sendPacket( all[i], "(tactest test-spawn)" );
+                    }
+                }
+            }
+        }
+        finished = true;
+    }
+};
+
+bool benchmark(bool sharded, int games, int tacPlayers, Tac::DungeonSketch& level, double duration) {
+    using namespace std;
+    Server *server = new Server();
+    Nash::NashSubserver *nash = new Nash::NashSubserver( *server );
+    Tac::TacTestServer *tac = new Tac::TacTestServer( *server, "../config/unit-types.lisp", "../config/tile-types.lisp", 1337, level );
+    if( sharded ) {
+        server->shardSubServer( "nash" );
+        server->shardSubServer( "tactest" );
+    }
+
+    Load load;
+    vector<Connection*> whites;
+    bool ok = true;
+    for(int i=0;i<games;i++) {
+        Connection *white = connect( *server, numbered( "white", i ) );
+        Connection *black = connect( *server, numbered( "black", i ) );
+        sendPacket( white, "(nash challenge \"" + numbered( "black", i ) + "\")" );
+        ok = ok && await( *server, black, "(nash challenge" );
+        sendPacket( black, "(nash accept \"" + numbered( "white", i ) + "\")" );
+        ok = ok && await( *server, black, "(nash welcome" );
+        whites.push_back( white );
+        load.hex.push_back( black );
+        load.gameIds.push_back( i + 1 );
+    }
+    for(int i=0;i<tacPlayers;i++) {
+        load.tac.push_back( connect( *server, numbered( "tac", i ) ) );
+    }
+    // nothing from before goes into the measurements
+    for(int i=0;i<10;i++) {
+        serve( *server );
+    }
+    for(size_t i=0;i<load.hex.size();i++) {
+        vector<string> lines;
+        receiveLines( load.hex[i], lines );
+    }
+
+    load.duration = duration;
+    boost::thread clients ( boost::ref( load ) );
+    while( !load.finished ) {
+        Timer timer;
+        server->manage( 100 );
+        server->tick( timer.getElapsedTime() );
+    }
+    clients.join();
+
+    vector<double>& latencies = load.latencies;
+    sort( latencies.begin(), latencies.end() );
+    ok = ok && !latencies.empty();
+    if( ok ) {
+        cout << "  " << (sharded ? "sharded" : "single-threaded") << ": "
+             << (latencies.size() / duration) << " hex replies/sec"
+             << ", latency p50 " << (1e3 * latencies[ latencies.size() / 2 ]) << "ms"
+             << " p99 " << (1e3 * latencies[ (latencies.size() * 99) / 100 ]) << "ms"
+             << ", " << (load.respawns / duration) << " tac respawns/sec" << endl;
+    }
+
+    server->stopShards();
+    delete tac;
+    delete nash;
+    vector<Connection*> all ( whites );
+    all.insert( all.end(), load.hex.begin(), load.hex.end() );
+    all.insert( all.end(), load.tac.begin(), load.tac.end() );
+    delete server;
+    for(vector<Connection*>::iterator i = all.begin(); i != all.end(); i++) {
+        close( (*i)->peer );
+        delete *i;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkShards();
+    cout << "sharded packets and disconnects " << (ok ? "ok" : "FAILED") << endl;
+
+    Tac::StandardLevelConfiguration configuration ( 50 );
+    Tac::GeneratedLevel *level = 0;
+    for(unsigned long seed = 1; !level; seed++) {
+        level = new Tac::GeneratedLevel( configuration, seed );
+        if( !level->generate() ) {
+            delete level;
+            level = 0;
+        }
+    }
+
+    const int games = 200, tacPlayers = 8;
+    const double duration = 5;
+    cout << games << " hex games and a tac game with " << tacPlayers << " players respawning, "
+         << duration << "s each:" << endl;
+    scratch.reset();
+    ok = benchmark( false, games, tacPlayers, level->getSketch(), duration ) && ok;
+    scratch.reset();
+    ok = benchmark( true, games, tacPlayers, level->getSketch(), duration ) && ok;
+    delete level;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,309 @@
+#include "SProto.h"
+#include "NashServer.h"
+
+#include "Turns.h"
+#include "TestScratch.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+// checks the timer wheel against a plain list of deadlines through random
+// settings, cancellations and advances, some far beyond the wheel's span,
+// then measures what an idle server with 100000 Hex games in progress
+// costs when it sleeps until the next clock runs out against polling
+// every game's clock ten times a second, as before, and how late alarms
+// ring with the network thread's loop and with an executor driving them
+
+using namespace SProto;
+
+const std::string scratchDir = "./test-timers-scratch"; // for the server's persistent files
+
+std::string numbered(const std::string& prefix, int i) {
+    std::ostringstream oss;
+    oss << prefix << i;
+    return oss.str();
+}
+
+unsigned long nextRandom(unsigned long& state) {
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+double cpuTime(void) {
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+         + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+long long microseconds(void) {
+    // on the same clock as the wheel's milliseconds
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+struct CheckedAlarm : public Alarm {
+    TimerWheel *wheel;
+    long long expected; // when it should ring, or -1 while not set
+    long long *lastRing; // by any of them
+    unsigned long *state;
+    bool *ok;
+
+    void ring(void) {
+        // exactly on time, in order, and sometimes set again from inside
+        if( wheel->getTime() != expected || wheel->getTime() < *lastRing ) {
+            *ok = false;
+        }
+        *lastRing = wheel->getTime();
+        expected = -1;
+        if( nextRandom( *state ) % 4 == 0 ) {
+            const long long due = wheel->getTime() + nextRandom( *state ) % 100;
+            wheel->set( this, due );
+            expected = std::max( due, wheel->getTime() + 1 );
+        }
+    }
+};
+
+bool checkWheel(void) {
+    const int alarms = 2000, steps = 50000;
+    const long long spans[] = { 70, 5000, 300000, 1LL << 26 };
+    TimerWheel wheel;
+    unsigned long state = 4242;
+    long long lastRing = 0;
+    bool ok = true;
+    CheckedAlarm *checked = new CheckedAlarm [ alarms ];
+    for(int i=0;i<alarms;i++) {
+        checked[i].wheel = &wheel;
+        checked[i].expected = -1;
+        checked[i].lastRing = &lastRing;
+        checked[i].state = &state;
+        checked[i].ok = &ok;
+    }
+    for(int step=0;step<steps && ok;step++) {
+        CheckedAlarm& alarm = checked[ nextRandom( state ) % alarms ];
+        const long long span = spans[ nextRandom( state ) % 4 ];
+        switch( nextRandom( state ) % 4 ) {
+            case 0:
+            case 1:
+                {
+                    const long long due = wheel.getTime() + (long long) (nextRandom( state ) % span);
+                    wheel.set( &alarm, due );
+                    alarm.expected = std::max( due, wheel.getTime() + 1 );
+                }
+                break;
+            case 2:
+                alarm.cancel();
+                alarm.expected = -1;
+                break;
+            case 3:
+                {
+                    const long long to = wheel.getTime() + (long long) (nextRandom( state ) % span) / 16;
+                    wheel.advanceTo( to );
+                    ok = ok && wheel.getTime() == to;
+                }
+                break;
+        }
+        long long earliest = -1;
+        int set = 0;
+        for(int i=0;i<alarms;i++) {
+            const long long expected = checked[i].expected;
+            if( checked[i].isSet() != (expected >= 0) || (expected >= 0 && expected <= wheel.getTime()) ) {
+                ok = false;
+            }
+            if( expected >= 0 ) {
+                ++set;
+                if( earliest < 0 || expected < earliest ) {
+                    earliest = expected;
+                }
+            }
+        }
+        // never sleeping past anything that is due
+        const long long next = wheel.nextEvent();
+        ok = ok && wheel.size() == set
+                && (earliest < 0 ? next < 0 : (next > wheel.getTime() && next <= earliest));
+    }
+    delete [] checked;
+    return ok;
+}
+
+RemoteClient* connect(Server& server) {
+    RemoteClient *rc = new RemoteClient( open( "/dev/null", O_WRONLY ), server, "test", server.getClients() );
+    rc->setState( RemoteClient::ST_VERSION_OK );
+    return rc;
+}
+
+void nashCommand(Server& server, RemoteClient *cli, const std::string& cmd, const std::string& name) {
+    Sise::SExp *arg = Sise::List()( new Sise::Symbol( cmd ) )
+                                  ( new Sise::String( name ) )
+                      .make();
+    server.handle( cli, "nash", arg );
+    delete arg;
+}
+
+void serveUntil(Server& server, double duration, int& wakeups) {
+    // the server's own loop, as in spserver, for a while
+    Timer total, timer;
+    double remaining;
+    while( (remaining = duration - total.getElapsedTime()) > 0 ) {
+        double wait = server.untilNextDeadline();
+        if( wait < 0 || wait > remaining ) {
+            wait = remaining;
+        }
+        server.manage( (int) ceil( wait * 1000 ) );
+        server.tick( timer.getElapsedTime() );
+        timer.reset();
+        ++wakeups;
+    }
+}
+
+void idleGames(int games, double duration) {
+    using namespace std;
+    Server *server = new Server();
+    Nash::NashSubserver *nash = new Nash::NashSubserver( *server );
+    RemoteClient *white = connect( *server ), *black = connect( *server );
+    Timer timer;
+    for(int i=0;i<games;i++) {
+        // the names move on, so that the games send nothing further
+        white->setUsername( numbered( "white", i ) );
+        black->setUsername( numbered( "black", i ) );
+        nashCommand( *server, white, "challenge", black->getUsername() );
+        nashCommand( *server, black, "accept", white->getUsername() );
+        white->transmit();
+        black->transmit();
+    }
+    const double setup = timer.getElapsedTime();
+    cout << games << " hex games started in " << setup << "s" << endl;
+
+    // the first game's clock runs out 60s after it started; both windows
+    // end before that, or they would be measuring games timing out
+    const double window = std::min( duration, (60.0 - setup - 1.0) / 2 );
+    if( window <= 0 ) {
+        cout << "  too slow starting the games to measure them idle" << endl;
+        delete nash;
+        delete white;
+        delete black;
+        delete server;
+        return;
+    }
+
+    int wakeups = 0;
+    double cpu = cpuTime();
+    timer.reset();
+    serveUntil( *server, window, wakeups );
+    const double deadlines = (cpuTime() - cpu) / timer.getElapsedTime();
+
+    vector<FischerTurnManager> clocks ( games );
+    for(int i=0;i<games;i++) {
+        clocks[i].addParticipant( 0, 60.0, 30.0 );
+        clocks[i].addParticipant( 1, 60.0, 30.0 );
+        clocks[i].start();
+    }
+    int polls = 0;
+    cpu = cpuTime();
+    timer.reset();
+    while( timer.getElapsedTime() < window ) {
+        server->manage( 100 );
+        for(int i=0;i<games;i++) {
+            if( clocks[i].getCurrentRemainingTime() < 0 ) {
+                clocks[i].stop();
+            }
+        }
+        ++polls;
+    }
+    const double polling = (cpuTime() - cpu) / timer.getElapsedTime();
+
+    cout << "  idle for " << window << "s, cpu per second: " << (100 * polling) << "% polling every clock (" << polls << " polls)"
+         << ", " << (100 * deadlines) << "% sleeping until the next deadline (" << wakeups << " wakeups)" << endl;
+
+    delete nash;
+    delete white;
+    delete black;
+    delete server;
+}
+
+class AlarmClock : public SubServer {
+    // a subserver that has nothing to do but ring alarms
+    public:
+        struct Ringer : public Alarm {
+            AlarmClock *clock;
+            void ring(void) { clock->lateness.push_back( (microseconds() - 1000 * getDue()) / 1e3 ); }
+        };
+
+        TimerWheel wheel;
+        Ringer *ringers;
+        std::vector<double> lateness; // milliseconds
+
+        AlarmClock(Server& server, int alarms, double spread) :
+            SubServer( "alarms", server ),
+            ringers ( new Ringer [ alarms ] )
+        {
+            unsigned long state = 777;
+            for(int i=0;i<alarms;i++) {
+                ringers[i].clock = this;
+                wheel.setIn( &ringers[i], 0.1 + spread * (nextRandom( state ) % 100000) / 100000.0 );
+            }
+            lateness.reserve( alarms );
+        }
+        ~AlarmClock(void) {
+            delete [] ringers;
+        }
+
+        void tick(double) { wheel.advance(); }
+        double untilNextDeadline(void) { return wheel.untilNext(); }
+        bool handle(RemoteClient*, const std::string&, Sise::SExp*) { return false; }
+};
+
+bool alarmAccuracy(bool sharded, int alarms, double spread) {
+    using namespace std;
+    Server *server = new Server();
+    AlarmClock *clock = new AlarmClock( *server, alarms, spread );
+    if( sharded ) {
+        server->shardSubServer( "alarms" );
+    }
+    int wakeups = 0;
+    serveUntil( *server, spread + 0.5, wakeups );
+    server->stopShards();
+
+    vector<double>& lateness = clock->lateness;
+    sort( lateness.begin(), lateness.end() );
+    const bool ok = (int) lateness.size() == alarms && lateness[0] >= 0;
+    if( ok ) {
+        cout << "  " << (sharded ? "on an executor" : "on the network thread") << ": lateness"
+             << " p50 " << lateness[ alarms / 2 ] << "ms"
+             << " p99 " << lateness[ (alarms * 99) / 100 ] << "ms"
+             << " max " << lateness.back() << "ms" << endl;
+    }
+    delete clock;
+    delete server;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    ScratchDirectory scratch ( scratchDir );
+
+    bool ok = checkWheel();
+    cout << "timer wheel against a list of deadlines " << (ok ? "ok" : "FAILED") << endl;
+
+    idleGames( 100000, 3 );
+
+    const int alarms = 100000;
+    const double spread = 2;
+    cout << alarms << " alarms over " << spread << "s:" << endl;
+    ok = alarmAccuracy( false, alarms, spread ) && ok;
+    ok = alarmAccuracy( true, alarms, spread ) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+#include "Turns.h"
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cmath>
+
+#include <sys/time.h>
+#include <unistd.h>
+
+// checks the Fischer clock: the mover pays for the turn and then gets
+// the increment, added time, skipping, stopping, and removal with ids that
+// aren't positions; then measures polling 100k running clocks every tick
+// against the map-based manager this replaced
+
+class MapTurnManager {
+    // the old layout, kept to compare against: a map per field and the
+    // wall clock, flushed on every query
+    private:
+        struct timeval t0;
+        std::map<int,int> indices;
+        std::map<int,double> increments;
+        std::map<int,double> allocations;
+        std::vector<int> participants;
+        int index;
+        bool running;
+
+        double lap(void) {
+            struct timeval t1, dt;
+            gettimeofday( &t1, 0 );
+            timersub( &t1, &t0, &dt );
+            t0 = t1;
+            return dt.tv_sec + 0.000001 * dt.tv_usec;
+        }
+
+        void flushTime(void) {
+            const double elapsed = lap();
+            if( running ) {
+                allocations[ participants[index] ] -= elapsed;
+            }
+        }
+
+    public:
+        MapTurnManager(void) : index ( 0 ), running ( false ) { gettimeofday( &t0, 0 ); }
+
+        void addParticipant(int id, double seconds, double increment) {
+            increments[id] = increment;
+            allocations[id] = seconds;
+            indices[id] = participants.size();
+            participants.push_back( id );
+        }
+
+        void start(void) {
+            flushTime();
+            running = true;
+        }
+
+        int next(void) {
+            flushTime();
+            allocations[participants[index]] += increments[participants[index]];
+            if( ++index >= (int) participants.size() ) {
+                index = 0;
+            }
+            return participants[index];
+        }
+
+        double getCurrentRemainingTime(void) {
+            flushTime();
+            return allocations[participants[index]];
+        }
+};
+
+long expiredSink = 0; // keeps the polls from being optimised away
+
+bool near(double a, double b) {
+    return fabs( a - b ) < 0.02;
+}
+
+bool checkFischer(void) {
+    FischerTurnManager turns;
+    turns.addParticipant( 17, 10.0, 2.0 );
+    turns.addParticipant( 42, 10.0, 2.0 );
+    turns.start();
+    if( turns.current() != 17 ) return false;
+    usleep( 100000 );
+    if( !near( turns.getCurrentRemainingTime(), 9.9 ) ) return false;
+    if( turns.next() != 42 ) return false;
+    // the mover's time came off the mover's clock, not the next one's
+    if( !near( turns.getRemainingTime( 17 ), 11.9 ) || !near( turns.getRemainingTime( 42 ), 10.0 ) ) return false;
+
+    usleep( 100000 );
+    if( turns.skip() != 17 ) return false;
+    if( !near( turns.getRemainingTime( 42 ), 9.9 ) ) return false;
+
+    turns.stop();
+    const double stopped = turns.getCurrentRemainingTime();
+    usleep( 50000 );
+    if( turns.getCurrentRemainingTime() != stopped ) return false;
+    turns.start();
+
+    if( turns.getRemainingTime( 99 ) != 0 || turns.current() != 17 ) return false;
+    return true;
+}
+
+bool checkAddTime(void) {
+    FischerTurnManager turns;
+    turns.addParticipant( 5, -3.0, 0.0 );
+    turns.addParticipant( 6, 4.0, 0.0 );
+    turns.addTime( 5, 30.0 ); // never into negative time
+    turns.addTime( 6, 1.5 );
+    turns.addTime( 7, 100.0 ); // nobody
+    return turns.getRemainingTime( 5 ) == 30.0 && turns.getRemainingTime( 6 ) == 5.5
+        && turns.getNumberOfParticipants() == 2;
+}
+
+bool checkRemoval(void) {
+    // more than fit inside the manager, and copied about
+    std::vector<FischerTurnManager> managers ( 1 );
+    FischerTurnManager& turns = managers[0];
+    const int ids[] = { 30, 10, 50, 20, 40 };
+    for(int i=0;i<5;i++) {
+        turns.addParticipant( ids[i], 60.0 + i, 1.0 );
+    }
+    turns.skip();
+    turns.skip();
+    if( turns.current() != 50 ) return false;
+    managers.push_back( turns );
+    FischerTurnManager& copy = managers.back();
+    copy.removeParticipant( 30 ); // before the mover
+    if( copy.current() != 50 || copy.getNumberOfParticipants() != 4 ) return false;
+    copy.removeParticipant( 50 ); // the mover; the next one moves
+    if( copy.current() != 20 || copy.getNumberOfParticipants() != 3 ) return false;
+    copy.removeParticipant( 40 ); // the last, after the mover
+    if( copy.current() != 20 || copy.next() != 10 || copy.next() != 20 ) return false;
+    copy.removeParticipant( 20 );
+    if( copy.current() != 10 || copy.getRemainingTime( 10 ) != 62.0 ) return false;
+    copy.removeParticipant( 10 );
+    if( copy.current() != -1 || copy.next() != -1 ) return false;
+    return managers[0].getNumberOfParticipants() == 5 && managers[0].current() == 50;
+}
+
+bool checkMonotonic(void) {
+    double last = Timer::now();
+    for(int i=0;i<1000000;i++) {
+        const double t = Timer::now();
+        if( t < last ) return false;
+        last = t;
+    }
+    return true;
+}
+
+template<class T>
+double pollEach(std::vector<T>& clocks, double duration, long& polls) {
+    // every clock every tick, and a move on one in a hundred
+    Timer timer;
+    int expired = 0;
+    polls = 0;
+    for(int tick=0;timer.getElapsedTime() < duration;tick++) {
+        const int n = clocks.size();
+        for(int i=0;i<n;i++) {
+            if( clocks[i].getCurrentRemainingTime() < 0 ) {
+                ++expired;
+            }
+            if( (i + tick) % 100 == 0 ) {
+                clocks[i].next();
+            }
+        }
+        polls += n;
+    }
+    expiredSink += expired;
+    return timer.getElapsedTime();
+}
+
+double pollOnce(std::vector<FischerTurnManager>& clocks, double duration, long& polls) {
+    // as above, but the clock is read once a tick
+    Timer timer;
+    int expired = 0;
+    polls = 0;
+    for(int tick=0;timer.getElapsedTime() < duration;tick++) {
+        const double now = Timer::now();
+        const int n = clocks.size();
+        for(int i=0;i<n;i++) {
+            if( clocks[i].getCurrentRemainingTime( now ) < 0 ) {
+                ++expired;
+            }
+            if( (i + tick) % 100 == 0 ) {
+                clocks[i].next();
+            }
+        }
+        polls += n;
+    }
+    expiredSink += expired;
+    return timer.getElapsedTime();
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    bool ok = checkFischer();
+    cout << "Fischer increments, charging the mover, skip and stop " << (ok ? "ok" : "FAILED") << endl;
+    const bool added = checkAddTime();
+    ok = ok && added;
+    cout << "added time " << (added ? "ok" : "FAILED") << endl;
+    const bool removed = checkRemoval();
+    ok = ok && removed;
+    cout << "removal and copying " << (removed ? "ok" : "FAILED") << endl;
+    const bool monotonic = checkMonotonic();
+    ok = ok && monotonic;
+    cout << "timer never goes backwards " << (monotonic ? "ok" : "FAILED") << endl;
+
+    const int games = 100000;
+    const double duration = 3;
+    vector<MapTurnManager> old ( games );
+    vector<FischerTurnManager> compact ( games );
+    for(int i=0;i<games;i++) {
+        old[i].addParticipant( 0, 600.0, 30.0 );
+        old[i].addParticipant( 1, 600.0, 30.0 );
+        old[i].start();
+        compact[i].addParticipant( 0, 600.0, 30.0 );
+        compact[i].addParticipant( 1, 600.0, 30.0 );
+        compact[i].start();
+    }
+
+    cout << games << " running clocks polled every tick, per poll:" << endl;
+    long polls;
+    double elapsed = pollEach( old, duration, polls );
+    cout << "  maps and the wall clock: " << (elapsed / polls * 1e9) << "ns ("
+         << (elapsed / polls * games * 1e3) << "ms a tick)" << endl;
+    elapsed = pollEach( compact, duration, polls );
+    cout << "  compact, reading the clock each poll: " << (elapsed / polls * 1e9) << "ns ("
+         << (elapsed / polls * games * 1e3) << "ms a tick)" << endl;
+    elapsed = pollOnce( compact, duration, polls );
+    cout << "  compact, reading the clock once a tick: " << (elapsed / polls * 1e9) << "ns ("
+         << (elapsed / polls * games * 1e3) << "ms a tick)" << endl;
+    cout << "  " << sizeof (FischerTurnManager) << " bytes a clock, nothing on the heap for two players" << endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+#include "Tac.h"
+#include "Manager.h"
+#include "Turns.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+
+// checks that the frozen type tables agree with ResourceManager on the
+// files in config/ and that the perfect hash finds every name of a large
+// generated table, then measures loading and lookups for both
+
+using namespace Tac;
+
+struct Named {
+    std::string symbol;
+    int index;
+
+    explicit Named(Sise::SExp *sexp) {
+        using namespace Sise;
+        Cons *args = asProperCons( sexp );
+        symbol = *asSymbol( args->nthcar(0) );
+        index = *asInt( args->nthcar(1) );
+    }
+};
+
+const std::string generatedName = "./test-typetable-generated.lisp";
+
+void writeGenerated(const std::string& filename, int count, bool duplicate) {
+    std::ofstream os ( filename.c_str() );
+    for(int i=0;i<count;i++) {
+        os << "(type-" << i << " " << i << ")" << std::endl;
+    }
+    if( duplicate ) {
+        os << "(type-0 " << count << ")" << std::endl;
+    }
+}
+
+void fileOrder(const std::string& filename, std::vector<std::string>& names) {
+    using namespace Sise;
+    std::vector<SExp*> sexps;
+    readSExpsFromFile( filename, sexps );
+    for(size_t i=0;i<sexps.size();i++) {
+        names.push_back( *asSymbol( asProperCons( sexps[i] )->getcar() ) );
+        delete sexps[i];
+    }
+}
+
+template<class T>
+bool sameAsManager(const std::string& filename) {
+    FrozenResourceTable<T> table ( filename );
+    ResourceManager<T> manager ( filename );
+    std::vector<std::string> names;
+    fileOrder( filename, names );
+    if( table.size() != (int) names.size() ) return false;
+    for(int i=0;i<(int)names.size();i++) {
+        if( table.find( names[i] ) != i || table.getName( i ) != names[i] ) return false;
+        if( table.idOf( &table[ names[i] ] ) != i ) return false;
+        if( table.get( i ).symbol != manager[ names[i] ].symbol ) return false;
+        if( table.get( i ).name != manager[ names[i] ].name ) return false;
+    }
+    if( table.has( "no-such-type" ) || table.find( "" ) >= 0 ) return false;
+    if( table.idOf( &manager[ names[0] ] ) >= 0 ) return false;
+    try {
+        table[ "no-such-type" ];
+        return false;
+    }
+    catch( std::runtime_error& ) {
+    }
+    return true;
+}
+
+bool generatedTable(int count) {
+    writeGenerated( generatedName, count, false );
+    FrozenResourceTable<Named> table ( generatedName );
+    if( table.size() != count ) return false;
+    for(int i=0;i<count;i++) {
+        std::ostringstream oss;
+        oss << "type-" << i;
+        const int id = table.find( oss.str() );
+        if( id != i || table.get( id ).index != i ) return false;
+        oss << "x";
+        if( table.has( oss.str() ) ) return false;
+    }
+
+    writeGenerated( generatedName, count, true );
+    try {
+        FrozenResourceTable<Named> duplicated ( generatedName );
+        return false;
+    }
+    catch( std::runtime_error& ) {
+    }
+    return true;
+}
+
+template<class T>
+void benchmarkLoading(const std::string& filename, int rounds) {
+    using namespace std;
+    Timer timer;
+    for(int i=0;i<rounds;i++) {
+        ResourceManager<T> manager ( filename );
+    }
+    const double managerTime = timer.getElapsedTime();
+    timer.reset();
+    for(int i=0;i<rounds;i++) {
+        FrozenResourceTable<T> table ( filename );
+    }
+    const double tableTime = timer.getElapsedTime();
+    cout << "  " << filename << ": ResourceManager " << (managerTime / rounds * 1e6)
+         << "us, frozen table " << (tableTime / rounds * 1e6) << "us" << endl;
+}
+
+template<class T>
+void benchmarkLookups(const std::string& filename, long lookups) {
+    using namespace std;
+    FrozenResourceTable<T> table ( filename );
+    ResourceManager<T> manager ( filename );
+    vector<string> names;
+    fileOrder( filename, names );
+    const int n = names.size();
+    size_t sink = 0;
+
+    Timer timer;
+    for(long i=0;i<lookups;i++) {
+        sink += manager[ names[i % n] ].symbol.size();
+    }
+    const double managerTime = timer.getElapsedTime();
+    timer.reset();
+    for(long i=0;i<lookups;i++) {
+        sink += table[ names[i % n] ].symbol.size();
+    }
+    const double nameTime = timer.getElapsedTime();
+    timer.reset();
+    for(long i=0;i<lookups;i++) {
+        sink += table.get( i % n ).symbol.size();
+    }
+    const double idTime = timer.getElapsedTime();
+
+    cout << "  " << filename << " (" << n << " types): by name in the map "
+         << (managerTime / lookups * 1e9) << "ns, by name in the table "
+         << (nameTime / lookups * 1e9) << "ns, by id " << (idTime / lookups * 1e9) << "ns"
+         << (sink ? "" : " ") << endl;
+}
+
+int main(int argc, char *argv[]) {
+    using namespace std;
+
+    bool ok = sameAsManager<TileType>( "./config/tile-types.lisp" )
+           && sameAsManager<UnitType>( "./config/unit-types.lisp" );
+    cout << "frozen tables agree with ResourceManager on config/ " << (ok ? "ok" : "FAILED") << endl;
+
+    const bool generated = generatedTable( 1 ) && generatedTable( 2 ) && generatedTable( 5000 );
+    ok = ok && generated;
+    cout << "perfect hash over generated tables " << (generated ? "ok" : "FAILED") << endl;
+
+    cout << "loading, per load:" << endl;
+    benchmarkLoading<TileType>( "./config/tile-types.lisp", 2000 );
+    benchmarkLoading<UnitType>( "./config/unit-types.lisp", 2000 );
+    writeGenerated( generatedName, 5000, false );
+    benchmarkLoading<Named>( generatedName, 20 );
+
+    cout << "lookups, per lookup:" << endl;
+    benchmarkLookups<TileType>( "./config/tile-types.lisp", 10000000 );
+    benchmarkLookups<UnitType>( "./config/unit-types.lisp", 10000000 );
+    benchmarkLookups<Named>( generatedName, 10000000 );
+
+    remove( generatedName.c_str() );
+
+    return ok ? 0 : 1;
+}